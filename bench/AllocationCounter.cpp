@@ -0,0 +1,90 @@
+#include "AllocationCounter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace
+{
+	std::atomic<uint64_t> g_NumAllocations = 0;
+	std::atomic<uint64_t> g_AllocatedBytes = 0;
+
+	void CountAllocation(const size_t size)
+	{
+		g_NumAllocations.fetch_add(1, std::memory_order_relaxed);
+		g_AllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	}
+
+	void* Allocate(const size_t size) noexcept
+	{
+		CountAllocation(size);
+		return std::malloc(size ? size : 1);
+	}
+
+	// Over-aligned types, freed by FreeAligned only
+	void* AllocateAligned(const size_t size, const std::align_val_t alignment) noexcept
+	{
+		CountAllocation(size);
+		const size_t align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+		return _aligned_malloc(size ? size : 1, align);
+#else
+		// aligned_alloc takes a whole number of alignments
+		return std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) & ~(align - 1));
+#endif
+	}
+
+	void FreeAligned(void* const ptr) noexcept
+	{
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		std::free(ptr);
+#endif
+	}
+
+	void* ThrowIfNull(void* const ptr)
+	{
+		if (!ptr)
+			throw std::bad_alloc();
+		return ptr;
+	}
+}
+
+// Every form allocates through Allocate or AllocateAligned and frees through the matching free
+void* operator new(const size_t size) { return ThrowIfNull(Allocate(size)); }
+void* operator new[](const size_t size) { return ThrowIfNull(Allocate(size)); }
+void* operator new(const size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new[](const size_t size, const std::nothrow_t&) noexcept { return Allocate(size); }
+void* operator new(const size_t size, const std::align_val_t alignment) { return ThrowIfNull(AllocateAligned(size, alignment)); }
+void* operator new[](const size_t size, const std::align_val_t alignment) { return ThrowIfNull(AllocateAligned(size, alignment)); }
+void* operator new(const size_t size, const std::align_val_t alignment, const std::nothrow_t&) noexcept { return AllocateAligned(size, alignment); }
+void* operator new[](const size_t size, const std::align_val_t alignment, const std::nothrow_t&) noexcept { return AllocateAligned(size, alignment); }
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { FreeAligned(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { FreeAligned(ptr); }
+
+uint64_t AllocationCounter::GetNumAllocations()
+{
+	return g_NumAllocations.load(std::memory_order_relaxed);
+}
+
+uint64_t AllocationCounter::GetAllocatedBytes()
+{
+	return g_AllocatedBytes.load(std::memory_order_relaxed);
+}
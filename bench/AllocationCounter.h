@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts the allocations made through the global operator new. The whole replaceable new/delete family is replaced in
+// AllocationCounter.cpp, a translation unit of its own so no caller sees the bodies and pairs an inlined free with its new
+namespace AllocationCounter
+{
+	uint64_t GetNumAllocations();
+	uint64_t GetAllocatedBytes();
+}
@@ -0,0 +1,430 @@
+// Headless benchmark of the terrain CPU path: builds the quadtrees of a heightmap, then replays scripted
+// camera paths through QuadTree::UpdateSelection / NodeSelect and PackInstances, the work TerrainPass::SelectNodes
+// and UpdateTransforms do every frame. No graphics device is created.
+//
+// Usage: vRenderer_terrain_bench [--size N] [--world N] [--surface N] [--heightmap file.raw] [--format r8|r16|r16f|r32f]
+//                                [--frames N] [--path orbit|flyover|zoom|all] [--full] [--max-height H] [--seed N]
+//                                [--bake file.vtb] [--albedo rgba8|bc1|bc7] [--normals] [--grid] [--cache N]
+
+#include <donut/core/math/math.h>
+#include <taskflow/taskflow.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../source/terrain/NormalMap.h"
+#include "../source/terrain/QuadTree.h"
+#include "../source/terrain/TerrainBake.h"
+#include "../source/terrain/TerrainGrid.h"
+#include "../source/terrain/TerrainInstance.h"
+#include "AllocationCounter.h"
+#include "TerrainScene.h"
+
+using namespace donut;
+using namespace donut::math;
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct Options
+	{
+		uint32_t heightmapSize = 2048;
+		float worldSize = 2048.0f;
+		float surfaceSize = 2048.0f;
+		std::string heightmapPath; // raw texels of the heightmap format, heightmapSize squared
+		HeightmapFormat format = HeightmapFormat::R8_UNORM;
+		int numFrames = 2000;
+		std::string path = "all";
+		bool fullSelection = false; // NodeSelect every frame instead of UpdateSelection
+		std::string bakePath; // bakes the built trees, then times the startup from the bake
+		TerrainBake::AlbedoFormat albedoFormat = TerrainBake::AlbedoFormat::NONE; // bakes a generated albedo of the heightmap size
+		bool normals = false; // times the normal map build
+		bool grid = false; // post-transform cache efficiency of the grid meshes
+		uint32_t cacheSize = TerrainGrid::CACHE_SIZE; // entries the grids are ordered for and simulated with
+		float maxHeight = 400.0f;
+		uint32_t seed = 1;
+	};
+
+	// Per stage samples in microseconds
+	struct Stage
+	{
+		const char* name;
+		std::vector<double> samples;
+	};
+
+	bool ParseOptions(const int argc, const char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const std::string arg = argv[i];
+			const bool hasValue = i + 1 < argc;
+			if (arg == "--size" && hasValue)
+				options.heightmapSize = static_cast<uint32_t>(std::atoi(argv[++i]));
+			else if (arg == "--world" && hasValue)
+				options.worldSize = static_cast<float>(std::atof(argv[++i]));
+			else if (arg == "--surface" && hasValue)
+				options.surfaceSize = static_cast<float>(std::atof(argv[++i]));
+			else if (arg == "--heightmap" && hasValue)
+				options.heightmapPath = argv[++i];
+			else if (arg == "--format" && hasValue)
+			{
+				const std::string format = argv[++i];
+				if (format == "r8")
+					options.format = HeightmapFormat::R8_UNORM;
+				else if (format == "r16")
+					options.format = HeightmapFormat::R16_UNORM;
+				else if (format == "r16f")
+					options.format = HeightmapFormat::R16_FLOAT;
+				else if (format == "r32f")
+					options.format = HeightmapFormat::R32_FLOAT;
+				else
+				{
+					std::fprintf(stderr, "Unknown heightmap format %s\n", format.c_str());
+					return false;
+				}
+			}
+			else if (arg == "--frames" && hasValue)
+				options.numFrames = std::atoi(argv[++i]);
+			else if (arg == "--path" && hasValue)
+				options.path = argv[++i];
+			else if (arg == "--bake" && hasValue)
+				options.bakePath = argv[++i];
+			else if (arg == "--albedo" && hasValue)
+			{
+				const std::string format = argv[++i];
+				if (format == "rgba8")
+					options.albedoFormat = TerrainBake::AlbedoFormat::RGBA8_SRGB;
+				else if (format == "bc1")
+					options.albedoFormat = TerrainBake::AlbedoFormat::BC1_SRGB;
+				else if (format == "bc7")
+					options.albedoFormat = TerrainBake::AlbedoFormat::BC7_SRGB;
+				else
+				{
+					std::fprintf(stderr, "Unknown albedo format %s\n", format.c_str());
+					return false;
+				}
+			}
+			else if (arg == "--full")
+				options.fullSelection = true;
+			else if (arg == "--normals")
+				options.normals = true;
+			else if (arg == "--grid")
+				options.grid = true;
+			else if (arg == "--cache" && hasValue)
+				options.cacheSize = static_cast<uint32_t>(std::atoi(argv[++i]));
+			else if (arg == "--max-height" && hasValue)
+				options.maxHeight = static_cast<float>(std::atof(argv[++i]));
+			else if (arg == "--seed" && hasValue)
+				options.seed = static_cast<uint32_t>(std::atoi(argv[++i]));
+			else
+			{
+				std::fprintf(stderr, "Unknown or incomplete argument %s\n", arg.c_str());
+				return false;
+			}
+		}
+
+		const bool knownPath = options.path == "all" || std::find(TerrainScene::PATHS.begin(), TerrainScene::PATHS.end(), options.path) != TerrainScene::PATHS.end();
+		if (!knownPath || options.heightmapSize == 0 || options.cacheSize < 3 || options.numFrames <= 0 || options.surfaceSize <= 0.0f || options.worldSize < options.surfaceSize)
+		{
+			std::fprintf(stderr, "Invalid options\n");
+			return false;
+		}
+		return true;
+	}
+
+	// Raw files are mapped, generated texels are shared as they are
+	std::shared_ptr<const HeightmapStore> CreateHeightmap(const Options& options)
+	{
+		if (options.heightmapPath.empty())
+			return TerrainScene::CreateHeightmap(options.heightmapSize, options.format, options.seed);
+
+		std::shared_ptr<const HeightmapStore> heightmap = HeightmapStore::CreateMapped(options.heightmapPath, options.heightmapSize, options.heightmapSize, options.format);
+		if (!heightmap)
+			std::fprintf(stderr, "Could not map %u x %u texels from %s\n", options.heightmapSize, options.heightmapSize, options.heightmapPath.c_str());
+		return heightmap;
+	}
+
+	double Percentile(std::vector<double> samples, const double p)
+	{
+		if (samples.empty())
+			return 0.0;
+		std::sort(samples.begin(), samples.end());
+		const size_t index = std::min(samples.size() - 1, static_cast<size_t>(p * static_cast<double>(samples.size() - 1) + 0.5));
+		return samples[index];
+	}
+
+	void PrintStage(const Stage& stage)
+	{
+		double sum = 0.0;
+		for (const double sample : stage.samples)
+			sum += sample;
+		const double mean = stage.samples.empty() ? 0.0 : sum / static_cast<double>(stage.samples.size());
+
+		std::printf("  %-12s mean %9.2f  p50 %9.2f  p90 %9.2f  p99 %9.2f  max %9.2f us\n", stage.name, mean,
+			Percentile(stage.samples, 0.5), Percentile(stage.samples, 0.9), Percentile(stage.samples, 0.99), Percentile(stage.samples, 1.0));
+	}
+
+	double ElapsedMicroseconds(const Clock::time_point begin, const Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::micro>(end - begin).count();
+	}
+
+	void ReplayPath(const Options& options, const std::string_view path, const std::vector<std::unique_ptr<QuadTree>>& quadTrees)
+	{
+		std::vector<QuadTreeSelection> selections(quadTrees.size());
+		std::vector<TerrainInstanceData> instanceData;
+
+		Stage select = { "select", {} };
+		Stage transforms = { "transforms", {} };
+		Stage total = { "total", {} };
+		uint64_t numInstances = 0;
+		uint64_t numRecords = 0;
+		uint64_t numRebuilt = 0;
+		uint64_t numStitched = 0; // edges bordering a node one level coarser
+		uint64_t numFarStitched = 0; // more levels coarser, snapped by the vertex shader
+		int maxInstances = 0;
+
+		const uint64_t allocationsBefore = AllocationCounter::GetNumAllocations();
+		const uint64_t bytesBefore = AllocationCounter::GetAllocatedBytes();
+
+		for (int frame = 0; frame < options.numFrames; frame++)
+		{
+			const float t = options.numFrames > 1 ? static_cast<float>(frame) / static_cast<float>(options.numFrames - 1) : 0.0f;
+			const TerrainScene::Camera camera = TerrainScene::EvaluatePath(path, t, options.worldSize, options.maxHeight);
+			const dm::frustum frustum = TerrainScene::MakeFrustum(camera, options.worldSize);
+
+			const Clock::time_point begin = Clock::now();
+			bool rebuilt = false;
+			for (size_t i = 0; i < quadTrees.size(); i++)
+			{
+				if (options.fullSelection)
+				{
+					selections[i].Clear();
+					quadTrees[i]->NodeSelect(selections[i], camera.position, frustum, options.maxHeight);
+					rebuilt = true;
+				}
+				else if (quadTrees[i]->UpdateSelection(selections[i], camera.position, frustum, options.maxHeight))
+				{
+					rebuilt = true;
+				}
+			}
+			const Clock::time_point selected = Clock::now();
+
+			// As in TerrainPass::SelectNodes the instances are only packed again when a selection changed
+			int frameInstances = 0;
+			for (const QuadTreeSelection& selection : selections)
+				frameInstances += selection.m_NumInstances;
+			if (rebuilt)
+			{
+				instanceData.resize(std::max(instanceData.size(), static_cast<size_t>(frameInstances)));
+				int offset = 0;
+				for (size_t i = 0; i < quadTrees.size(); i++)
+				{
+					quadTrees[i]->PackInstances(selections[i], instanceData.data() + offset);
+					offset += selections[i].m_NumInstances;
+				}
+			}
+			const Clock::time_point end = Clock::now();
+
+			select.samples.push_back(ElapsedMicroseconds(begin, selected));
+			transforms.samples.push_back(ElapsedMicroseconds(selected, end));
+			total.samples.push_back(ElapsedMicroseconds(begin, end));
+
+			for (const QuadTreeSelection& selection : selections)
+				numRecords += selection.m_Nodes.size();
+			// Only counted, the Selection tests check the flags against a walk up the neighbour ancestors
+			for (int i = 0; i < frameInstances; i++)
+			{
+				const uint32_t flags = UnpackFlags(instanceData[i].lodAndFlags);
+				for (int edge = 0; edge < 4; edge++)
+				{
+					if (!(flags & (1u << edge)))
+						continue;
+					if ((flags >> (TERRAIN_STITCH_LEVELS_SHIFT + 2 * edge)) & 3)
+						numFarStitched++;
+					else
+						numStitched++;
+				}
+			}
+			numInstances += static_cast<uint64_t>(frameInstances);
+			numRebuilt += rebuilt ? 1 : 0;
+			maxInstances = std::max(maxInstances, frameInstances);
+		}
+
+		// The stage sample vectors grow during the replay too, their allocations are small and logarithmic in the frame count
+		const uint64_t allocations = AllocationCounter::GetNumAllocations() - allocationsBefore;
+		const uint64_t bytes = AllocationCounter::GetAllocatedBytes() - bytesBefore;
+		const double frames = static_cast<double>(options.numFrames);
+
+		std::printf("path %.*s, %d frames, %s\n", static_cast<int>(path.size()), path.data(), options.numFrames, options.fullSelection ? "full selection" : "incremental selection");
+		PrintStage(select);
+		PrintStage(transforms);
+		PrintStage(total);
+		std::printf("  instances    mean %9.1f  max %d\n", static_cast<double>(numInstances) / frames, maxInstances);
+		std::printf("  records      mean %9.1f\n", static_cast<double>(numRecords) / frames);
+		std::printf("  stitched     mean %9.1f edges one level coarser, %.1f more\n", static_cast<double>(numStitched) / frames, static_cast<double>(numFarStitched) / frames);
+		std::printf("  rebuilt      %5.1f%% of the frames\n", 100.0 * static_cast<double>(numRebuilt) / frames);
+		std::printf("  allocations  %llu (%.2f per frame, %llu bytes)\n", static_cast<unsigned long long>(allocations), static_cast<double>(allocations) / frames, static_cast<unsigned long long>(bytes));
+	}
+
+	// The error of the stored normals against the shader differences is checked by the NormalMap tests
+	void BenchNormals(const HeightmapStore& heightmap)
+	{
+		const uint32_t numMips = static_cast<uint32_t>(std::bit_width(std::max(heightmap.GetWidth(), heightmap.GetHeight())));
+		const Clock::time_point buildBegin = Clock::now();
+		const std::vector<NormalMap::Mip> mips = NormalMap::Build(heightmap, numMips);
+		const Clock::time_point buildEnd = Clock::now();
+
+		std::printf("normals      %9.2f ms, %zu mips\n", ElapsedMicroseconds(buildBegin, buildEnd) / 1000.0, mips.size());
+	}
+
+	// The row major grid against the strips, both through a FIFO cache and an LRU one. The TerrainGrid tests check the
+	// strips are fetch ordered and beat the row major grid for every tier
+	template <uint32_t GridSize>
+	void AnalyzeGrid(const uint32_t cacheSize)
+	{
+		using Mesh = TerrainGrid::Mesh<GridSize>;
+		const std::unique_ptr<Mesh> rowMajor = std::make_unique<Mesh>();
+		const std::unique_ptr<Mesh> strips = std::make_unique<Mesh>();
+		TerrainGrid::BuildRowMajor(*rowMajor);
+		TerrainGrid::Build(*strips, cacheSize);
+
+		for (const bool lru : { false, true })
+		{
+			const TerrainGrid::CacheStats before = TerrainGrid::SimulateCache<typename Mesh::Index>({ rowMajor->indices.data(), rowMajor->numIndices }, Mesh::NUM_VERTICES, cacheSize, lru);
+			const TerrainGrid::CacheStats after = TerrainGrid::SimulateCache<typename Mesh::Index>({ strips->indices.data(), strips->numIndices }, Mesh::NUM_VERTICES, cacheSize, lru);
+			std::printf("  %3u quads %s  row major acmr %.3f atvr %.2f  strips acmr %.3f atvr %.2f\n", GridSize, lru ? "lru " : "fifo",
+				before.acmr, before.atvr, after.acmr, after.atvr);
+		}
+	}
+
+	void AnalyzeGrids(const uint32_t cacheSize)
+	{
+		std::printf("grid %u entry cache, strips of %u quads at 128\n", cacheSize, TerrainGrid::GetStripWidth(128, cacheSize));
+		AnalyzeGrid<TerrainGrid::GetGridSize(TerrainGrid::Tier::Low)>(cacheSize);
+		AnalyzeGrid<TerrainGrid::GetGridSize(TerrainGrid::Tier::Medium)>(cacheSize);
+		AnalyzeGrid<TerrainGrid::GetGridSize(TerrainGrid::Tier::High)>(cacheSize);
+		AnalyzeGrid<TerrainGrid::GetGridSize(TerrainGrid::Tier::Ultra)>(cacheSize);
+	}
+
+	// Startup from a bake is the file mapping and pointing every tree at its baked nodes
+	bool BakeAndReload(const Options& options, const HeightmapStore& heightmap, const std::vector<std::unique_ptr<QuadTree>>& quadTrees)
+	{
+		std::vector<const QuadTree*> trees;
+		for (const auto& quadTree : quadTrees)
+			trees.push_back(quadTree.get());
+
+		TerrainBake::BakeParameters params;
+		params.worldSize = options.worldSize;
+		params.surfaceSize = options.surfaceSize;
+		params.albedoFormat = options.albedoFormat;
+
+		std::vector<uint8_t> albedoTexels;
+		TerrainBake::AlbedoView albedo;
+		if (options.albedoFormat != TerrainBake::AlbedoFormat::NONE)
+		{
+			albedoTexels = TerrainScene::GenerateAlbedo(options.heightmapSize, options.seed);
+			albedo.data = albedoTexels.data();
+			albedo.width = options.heightmapSize;
+			albedo.height = options.heightmapSize;
+		}
+
+		const Clock::time_point writeBegin = Clock::now();
+		if (!TerrainBake::Write(options.bakePath, params, heightmap, trees, albedo.data ? &albedo : nullptr))
+		{
+			std::fprintf(stderr, "Could not bake %s\n", options.bakePath.c_str());
+			return false;
+		}
+		const Clock::time_point writeEnd = Clock::now();
+
+		const std::shared_ptr<BakedTerrain> bake = BakedTerrain::Open(options.bakePath);
+		if (!bake || !bake->Matches(0, options.worldSize, options.surfaceSize) || bake->GetHeader().numTrees != trees.size())
+		{
+			std::fprintf(stderr, "Could not open %s\n", options.bakePath.c_str());
+			return false;
+		}
+
+		// The baked nodes are checked against the built ones by the Bake tests
+		std::vector<std::unique_ptr<QuadTree>> bakedTrees;
+		bool loaded = true;
+		for (size_t i = 0; i < trees.size(); i++)
+		{
+			const QuadTree& quadTree = *trees[i];
+			const float2 treeMin = quadTree.GetTreeMin();
+			const float surfaceSize = options.surfaceSize;
+			bakedTrees.push_back(std::make_unique<QuadTree>(surfaceSize, surfaceSize, options.worldSize, float3(treeMin.x + surfaceSize * 0.5f, 0.0f, treeMin.y + surfaceSize * 0.5f)));
+			loaded = bakedTrees.back()->InitBaked(bake->GetNodes(static_cast<uint32_t>(i)), bake) && loaded;
+		}
+		const Clock::time_point loadEnd = Clock::now();
+
+		std::printf("bake write   %9.2f ms, %u height mips of %u tiles\n", ElapsedMicroseconds(writeBegin, writeEnd) / 1000.0,
+			bake->GetHeader().numHeightMips, bake->GetHeader().heightMips[0].numTilesX * bake->GetHeader().heightMips[0].numTilesY);
+		std::printf("bake load    %9.2f ms, %zu trees\n", ElapsedMicroseconds(writeEnd, loadEnd) / 1000.0, bakedTrees.size());
+		if (!loaded)
+			std::fprintf(stderr, "Could not load the baked nodes of %s\n", options.bakePath.c_str());
+
+		const TerrainBake::Header& header = bake->GetHeader();
+		if (header.numAlbedoMips > 0)
+		{
+			uint64_t albedoSize = 0;
+			uint64_t uncompressedSize = 0;
+			for (uint32_t mip = 0; mip < header.numAlbedoMips; mip++)
+			{
+				albedoSize += header.albedoMips[mip].size;
+				uncompressedSize += static_cast<uint64_t>(header.albedoMips[mip].width) * header.albedoMips[mip].height * 4;
+			}
+			// The encoding quality is checked by the BlockCompress tests
+			std::printf("bake albedo  %9.2f MB, %.1fx smaller than RGBA8\n", static_cast<double>(albedoSize) / (1 << 20),
+				static_cast<double>(uncompressedSize) / static_cast<double>(albedoSize));
+		}
+		return loaded;
+	}
+}
+
+int main(const int argc, const char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+		return 1;
+
+	const std::shared_ptr<const HeightmapStore> heightmap = CreateHeightmap(options);
+	if (!heightmap)
+		return 1;
+
+	tf::Executor executor;
+
+	const uint64_t allocationsBefore = AllocationCounter::GetNumAllocations();
+	const Clock::time_point buildBegin = Clock::now();
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(options.worldSize, options.surfaceSize, heightmap, executor);
+	const Clock::time_point buildEnd = Clock::now();
+
+	std::printf("heightmap %u x %u, world %.0f, %zu quadtrees of %d lods\n", options.heightmapSize, options.heightmapSize,
+		options.worldSize, quadTrees.size(), quadTrees.empty() ? 0 : quadTrees[0]->GetNumLods());
+	std::printf("build        %9.2f ms, %llu allocations\n", ElapsedMicroseconds(buildBegin, buildEnd) / 1000.0,
+		static_cast<unsigned long long>(AllocationCounter::GetNumAllocations() - allocationsBefore));
+
+	if (!options.bakePath.empty() && !BakeAndReload(options, *heightmap, quadTrees))
+		return 1;
+
+	if (options.normals)
+		BenchNormals(*heightmap);
+
+	if (options.grid)
+		AnalyzeGrids(options.cacheSize);
+
+	for (const std::string_view path : TerrainScene::PATHS)
+	{
+		if (options.path == "all" || options.path == path)
+			ReplayPath(options, path, quadTrees);
+	}
+
+	return 0;
+}
@@ -0,0 +1,166 @@
+#include "TerrainScene.h"
+
+#include <taskflow/taskflow.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace donut;
+using namespace donut::math;
+
+namespace TerrainScene
+{
+	uint32_t Hash(uint32_t x, uint32_t y, const uint32_t seed)
+	{
+		uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ seed * 0xcb1ab31fu;
+		h ^= h >> 13;
+		h *= 0x5bd1e995u;
+		return h ^ (h >> 15);
+	}
+
+	std::vector<uint8_t> EncodeHeights(const std::vector<float>& heights, const HeightmapFormat format)
+	{
+		std::vector<uint8_t> texels(heights.size() * GetBytesPerTexel(format));
+		for (size_t i = 0; i < heights.size(); i++)
+		{
+			const float height = std::clamp(heights[i], 0.0f, 1.0f);
+			switch (format)
+			{
+			case HeightmapFormat::R8_UNORM:
+				texels[i] = static_cast<uint8_t>(height * 255.0f);
+				break;
+			case HeightmapFormat::R16_UNORM:
+			{
+				const uint16_t texel = static_cast<uint16_t>(height * 65535.0f);
+				std::memcpy(texels.data() + i * sizeof(texel), &texel, sizeof(texel));
+				break;
+			}
+			case HeightmapFormat::R16_FLOAT:
+			{
+				const uint16_t texel = FloatToHalf(height);
+				std::memcpy(texels.data() + i * sizeof(texel), &texel, sizeof(texel));
+				break;
+			}
+			case HeightmapFormat::R32_FLOAT:
+				std::memcpy(texels.data() + i * sizeof(height), &height, sizeof(height));
+				break;
+			}
+		}
+		return texels;
+	}
+
+	std::vector<uint8_t> GenerateHeightmap(const uint32_t size, const HeightmapFormat format, const uint32_t seed)
+	{
+		std::vector<float> heights(static_cast<size_t>(size) * size, 0.0f);
+		float amplitude = 1.0f;
+		float totalAmplitude = 0.0f;
+		for (uint32_t cell = std::max(size / 8, 2u); cell >= 2; cell /= 2)
+		{
+			for (uint32_t y = 0; y < size; y++)
+			{
+				for (uint32_t x = 0; x < size; x++)
+				{
+					const uint32_t cx = x / cell;
+					const uint32_t cy = y / cell;
+					const float fx = static_cast<float>(x % cell) / static_cast<float>(cell);
+					const float fy = static_cast<float>(y % cell) / static_cast<float>(cell);
+					const float sx = fx * fx * (3.0f - 2.0f * fx);
+					const float sy = fy * fy * (3.0f - 2.0f * fy);
+
+					const float h00 = static_cast<float>(Hash(cx, cy, seed) & 0xffff);
+					const float h10 = static_cast<float>(Hash(cx + 1, cy, seed) & 0xffff);
+					const float h01 = static_cast<float>(Hash(cx, cy + 1, seed) & 0xffff);
+					const float h11 = static_cast<float>(Hash(cx + 1, cy + 1, seed) & 0xffff);
+					const float h = lerp(lerp(h00, h10, sx), lerp(h01, h11, sx), sy) / 65535.0f;
+					heights[static_cast<size_t>(y) * size + x] += h * amplitude;
+				}
+			}
+			totalAmplitude += amplitude;
+			amplitude *= 0.5f;
+		}
+
+		for (float& height : heights)
+			height /= totalAmplitude;
+		return EncodeHeights(heights, format);
+	}
+
+	// The store keeps the generated texels alive
+	std::shared_ptr<const HeightmapStore> CreateHeightmap(const uint32_t size, const HeightmapFormat format, const uint32_t seed)
+	{
+		auto texels = std::make_shared<std::vector<uint8_t>>(GenerateHeightmap(size, format, seed));
+		HeightmapView view;
+		view.data = texels->data();
+		view.width = size;
+		view.height = size;
+		view.format = format;
+		return std::make_shared<HeightmapStore>(view, std::move(texels));
+	}
+
+	std::vector<uint8_t> GenerateAlbedo(const uint32_t size, const uint32_t seed)
+	{
+		const std::vector<uint8_t> heights = GenerateHeightmap(size, HeightmapFormat::R8_UNORM, seed);
+		std::vector<uint8_t> texels(heights.size() * 4);
+		for (uint32_t y = 0; y < size; y++)
+		{
+			for (uint32_t x = 0; x < size; x++)
+			{
+				const size_t i = static_cast<size_t>(y) * size + x;
+				const float t = static_cast<float>(heights[i]) / 255.0f;
+				const float grain = static_cast<float>(Hash(x, y, seed + 1) & 0xff) / 255.0f * 0.2f + 0.9f;
+				const float3 color = lerp(float3(70.0f, 110.0f, 40.0f), float3(150.0f, 140.0f, 130.0f), t) * grain;
+				texels[i * 4 + 0] = static_cast<uint8_t>(std::min(color.x, 255.0f));
+				texels[i * 4 + 1] = static_cast<uint8_t>(std::min(color.y, 255.0f));
+				texels[i * 4 + 2] = static_cast<uint8_t>(std::min(color.z, 255.0f));
+				texels[i * 4 + 3] = 255;
+			}
+		}
+		return texels;
+	}
+
+	Camera EvaluatePath(const std::string_view path, const float t, const float worldSize, const float maxHeight)
+	{
+		const float halfWorld = worldSize * 0.5f;
+		if (path == "orbit")
+		{
+			// Circles the world center looking inwards and down
+			const float angle = t * 2.0f * PI_f;
+			const float3 position = float3(cosf(angle) * halfWorld * 0.6f, maxHeight * 1.5f, sinf(angle) * halfWorld * 0.6f);
+			return { position, normalize(float3(-position.x, -maxHeight, -position.z)) };
+		}
+		if (path == "flyover")
+		{
+			// Low and fast along a diagonal, the worst case for the incremental selection
+			const float3 position = float3(lerp(-halfWorld, halfWorld, t) * 0.9f, maxHeight * 1.1f, lerp(-halfWorld, halfWorld, t) * 0.7f);
+			return { position, normalize(float3(1.0f, -0.3f, 0.8f)) };
+		}
+
+		// zoom: descends from high above the center towards the ground, looking down
+		const float height = lerp(worldSize, maxHeight * 1.05f, t);
+		return { float3(0.0f, height, 0.0f), normalize(float3(0.2f, -1.0f, 0.1f)) };
+	}
+
+	dm::frustum MakeFrustum(const Camera& camera, const float worldSize)
+	{
+		const float3 up = std::abs(camera.forward.y) > 0.99f ? float3(0.0f, 0.0f, 1.0f) : float3(0.0f, 1.0f, 0.0f);
+		const affine3 viewToWorld = lookatZ(camera.forward, up) * translation(camera.position);
+		const float4x4 viewMatrix = affineToHomogeneous(inverse(viewToWorld));
+		const float4x4 projMatrix = perspProjD3DStyle(radians(60.0f), 16.0f / 9.0f, 0.1f, worldSize * 2.0f);
+		return dm::frustum(viewMatrix * projMatrix, false);
+	}
+
+	std::vector<std::unique_ptr<QuadTree>> BuildQuadTrees(const float worldSize, const float surfaceSize, const std::shared_ptr<const HeightmapStore>& heightmap, tf::Executor& executor)
+	{
+		const int numSurfacesPerSide = static_cast<int>(worldSize / surfaceSize);
+		std::vector<std::unique_ptr<QuadTree>> quadTrees;
+		for (int i = 0; i < numSurfacesPerSide * numSurfacesPerSide; i++)
+		{
+			const float x = -0.5f * static_cast<float>(numSurfacesPerSide - 1) + static_cast<float>(i % numSurfacesPerSide);
+			const float y = -0.5f * static_cast<float>(numSurfacesPerSide - 1) + static_cast<float>(i / numSurfacesPerSide);
+			quadTrees.push_back(std::make_unique<QuadTree>(surfaceSize, surfaceSize, worldSize, float3(x * surfaceSize, 0.0f, y * surfaceSize)));
+			quadTrees.back()->Init(heightmap, executor);
+		}
+		executor.wait_for_all();
+		return quadTrees;
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <donut/core/math/math.h>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "../source/terrain/HeightmapStore.h"
+#include "../source/terrain/QuadTree.h"
+
+namespace tf
+{
+	class Executor;
+}
+
+// Generated terrain and scripted cameras shared by the benchmark, which times them, and the tests, which check them
+namespace TerrainScene
+{
+	struct Camera
+	{
+		donut::math::float3 position;
+		donut::math::float3 forward;
+	};
+
+	constexpr std::array<std::string_view, 3> PATHS = { "orbit", "flyover", "zoom" };
+
+	uint32_t Hash(uint32_t x, uint32_t y, uint32_t seed);
+
+	// Normalized heights clamped to [0, 1] in the texels of format
+	std::vector<uint8_t> EncodeHeights(const std::vector<float>& heights, HeightmapFormat format);
+
+	// Sum of value noise octaves, smooth enough for the min/max pyramid to look like real terrain
+	std::vector<uint8_t> GenerateHeightmap(uint32_t size, HeightmapFormat format, uint32_t seed);
+	std::shared_ptr<const HeightmapStore> CreateHeightmap(uint32_t size, HeightmapFormat format, uint32_t seed);
+
+	// Grass to rock by height with per texel grain in RGBA8, the kind of detail block compression has to keep
+	std::vector<uint8_t> GenerateAlbedo(uint32_t size, uint32_t seed);
+
+	// One of PATHS over the world, t in [0, 1]
+	Camera EvaluatePath(std::string_view path, float t, float worldSize, float maxHeight);
+
+	donut::math::frustum MakeFrustum(const Camera& camera, float worldSize);
+
+	// Same surface layout as TerrainPass::Init, the bounds are built once this returns
+	std::vector<std::unique_ptr<QuadTree>> BuildQuadTrees(float worldSize, float surfaceSize, const std::shared_ptr<const HeightmapStore>& heightmap, tf::Executor& executor);
+}
@@ -4,6 +4,8 @@
 #include "donut/shaders/light_cb.h"
 #include "donut/shaders/view_cb.h"
 
+#define TERRAIN_MAX_LODS 12 // same as QuadTree::MAX_LODS
+
 struct TerrainViewConstants
 {
 	PlanarViewConstants view;
@@ -15,13 +17,35 @@ struct TerrainLightConstants
 	LightConstants lights[16];
 };
 
+#define TERRAIN_STREAM_MAX_MIPS 16 // same as TerrainBake::MAX_MIPS
+
+// Streamed terrain, heights and albedo are sampled from page atlases through the page table
+struct TerrainStreamConstants
+{
+	uint enabled;
+	int lodMipOffset; // mip sampled by a LOD level minus the level
+	uint numMips;
+	uint slotsPerRow; // slots on a row of the atlases
+	uint pageSize; // height texels on a page side, without the border
+	uint albedoPageSize;
+	uint albedoSlotSize; // albedo page and border, whole blocks when block compressed
+	float padding;
+	float4 atlasInvSize; // xy height atlas, zw albedo atlas
+	uint4 mips[TERRAIN_STREAM_MAX_MIPS]; // x first page, y pages per row, zw height mip size
+	uint4 albedoMipSizes[TERRAIN_STREAM_MAX_MIPS]; // xy
+};
+
 struct TerrainParamsConstants
 {
 	float worldSize;
 	float surfaceSize;
 	float maxHeight;
 	float gridSize;
-	float4 lodRanges[12]; // same as QuadTree::MAX_LODS
+	float4 lodRanges[TERRAIN_MAX_LODS];
+	float4 lodOrigin; // xyz, LOD distances are measured from it
+	uint normalMap; // normals are fetched from the normal map, not differenced from the heights
+	float3 padding;
+	TerrainStreamConstants stream;
 };
 
 #endif // TERRAIN_CB_H
\ No newline at end of file
@@ -17,4 +17,73 @@ cbuffer c_TerrainParams : register(b2 VK_DESCRIPTOR_SET(2))
 };
 
 Texture2D t_Heightmap : register(t0);
-SamplerState s_LinearClampSampler : register(s0);
\ No newline at end of file
+SamplerState s_LinearClampSampler : register(s0);
+
+Buffer<uint> t_PageTable : register(t2);
+Texture2D t_HeightAtlas : register(t3);
+Texture2D t_ColorAtlas : register(t4);
+Texture2D t_NormalAtlas : register(t6);
+
+uint streamMipForLod(uint lod)
+{
+    return uint(clamp(int(lod) + c_TerrainParams.stream.lodMipOffset, 0, int(c_TerrainParams.stream.numMips) - 1));
+}
+
+// Atlas uv of uv in the first resident mip from mip on, the coarsest mips are always resident. Pages cover the same
+// area in both atlases. A slot holds the page and the texels past it that the bilinear footprint reaches: one column and
+// row for the heights, more for an albedo finer than the heights since the height texel picks the page. Block compressed
+// albedo borders are rounded up to whole blocks
+float2 streamAtlasUv(float2 uv, uint mip, bool albedo)
+{
+    uint4 mipDesc = 0;
+    uint2 page = 0;
+    uint slot = 0;
+    [loop]
+    for (; mip < c_TerrainParams.stream.numMips; mip++)
+    {
+        mipDesc = c_TerrainParams.stream.mips[mip];
+        const uint2 numPages = (mipDesc.zw + c_TerrainParams.stream.pageSize - 1) / c_TerrainParams.stream.pageSize;
+        const float2 heightTexel = clamp(uv * float2(mipDesc.zw) - 0.5, 0.0, float2(mipDesc.zw) - 1.0);
+        page = min(uint2(heightTexel) / c_TerrainParams.stream.pageSize, numPages - 1);
+        slot = t_PageTable[mipDesc.x + page.y * mipDesc.y + page.x];
+        if (slot != 0)
+            break;
+    }
+    mip = min(mip, c_TerrainParams.stream.numMips - 1);
+    slot = max(slot, 1) - 1;
+
+    const float2 mipSize = albedo ? float2(c_TerrainParams.stream.albedoMipSizes[mip].xy) : float2(mipDesc.zw);
+    const uint pageSize = albedo ? c_TerrainParams.stream.albedoPageSize : c_TerrainParams.stream.pageSize;
+    const float2 invAtlasSize = albedo ? c_TerrainParams.stream.atlasInvSize.zw : c_TerrainParams.stream.atlasInvSize.xy;
+
+    const float2 texel = clamp(uv * mipSize - 0.5, 0.0, mipSize - 1.0);
+    const uint slotSize = albedo ? c_TerrainParams.stream.albedoSlotSize : pageSize + 1;
+    const float2 pageTexel = clamp(texel - float2(page * pageSize), 0.0, float(slotSize - 1));
+    const uint2 slotOrigin = uint2(slot % c_TerrainParams.stream.slotsPerRow, slot / c_TerrainParams.stream.slotsPerRow) * slotSize;
+
+    return (float2(slotOrigin) + pageTexel + 0.5) * invAtlasSize;
+}
+
+// Normalized height of a streamed mip
+float sampleStreamHeight(float2 uv, uint mip)
+{
+    return t_HeightAtlas.SampleLevel(s_LinearClampSampler, streamAtlasUv(uv, mip, false), 0).r;
+}
+
+float3 sampleStreamColor(float2 uv, uint mip)
+{
+    return t_ColorAtlas.SampleLevel(s_LinearClampSampler, streamAtlasUv(uv, mip, true), 0).rgb;
+}
+
+// Hemi-octahedral normal map texel, up is +y
+float3 decodeTerrainNormal(float2 encoded)
+{
+    const float2 p = float2(encoded.x + encoded.y, encoded.x - encoded.y) * 0.5;
+    return normalize(float3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y));
+}
+
+// Normal pages share the slots of the height pages
+float3 sampleStreamNormal(float2 uv, uint mip)
+{
+    return decodeTerrainNormal(t_NormalAtlas.SampleLevel(s_LinearClampSampler, streamAtlasUv(uv, mip, false), 0).rg);
+}
@@ -0,0 +1,25 @@
+#ifndef TERRAIN_INSTANCE_H
+#define TERRAIN_INSTANCE_H
+
+// lodAndFlags layout: bits 0-7 the lod level, bits 8-23 the flags
+#define TERRAIN_INSTANCE_LOD_MASK 0xff
+#define TERRAIN_INSTANCE_FLAGS_SHIFT 8
+#define TERRAIN_INSTANCE_FLAGS_MASK 0xffff
+
+// Flags bits 0-3, one per edge in the order -x, +x, -z, +z, set where the neighbour across the edge is coarser.
+// The instance is drawn with the grid variant of that mask, every other vertex of these edges merged
+#define TERRAIN_STITCH_MASK 0xf
+// Flags bits 4-11, two per edge in the same order: how many levels past the first the neighbour is coarser by.
+// The vertex shader snaps those edges to the neighbour grid, differences beyond the last one it stores still crack
+#define TERRAIN_STITCH_LEVELS_SHIFT 4
+#define TERRAIN_STITCH_MAX_EXTRA_LEVELS 3
+
+// Per chunk vertex buffer data, chunks are axis aligned squares
+struct TerrainInstanceData
+{
+	float2 offset; // xz center of the chunk in world space
+	float scale; // half size of the chunk
+	uint lodAndFlags;
+};
+
+#endif // TERRAIN_INSTANCE_H
\ No newline at end of file
@@ -6,23 +6,52 @@
 #include <donut/shaders/material_bindings.hlsli>
 
 Texture2D t_Color : register(t1);
+Texture2D t_Normal : register(t5);
 
-float3 sampleColor(float2 worldPos)
+float3 sampleColor(float2 worldPos, uint streamMip)
 {
     const float halfSize = c_TerrainParams.worldSize * 0.5;
     float2 uv = (worldPos + halfSize) / c_TerrainParams.worldSize;
     
+    // Streamed pixels stay on the mip of their node, finer ones may not be resident
+    if (c_TerrainParams.stream.enabled != 0)
+        return sampleStreamColor(uv, streamMip);
+
     return t_Color.Sample(s_LinearClampSampler, uv).rgb;
 }
 
-float sampleHeight(float2 worldPos, float2 offset)
+float sampleHeight(float2 worldPos, float2 offset, uint streamMip)
 {
     const float halfSize = c_TerrainParams.worldSize * 0.5;
     float2 uv = (worldPos + halfSize) / c_TerrainParams.worldSize;
     
+    if (c_TerrainParams.stream.enabled != 0)
+        return sampleStreamHeight(uv + offset, streamMip);
+
     return t_Heightmap.Sample(s_LinearClampSampler, uv + offset).r;
 }
 
+// One fetch from the normal map when there is one
+float3 sampleNormal(float2 worldPos, uint streamMip)
+{
+    if (c_TerrainParams.normalMap != 0)
+    {
+        const float halfSize = c_TerrainParams.worldSize * 0.5;
+        float2 uv = (worldPos + halfSize) / c_TerrainParams.worldSize;
+
+        if (c_TerrainParams.stream.enabled != 0)
+            return sampleStreamNormal(uv, streamMip);
+
+        return decodeTerrainNormal(t_Normal.Sample(s_LinearClampSampler, uv).rg);
+    }
+
+    float offset = .1; // NormalMap::UV_OFFSET
+    float hDx = sampleHeight(worldPos, float2(offset, 0.0), streamMip) - sampleHeight(worldPos, float2(-offset, 0.0), streamMip);
+    float hDy = sampleHeight(worldPos, float2(0.0, offset), streamMip) - sampleHeight(worldPos, float2(0.0, -offset), streamMip);
+
+    return normalize(float3(-hDx, 2.0 * offset, -hDy));
+}
+
 float3 hsv_to_rgb(float3 HSV)
 {
     float3 RGB = HSV.z;
@@ -46,6 +75,7 @@ void main_ps(
     in float4 i_position : SV_Position,
     in SceneVertex i_vtx,
     in float3 i_debug : LOCATION,
+    in nointerpolation uint i_streamMip : STREAM_MIP,
     out float4 o_channel0 : SV_Target0,
     out float4 o_channel1 : SV_Target1,
     out float4 o_channel2 : SV_Target2,
@@ -56,16 +86,12 @@ void main_ps(
 
     //MaterialSample surface = EvaluateSceneMaterial(i_vtx.normal, i_vtx.tangent, g_Material, textures);
     
-    float offset = .1;
-    float hDx = sampleHeight(i_vtx.pos.xz, float2(offset, 0.0)) - sampleHeight(i_vtx.pos.xz, float2(-offset, 0.0));
-    float hDy = sampleHeight(i_vtx.pos.xz, float2(0.0, offset)) - sampleHeight(i_vtx.pos.xz ,float2(0.0, -offset));
-    
-    float3 normal = normalize(float3(-hDx, 2.0 * offset, -hDy));
+    float3 normal = sampleNormal(i_vtx.pos.xz, i_streamMip);
     //normal = -normalize(cross(ddx(i_vtx.pos), ddy(i_vtx.pos)));
     
     float height = i_vtx.pos.y / c_TerrainParams.maxHeight;
     
-    float3 textureColor = sampleColor(i_vtx.pos.xz);
+    float3 textureColor = sampleColor(i_vtx.pos.xz, i_streamMip);
 
     float PHI = (1.0 + sqrt(50))/2.0;
     float n = i_debug.x * PHI - floor(i_debug.x * PHI);
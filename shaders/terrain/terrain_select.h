@@ -0,0 +1,175 @@
+#ifndef TERRAIN_SELECT_H
+#define TERRAIN_SELECT_H
+
+#include "terrain_instance.h"
+
+// Quadtree LOD selection shared by terrain_select_cs.hlsl and its CPU reference in TerrainSelect.cpp.
+// Only uses code that compiles both as HLSL and as C++ with donut math, and no operation whose result
+// may differ between the two: no division or square root on floats and no fused multiply add.
+// The selection walks the tree level by level, every node of a level list is processed on its own
+
+#define TERRAIN_SELECT_GROUP_SIZE 64
+#define TERRAIN_SELECT_MAX_LODS 12 // same as QuadTree::MAX_LODS
+#define TERRAIN_SELECT_MAX_NODES 4096 // per level list, a node whose refined children don't fit is drawn whole
+
+// Byte offsets in the counters buffer
+#define TERRAIN_SELECT_LIST_COUNT_OFFSET 0 // one count per list
+#define TERRAIN_SELECT_INSTANCE_COUNT_OFFSET 8
+
+#ifdef __cplusplus
+#define TERRAIN_SELECT_FUNC inline
+#define TERRAIN_SELECT_PRECISE
+#define TERRAIN_SELECT_IN(T) const T&
+#else
+#define TERRAIN_SELECT_FUNC
+#define TERRAIN_SELECT_PRECISE precise
+#define TERRAIN_SELECT_IN(T) T
+#endif
+
+// One quadtree seen from one view
+struct TerrainSelectConstants
+{
+	float4 frustumPlanes[6]; // xyz normal, w distance
+	float4 lodExtents[TERRAIN_SELECT_MAX_LODS]; // xy half size of the nodes of each level
+	float4 lodRangesSq[TERRAIN_SELECT_MAX_LODS]; // x squared range of each level, scaled by the LOD range scale
+	float3 lodOrigin;
+	float heightScale; // maxHeight / 255, node heights are 8 bit
+	float2 treeMin; // xz of the tree min corner
+	uint numLods;
+	uint nodeBase; // first node of the tree in the node heights buffer
+	uint firstInstance; // first instance of the view in the instance buffer
+	uint maxInstances;
+	uint drawArgsOffset; // byte offset of the view draw arguments
+	uint padding;
+};
+
+struct TerrainSelectPushConstants
+{
+	uint lodLevel;
+	uint inputList; // list processed by the level pass, the other one receives the children
+	uint resetInstances; // the root pass of the first quadtree of a view clears the instance count
+	uint padding;
+};
+
+struct TerrainSelectBox
+{
+	float3 mins;
+	float3 maxs;
+};
+
+// Outcome of a node of a level list, which is in range of its LOD and inside the frustum
+struct TerrainSelectResult
+{
+	bool drawWhole; // no child in range of the finer LOD, the node is drawn at its level
+	uint drawMask; // bit i set if child i is drawn one level below
+	uint refineMask; // bit i set if child i goes to the next level list
+};
+
+// Spreads the lower 16 bits of v to the even bits
+TERRAIN_SELECT_FUNC uint TerrainSelect_Part1By1(uint v)
+{
+	v &= 0x0000ffffu;
+	v = (v | (v << 8u)) & 0x00ff00ffu;
+	v = (v | (v << 4u)) & 0x0f0f0f0fu;
+	v = (v | (v << 2u)) & 0x33333333u;
+	v = (v | (v << 1u)) & 0x55555555u;
+	return v;
+}
+
+// Same layout as QuadTree::GetNodeIndex, level by level and in Morton order within a level
+TERRAIN_SELECT_FUNC uint TerrainSelect_NodeIndex(uint numLods, uint lodLevel, uint x, uint z)
+{
+	const uint depth = numLods - lodLevel;
+	return ((1u << (2u * depth)) - 1u) / 3u + (TerrainSelect_Part1By1(x) | (TerrainSelect_Part1By1(z) << 1u));
+}
+
+// Packed heights are min | max << 8, the layout of a Node
+TERRAIN_SELECT_FUNC TerrainSelectBox TerrainSelect_NodeBounds(TERRAIN_SELECT_IN(TerrainSelectConstants) c, uint lodLevel, uint x, uint z, uint packedHeights)
+{
+	const float2 extents = float2(c.lodExtents[lodLevel].x, c.lodExtents[lodLevel].y);
+	TERRAIN_SELECT_PRECISE const float centerX = c.treeMin.x + extents.x * float(2u * x + 1u);
+	TERRAIN_SELECT_PRECISE const float centerZ = c.treeMin.y + extents.y * float(2u * z + 1u);
+
+	TerrainSelectBox box;
+	box.mins = float3(centerX - extents.x, float(packedHeights & 0xffu) * c.heightScale, centerZ - extents.y);
+	box.maxs = float3(centerX + extents.x, float((packedHeights >> 8u) & 0xffu) * c.heightScale, centerZ + extents.y);
+	return box;
+}
+
+// Same test as NodeCull::RangeMask, on the xz plane and inclusive of the range
+TERRAIN_SELECT_FUNC bool TerrainSelect_InRange(TERRAIN_SELECT_IN(TerrainSelectBox) box, float3 position, float rangeSq)
+{
+	TERRAIN_SELECT_PRECISE const float dx = max(max(box.mins.x - position.x, position.x - box.maxs.x), 0.0f);
+	TERRAIN_SELECT_PRECISE const float dz = max(max(box.mins.z - position.z, position.z - box.maxs.z), 0.0f);
+	TERRAIN_SELECT_PRECISE const float distanceSq = dx * dx + dz * dz;
+	return distanceSq <= rangeSq;
+}
+
+// Same test as NodeCull::FrustumMask, the box vertex furthest inside each plane is tested
+TERRAIN_SELECT_FUNC bool TerrainSelect_InFrustum(TERRAIN_SELECT_IN(TerrainSelectConstants) c, TERRAIN_SELECT_IN(TerrainSelectBox) box)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const float4 p = c.frustumPlanes[i];
+		const float x = p.x > 0.0f ? box.mins.x : box.maxs.x;
+		const float y = p.y > 0.0f ? box.mins.y : box.maxs.y;
+		const float z = p.z > 0.0f ? box.mins.z : box.maxs.z;
+		TERRAIN_SELECT_PRECISE const float d = p.x * x + p.y * y + p.z * z;
+		if (d > p.w)
+			return false;
+	}
+	return true;
+}
+
+// The root starts the first level list if it is in range of the coarsest LOD and inside the frustum
+TERRAIN_SELECT_FUNC bool TerrainSelect_Root(TERRAIN_SELECT_IN(TerrainSelectConstants) c, uint packedHeights)
+{
+	const TerrainSelectBox box = TerrainSelect_NodeBounds(c, c.numLods, 0u, 0u, packedHeights);
+	return TerrainSelect_InRange(box, c.lodOrigin, c.lodRangesSq[c.numLods].x) && TerrainSelect_InFrustum(c, box);
+}
+
+// Same decisions as QuadTree::NodeSelect for one node, childHeights[i] holds the packed heights of child i
+TERRAIN_SELECT_FUNC TerrainSelectResult TerrainSelect_ProcessNode(TERRAIN_SELECT_IN(TerrainSelectConstants) c, uint lodLevel, uint x, uint z, uint childHeights[4])
+{
+	TerrainSelectResult result;
+	result.drawWhole = true;
+	result.drawMask = 0u;
+	result.refineMask = 0u;
+
+	if (lodLevel == 0u)
+		return result;
+
+	uint rangeMask = 0u;
+	uint frustumMask = 0u;
+	for (uint i = 0u; i < 4u; i++)
+	{
+		const TerrainSelectBox box = TerrainSelect_NodeBounds(c, lodLevel - 1u, 2u * x + (i & 1u), 2u * z + (i >> 1u), childHeights[i]);
+		if (TerrainSelect_InRange(box, c.lodOrigin, c.lodRangesSq[lodLevel - 1u].x))
+			rangeMask |= 1u << i;
+		if (TerrainSelect_InFrustum(c, box))
+			frustumMask |= 1u << i;
+	}
+
+	if (rangeMask == 0u)
+		return result;
+
+	result.drawWhole = false;
+	result.drawMask = ~rangeMask & frustumMask & 0xfu;
+	result.refineMask = rangeMask & frustumMask;
+	return result;
+}
+
+// Instance drawing a node, same as PackTerrainInstance
+TERRAIN_SELECT_FUNC TerrainInstanceData TerrainSelect_PackInstance(TERRAIN_SELECT_IN(TerrainSelectBox) box, uint lodLevel)
+{
+	TERRAIN_SELECT_PRECISE const float centerX = (box.mins.x + box.maxs.x) * 0.5f;
+	TERRAIN_SELECT_PRECISE const float centerZ = (box.mins.z + box.maxs.z) * 0.5f;
+
+	TerrainInstanceData instance;
+	instance.offset = float2(centerX, centerZ);
+	instance.scale = (box.maxs.x - box.mins.x) * 0.5f;
+	instance.lodAndFlags = lodLevel & TERRAIN_INSTANCE_LOD_MASK;
+	return instance;
+}
+
+#endif // TERRAIN_SELECT_H
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include <donut/shaders/vulkan.hlsli>
+#include "terrain_select.h"
+
+// GPU quadtree selection, one chain of dispatches per quadtree and view:
+//  - main_root pushes the root into list 0
+//  - main_level processes the nodes of one level list and appends their children to the other list
+//  - main_args turns the count of the new list into the dispatch arguments of the next level
+// The instances go to the view range of the instance buffer, their count to the view draw arguments
+
+cbuffer c_TerrainSelect : register(b0)
+{
+    TerrainSelectConstants c_TerrainSelect;
+};
+
+VK_PUSH_CONSTANT ConstantBuffer<TerrainSelectPushConstants> g_Select : register(b1);
+
+ByteAddressBuffer t_NodeHeights : register(t0);
+
+RWByteAddressBuffer u_Instances : register(u0);
+RWByteAddressBuffer u_NodeLists : register(u1);
+RWByteAddressBuffer u_Counters : register(u2);
+RWByteAddressBuffer u_DispatchArgs : register(u3);
+RWByteAddressBuffer u_DrawArgs : register(u4);
+
+// Nodes are two bytes, min then max
+uint loadNodeHeights(uint nodeIndex)
+{
+    const uint byteOffset = (c_TerrainSelect.nodeBase + nodeIndex) * 2;
+    const uint word = t_NodeHeights.Load(byteOffset & ~3u);
+    return (byteOffset & 2) ? (word >> 16) : (word & 0xffff);
+}
+
+void emitInstance(TerrainSelectBox box, uint lodLevel)
+{
+    uint index;
+    u_Counters.InterlockedAdd(TERRAIN_SELECT_INSTANCE_COUNT_OFFSET, 1, index);
+    if (index >= c_TerrainSelect.maxInstances)
+        return;
+
+    const TerrainInstanceData instance = TerrainSelect_PackInstance(box, lodLevel);
+    u_Instances.Store4((c_TerrainSelect.firstInstance + index) * 16,
+        uint4(asuint(instance.offset.x), asuint(instance.offset.y), asuint(instance.scale), instance.lodAndFlags));
+}
+
+// Reserves numNodes consecutive entries of a level list, all or none. The count keeps growing past a failed
+// reservation, main_args clamps it
+bool reserveNodes(uint list, uint numNodes, out uint first)
+{
+    first = 0;
+    if (numNodes == 0)
+        return true;
+
+    u_Counters.InterlockedAdd(TERRAIN_SELECT_LIST_COUNT_OFFSET + list * 4, numNodes, first);
+    return first + numNodes <= TERRAIN_SELECT_MAX_NODES;
+}
+
+void writeInstanceCount()
+{
+    const uint count = u_Counters.Load(TERRAIN_SELECT_INSTANCE_COUNT_OFFSET);
+    u_DrawArgs.Store(c_TerrainSelect.drawArgsOffset + 4, min(count, c_TerrainSelect.maxInstances));
+}
+
+[numthreads(1, 1, 1)]
+void main_root()
+{
+    if (g_Select.resetInstances != 0)
+        u_Counters.Store(TERRAIN_SELECT_INSTANCE_COUNT_OFFSET, 0);
+
+    const bool selected = TerrainSelect_Root(c_TerrainSelect, loadNodeHeights(0));
+    u_Counters.Store2(TERRAIN_SELECT_LIST_COUNT_OFFSET, uint2(selected ? 1 : 0, 0));
+    if (selected)
+        u_NodeLists.Store(0, 0);
+
+    u_DispatchArgs.Store3(0, uint3(selected ? 1 : 0, 1, 1));
+    writeInstanceCount();
+}
+
+[numthreads(TERRAIN_SELECT_GROUP_SIZE, 1, 1)]
+void main_level(uint3 threadId : SV_DispatchThreadID)
+{
+    const uint inputList = g_Select.inputList;
+    const uint count = min(u_Counters.Load(TERRAIN_SELECT_LIST_COUNT_OFFSET + inputList * 4), TERRAIN_SELECT_MAX_NODES);
+    if (threadId.x >= count)
+        return;
+
+    const uint packed = u_NodeLists.Load((inputList * TERRAIN_SELECT_MAX_NODES + threadId.x) * 4);
+    const uint x = packed & 0xffff;
+    const uint z = packed >> 16;
+    const uint lodLevel = g_Select.lodLevel;
+    const uint nodeIndex = TerrainSelect_NodeIndex(c_TerrainSelect.numLods, lodLevel, x, z);
+
+    uint childHeights[4] = { 0, 0, 0, 0 };
+    if (lodLevel > 0)
+    {
+        for (uint i = 0; i < 4; i++)
+            childHeights[i] = loadNodeHeights(nodeIndex * 4 + 1 + i);
+    }
+
+    // A node whose children don't fit in the full list is drawn whole, coarser than asked for but without holes
+    const TerrainSelectResult result = TerrainSelect_ProcessNode(c_TerrainSelect, lodLevel, x, z, childHeights);
+    const uint outputList = 1 - inputList;
+    uint nextNode;
+    if (result.drawWhole || !reserveNodes(outputList, countbits(result.refineMask), nextNode))
+    {
+        emitInstance(TerrainSelect_NodeBounds(c_TerrainSelect, lodLevel, x, z, loadNodeHeights(nodeIndex)), lodLevel);
+        return;
+    }
+
+    for (uint i = 0; i < 4; i++)
+    {
+        const uint childX = 2 * x + (i & 1);
+        const uint childZ = 2 * z + (i >> 1);
+        if (result.drawMask & (1u << i))
+            emitInstance(TerrainSelect_NodeBounds(c_TerrainSelect, lodLevel - 1, childX, childZ, childHeights[i]), lodLevel - 1);
+        if (result.refineMask & (1u << i))
+            u_NodeLists.Store((outputList * TERRAIN_SELECT_MAX_NODES + nextNode++) * 4, childX | (childZ << 16));
+    }
+}
+
+[numthreads(1, 1, 1)]
+void main_args()
+{
+    // The processed list is emptied for the level after next, the new one sizes the next level pass
+    const uint outputList = 1 - g_Select.inputList;
+    const uint count = min(u_Counters.Load(TERRAIN_SELECT_LIST_COUNT_OFFSET + outputList * 4), TERRAIN_SELECT_MAX_NODES);
+    u_Counters.Store(TERRAIN_SELECT_LIST_COUNT_OFFSET + g_Select.inputList * 4, 0);
+
+    u_DispatchArgs.Store3(0, uint3((count + TERRAIN_SELECT_GROUP_SIZE - 1) / TERRAIN_SELECT_GROUP_SIZE, 1, 1));
+    writeInstanceCount();
+}
\ No newline at end of file
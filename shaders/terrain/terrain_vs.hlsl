@@ -1,6 +1,7 @@
 #pragma pack_matrix(row_major)
 
 #include "terrain_cb.h"
+#include "terrain_instance.h"
 #include "terrain_common.hlsli"
 
 // morphs input vertex uv from high to low detailed mesh position
@@ -13,10 +14,53 @@ float2 morphVertex(float2 gridPos, float2 vertex, float morphK, float gridExtent
     return vertex - fracPart * gridExtents * morphK;
 }
 
-float computeMorphK(float distance, float gridExtents)
+// The grid variant merged every other vertex of the stitched edges, edges bordering a node more levels coarser
+// are snapped down to its vertices. Only instances with such an edge pay for it
+float2 snapStitchedEdges(float2 gridVertex, uint flags)
 {
-    int lod = clamp(int(log2(gridExtents)), 0, 11); // same as QuadTree::MAX_LODS
+    uint extraLevels = (flags >> TERRAIN_STITCH_LEVELS_SHIFT) & 0xff;
+    if (extraLevels == 0)
+        return gridVertex;
 
+    float2 cell = round((gridVertex + 1.0) * 0.5 * c_TerrainParams.gridSize);
+    // Cells between the neighbour vertices on each edge, 1 leaves the edge as it is
+    uint4 levels = (extraLevels >> uint4(0, 2, 4, 6)) & 3;
+    float4 steps = float4(1u << (levels + min(levels, 1u)));
+    if (cell.x == 0.0)
+        cell.y = floor(cell.y / steps.x) * steps.x;
+    if (cell.x == c_TerrainParams.gridSize)
+        cell.y = floor(cell.y / steps.y) * steps.y;
+    if (cell.y == 0.0)
+        cell.x = floor(cell.x / steps.z) * steps.z;
+    if (cell.y == c_TerrainParams.gridSize)
+        cell.x = floor(cell.x / steps.w) * steps.w;
+    return cell * 2.0 / c_TerrainParams.gridSize - 1.0;
+}
+
+// LOD of the coarser neighbour a vertex of a stitched edge is shared with, lod for the other vertices. Corners on two
+// stitched edges take the coarser neighbour
+uint stitchedEdgeLod(float2 gridVertex, uint lod, uint flags)
+{
+    uint mask = flags & TERRAIN_STITCH_MASK;
+    if (mask == 0)
+        return lod;
+
+    float2 cell = round((gridVertex + 1.0) * 0.5 * c_TerrainParams.gridSize);
+    uint4 levels = 1 + ((flags >> (TERRAIN_STITCH_LEVELS_SHIFT + uint4(0, 2, 4, 6))) & 3);
+    uint edgeLevels = 0;
+    if (cell.x == 0.0 && (mask & 1) != 0)
+        edgeLevels = max(edgeLevels, levels.x);
+    if (cell.x == c_TerrainParams.gridSize && (mask & 2) != 0)
+        edgeLevels = max(edgeLevels, levels.y);
+    if (cell.y == 0.0 && (mask & 4) != 0)
+        edgeLevels = max(edgeLevels, levels.z);
+    if (cell.y == c_TerrainParams.gridSize && (mask & 8) != 0)
+        edgeLevels = max(edgeLevels, levels.w);
+    return min(lod + edgeLevels, TERRAIN_MAX_LODS - 1);
+}
+
+float computeMorphK(float distance, uint lod)
+{
     float start = c_TerrainParams.lodRanges[lod].x * 0.85;
     float end = c_TerrainParams.lodRanges[lod].x;
     float delta = end - start;
@@ -24,31 +68,49 @@ float computeMorphK(float distance, float gridExtents)
     return saturate(morph);
 }
 
-float sampleHeight(float2 worldPos)
+float sampleHeight(float2 worldPos, uint lod, float morphK)
 {
     const float halfSize = c_TerrainParams.worldSize * 0.5;
     float2 uv = (worldPos + halfSize) / c_TerrainParams.worldSize;
     
+    // Streamed nodes sample the mip of their LOD, blended to the next one as they morph to the parent grid
+    if (c_TerrainParams.stream.enabled != 0)
+    {
+        const float height = sampleStreamHeight(uv, streamMipForLod(lod));
+        const float parentHeight = sampleStreamHeight(uv, streamMipForLod(lod + 1));
+        return lerp(height, parentHeight, morphK) * c_TerrainParams.maxHeight;
+    }
+
     return t_Heightmap.SampleLevel(s_LinearClampSampler, uv, 0.1).r * c_TerrainParams.maxHeight;
 }
 
 void main_vs(
     in SceneVertex i_vtx,
-    in float3x4 i_instanceMatrix : TRANSFORM,
+    in float2 i_instanceOffset : INSTANCE_OFFSET,
+    in float i_instanceScale : INSTANCE_SCALE,
+    in uint i_instanceLodAndFlags : INSTANCE_LOD,
     in uint i_instance : SV_InstanceID,
     out float4 o_position : SV_Position,
     out SceneVertex o_vtx,
-    out float3 o_debug : LOCATION
+    out float3 o_debug : LOCATION,
+    out nointerpolation uint o_streamMip : STREAM_MIP
 )
 {
-    float4 worldPos = float4(mul(i_instanceMatrix, float4(i_vtx.pos, 1.0)), 1.0);
+    uint flags = (i_instanceLodAndFlags >> TERRAIN_INSTANCE_FLAGS_SHIFT) & TERRAIN_INSTANCE_FLAGS_MASK;
+    float2 gridVertex = snapStitchedEdges(i_vtx.pos.xz, flags);
+    float4 worldPos = float4(i_instanceOffset.x + gridVertex.x * i_instanceScale, 0.0, i_instanceOffset.y + gridVertex.y * i_instanceScale, 1.0);
     
-    float distance = length(worldPos.xz - c_Terrain.view.matViewToWorld[3].xz);
-    float gridExtents = 2.0 * length(float3(i_instanceMatrix[0].x, i_instanceMatrix[1].x, i_instanceMatrix[2].x));
-    float morphK = computeMorphK(distance, gridExtents);
-    float2 gridPos = (i_vtx.pos.xz + 1.0) * 0.5;
+    float distance = length(worldPos.xz - c_TerrainParams.lodOrigin.xz);
+    float gridExtents = 2.0 * i_instanceScale;
+    uint lod = min(i_instanceLodAndFlags & TERRAIN_INSTANCE_LOD_MASK, TERRAIN_MAX_LODS - 1);
+    float morphK = computeMorphK(distance, lod);
+    float2 gridPos = (gridVertex + 1.0) * 0.5;
     worldPos.xz = morphVertex(gridPos, worldPos.xz, morphK, gridExtents);
-    worldPos.y = sampleHeight(worldPos.xz);
+    // The even vertices left on a stitched edge don't morph, they take the height the coarser neighbour samples there
+    // from its own streamed mips
+    uint heightLod = stitchedEdgeLod(gridVertex, lod, flags);
+    worldPos.y = sampleHeight(worldPos.xz, heightLod, heightLod == lod ? morphK : computeMorphK(distance, heightLod));
+    o_streamMip = streamMipForLod(lod);
     // worldPos.y = worldPos.y * c_TerrainParams.maxHeight;
 
     o_debug = float3(worldPos.y, worldPos.y, worldPos.y) / c_TerrainParams.maxHeight;
@@ -12,6 +12,7 @@
 #include "donut/render/ToneMappingPasses.h"
 
 #include "profiler/Profiler.h"
+#include "terrain/TerrainBake.h"
 #include "editor/ImGuizmo.h"
 
 #include "nvrhi/utils.h"
@@ -47,23 +48,43 @@ Renderer::Renderer(donut::app::DeviceManager* deviceManager, tf::Executor& execu
 
 	m_CommandList = GetDevice()->createCommandList();
 
-	// To remove
-	const std::filesystem::path textureFileName = "/media/terrain_heightmap.png";
-	std::shared_ptr<engine::LoadedTexture> heightmapTexture = m_TextureCache->LoadTextureFromFileDeferred(textureFileName, false);
+	m_TerrainPass = std::make_unique<TerrainPass>(GetDevice(), m_CommonPasses);
 
-	const std::filesystem::path colorTextureFileName = "/media/terrain_albedo.png";
-	std::shared_ptr<engine::LoadedTexture> colorTexture = m_TextureCache->LoadTextureFromFileDeferred(colorTextureFileName, true);
+	// The bake is rewritten when the source textures change, a bake shipped without its sources is always taken
+	const std::filesystem::path bakePath = mediaPath / "terrain.vtb";
+	const std::filesystem::path bakeSources[] = { mediaPath / "terrain_heightmap.png", mediaPath / "terrain_albedo.png" };
+	const uint64_t sourceStamp = TerrainBake::GetSourceStamp(bakeSources);
 
-	engine::TextureData* textureData = (engine::TextureData*)heightmapTexture.get();
-	if (!textureData->data)
+	const std::shared_ptr<BakedTerrain> bakedTerrain = BakedTerrain::Open(bakePath);
+	if (bakedTerrain && bakedTerrain->Matches(sourceStamp, static_cast<float>(TerrainSettings::WORLD_SIZE), static_cast<float>(TerrainSettings::SURFACE_SIZE)))
 	{
-		log::warning("Couldn't load %s", textureFileName.generic_string().c_str());
-        heightmapTexture.reset();
-		colorTexture.reset();
+		// Only the pages around the camera are kept on the GPU
+		TerrainPass::CreateParameters createParams;
+		createParams.streamingBudget = 64ull << 20;
+		m_TerrainPass->InitBaked(*m_ShaderFactory, createParams, m_CommandList, bakedTerrain, m_Executor);
 	}
+	else
+	{
+		// To remove
+		const std::filesystem::path textureFileName = "/media/terrain_heightmap.png";
+		std::shared_ptr<engine::LoadedTexture> heightmapTexture = m_TextureCache->LoadTextureFromFileDeferred(textureFileName, false);
 
-	m_TerrainPass = std::make_unique<TerrainPass>(GetDevice(), m_CommonPasses);
-	m_TerrainPass->Init(*m_ShaderFactory, TerrainPass::CreateParameters(), m_CommandList, heightmapTexture, colorTexture, m_Executor);
+		const std::filesystem::path colorTextureFileName = "/media/terrain_albedo.png";
+		std::shared_ptr<engine::LoadedTexture> colorTexture = m_TextureCache->LoadTextureFromFileDeferred(colorTextureFileName, true);
+
+		engine::TextureData* textureData = (engine::TextureData*)heightmapTexture.get();
+		if (!textureData->data)
+		{
+			log::warning("Couldn't load %s", textureFileName.generic_string().c_str());
+			heightmapTexture.reset();
+			colorTexture.reset();
+		}
+
+		TerrainPass::BakeTarget bakeTarget;
+		bakeTarget.path = bakePath;
+		bakeTarget.sourceStamp = sourceStamp;
+		m_TerrainPass->Init(*m_ShaderFactory, TerrainPass::CreateParameters(), m_CommandList, heightmapTexture, colorTexture, m_Executor, bakeTarget);
+	}
 
 	// Shadows
 	{
@@ -328,6 +349,9 @@ void Renderer::RecordCommand(nvrhi::IFramebuffer* framebuffer)
 		PROFILE_GPU_BEGIN(m_CommandList, "Scene Refresh");
 		if (m_Scene && m_Scene->GetSceneGraph())
 			m_Scene->RefreshBuffers(m_CommandList, GetFrameIndex()); // Updates any geometry, material, etc buffer changes
+		m_TerrainPass->BeginFrame();
+		if (m_EditorParams.m_RenderTerrain && !m_EditorParams.m_LockView)
+			m_TerrainPass->UpdateStreaming(m_CommandList, m_View.GetViewOrigin());
 		PROFILE_GPU_END(m_CommandList);
 
 		if (m_DirectionalLight)
@@ -355,7 +379,15 @@ void Renderer::RecordCommand(nvrhi::IFramebuffer* framebuffer)
 				vRenderer::TerrainPass::RenderParams renderParams;
 				renderParams.wireframe = m_EditorParams.m_Wireframe;
 				renderParams.lockView = m_EditorParams.m_LockView;
+				renderParams.incrementalSelection = m_EditorParams.m_IncrementalSelection;
+				renderParams.gpuSelection = m_EditorParams.m_GpuSelection;
+				renderParams.stitchEdges = m_EditorParams.m_StitchEdges;
+				renderParams.gridTier = static_cast<TerrainGrid::Tier>(m_EditorParams.m_GridTier);
 				renderParams.depthOnly = true;
+				// Shadow LODs follow the camera and are one level coarser, and one more for every further cascade
+				renderParams.lodView = &m_View;
+				renderParams.lodRangeScale = 0.5f;
+				renderParams.cascadeLodRangeScale = 0.5f;
 
 				m_TerrainPass->Render(
 					m_CommandList,
@@ -404,6 +436,10 @@ void Renderer::RecordCommand(nvrhi::IFramebuffer* framebuffer)
 			vRenderer::TerrainPass::RenderParams renderParams;
 			renderParams.wireframe = m_EditorParams.m_Wireframe;
 			renderParams.lockView = m_EditorParams.m_LockView;
+			renderParams.incrementalSelection = m_EditorParams.m_IncrementalSelection;
+			renderParams.gpuSelection = m_EditorParams.m_GpuSelection;
+			renderParams.stitchEdges = m_EditorParams.m_StitchEdges;
+			renderParams.gridTier = static_cast<TerrainGrid::Tier>(m_EditorParams.m_GridTier);
 
 			m_TerrainPass->Render(
 				m_CommandList,
@@ -464,6 +500,18 @@ void Renderer::RenderUI()
 	ImGui::Checkbox("Enable Terrain", &m_EditorParams.m_RenderTerrain);
 	ImGui::Checkbox("Wireframe", &m_EditorParams.m_Wireframe);
 	ImGui::Checkbox("Lock View", &m_EditorParams.m_LockView);
+	ImGui::Checkbox("Incremental Selection", &m_EditorParams.m_IncrementalSelection);
+	// The compute passes don't write the stitch flags, TerrainPass selects on the CPU while the edges are stitched
+	ImGui::BeginDisabled(m_EditorParams.m_StitchEdges);
+	ImGui::Checkbox("GPU Selection", &m_EditorParams.m_GpuSelection);
+	ImGui::EndDisabled();
+	if (m_EditorParams.m_StitchEdges)
+	{
+		ImGui::SameLine();
+		ImGui::TextDisabled("(off while stitching edges)");
+	}
+	ImGui::Checkbox("Stitch Edges", &m_EditorParams.m_StitchEdges);
+	ImGui::Combo("Grid Density", &m_EditorParams.m_GridTier, "16\0" "32\0" "64\0" "128\0");
 	ImGui::InputFloat("Max Height", &m_EditorParams.m_MaxHeight, 1.0);
 	ImGui::Text("Num instances : %i", m_EditorParams.m_NumChunks);
 
@@ -486,27 +534,29 @@ void Renderer::RenderUI()
 			ImGuizmo::SetRect(0, 0, io.DisplaySize.x, io.DisplaySize.y);
 
 			auto& quadTrees = m_TerrainPass->GetQuadTrees();
-			for (const auto& quadTree : quadTrees)
+			const vRenderer::TerrainPass::ViewSelection* viewSelection = m_TerrainPass->GetViewSelection(&m_View, 0);
+			for (size_t i = 0; viewSelection && i < viewSelection->quadTrees.size(); i++)
 			{
-				auto& nodes = quadTree->GetSelectedNodes();
-				for (const Node* node : nodes)
+				const auto& quadTree = quadTrees[i];
+				for (const SelectedNode& selected : viewSelection->quadTrees[i].m_Nodes)
 				{
-					float height = m_EditorParams.m_MaxHeight;
-					float3 size = float3(node->m_Extents.x * 2.0f, node->m_Extents.y * height, node->m_Extents.z * 2.0f);
-					float3 position = float3(node->m_Position.x, node->m_Position.y * height, node->m_Position.z);
-
-					/*size = node->m_Extents * 2.0f;
-					position = node->m_Position;*/
+					quadTree->ForEachSelectedInstance(selected, [this, &quadTree](const int lodLevel, const uint32_t x, const uint32_t z)
+						{
+							const box3 bounds = quadTree->GetNodeBounds(lodLevel, x, z);
+							float height = m_EditorParams.m_MaxHeight;
+							float3 size = bounds.diagonal() * float3(1.0f, height, 1.0f);
+							float3 position = bounds.center() * float3(1.0f, height, 1.0f);
 
-					const float4x4 transform = affineToHomogeneous(scaling(size) * math::translation(position));
-					const float4x4 view = affineToHomogeneous(m_View.GetViewMatrix());
-					const float4x4 proj = m_View.GetProjectionMatrix(true);
+							const float4x4 transform = affineToHomogeneous(scaling(size) * math::translation(position));
+							const float4x4 view = affineToHomogeneous(m_View.GetViewMatrix());
+							const float4x4 proj = m_View.GetProjectionMatrix(true);
 
-					box3 cube = box3(float3(-0.5f), float3(0.5f)) * homogeneousToAffine(transform);
+							box3 cube = box3(float3(-0.5f), float3(0.5f)) * homogeneousToAffine(transform);
 
-					ImU32 color = m_View.GetViewFrustum().intersectsWith(cube) ? IM_COL32(0, 255, 0, 255) : IM_COL32(255, 0, 0, 255);
+							ImU32 color = m_View.GetViewFrustum().intersectsWith(cube) ? IM_COL32(0, 255, 0, 255) : IM_COL32(255, 0, 0, 255);
 
-					ImGuizmo::DrawCubes(view.m_data, proj.m_data, transform.m_data, 1, color);
+							ImGuizmo::DrawCubes(view.m_data, proj.m_data, transform.m_data, 1, color);
+						});
 				}
 			}
 		}
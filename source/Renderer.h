@@ -37,6 +37,10 @@ namespace vRenderer
 		bool m_RenderTerrain = true;
 		bool m_Wireframe = false;
 		bool m_LockView = false;
+		bool m_IncrementalSelection = true;
+		bool m_GpuSelection = false;
+		bool m_StitchEdges = true; // GPU selection only applies without
+		int m_GridTier = static_cast<int>(TerrainGrid::Tier::Medium); // quads per node side, 16 << tier
 		float m_MaxHeight = 400.0f;
 		uint32_t m_NumChunks = 0;
 
@@ -0,0 +1,529 @@
+#include "BlockCompress.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace BlockCompress;
+
+namespace
+{
+	using Color = std::array<float, 4>;
+
+	constexpr uint32_t NUM_TEXELS = BLOCK_SIZE * BLOCK_SIZE;
+	constexpr int NUM_REFINEMENTS = 2;
+
+	// BC1 palette entries in index order, as weights of the second endpoint
+	constexpr std::array<float, 4> BC1_WEIGHTS = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	// BC7 4 bit index weights, out of 64
+	constexpr std::array<uint32_t, 16> BC7_WEIGHTS = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	struct BitWriter
+	{
+		uint8_t* data;
+		uint32_t position = 0;
+
+		void Write(const uint32_t value, const uint32_t numBits)
+		{
+			for (uint32_t bit = 0; bit < numBits; bit++, position++)
+			{
+				if ((value >> bit) & 1)
+					data[position >> 3] |= static_cast<uint8_t>(1 << (position & 7));
+			}
+		}
+	};
+
+	struct BitReader
+	{
+		const uint8_t* data;
+		uint32_t position = 0;
+
+		uint32_t Read(const uint32_t numBits)
+		{
+			uint32_t value = 0;
+			for (uint32_t bit = 0; bit < numBits; bit++, position++)
+				value |= ((data[position >> 3] >> (position & 7)) & 1u) << bit;
+			return value;
+		}
+	};
+
+	float GetDistanceSq(const uint8_t* texel, const Color& color, const int numChannels)
+	{
+		float distanceSq = 0.0f;
+		for (int c = 0; c < numChannels; c++)
+		{
+			const float d = static_cast<float>(texel[c]) - color[c];
+			distanceSq += d * d;
+		}
+		return distanceSq;
+	}
+
+	// Endpoints at the extreme projections of the texels on their principal axis
+	void FitAxis(const uint8_t* texels, const int numChannels, Color& e0, Color& e1)
+	{
+		Color mean = {};
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			for (int c = 0; c < numChannels; c++)
+				mean[c] += static_cast<float>(texels[i * 4 + c]);
+		}
+		for (int c = 0; c < numChannels; c++)
+			mean[c] /= static_cast<float>(NUM_TEXELS);
+
+		float covariance[4][4] = {};
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			for (int a = 0; a < numChannels; a++)
+			{
+				const float da = static_cast<float>(texels[i * 4 + a]) - mean[a];
+				for (int b = 0; b < numChannels; b++)
+					covariance[a][b] += da * (static_cast<float>(texels[i * 4 + b]) - mean[b]);
+			}
+		}
+
+		// Power iteration, a flat block keeps the diagonal
+		Color axis = { 1.0f, 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			Color next = {};
+			float maxComponent = 0.0f;
+			for (int a = 0; a < numChannels; a++)
+			{
+				for (int b = 0; b < numChannels; b++)
+					next[a] += covariance[a][b] * axis[b];
+				maxComponent = std::max(maxComponent, std::abs(next[a]));
+			}
+			if (maxComponent <= 1e-6f)
+				break;
+			for (int c = 0; c < numChannels; c++)
+				axis[c] = next[c] / maxComponent;
+		}
+
+		float lengthSq = 0.0f;
+		for (int c = 0; c < numChannels; c++)
+			lengthSq += axis[c] * axis[c];
+		const float invLength = 1.0f / std::sqrt(lengthSq);
+
+		float minT = 0.0f;
+		float maxT = 0.0f;
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < numChannels; c++)
+				t += (static_cast<float>(texels[i * 4 + c]) - mean[c]) * axis[c] * invLength;
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+
+		for (int c = 0; c < numChannels; c++)
+		{
+			e0[c] = std::clamp(mean[c] + axis[c] * invLength * minT, 0.0f, 255.0f);
+			e1[c] = std::clamp(mean[c] + axis[c] * invLength * maxT, 0.0f, 255.0f);
+		}
+	}
+
+	// Least squares endpoints for the chosen indices, unchanged when all the texels use one weight
+	void SolveEndpoints(const uint8_t* texels, const uint8_t* indices, const float* weights, const int numChannels, Color& e0, Color& e1)
+	{
+		float a = 0.0f;
+		float b = 0.0f;
+		float c = 0.0f;
+		Color x = {};
+		Color y = {};
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			const float w = weights[indices[i]];
+			a += (1.0f - w) * (1.0f - w);
+			b += (1.0f - w) * w;
+			c += w * w;
+			for (int channel = 0; channel < numChannels; channel++)
+			{
+				x[channel] += (1.0f - w) * static_cast<float>(texels[i * 4 + channel]);
+				y[channel] += w * static_cast<float>(texels[i * 4 + channel]);
+			}
+		}
+
+		const float determinant = a * c - b * b;
+		if (std::abs(determinant) < 1e-6f)
+			return;
+
+		for (int channel = 0; channel < numChannels; channel++)
+		{
+			e0[channel] = std::clamp((c * x[channel] - b * y[channel]) / determinant, 0.0f, 255.0f);
+			e1[channel] = std::clamp((a * y[channel] - b * x[channel]) / determinant, 0.0f, 255.0f);
+		}
+	}
+
+	uint16_t To565(const Color& color)
+	{
+		const uint32_t r = static_cast<uint32_t>(color[0] * 31.0f / 255.0f + 0.5f);
+		const uint32_t g = static_cast<uint32_t>(color[1] * 63.0f / 255.0f + 0.5f);
+		const uint32_t b = static_cast<uint32_t>(color[2] * 31.0f / 255.0f + 0.5f);
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	std::array<uint32_t, 3> From565(const uint16_t color)
+	{
+		const uint32_t r = (color >> 11) & 31;
+		const uint32_t g = (color >> 5) & 63;
+		const uint32_t b = color & 31;
+		return { (r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2) };
+	}
+
+	// Four color mode palette in index order, the decoder rounding
+	std::array<Color, 4> GetBC1Palette(const uint16_t color0, const uint16_t color1)
+	{
+		const std::array<uint32_t, 3> c0 = From565(color0);
+		const std::array<uint32_t, 3> c1 = From565(color1);
+		std::array<Color, 4> palette = {};
+		for (int c = 0; c < 3; c++)
+		{
+			palette[0][c] = static_cast<float>(c0[c]);
+			palette[1][c] = static_cast<float>(c1[c]);
+			palette[2][c] = static_cast<float>((2 * c0[c] + c1[c]) / 3);
+			palette[3][c] = static_cast<float>((c0[c] + 2 * c1[c]) / 3);
+		}
+		return palette;
+	}
+
+	void EncodeBC1(const uint8_t* texels, uint8_t* block)
+	{
+		Color e0 = {};
+		Color e1 = {};
+		FitAxis(texels, 3, e0, e1);
+
+		uint16_t bestColor0 = 0;
+		uint16_t bestColor1 = 0;
+		std::array<uint8_t, NUM_TEXELS> bestIndices = {};
+		float bestError = std::numeric_limits<float>::max();
+		std::array<uint8_t, NUM_TEXELS> indices = {};
+		for (int refinement = 0; refinement <= NUM_REFINEMENTS; refinement++)
+		{
+			const uint16_t color0 = To565(e0);
+			const uint16_t color1 = To565(e1);
+			const std::array<Color, 4> palette = GetBC1Palette(color0, color1);
+
+			float error = 0.0f;
+			for (uint32_t i = 0; i < NUM_TEXELS; i++)
+			{
+				float bestDistanceSq = std::numeric_limits<float>::max();
+				for (uint8_t index = 0; index < 4; index++)
+				{
+					const float distanceSq = GetDistanceSq(texels + i * 4, palette[index], 3);
+					if (distanceSq < bestDistanceSq)
+					{
+						bestDistanceSq = distanceSq;
+						indices[i] = index;
+					}
+				}
+				error += bestDistanceSq;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				bestColor0 = color0;
+				bestColor1 = color1;
+				bestIndices = indices;
+			}
+			SolveEndpoints(texels, indices.data(), BC1_WEIGHTS.data(), 3, e0, e1);
+		}
+
+		// The four color mode needs color0 > color1, equal colors would select the three color mode
+		uint32_t indexFlip = 0;
+		if (bestColor0 < bestColor1)
+		{
+			std::swap(bestColor0, bestColor1);
+			indexFlip = 1;
+		}
+		else if (bestColor0 == bestColor1)
+		{
+			bestIndices.fill(0);
+		}
+
+		uint32_t packedIndices = 0;
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+			packedIndices |= (bestIndices[i] ^ indexFlip) << (2 * i);
+
+		memcpy(block, &bestColor0, 2);
+		memcpy(block + 2, &bestColor1, 2);
+		memcpy(block + 4, &packedIndices, 4);
+	}
+
+	void DecodeBC1(const uint8_t* block, uint8_t* texels)
+	{
+		uint16_t color0;
+		uint16_t color1;
+		uint32_t packedIndices;
+		memcpy(&color0, block, 2);
+		memcpy(&color1, block + 2, 2);
+		memcpy(&packedIndices, block + 4, 4);
+
+		const std::array<uint32_t, 3> c0 = From565(color0);
+		const std::array<uint32_t, 3> c1 = From565(color1);
+		uint8_t palette[4][4];
+		for (int c = 0; c < 3; c++)
+		{
+			palette[0][c] = static_cast<uint8_t>(c0[c]);
+			palette[1][c] = static_cast<uint8_t>(c1[c]);
+			palette[2][c] = static_cast<uint8_t>(color0 > color1 ? (2 * c0[c] + c1[c]) / 3 : (c0[c] + c1[c]) / 2);
+			palette[3][c] = static_cast<uint8_t>(color0 > color1 ? (c0[c] + 2 * c1[c]) / 3 : 0);
+		}
+		palette[0][3] = palette[1][3] = palette[2][3] = 255;
+		palette[3][3] = color0 > color1 ? 255 : 0;
+
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+			memcpy(texels + i * 4, palette[(packedIndices >> (2 * i)) & 3], 4);
+	}
+
+	// 7 bits per channel and the low bit shared by the four channels, whichever is closer
+	void QuantizeBC7Endpoint(const Color& color, std::array<uint32_t, 4>& quantized, uint32_t& lowBit)
+	{
+		float bestError = std::numeric_limits<float>::max();
+		for (uint32_t p = 0; p < 2; p++)
+		{
+			std::array<uint32_t, 4> candidate;
+			float error = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				candidate[c] = std::min(static_cast<uint32_t>(std::max((color[c] - static_cast<float>(p)) * 0.5f + 0.5f, 0.0f)), 127u);
+				const float d = static_cast<float>(candidate[c] * 2 + p) - color[c];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				quantized = candidate;
+				lowBit = p;
+			}
+		}
+	}
+
+	std::array<Color, 16> GetBC7Palette(const std::array<uint32_t, 4>& endpoint0, const uint32_t lowBit0, const std::array<uint32_t, 4>& endpoint1, const uint32_t lowBit1)
+	{
+		std::array<Color, 16> palette;
+		for (uint32_t index = 0; index < 16; index++)
+		{
+			const uint32_t w = BC7_WEIGHTS[index];
+			for (int c = 0; c < 4; c++)
+				palette[index][c] = static_cast<float>(((64 - w) * (endpoint0[c] * 2 + lowBit0) + w * (endpoint1[c] * 2 + lowBit1) + 32) >> 6);
+		}
+		return palette;
+	}
+
+	void EncodeBC7(const uint8_t* texels, uint8_t* block)
+	{
+		static const std::array<float, 16> weights = []()
+			{
+				std::array<float, 16> result;
+				for (size_t i = 0; i < result.size(); i++)
+					result[i] = static_cast<float>(BC7_WEIGHTS[i]) / 64.0f;
+				return result;
+			}();
+
+		Color e0 = {};
+		Color e1 = {};
+		FitAxis(texels, 4, e0, e1);
+
+		std::array<uint32_t, 4> bestEndpoint0 = {};
+		std::array<uint32_t, 4> bestEndpoint1 = {};
+		uint32_t bestLowBit0 = 0;
+		uint32_t bestLowBit1 = 0;
+		std::array<uint8_t, NUM_TEXELS> bestIndices = {};
+		float bestError = std::numeric_limits<float>::max();
+		std::array<uint8_t, NUM_TEXELS> indices = {};
+		for (int refinement = 0; refinement <= NUM_REFINEMENTS; refinement++)
+		{
+			std::array<uint32_t, 4> endpoint0;
+			std::array<uint32_t, 4> endpoint1;
+			uint32_t lowBit0;
+			uint32_t lowBit1;
+			QuantizeBC7Endpoint(e0, endpoint0, lowBit0);
+			QuantizeBC7Endpoint(e1, endpoint1, lowBit1);
+			const std::array<Color, 16> palette = GetBC7Palette(endpoint0, lowBit0, endpoint1, lowBit1);
+
+			// The projection on the endpoint line picks the index, its neighbours absorb the weight rounding
+			Color direction;
+			float lengthSq = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				direction[c] = palette[15][c] - palette[0][c];
+				lengthSq += direction[c] * direction[c];
+			}
+			const float invLengthSq = lengthSq > 0.0f ? 1.0f / lengthSq : 0.0f;
+
+			float error = 0.0f;
+			for (uint32_t i = 0; i < NUM_TEXELS; i++)
+			{
+				float t = 0.0f;
+				for (int c = 0; c < 4; c++)
+					t += (static_cast<float>(texels[i * 4 + c]) - palette[0][c]) * direction[c];
+				const int guess = std::clamp(static_cast<int>(t * invLengthSq * 15.0f + 0.5f), 0, 15);
+
+				float bestDistanceSq = std::numeric_limits<float>::max();
+				for (int index = std::max(guess - 1, 0); index <= std::min(guess + 1, 15); index++)
+				{
+					const float distanceSq = GetDistanceSq(texels + i * 4, palette[index], 4);
+					if (distanceSq < bestDistanceSq)
+					{
+						bestDistanceSq = distanceSq;
+						indices[i] = static_cast<uint8_t>(index);
+					}
+				}
+				error += bestDistanceSq;
+			}
+
+			if (error < bestError)
+			{
+				bestError = error;
+				bestEndpoint0 = endpoint0;
+				bestEndpoint1 = endpoint1;
+				bestLowBit0 = lowBit0;
+				bestLowBit1 = lowBit1;
+				bestIndices = indices;
+			}
+			SolveEndpoints(texels, indices.data(), weights.data(), 4, e0, e1);
+		}
+
+		// The first index is stored without its high bit
+		if (bestIndices[0] & 8)
+		{
+			std::swap(bestEndpoint0, bestEndpoint1);
+			std::swap(bestLowBit0, bestLowBit1);
+			for (uint8_t& index : bestIndices)
+				index = static_cast<uint8_t>(15 - index);
+		}
+
+		memset(block, 0, 16);
+		BitWriter writer{ block };
+		writer.Write(1 << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			writer.Write(bestEndpoint0[c], 7);
+			writer.Write(bestEndpoint1[c], 7);
+		}
+		writer.Write(bestLowBit0, 1);
+		writer.Write(bestLowBit1, 1);
+		writer.Write(bestIndices[0], 3);
+		for (uint32_t i = 1; i < NUM_TEXELS; i++)
+			writer.Write(bestIndices[i], 4);
+	}
+
+	bool DecodeBC7(const uint8_t* block, uint8_t* texels)
+	{
+		if ((block[0] & 0x7f) != 1 << 6)
+		{
+			for (uint32_t i = 0; i < NUM_TEXELS; i++)
+			{
+				const uint8_t magenta[4] = { 255, 0, 255, 255 };
+				memcpy(texels + i * 4, magenta, 4);
+			}
+			return false;
+		}
+
+		BitReader reader{ block, 7 };
+		std::array<uint32_t, 4> endpoint0;
+		std::array<uint32_t, 4> endpoint1;
+		for (int c = 0; c < 4; c++)
+		{
+			endpoint0[c] = reader.Read(7);
+			endpoint1[c] = reader.Read(7);
+		}
+		const uint32_t lowBit0 = reader.Read(1);
+		const uint32_t lowBit1 = reader.Read(1);
+		const std::array<Color, 16> palette = GetBC7Palette(endpoint0, lowBit0, endpoint1, lowBit1);
+
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			const uint32_t index = reader.Read(i == 0 ? 3 : 4);
+			for (int c = 0; c < 4; c++)
+				texels[i * 4 + c] = static_cast<uint8_t>(palette[index][c]);
+		}
+		return true;
+	}
+}
+
+namespace BlockCompress
+{
+	size_t GetBlockBytes(const Format format)
+	{
+		return format == Format::BC1 ? 8 : 16;
+	}
+
+	size_t GetEncodedSize(const Format format, const uint32_t width, const uint32_t height)
+	{
+		const size_t numBlocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		const size_t numBlocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		return numBlocksX * numBlocksY * GetBlockBytes(format);
+	}
+
+	void EncodeBlock(const Format format, const uint8_t* texels, uint8_t* block)
+	{
+		if (format == Format::BC1)
+			EncodeBC1(texels, block);
+		else
+			EncodeBC7(texels, block);
+	}
+
+	bool DecodeBlock(const Format format, const uint8_t* block, uint8_t* texels)
+	{
+		if (format == Format::BC1)
+		{
+			DecodeBC1(block, texels);
+			return true;
+		}
+		return DecodeBC7(block, texels);
+	}
+
+	std::vector<uint8_t> Encode(const Format format, const uint8_t* rgba, const uint32_t width, const uint32_t height)
+	{
+		const uint32_t numBlocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		const uint32_t numBlocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		const size_t blockBytes = GetBlockBytes(format);
+		std::vector<uint8_t> blocks(GetEncodedSize(format, width, height));
+
+		uint8_t texels[NUM_TEXELS * 4];
+		for (uint32_t blockY = 0; blockY < numBlocksY; blockY++)
+		{
+			for (uint32_t blockX = 0; blockX < numBlocksX; blockX++)
+			{
+				for (uint32_t y = 0; y < BLOCK_SIZE; y++)
+				{
+					const uint32_t srcY = std::min(blockY * BLOCK_SIZE + y, height - 1);
+					for (uint32_t x = 0; x < BLOCK_SIZE; x++)
+					{
+						const uint32_t srcX = std::min(blockX * BLOCK_SIZE + x, width - 1);
+						memcpy(texels + (y * BLOCK_SIZE + x) * 4, rgba + (static_cast<size_t>(srcY) * width + srcX) * 4, 4);
+					}
+				}
+				EncodeBlock(format, texels, blocks.data() + (static_cast<size_t>(blockY) * numBlocksX + blockX) * blockBytes);
+			}
+		}
+		return blocks;
+	}
+
+	std::vector<uint8_t> Decode(const Format format, const uint8_t* blocks, const uint32_t width, const uint32_t height)
+	{
+		const uint32_t numBlocksX = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		const uint32_t numBlocksY = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		const size_t blockBytes = GetBlockBytes(format);
+		std::vector<uint8_t> rgba(static_cast<size_t>(width) * height * 4);
+
+		uint8_t texels[NUM_TEXELS * 4];
+		for (uint32_t blockY = 0; blockY < numBlocksY; blockY++)
+		{
+			for (uint32_t blockX = 0; blockX < numBlocksX; blockX++)
+			{
+				DecodeBlock(format, blocks + (static_cast<size_t>(blockY) * numBlocksX + blockX) * blockBytes, texels);
+				for (uint32_t y = 0; y < BLOCK_SIZE && blockY * BLOCK_SIZE + y < height; y++)
+				{
+					const uint32_t numColumns = std::min(BLOCK_SIZE, width - blockX * BLOCK_SIZE);
+					memcpy(rgba.data() + (static_cast<size_t>(blockY * BLOCK_SIZE + y) * width + blockX * BLOCK_SIZE) * 4, texels + y * BLOCK_SIZE * 4, numColumns * 4);
+				}
+			}
+		}
+		return rgba;
+	}
+}
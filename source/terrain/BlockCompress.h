@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CPU block compression of RGBA8 images, headless so bakes can be made offline. Blocks are 4x4 texels in row major
+// block order, texels past the image edge repeat the edge. Colors are fitted in the space they are stored in, sRGB
+// images stay sRGB
+namespace BlockCompress
+{
+	constexpr uint32_t BLOCK_SIZE = 4;
+
+	enum class Format : uint32_t
+	{
+		BC1, // RGB 565 endpoints, 2 bit indices, 8 bytes per block. Alpha is dropped
+		BC7, // mode 6 only: RGBA 7777 endpoints with a shared low bit, 4 bit indices, 16 bytes per block
+	};
+
+	size_t GetBlockBytes(Format format);
+	size_t GetEncodedSize(Format format, uint32_t width, uint32_t height);
+
+	// 16 texels in, one block out
+	void EncodeBlock(Format format, const uint8_t* texels, uint8_t* block);
+	// One block in, 16 texels out. BC7 blocks in modes other than 6 decode to magenta and return false
+	bool DecodeBlock(Format format, const uint8_t* block, uint8_t* texels);
+
+	// Tightly packed RGBA8 rows
+	std::vector<uint8_t> Encode(Format format, const uint8_t* rgba, uint32_t width, uint32_t height);
+	std::vector<uint8_t> Decode(Format format, const uint8_t* blocks, uint32_t width, uint32_t height);
+}
@@ -0,0 +1,258 @@
+#include "HeightReduce.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX2__)
+#define HEIGHT_REDUCE_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HEIGHT_REDUCE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+#if HEIGHT_REDUCE_SSE2
+	// SSE2 only has signed 16 bit min/max, flipping the sign bit maps unsigned order onto signed order
+	const __m128i c_SignBit16 = _mm_set1_epi16(static_cast<short>(0x8000));
+
+	__m128i MinU16(const __m128i a, const __m128i b)
+	{
+		return _mm_xor_si128(_mm_min_epi16(_mm_xor_si128(a, c_SignBit16), _mm_xor_si128(b, c_SignBit16)), c_SignBit16);
+	}
+
+	__m128i MaxU16(const __m128i a, const __m128i b)
+	{
+		return _mm_xor_si128(_mm_max_epi16(_mm_xor_si128(a, c_SignBit16), _mm_xor_si128(b, c_SignBit16)), c_SignBit16);
+	}
+#endif
+
+	template<typename T, typename TVector>
+	void ReduceLanes(const TVector& vMin, const TVector& vMax, T& outMin, T& outMax)
+	{
+		constexpr size_t numLanes = sizeof(TVector) / sizeof(T);
+		alignas(32) T lanesMin[numLanes];
+		alignas(32) T lanesMax[numLanes];
+		memcpy(lanesMin, &vMin, sizeof(TVector));
+		memcpy(lanesMax, &vMax, sizeof(TVector));
+
+		for (size_t i = 0; i < numLanes; i++)
+		{
+			outMin = std::min(outMin, lanesMin[i]);
+			outMax = std::max(outMax, lanesMax[i]);
+		}
+	}
+
+	template<typename T>
+	void AccumulateRowScalar(const T* row, const size_t begin, const size_t count, T* colMin, T* colMax)
+	{
+		for (size_t i = begin; i < count; i++)
+		{
+			colMin[i] = std::min(colMin[i], row[i]);
+			colMax[i] = std::max(colMax[i], row[i]);
+		}
+	}
+
+	template<typename T>
+	void MinMaxScalar(const T* rowMin, const T* rowMax, const size_t begin, const size_t count, T& outMin, T& outMax)
+	{
+		for (size_t i = begin; i < count; i++)
+		{
+			outMin = std::min(outMin, rowMin[i]);
+			outMax = std::max(outMax, rowMax[i]);
+		}
+	}
+}
+
+namespace HeightReduce
+{
+	void AccumulateRow(const uint8_t* row, const size_t count, uint8_t* colMin, uint8_t* colMax)
+	{
+		size_t i = 0;
+#if HEIGHT_REDUCE_AVX2
+		for (; i + 32 <= count; i += 32)
+		{
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+			__m256i* pMin = reinterpret_cast<__m256i*>(colMin + i);
+			__m256i* pMax = reinterpret_cast<__m256i*>(colMax + i);
+			_mm256_storeu_si256(pMin, _mm256_min_epu8(_mm256_loadu_si256(pMin), v));
+			_mm256_storeu_si256(pMax, _mm256_max_epu8(_mm256_loadu_si256(pMax), v));
+		}
+#elif HEIGHT_REDUCE_SSE2
+		for (; i + 16 <= count; i += 16)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+			__m128i* pMin = reinterpret_cast<__m128i*>(colMin + i);
+			__m128i* pMax = reinterpret_cast<__m128i*>(colMax + i);
+			_mm_storeu_si128(pMin, _mm_min_epu8(_mm_loadu_si128(pMin), v));
+			_mm_storeu_si128(pMax, _mm_max_epu8(_mm_loadu_si128(pMax), v));
+		}
+#endif
+		AccumulateRowScalar(row, i, count, colMin, colMax);
+	}
+
+	void AccumulateRow(const uint16_t* row, const size_t count, uint16_t* colMin, uint16_t* colMax)
+	{
+		size_t i = 0;
+#if HEIGHT_REDUCE_AVX2
+		for (; i + 16 <= count; i += 16)
+		{
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+			__m256i* pMin = reinterpret_cast<__m256i*>(colMin + i);
+			__m256i* pMax = reinterpret_cast<__m256i*>(colMax + i);
+			_mm256_storeu_si256(pMin, _mm256_min_epu16(_mm256_loadu_si256(pMin), v));
+			_mm256_storeu_si256(pMax, _mm256_max_epu16(_mm256_loadu_si256(pMax), v));
+		}
+#elif HEIGHT_REDUCE_SSE2
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+			__m128i* pMin = reinterpret_cast<__m128i*>(colMin + i);
+			__m128i* pMax = reinterpret_cast<__m128i*>(colMax + i);
+			_mm_storeu_si128(pMin, MinU16(_mm_loadu_si128(pMin), v));
+			_mm_storeu_si128(pMax, MaxU16(_mm_loadu_si128(pMax), v));
+		}
+#endif
+		AccumulateRowScalar(row, i, count, colMin, colMax);
+	}
+
+	void AccumulateRow(const float* row, const size_t count, float* colMin, float* colMax)
+	{
+		size_t i = 0;
+#if HEIGHT_REDUCE_AVX2
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m256 v = _mm256_loadu_ps(row + i);
+			_mm256_storeu_ps(colMin + i, _mm256_min_ps(_mm256_loadu_ps(colMin + i), v));
+			_mm256_storeu_ps(colMax + i, _mm256_max_ps(_mm256_loadu_ps(colMax + i), v));
+		}
+#elif HEIGHT_REDUCE_SSE2
+		for (; i + 4 <= count; i += 4)
+		{
+			const __m128 v = _mm_loadu_ps(row + i);
+			_mm_storeu_ps(colMin + i, _mm_min_ps(_mm_loadu_ps(colMin + i), v));
+			_mm_storeu_ps(colMax + i, _mm_max_ps(_mm_loadu_ps(colMax + i), v));
+		}
+#endif
+		AccumulateRowScalar(row, i, count, colMin, colMax);
+	}
+
+	void MinMax(const uint8_t* row, const size_t count, uint8_t& outMin, uint8_t& outMax)
+	{
+		MinMax(row, row, count, outMin, outMax);
+	}
+
+	void MinMax(const uint16_t* row, const size_t count, uint16_t& outMin, uint16_t& outMax)
+	{
+		MinMax(row, row, count, outMin, outMax);
+	}
+
+	void MinMax(const float* row, const size_t count, float& outMin, float& outMax)
+	{
+		MinMax(row, row, count, outMin, outMax);
+	}
+
+	void MinMax(const uint8_t* rowMin, const uint8_t* rowMax, const size_t count, uint8_t& outMin, uint8_t& outMax)
+	{
+		outMin = UINT8_MAX;
+		outMax = 0;
+
+		size_t i = 0;
+#if HEIGHT_REDUCE_AVX2
+		if (count >= 32)
+		{
+			__m256i vMin = _mm256_set1_epi8(static_cast<char>(UINT8_MAX));
+			__m256i vMax = _mm256_setzero_si256();
+			for (; i + 32 <= count; i += 32)
+			{
+				vMin = _mm256_min_epu8(vMin, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rowMin + i)));
+				vMax = _mm256_max_epu8(vMax, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rowMax + i)));
+			}
+			ReduceLanes(vMin, vMax, outMin, outMax);
+		}
+#elif HEIGHT_REDUCE_SSE2
+		if (count >= 16)
+		{
+			__m128i vMin = _mm_set1_epi8(static_cast<char>(UINT8_MAX));
+			__m128i vMax = _mm_setzero_si128();
+			for (; i + 16 <= count; i += 16)
+			{
+				vMin = _mm_min_epu8(vMin, _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowMin + i)));
+				vMax = _mm_max_epu8(vMax, _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowMax + i)));
+			}
+			ReduceLanes(vMin, vMax, outMin, outMax);
+		}
+#endif
+		MinMaxScalar(rowMin, rowMax, i, count, outMin, outMax);
+	}
+
+	void MinMax(const uint16_t* rowMin, const uint16_t* rowMax, const size_t count, uint16_t& outMin, uint16_t& outMax)
+	{
+		outMin = UINT16_MAX;
+		outMax = 0;
+
+		size_t i = 0;
+#if HEIGHT_REDUCE_AVX2
+		if (count >= 16)
+		{
+			__m256i vMin = _mm256_set1_epi16(static_cast<short>(UINT16_MAX));
+			__m256i vMax = _mm256_setzero_si256();
+			for (; i + 16 <= count; i += 16)
+			{
+				vMin = _mm256_min_epu16(vMin, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rowMin + i)));
+				vMax = _mm256_max_epu16(vMax, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rowMax + i)));
+			}
+			ReduceLanes(vMin, vMax, outMin, outMax);
+		}
+#elif HEIGHT_REDUCE_SSE2
+		if (count >= 8)
+		{
+			__m128i vMin = _mm_set1_epi16(static_cast<short>(UINT16_MAX));
+			__m128i vMax = _mm_setzero_si128();
+			for (; i + 8 <= count; i += 8)
+			{
+				vMin = MinU16(vMin, _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowMin + i)));
+				vMax = MaxU16(vMax, _mm_loadu_si128(reinterpret_cast<const __m128i*>(rowMax + i)));
+			}
+			ReduceLanes(vMin, vMax, outMin, outMax);
+		}
+#endif
+		MinMaxScalar(rowMin, rowMax, i, count, outMin, outMax);
+	}
+
+	void MinMax(const float* rowMin, const float* rowMax, const size_t count, float& outMin, float& outMax)
+	{
+		outMin = std::numeric_limits<float>::max();
+		outMax = std::numeric_limits<float>::lowest();
+
+		size_t i = 0;
+#if HEIGHT_REDUCE_AVX2
+		if (count >= 8)
+		{
+			__m256 vMin = _mm256_set1_ps(outMin);
+			__m256 vMax = _mm256_set1_ps(outMax);
+			for (; i + 8 <= count; i += 8)
+			{
+				vMin = _mm256_min_ps(vMin, _mm256_loadu_ps(rowMin + i));
+				vMax = _mm256_max_ps(vMax, _mm256_loadu_ps(rowMax + i));
+			}
+			ReduceLanes(vMin, vMax, outMin, outMax);
+		}
+#elif HEIGHT_REDUCE_SSE2
+		if (count >= 4)
+		{
+			__m128 vMin = _mm_set1_ps(outMin);
+			__m128 vMax = _mm_set1_ps(outMax);
+			for (; i + 4 <= count; i += 4)
+			{
+				vMin = _mm_min_ps(vMin, _mm_loadu_ps(rowMin + i));
+				vMax = _mm_max_ps(vMax, _mm_loadu_ps(rowMax + i));
+			}
+			ReduceLanes(vMin, vMax, outMin, outMax);
+		}
+#endif
+		MinMaxScalar(rowMin, rowMax, i, count, outMin, outMax);
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Min/max reduction kernels over heightmap rows, used to build the quadtree height bounds.
+// AVX2 or SSE2 is picked at compile time depending on the target, other targets use the scalar loops.
+namespace HeightReduce
+{
+	// colMin[i] = min(colMin[i], row[i]) and colMax[i] = max(colMax[i], row[i]) for i in [0, count)
+	void AccumulateRow(const uint8_t* row, size_t count, uint8_t* colMin, uint8_t* colMax);
+	void AccumulateRow(const uint16_t* row, size_t count, uint16_t* colMin, uint16_t* colMax);
+	void AccumulateRow(const float* row, size_t count, float* colMin, float* colMax);
+
+	// Reduces a row to a single min/max pair
+	void MinMax(const uint8_t* row, size_t count, uint8_t& outMin, uint8_t& outMax);
+	void MinMax(const uint16_t* row, size_t count, uint16_t& outMin, uint16_t& outMax);
+	void MinMax(const float* row, size_t count, float& outMin, float& outMax);
+
+	// Reduces rows of accumulated minimums and maximums to a single min/max pair
+	void MinMax(const uint8_t* rowMin, const uint8_t* rowMax, size_t count, uint8_t& outMin, uint8_t& outMax);
+	void MinMax(const uint16_t* rowMin, const uint16_t* rowMax, size_t count, uint16_t& outMin, uint16_t& outMax);
+	void MinMax(const float* rowMin, const float* rowMax, size_t count, float& outMin, float& outMax);
+}
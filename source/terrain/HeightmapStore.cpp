@@ -0,0 +1,86 @@
+#include "HeightmapStore.h"
+#include "MappedFile.h"
+
+#include <cmath>
+#include <cstring>
+
+float HalfToFloat(const uint16_t half)
+{
+	const uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+	const uint32_t exponent = (half >> 10) & 0x1fu;
+	const uint32_t mantissa = half & 0x3ffu;
+
+	if (exponent == 0)
+	{
+		// Zero and subnormals
+		const float magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+		return sign ? -magnitude : magnitude;
+	}
+
+	const uint32_t bits = exponent == 0x1fu
+		? sign | 0x7f800000u | (mantissa << 13)
+		: sign | ((exponent + 112u) << 23) | (mantissa << 13);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+uint16_t FloatToHalf(const float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	const uint32_t sign = (bits >> 16) & 0x8000u;
+	const uint32_t magnitude = bits & 0x7fffffffu;
+
+	// Infinities and NaNs, then values rounding past the largest half
+	if (magnitude >= 0x7f800000u)
+		return static_cast<uint16_t>(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x200u : 0u));
+	if (magnitude >= 0x477ff000u)
+		return static_cast<uint16_t>(sign | 0x7c00u);
+
+	// Below the smallest normal half the value is a multiple of 2^-24
+	if (magnitude < 0x38800000u)
+	{
+		float absValue;
+		memcpy(&absValue, &magnitude, sizeof(absValue));
+		return static_cast<uint16_t>(sign | static_cast<uint32_t>(std::nearbyint(absValue * 16777216.0f)));
+	}
+
+	const uint32_t rounded = magnitude + 0xfffu + ((magnitude >> 13) & 1u);
+	return static_cast<uint16_t>(sign | ((rounded - 0x38000000u) >> 13));
+}
+
+HeightmapStore::HeightmapStore(const HeightmapView& view, std::shared_ptr<const void> owner)
+	: m_View(view)
+	, m_Owner(std::move(owner))
+{
+}
+
+std::shared_ptr<HeightmapStore> HeightmapStore::CreateCopy(const HeightmapView& view)
+{
+	const size_t dataSize = static_cast<size_t>(view.width) * view.height * GetBytesPerTexel(view.format);
+	if (!view.data || dataSize == 0)
+		return nullptr;
+
+	std::shared_ptr<uint8_t[]> data(new uint8_t[dataSize]);
+	memcpy(data.get(), view.data, dataSize);
+
+	HeightmapView copy = view;
+	copy.data = data.get();
+	return std::make_shared<HeightmapStore>(copy, std::move(data));
+}
+
+std::shared_ptr<HeightmapStore> HeightmapStore::CreateMapped(const std::filesystem::path& path, const uint32_t width, const uint32_t height, const HeightmapFormat format)
+{
+	auto file = std::make_shared<MappedFile>();
+	const size_t dataSize = static_cast<size_t>(width) * height * GetBytesPerTexel(format);
+	if (dataSize == 0 || !file->Open(path) || file->GetSize() < dataSize)
+		return nullptr;
+
+	HeightmapView view;
+	view.data = file->GetData();
+	view.width = width;
+	view.height = height;
+	view.format = format;
+	return std::make_shared<HeightmapStore>(view, std::move(file));
+}
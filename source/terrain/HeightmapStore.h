@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+
+// Height texels are normalized, the height in world units is the sampled value times maxHeight
+enum class HeightmapFormat : uint8_t
+{
+	R8_UNORM,
+	R16_UNORM,
+	R16_FLOAT,
+	R32_FLOAT,
+};
+
+inline uint32_t GetBytesPerTexel(const HeightmapFormat format)
+{
+	switch (format)
+	{
+	case HeightmapFormat::R8_UNORM: return 1;
+	case HeightmapFormat::R16_UNORM: return 2;
+	case HeightmapFormat::R16_FLOAT: return 2;
+	case HeightmapFormat::R32_FLOAT: return 4;
+	}
+	return 0;
+}
+
+// IEEE half conversions for R16_FLOAT texels, round to nearest even
+float HalfToFloat(uint16_t half);
+uint16_t FloatToHalf(float value);
+
+// Heightmap in memory, independent of any texture or device type. Rows are tightly packed
+struct HeightmapView
+{
+	const void* data = nullptr;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	HeightmapFormat format = HeightmapFormat::R8_UNORM;
+};
+
+// Read-only heightmap texels shared by all the quadtrees of a terrain, each tree only reads its own sub-rectangle.
+// The texels are borrowed from an owner kept alive with the store, copied once, or mapped from a raw file
+class HeightmapStore
+{
+public:
+	// owner keeps view.data alive, e.g. the blob a texture was loaded from
+	HeightmapStore(const HeightmapView& view, std::shared_ptr<const void> owner);
+
+	static std::shared_ptr<HeightmapStore> CreateCopy(const HeightmapView& view);
+	// Raw file of width * height tightly packed texels, nullptr if it can't be mapped or is too small
+	static std::shared_ptr<HeightmapStore> CreateMapped(const std::filesystem::path& path, uint32_t width, uint32_t height, HeightmapFormat format);
+
+	const HeightmapView& GetView() const { return m_View; }
+	uint32_t GetWidth() const { return m_View.width; }
+	uint32_t GetHeight() const { return m_View.height; }
+	HeightmapFormat GetFormat() const { return m_View.format; }
+	size_t GetRowPitch() const { return static_cast<size_t>(m_View.width) * GetBytesPerTexel(m_View.format); }
+	size_t GetDataSize() const { return GetRowPitch() * m_View.height; }
+
+	template<typename T>
+	const T* GetRow(const uint32_t row) const { return reinterpret_cast<const T*>(static_cast<const uint8_t*>(m_View.data) + row * GetRowPitch()); }
+
+private:
+	HeightmapView m_View;
+	std::shared_ptr<const void> m_Owner;
+};
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+	Close();
+
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!data)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	m_File = file;
+	m_Mapping = mapping;
+	m_Data = data;
+	m_Size = static_cast<size_t>(size.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data)
+		UnmapViewOfFile(m_Data);
+	if (m_Mapping)
+		CloseHandle(m_Mapping);
+	if (m_File)
+		CloseHandle(m_File);
+
+	m_Data = nullptr;
+	m_Mapping = nullptr;
+	m_File = nullptr;
+	m_Size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+	Close();
+
+	const int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat status;
+	if (fstat(file, &status) != 0 || status.st_size <= 0)
+	{
+		close(file);
+		return false;
+	}
+
+	const size_t size = static_cast<size_t>(status.st_size);
+	void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping keeps its own reference to the file
+	close(file);
+	if (data == MAP_FAILED)
+		return false;
+
+	m_Data = data;
+	m_Size = size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_Data)
+		munmap(const_cast<void*>(m_Data), m_Size);
+
+	m_Data = nullptr;
+	m_Size = 0;
+}
+
+#endif
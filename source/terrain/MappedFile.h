@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+// Whole file mapped read-only into memory. Pages are loaded on first access and shared with the OS file cache
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Fails on missing or empty files
+	bool Open(const std::filesystem::path& path);
+	void Close();
+
+	bool IsOpen() const { return m_Data != nullptr; }
+	const void* GetData() const { return m_Data; }
+	size_t GetSize() const { return m_Size; }
+
+private:
+	const void* m_Data = nullptr;
+	size_t m_Size = 0;
+#ifdef _WIN32
+	void* m_File = nullptr;
+	void* m_Mapping = nullptr;
+#endif
+};
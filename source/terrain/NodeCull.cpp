@@ -0,0 +1,112 @@
+#include "NodeCull.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NODE_CULL_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NODE_CULL_NEON 1
+#include <arm_neon.h>
+#endif
+
+using namespace donut::math;
+
+namespace
+{
+#if NODE_CULL_SSE2
+	__m128 Abs(const __m128 v)
+	{
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+	}
+
+	float MinLane(const __m128 v)
+	{
+		const __m128 m = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(_mm_min_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1))));
+	}
+#elif NODE_CULL_NEON
+	uint32_t MoveMask(const uint32x4_t v)
+	{
+		const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+		return vaddvq_u32(vandq_u32(v, vld1q_u32(laneBits)));
+	}
+#endif
+}
+
+namespace NodeCull
+{
+	uint32_t RangeMask(const Bounds4& bounds, const float3& position, const float radiusSq, float& margin)
+	{
+		const float radius = sqrtf(radiusSq);
+
+		// Distance to the box along an axis is max(min - p, p - max, 0)
+#if NODE_CULL_SSE2
+		const __m128 px = _mm_set1_ps(position.x);
+		const __m128 pz = _mm_set1_ps(position.z);
+		const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(bounds.minX), px), _mm_sub_ps(px, _mm_load_ps(bounds.maxX))), _mm_setzero_ps());
+		const __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(bounds.minZ), pz), _mm_sub_ps(pz, _mm_load_ps(bounds.maxZ))), _mm_setzero_ps());
+		const __m128 distanceSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz));
+		margin = std::min(margin, MinLane(Abs(_mm_sub_ps(_mm_sqrt_ps(distanceSq), _mm_set1_ps(radius)))));
+		return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(distanceSq, _mm_set1_ps(radiusSq))));
+#elif NODE_CULL_NEON
+		const float32x4_t px = vdupq_n_f32(position.x);
+		const float32x4_t pz = vdupq_n_f32(position.z);
+		const float32x4_t dx = vmaxq_f32(vmaxq_f32(vsubq_f32(vld1q_f32(bounds.minX), px), vsubq_f32(px, vld1q_f32(bounds.maxX))), vdupq_n_f32(0.0f));
+		const float32x4_t dz = vmaxq_f32(vmaxq_f32(vsubq_f32(vld1q_f32(bounds.minZ), pz), vsubq_f32(pz, vld1q_f32(bounds.maxZ))), vdupq_n_f32(0.0f));
+		const float32x4_t distanceSq = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dz, dz));
+		margin = std::min(margin, vminvq_f32(vabsq_f32(vsubq_f32(vsqrtq_f32(distanceSq), vdupq_n_f32(radius)))));
+		return MoveMask(vcleq_f32(distanceSq, vdupq_n_f32(radiusSq)));
+#else
+		uint32_t mask = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			const float dx = max(max(bounds.minX[i] - position.x, position.x - bounds.maxX[i]), 0.0f);
+			const float dz = max(max(bounds.minZ[i] - position.z, position.z - bounds.maxZ[i]), 0.0f);
+			const float distanceSq = dx * dx + dz * dz;
+			margin = std::min(margin, fabsf(sqrtf(distanceSq) - radius));
+			if (distanceSq <= radiusSq)
+				mask |= 1u << i;
+		}
+		return mask;
+#endif
+	}
+
+	uint32_t FrustumMask(const Bounds4& bounds, const frustum& frustum, float* planeMargins)
+	{
+		// The plane normal signs are shared by all lanes, so the vertex furthest inside each plane is picked per array
+		uint32_t mask = 0xf;
+		for (int i = 0; i < frustum::PLANES_COUNT && mask != 0; i++)
+		{
+			const plane& p = frustum.planes[i];
+			const float* x = p.normal.x > 0 ? bounds.minX : bounds.maxX;
+			const float* y = p.normal.y > 0 ? bounds.minY : bounds.maxY;
+			const float* z = p.normal.z > 0 ? bounds.minZ : bounds.maxZ;
+#if NODE_CULL_SSE2
+			const __m128 d = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_set1_ps(p.normal.x), _mm_load_ps(x)),
+				_mm_mul_ps(_mm_set1_ps(p.normal.y), _mm_load_ps(y))),
+				_mm_mul_ps(_mm_set1_ps(p.normal.z), _mm_load_ps(z)));
+			planeMargins[i] = std::min(planeMargins[i], MinLane(Abs(_mm_sub_ps(d, _mm_set1_ps(p.distance)))));
+			mask &= ~static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpgt_ps(d, _mm_set1_ps(p.distance))));
+#elif NODE_CULL_NEON
+			const float32x4_t d = vaddq_f32(vaddq_f32(
+				vmulq_f32(vdupq_n_f32(p.normal.x), vld1q_f32(x)),
+				vmulq_f32(vdupq_n_f32(p.normal.y), vld1q_f32(y))),
+				vmulq_f32(vdupq_n_f32(p.normal.z), vld1q_f32(z)));
+			planeMargins[i] = std::min(planeMargins[i], vminvq_f32(vabsq_f32(vsubq_f32(d, vdupq_n_f32(p.distance)))));
+			mask &= ~MoveMask(vcgtq_f32(d, vdupq_n_f32(p.distance)));
+#else
+			for (int lane = 0; lane < 4; lane++)
+			{
+				const float d = p.normal.x * x[lane] + p.normal.y * y[lane] + p.normal.z * z[lane];
+				planeMargins[i] = std::min(planeMargins[i], fabsf(d - p.distance));
+				if (d > p.distance)
+					mask &= ~(1u << lane);
+			}
+#endif
+		}
+		return mask;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <donut/core/math/math.h>
+#include <cstdint>
+
+// Culling kernels testing the four children of a quadtree node together, one child per lane.
+// SSE2 or NEON is picked at compile time depending on the target, other targets use the scalar loops.
+namespace NodeCull
+{
+	// Child bounds in structure of arrays layout, lane i holds child slot i
+	struct Bounds4
+	{
+		alignas(16) float minX[4];
+		alignas(16) float maxX[4];
+		alignas(16) float minY[4];
+		alignas(16) float maxY[4];
+		alignas(16) float minZ[4];
+		alignas(16) float maxZ[4];
+	};
+
+	// Bit i is set if child i is within radius of position on the xz plane, inclusive of the radius.
+	// margin is lowered to the smallest |distance - radius| of the lanes, how far position can move before a lane flips
+	uint32_t RangeMask(const Bounds4& bounds, const donut::math::float3& position, float radiusSq, float& margin);
+
+	// Bit i is set if child i intersects the frustum, same test as frustum::intersectsWith(box3).
+	// planeMargins[p] is lowered to the smallest distance between plane p and the box vertex tested against it
+	uint32_t FrustumMask(const Bounds4& bounds, const donut::math::frustum& frustum, float* planeMargins);
+}
\ No newline at end of file
@@ -0,0 +1,316 @@
+#include "NormalMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#define NORMAL_MAP_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NORMAL_MAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	constexpr float SNORM_SCALE = 127.0f;
+
+	// Heights sampled bilinearly on each side of the texels of a row, as the shader taps were
+	struct Taps
+	{
+		const float* left;
+		const float* right;
+		const float* prev; // the row above, towards -z
+		const float* next;
+	};
+
+	// Normalized heights of a row with the edge texel repeated padding times on each side, row[x + padding] is texel x
+	void LoadRow(const HeightmapStore& heightmap, const uint32_t y, const uint32_t padding, float* row)
+	{
+		const uint32_t width = heightmap.GetWidth();
+		float* texels = row + padding;
+		switch (heightmap.GetFormat())
+		{
+		case HeightmapFormat::R8_UNORM:
+		{
+			const uint8_t* src = heightmap.GetRow<uint8_t>(y);
+			for (uint32_t x = 0; x < width; x++)
+				texels[x] = static_cast<float>(src[x]) / 255.0f;
+			break;
+		}
+		case HeightmapFormat::R16_UNORM:
+		{
+			const uint16_t* src = heightmap.GetRow<uint16_t>(y);
+			for (uint32_t x = 0; x < width; x++)
+				texels[x] = static_cast<float>(src[x]) / 65535.0f;
+			break;
+		}
+		case HeightmapFormat::R16_FLOAT:
+		{
+			const uint16_t* src = heightmap.GetRow<uint16_t>(y);
+			for (uint32_t x = 0; x < width; x++)
+				texels[x] = HalfToFloat(src[x]);
+			break;
+		}
+		case HeightmapFormat::R32_FLOAT:
+			memcpy(texels, heightmap.GetRow<float>(y), width * sizeof(float));
+			break;
+		}
+		std::fill(row, texels, texels[0]);
+		std::fill(texels + width, texels + width + padding, texels[width - 1]);
+	}
+
+	// Blend of two rows, one sample between texel centers a fraction apart
+	void LerpRows(const float* a, const float* b, const float fraction, const uint32_t width, float* row)
+	{
+		for (uint32_t x = 0; x < width; x++)
+			row[x] = lerp(a[x], b[x], fraction);
+	}
+
+	// Texels x to count of a row from the heights sampled on each side of them
+	void EncodeRowScalar(const Taps& taps, const uint32_t begin, const uint32_t count, const float scale, uint8_t* texels)
+	{
+		for (uint32_t x = begin; x < count; x++)
+		{
+			const float gx = (taps.right[x] - taps.left[x]) * scale;
+			const float gz = (taps.next[x] - taps.prev[x]) * scale;
+			const float sum = std::abs(gx) + 1.0f + std::abs(gz);
+			const float px = -gx / sum;
+			const float pz = -gz / sum;
+			texels[x * 2 + 0] = static_cast<uint8_t>(static_cast<int8_t>(std::lrint((px + pz) * SNORM_SCALE)));
+			texels[x * 2 + 1] = static_cast<uint8_t>(static_cast<int8_t>(std::lrint((px - pz) * SNORM_SCALE)));
+		}
+	}
+
+	void EncodeRow(const Taps& taps, const uint32_t width, const float scale, uint8_t* texels)
+	{
+		uint32_t x = 0;
+#if NORMAL_MAP_AVX2
+		const __m256 vScale = _mm256_set1_ps(scale);
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 signBit = _mm256_set1_ps(-0.0f);
+		const __m256 snormScale = _mm256_set1_ps(SNORM_SCALE);
+		const __m256i byteMask = _mm256_set1_epi32(0xff);
+		for (; x + 8 <= width; x += 8)
+		{
+			const __m256 gx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(taps.right + x), _mm256_loadu_ps(taps.left + x)), vScale);
+			const __m256 gz = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(taps.next + x), _mm256_loadu_ps(taps.prev + x)), vScale);
+			const __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_andnot_ps(signBit, gx), one), _mm256_andnot_ps(signBit, gz));
+			const __m256 px = _mm256_div_ps(_mm256_xor_ps(gx, signBit), sum);
+			const __m256 pz = _mm256_div_ps(_mm256_xor_ps(gz, signBit), sum);
+			const __m256i ex = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_add_ps(px, pz), snormScale));
+			const __m256i ey = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_sub_ps(px, pz), snormScale));
+
+			// x in the low byte of each 16 bit texel, packed within each 128 bit lane then both lanes gathered
+			const __m256i packed = _mm256_or_si256(_mm256_and_si256(ex, byteMask), _mm256_slli_epi32(_mm256_and_si256(ey, byteMask), 8));
+			const __m256i texels16 = _mm256_permute4x64_epi64(_mm256_packus_epi32(packed, packed), 0x08);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(texels + x * 2), _mm256_castsi256_si128(texels16));
+		}
+#elif NORMAL_MAP_SSE2
+		const __m128 vScale = _mm_set1_ps(scale);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 signBit = _mm_set1_ps(-0.0f);
+		const __m128 snormScale = _mm_set1_ps(SNORM_SCALE);
+		const __m128i byteMask = _mm_set1_epi32(0xff);
+		for (; x + 4 <= width; x += 4)
+		{
+			const __m128 gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(taps.right + x), _mm_loadu_ps(taps.left + x)), vScale);
+			const __m128 gz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(taps.next + x), _mm_loadu_ps(taps.prev + x)), vScale);
+			const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signBit, gx), one), _mm_andnot_ps(signBit, gz));
+			const __m128 px = _mm_div_ps(_mm_xor_ps(gx, signBit), sum);
+			const __m128 pz = _mm_div_ps(_mm_xor_ps(gz, signBit), sum);
+			const __m128i ex = _mm_cvtps_epi32(_mm_mul_ps(_mm_add_ps(px, pz), snormScale));
+			const __m128i ey = _mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(px, pz), snormScale));
+
+			// SSE2 only packs with signed saturation, the 16 bit texels are written from the 32 bit lanes
+			alignas(16) uint32_t lanes[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm_or_si128(_mm_and_si128(ex, byteMask), _mm_slli_epi32(_mm_and_si128(ey, byteMask), 8)));
+			for (uint32_t i = 0; i < 4; i++)
+			{
+				const uint16_t texel = static_cast<uint16_t>(lanes[i]);
+				memcpy(texels + (x + i) * 2, &texel, sizeof(texel));
+			}
+		}
+#endif
+		EncodeRowScalar(taps, x, width, scale, texels);
+	}
+
+	float3 DecodeTexel(const uint8_t* texel)
+	{
+		const float ex = std::max(static_cast<float>(static_cast<int8_t>(texel[0])) / SNORM_SCALE, -1.0f);
+		const float ey = std::max(static_cast<float>(static_cast<int8_t>(texel[1])) / SNORM_SCALE, -1.0f);
+		return NormalMap::Decode(float2(ex, ey));
+	}
+
+	void EncodeTexel(const float3 normal, uint8_t* texel)
+	{
+		const float2 encoded = NormalMap::Encode(normal);
+		texel[0] = static_cast<uint8_t>(static_cast<int8_t>(std::lrint(encoded.x * SNORM_SCALE)));
+		texel[1] = static_cast<uint8_t>(static_cast<int8_t>(std::lrint(encoded.y * SNORM_SCALE)));
+	}
+
+	float GetTexel(const HeightmapStore& heightmap, const uint32_t x, const uint32_t y)
+	{
+		switch (heightmap.GetFormat())
+		{
+		case HeightmapFormat::R8_UNORM: return static_cast<float>(heightmap.GetRow<uint8_t>(y)[x]) / 255.0f;
+		case HeightmapFormat::R16_UNORM: return static_cast<float>(heightmap.GetRow<uint16_t>(y)[x]) / 65535.0f;
+		case HeightmapFormat::R16_FLOAT: return HalfToFloat(heightmap.GetRow<uint16_t>(y)[x]);
+		case HeightmapFormat::R32_FLOAT: return heightmap.GetRow<float>(y)[x];
+		}
+		return 0.0f;
+	}
+
+	float SampleBilinear(const HeightmapStore& heightmap, const float2 uv)
+	{
+		const float2 size = float2(static_cast<float>(heightmap.GetWidth()), static_cast<float>(heightmap.GetHeight()));
+		const float2 texel = clamp(uv * size - 0.5f, float2(0.0f), size - 1.0f);
+		const uint32_t x0 = static_cast<uint32_t>(texel.x);
+		const uint32_t y0 = static_cast<uint32_t>(texel.y);
+		const uint32_t x1 = std::min(x0 + 1, heightmap.GetWidth() - 1);
+		const uint32_t y1 = std::min(y0 + 1, heightmap.GetHeight() - 1);
+		const float fx = texel.x - static_cast<float>(x0);
+		const float fy = texel.y - static_cast<float>(y0);
+
+		const float h0 = lerp(GetTexel(heightmap, x0, y0), GetTexel(heightmap, x1, y0), fx);
+		const float h1 = lerp(GetTexel(heightmap, x0, y1), GetTexel(heightmap, x1, y1), fx);
+		return lerp(h0, h1, fy);
+	}
+}
+
+namespace NormalMap
+{
+	// Only the upper hemisphere is encoded, the diamond of the octahedral projection is turned to fill the square
+	float2 Encode(const float3 normal)
+	{
+		const float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+		const float px = normal.x / sum;
+		const float pz = normal.z / sum;
+		return float2(px + pz, px - pz);
+	}
+
+	float3 Decode(const float2 encoded)
+	{
+		const float px = (encoded.x + encoded.y) * 0.5f;
+		const float pz = (encoded.x - encoded.y) * 0.5f;
+		return normalize(float3(px, 1.0f - std::abs(px) - std::abs(pz), pz));
+	}
+
+	void BuildRows(const HeightmapStore& heightmap, const uint32_t firstRow, const uint32_t numRows, uint8_t* texels)
+	{
+		const uint32_t width = heightmap.GetWidth();
+		const uint32_t height = heightmap.GetHeight();
+
+		// The taps are UV_OFFSET away, whole texels then the same fraction for every texel away from the clamped edges
+		const float offsetX = UV_OFFSET * static_cast<float>(width);
+		const float offsetZ = UV_OFFSET * static_cast<float>(height);
+		const uint32_t texelsX = static_cast<uint32_t>(offsetX);
+		const uint32_t texelsZ = static_cast<uint32_t>(offsetZ);
+		const float fractionX = offsetX - static_cast<float>(texelsX);
+		const float fractionZ = offsetZ - static_cast<float>(texelsZ);
+		const uint32_t padding = texelsX + 1;
+		const float scale = 0.5f / UV_OFFSET;
+
+		// The row of the texels is padded, the edge texels repeated as the clamped sampler does. The rows of the vertical
+		// taps move down by one row at most from a texel row to the next, the pairs keep the rows they share
+		const size_t paddedWidth = width + 2 * padding;
+		std::vector<float> rows(paddedWidth + static_cast<size_t>(width) * 8);
+		float* cur = rows.data();
+		float* left = cur + paddedWidth;
+		float* right = left + width;
+		float* prev = right + width;
+		float* next = prev + width;
+		const Taps taps = { left, right, prev, next };
+
+		struct RowPair
+		{
+			float* a;
+			float* b;
+			int64_t rowA = -1;
+			int64_t rowB = -1;
+		};
+		RowPair prevRows = { next + width, next + 2 * width };
+		RowPair nextRows = { next + 3 * width, next + 4 * width };
+
+		auto loadRows = [&heightmap, height](RowPair& pair, const int64_t rowA, const int64_t rowB)
+			{
+				const int64_t clampedA = std::clamp<int64_t>(rowA, 0, height - 1);
+				const int64_t clampedB = std::clamp<int64_t>(rowB, 0, height - 1);
+				if (clampedA == pair.rowB)
+				{
+					std::swap(pair.a, pair.b);
+					std::swap(pair.rowA, pair.rowB);
+				}
+				if (clampedA != pair.rowA)
+					LoadRow(heightmap, static_cast<uint32_t>(clampedA), 0, pair.a);
+				if (clampedB != pair.rowB)
+					LoadRow(heightmap, static_cast<uint32_t>(clampedB), 0, pair.b);
+				pair.rowA = clampedA;
+				pair.rowB = clampedB;
+			};
+
+		for (uint32_t y = firstRow; y < firstRow + numRows; y++)
+		{
+			LoadRow(heightmap, y, padding, cur);
+			LerpRows(cur + padding - texelsX - 1, cur + padding - texelsX, 1.0f - fractionX, width, left);
+			LerpRows(cur + padding + texelsX, cur + padding + texelsX + 1, fractionX, width, right);
+
+			loadRows(prevRows, static_cast<int64_t>(y) - texelsZ - 1, static_cast<int64_t>(y) - texelsZ);
+			LerpRows(prevRows.a, prevRows.b, 1.0f - fractionZ, width, prev);
+			loadRows(nextRows, static_cast<int64_t>(y) + texelsZ, static_cast<int64_t>(y) + texelsZ + 1);
+			LerpRows(nextRows.a, nextRows.b, fractionZ, width, next);
+
+			EncodeRow(taps, width, scale, texels + static_cast<size_t>(y - firstRow) * width * BYTES_PER_TEXEL);
+		}
+	}
+
+	Mip Downsample(const Mip& source)
+	{
+		Mip mip;
+		mip.width = std::max(source.width / 2, 1u);
+		mip.height = std::max(source.height / 2, 1u);
+		mip.texels.resize(static_cast<size_t>(mip.width) * mip.height * BYTES_PER_TEXEL);
+
+		const auto sourceTexel = [&source](const uint32_t x, const uint32_t y)
+			{
+				return source.texels.data() + (static_cast<size_t>(std::min(y, source.height - 1)) * source.width + std::min(x, source.width - 1)) * BYTES_PER_TEXEL;
+			};
+
+		for (uint32_t y = 0; y < mip.height; y++)
+		{
+			for (uint32_t x = 0; x < mip.width; x++)
+			{
+				const float3 sum = DecodeTexel(sourceTexel(2 * x, 2 * y)) + DecodeTexel(sourceTexel(2 * x + 1, 2 * y))
+					+ DecodeTexel(sourceTexel(2 * x, 2 * y + 1)) + DecodeTexel(sourceTexel(2 * x + 1, 2 * y + 1));
+				EncodeTexel(sum, mip.texels.data() + (static_cast<size_t>(y) * mip.width + x) * BYTES_PER_TEXEL);
+			}
+		}
+		return mip;
+	}
+
+	std::vector<Mip> Build(const HeightmapStore& heightmap, const uint32_t numMips)
+	{
+		std::vector<Mip> mips;
+		if (numMips == 0 || heightmap.GetDataSize() == 0)
+			return mips;
+
+		mips.reserve(numMips);
+		Mip& mip0 = mips.emplace_back();
+		mip0.width = heightmap.GetWidth();
+		mip0.height = heightmap.GetHeight();
+		mip0.texels.resize(static_cast<size_t>(mip0.width) * mip0.height * BYTES_PER_TEXEL);
+		BuildRows(heightmap, 0, mip0.height, mip0.texels.data());
+
+		while (mips.size() < numMips)
+			mips.push_back(Downsample(mips.back()));
+		return mips;
+	}
+
+	float3 GetReferenceNormal(const HeightmapStore& heightmap, const float2 uv, const float offset)
+	{
+		const float hDx = SampleBilinear(heightmap, uv + float2(offset, 0.0f)) - SampleBilinear(heightmap, uv - float2(offset, 0.0f));
+		const float hDy = SampleBilinear(heightmap, uv + float2(0.0f, offset)) - SampleBilinear(heightmap, uv - float2(0.0f, offset));
+		return normalize(float3(-hDx, 2.0f * offset, -hDy));
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "HeightmapStore.h"
+
+#include <donut/core/math/math.h>
+#include <cstdint>
+#include <vector>
+
+using namespace donut::math;
+
+// Terrain normals precomputed from the heightmap, the pixel shader fetches one texel instead of four heights. A normal is
+// the central difference of the normalized heights sampled UV_OFFSET away, heights in the units of the uv: the four taps
+// of the terrain_ps.hlsl fallback, so the shading doesn't move. Stored hemi-octahedral, up is +y, in RG8_SNORM.
+// The row kernel uses AVX2 or SSE2 depending on the target, as HeightReduce does, and gives the same texels as the scalar loop
+namespace NormalMap
+{
+	constexpr uint32_t BYTES_PER_TEXEL = 2;
+	constexpr float UV_OFFSET = 0.1f; // offset of the shader taps
+
+	// One mip with tightly packed rows
+	struct Mip
+	{
+		std::vector<uint8_t> texels;
+		uint32_t width = 0;
+		uint32_t height = 0;
+	};
+
+	float2 Encode(float3 normal);
+	float3 Decode(float2 encoded);
+
+	// Normals of numRows heightmap rows from firstRow, rows are independent so they can be built in parallel
+	void BuildRows(const HeightmapStore& heightmap, uint32_t firstRow, uint32_t numRows, uint8_t* texels);
+	// Averages the normals of 2x2 texels, the last row and column are repeated on odd sizes
+	Mip Downsample(const Mip& source);
+	// numMips mips from the full heightmap, built on the calling thread
+	std::vector<Mip> Build(const HeightmapStore& heightmap, uint32_t numMips);
+
+	// The finite differences the shader used: heights sampled bilinearly, clamped to the edge, offset away on each axis
+	float3 GetReferenceNormal(const HeightmapStore& heightmap, float2 uv, float offset);
+}
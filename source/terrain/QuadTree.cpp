@@ -1,11 +1,18 @@
 #include "QuadTree.h"
+#include "HeightReduce.h"
+#include "NodeCull.h"
+#include "TerrainInstance.h"
+#include "TileStreamer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
 
 #include <donut/core/log.h>
-#include <donut/core/vfs/VFS.h>
 #include <taskflow/taskflow.hpp>
 
-#include "../editor/ImGuizmo.h"
-#include "donut/engine/View.h"
 
 QuadTree::QuadTree(const float width, const float height, const float worldSize, const float3 location)
 	: m_Location(location)
@@ -16,219 +23,919 @@ QuadTree::QuadTree(const float width, const float height, const float worldSize,
 	InitLodRanges();
 }
 
-void QuadTree::Init(const std::shared_ptr<engine::LoadedTexture>& loadedTexture, tf::Executor& executor)
+QuadTree::~QuadTree()
+{
+	// Tasks still building the bounds reference this tree and its heightmap
+	if (m_BuildFuture.valid())
+		m_BuildFuture.wait();
+}
+
+void QuadTree::Init(std::shared_ptr<const HeightmapStore> heightmap, tf::Executor& executor)
 {
-	const engine::TextureData* textureData = static_cast<engine::TextureData*>(loadedTexture.get());
 	m_NumLods = min(MAX_LODS-1, static_cast<int>(log2(m_Width)));
-	const size_t dataSize = textureData->dataLayout[0][0].dataSize;
-	if (dataSize > 0)
+	if (heightmap && heightmap->GetDataSize() > 0)
 	{
-		m_HeightmapData.width = textureData->width;
-		m_HeightmapData.height = textureData->height;
-		m_HeightmapData.data = malloc(dataSize);
-		m_TexelSize = float2(static_cast<float>(m_HeightmapData.width) / m_WorldSize, static_cast<float>(m_HeightmapData.height) / m_WorldSize);
-
-		memcpy(m_HeightmapData.data, textureData->data->data(), dataSize);
+		m_Heightmap = std::move(heightmap);
+		m_TexelSize = float2(static_cast<float>(m_Heightmap->GetWidth()) / m_WorldSize, static_cast<float>(m_Heightmap->GetHeight()) / m_WorldSize);
 	}
 	else
 	{
-		m_HeightmapData.width = 0;
-		m_HeightmapData.height = 0;
+		m_Heightmap.reset();
 		m_TexelSize = float2(0.0f, 0.0f);
 
 		log::error("Heightmap texture data missing for QuadTree generation");
 	}
 
-	m_RootNode = std::make_unique<Node>(m_Location, float3(m_Width / 2.0f, 0.0, m_Height / 2.0f));
+	Build();
 
-	Split(m_RootNode.get(), 1);
+	if (m_Heightmap)
+		SetHeight(executor);
+}
 
-	/*executor.silent_async([this]()
-		{
-			SetHeight(m_RootNode.get(), 0);
-			m_HeightLoaded = true;
-			log::info("QuadTree nodes height set");
-		});*/
+bool QuadTree::InitBaked(const std::span<const Node> nodes, std::shared_ptr<const void> owner)
+{
+	m_NumLods = min(MAX_LODS-1, static_cast<int>(log2(m_Width)));
+	InitLodExtents();
+	m_BuiltNodes = {};
+
+	if (nodes.size() != GetNumNodes(m_NumLods + 1))
+	{
+		log::error("Baked QuadTree has %zu nodes, %zu expected", nodes.size(), GetNumNodes(m_NumLods + 1));
+		m_Nodes = {};
+		return false;
+	}
+
+	m_Nodes = nodes;
+	m_NodesOwner = std::move(owner);
+	m_HeightLoaded.store(true, std::memory_order_release);
+	return true;
 }
 
-void QuadTree::Print(const Node* node, int level)
+void QuadTree::Print(const uint32_t nodeIndex, int level) const
 {
-	if (node == nullptr)
+	if (nodeIndex >= m_Nodes.size())
 		return;
 	
+	const box3 bounds = GetNodeBounds(nodeIndex);
+	const float3 position = bounds.center();
+	const float3 extents = bounds.diagonal() * 0.5f;
 	log::info("Level: %d", level);
-	log::info("Node Pos: %f, %f %f. Extents: %f, %f %f.", node->m_Position.x, node->m_Position.y, node->m_Position.z, node->m_Extents.x, node->m_Extents.y, node->m_Extents.z);
+	log::info("Node Pos: %f, %f %f. Extents: %f, %f %f.", position.x, position.y, position.z, extents.x, extents.y, extents.z);
 	
 	level++;
 	for (int i = 0; i < 4; i++)
 	{
-		Print(node->m_Children[i], level);
+		Print(GetChildIndex(nodeIndex, i), level);
 	}
 }
 
-void QuadTree::PrintSelected() const
+void QuadTree::PrintSelected(const QuadTreeSelection& selection) const
 {
-	const std::vector<const Node*> nodes = GetSelectedNodes();
 	log::info("Selected Nodes");
-	for (const Node* node : nodes)
+	for (const SelectedNode& selected : selection.m_Nodes)
 	{
-		log::info("Node Pos: %f, %f %f. Extents: %f, %f %f.", node->m_Position.x, node->m_Position.y, node->m_Position.z,
-		          node->m_Extents.x, node->m_Extents.y, node->m_Extents.z);
+		ForEachSelectedInstance(selected, [this](const int lodLevel, const uint32_t x, const uint32_t z)
+			{
+				const box3 bounds = GetNodeBounds(lodLevel, x, z);
+				const float3 position = bounds.center();
+				const float3 extents = bounds.diagonal() * 0.5f;
+				log::info("Node Pos: %f, %f %f. Extents: %f, %f %f.", position.x, position.y, position.z,
+				          extents.x, extents.y, extents.z);
+			});
 	}
 }
 
-bool QuadTree::NodeSelect(const float3 position, const Node* node, const int lodLevel, const dm::frustum& frustum, const float maxHeight)
+namespace
 {
-	if (!node->Intersects(position, m_LodRanges[lodLevel] * m_LodRanges[lodLevel])) // discard nodes out of range
-		return false;
+	// Spreads the lower 16 bits of v to the even bits
+	uint32_t Part1By1(uint32_t v)
+	{
+		v &= 0x0000ffff;
+		v = (v | (v << 8)) & 0x00ff00ff;
+		v = (v | (v << 4)) & 0x0f0f0f0f;
+		v = (v | (v << 2)) & 0x33333333;
+		v = (v | (v << 1)) & 0x55555555;
+		return v;
+	}
 
-	float3 min = node->m_Position - node->m_Extents;
-	float3 max = node->m_Position + node->m_Extents;
-	if (m_HeightLoaded)
+	constexpr uint32_t NOT_FOUND = ~0u;
+
+	// Last of the sorted keys at or below value, NOT_FOUND if there is none. The halving only depends on the
+	// number of keys, the compiler turns the comparison into a conditional move instead of a mispredicted branch
+	uint32_t FindLastAtOrBelow(const std::vector<uint32_t>& keys, const uint32_t value)
 	{
-		min.y *= maxHeight;
-		max.y *= maxHeight;
+		if (keys.empty())
+			return NOT_FOUND;
+
+		const uint32_t* base = keys.data();
+		size_t count = keys.size();
+		while (count > 1)
+		{
+			const size_t half = count / 2;
+			base = base[half] <= value ? base + half : base;
+			count -= half;
+		}
+		return *base <= value ? *base : NOT_FOUND;
 	}
-	else
+
+	// Gathers the even bits of v to the lower 16 bits
+	uint32_t Compact1By1(uint32_t v)
 	{
-		min.y = 0.0f;
-		max.y = position.y;
+		v &= 0x55555555;
+		v = (v | (v >> 1)) & 0x33333333;
+		v = (v | (v >> 2)) & 0x0f0f0f0f;
+		v = (v | (v >> 4)) & 0x00ff00ff;
+		v = (v | (v >> 8)) & 0x0000ffff;
+		return v;
 	}
-	box3 cube = box3(min, max);
-	
-	if (!frustum.intersectsWith(cube))
+
+	// Distance the view moved on the xz plane, range tests change by at most as much
+	float GetDisplacement(const float3& position, const float3& previous)
 	{
-		m_DebugDrawData.culledNodes.push_back(node);
-		return true; // Node out of frustum - return true to prevent parent from being selected
+		return length(float2(position.x - previous.x, position.z - previous.z));
 	}
 
-	if (lodLevel == 0) // Add leaf nodes
+	// Largest change of the plane distance of any point of the bounds, per plane. The change is linear in the point,
+	// its extremes are at the two vertices along the change of the normal. Unchanged planes don't change any test
+	PlaneMargins GetPlaneChanges(const box3& bounds, const dm::frustum& frustum, const dm::frustum& previous)
 	{
-		// Add Node
-		m_SelectedNodes.push_back(node);
+		PlaneMargins changes;
+		for (int i = 0; i < dm::frustum::PLANES_COUNT; i++)
+		{
+			const float3 normalChange = frustum.planes[i].normal - previous.planes[i].normal;
+			const float distanceChange = frustum.planes[i].distance - previous.planes[i].distance;
+			const float3 maxVertex = float3(normalChange.x > 0.0f ? bounds.m_maxs.x : bounds.m_mins.x,
+				normalChange.y > 0.0f ? bounds.m_maxs.y : bounds.m_mins.y, normalChange.z > 0.0f ? bounds.m_maxs.z : bounds.m_mins.z);
+			const float3 minVertex = bounds.m_mins + bounds.m_maxs - maxVertex;
+			changes[i] = std::max(std::abs(dot(normalChange, maxVertex) - distanceChange), std::abs(dot(normalChange, minVertex) - distanceChange));
+		}
+		return changes;
+	}
+
+	bool IsWithinMargins(const float rangeMargin, const PlaneMargins& planeMargins, const float displacement, const PlaneMargins& planeChanges, const float tolerance)
+	{
+		if (displacement > 0.0f && !(displacement + tolerance < rangeMargin))
+			return false;
+		for (int i = 0; i < dm::frustum::PLANES_COUNT; i++)
+		{
+			if (planeChanges[i] > 0.0f && !(planeChanges[i] + tolerance < planeMargins[i]))
+				return false;
+		}
 		return true;
 	}
-	else
+
+	// Margins of tests made from the previous view, as far as they still hold from the current one
+	void LowerMargins(float& rangeMargin, PlaneMargins& planeMargins, const float displacement, const PlaneMargins& planeChanges, const float tolerance)
 	{
-		if (!node->Intersects(position, m_LodRanges[lodLevel - 1] * m_LodRanges[lodLevel - 1])) // Add it if only this level is intersecting and not a deeper one
+		if (displacement > 0.0f)
+			rangeMargin -= displacement + tolerance;
+		for (int i = 0; i < dm::frustum::PLANES_COUNT; i++)
 		{
-			// Add Node
-			m_SelectedNodes.push_back(node);
+			if (planeChanges[i] > 0.0f)
+				planeMargins[i] -= planeChanges[i] + tolerance;
 		}
-		else
+	}
+}
+
+uint32_t QuadTree::EncodeMorton(const uint32_t x, const uint32_t z)
+{
+	return Part1By1(x) | (Part1By1(z) << 1);
+}
+
+uint2 QuadTree::DecodeMorton(const uint32_t code)
+{
+	return uint2(Compact1By1(code), Compact1By1(code >> 1));
+}
+
+uint32_t QuadTree::GetNodeIndex(const int lodLevel, const uint32_t x, const uint32_t z) const
+{
+	return static_cast<uint32_t>(GetNumNodes(m_NumLods - lodLevel)) + EncodeMorton(x, z);
+}
+
+box3 QuadTree::GetNodeBounds(const int lodLevel, const uint32_t x, const uint32_t z) const
+{
+	const float2 extents = m_LodExtents[lodLevel];
+	const float2 center = float2(m_Location.x - m_Width * 0.5f, m_Location.z - m_Height * 0.5f) 
+		+ extents * float2(static_cast<float>(2 * x + 1), static_cast<float>(2 * z + 1));
+
+	float minHeight = 0.0f;
+	float maxHeight = 0.0f;
+	if (IsHeightLoaded())
+	{
+		const Node& node = m_Nodes[GetNodeIndex(lodLevel, x, z)];
+		minHeight = static_cast<float>(node.m_MinHeight) / 255.0f;
+		maxHeight = static_cast<float>(node.m_MaxHeight) / 255.0f;
+	}
+
+	return box3(float3(center.x - extents.x, minHeight, center.y - extents.y), float3(center.x + extents.x, maxHeight, center.y + extents.y));
+}
+
+box3 QuadTree::GetNodeBounds(const uint32_t nodeIndex) const
+{
+	int depth = 0;
+	while (GetNumNodes(depth + 1) <= nodeIndex)
+		depth++;
+
+	const uint2 coords = DecodeMorton(nodeIndex - static_cast<uint32_t>(GetNumNodes(depth)));
+	return GetNodeBounds(m_NumLods - depth, coords.x, coords.y);
+}
+
+void QuadTree::NodeSelect(QuadTreeSelection& selection, const float3 position, const dm::frustum& frustum, const float maxHeight, const float lodRangeScale) const
+{
+	QuadTreeSelection* selections[] = { &selection };
+	const SelectionView view = { position, frustum, lodRangeScale };
+	NodeSelect(selections, &view, 1, maxHeight);
+}
+
+void QuadTree::NodeSelect(QuadTreeSelection* const* selections, const SelectionView* views, const int numViews, const float maxHeight) const
+{
+	assert(numViews > 0 && numViews <= MAX_SELECT_VIEWS);
+
+	std::array<SelectStackEntry, MAX_SELECT_STACK_SIZE> stack;
+	int stackSize = 0;
+
+	const bool heightLoaded = IsHeightLoaded();
+	const float heightScale = heightLoaded ? maxHeight : 0.0f;
+	const uint64_t residencyGeneration = m_Streamer ? m_Streamer->GetGeneration() : 0;
+
+	// The root goes through the same kernels as the children, replicated in every lane
+	NodeCull::Bounds4 children;
+	const box3 rootBounds = GetNodeBounds(m_NumLods, 0, 0);
+	for (int i = 0; i < 4; i++)
+	{
+		children.minX[i] = rootBounds.m_mins.x;
+		children.maxX[i] = rootBounds.m_maxs.x;
+		children.minZ[i] = rootBounds.m_mins.z;
+		children.maxZ[i] = rootBounds.m_maxs.z;
+		children.minY[i] = rootBounds.m_mins.y * heightScale;
+		children.maxY[i] = rootBounds.m_maxs.y * heightScale;
+	}
+
+	uint8_t rootMask = 0;
+	for (int v = 0; v < numViews; v++)
+	{
+		const SelectionView& view = views[v];
+
+		// Every test below lowers the margins, without heights the boxes follow the camera and the selection is never kept
+		SelectionCoherence& coherence = selections[v]->m_Coherence;
+		coherence.position = view.position;
+		coherence.frustum = view.frustum;
+		coherence.maxHeight = maxHeight;
+		coherence.lodRangeScale = view.lodRangeScale;
+		coherence.rangeMargin = std::numeric_limits<float>::max();
+		coherence.planeMargins.fill(std::numeric_limits<float>::max());
+		coherence.residencyGeneration = residencyGeneration;
+		coherence.valid = heightLoaded;
+
+		// Without heights the boxes span from 0 to the camera height
+		if (!heightLoaded)
+		{
+			for (int i = 0; i < 4; i++)
+				children.maxY[i] = view.position.y;
+		}
+
+		if (!NodeCull::RangeMask(children, view.position, m_LodRangesSq[m_NumLods] * view.lodRangeScale * view.lodRangeScale, coherence.rangeMargin)) // discard the whole tree if out of range
+			continue;
+
+		if (!NodeCull::FrustumMask(children, view.frustum, coherence.planeMargins.data()))
+		{
+			selections[v]->m_CulledNodes.push_back(ROOT_NODE);
+			continue;
+		}
+
+		rootMask |= static_cast<uint8_t>(1u << v);
+	}
+
+	if (rootMask != 0)
+		stack[stackSize++] = { 0, 0, static_cast<uint8_t>(m_NumLods), rootMask };
+
+	SelectSubtrees(selections, views, maxHeight, stack.data(), stackSize);
+
+	for (int v = 0; v < numViews; v++)
+		SetStitchFlags(*selections[v]);
+}
+
+void QuadTree::SelectSubtrees(QuadTreeSelection* const* selections, const SelectionView* views, const float maxHeight, SelectStackEntry* stack, int stackSize) const
+{
+	const bool heightLoaded = IsHeightLoaded();
+	const float heightScale = heightLoaded ? maxHeight : 0.0f;
+	const int blockLevel = m_NumLods - SELECTION_BLOCK_DEPTH;
+
+	// Entries are popped depth first, the records and culled nodes of a view after a block root belong to its block until the
+	// next entry above the blocks. The tests of an entry lower the margins of its block, or the selection's above the blocks
+	auto getMargins = [blockLevel](QuadTreeSelection& selection, const SelectStackEntry& entry)
+		{
+			if (entry.lodLevel > blockLevel)
+				return std::pair(&selection.m_Coherence.rangeMargin, selection.m_Coherence.planeMargins.data());
+			SelectionBlock& block = selection.m_Blocks.back();
+			return std::pair(&block.m_RangeMargin, block.m_PlaneMargins.data());
+		};
+	auto endRecords = [selections, blockLevel](const SelectStackEntry& entry)
 		{
-			for (int i = 0; i < 4; i++) // Recursive call to check if children intersect 
+			if (entry.lodLevel > blockLevel)
+				return;
+			for (uint32_t mask = entry.viewMask; mask != 0; mask &= mask - 1)
 			{
-				if (!NodeSelect(position, node->m_Children[i], lodLevel - 1, frustum, maxHeight))
-				{
-					// Add Node
-					m_SelectedNodes.push_back(node->m_Children[i]);
-				}
+				QuadTreeSelection& selection = *selections[std::countr_zero(mask)];
+				selection.m_Blocks.back().m_EndNode = static_cast<uint32_t>(selection.m_Nodes.size());
+				selection.m_Blocks.back().m_EndCulled = static_cast<uint32_t>(selection.m_CulledNodes.size());
+			}
+		};
+
+	// Nodes are only pushed once they are known to be in range of their own LOD and inside the frustum,
+	// the four children of a node are then tested together
+	NodeCull::Bounds4 children;
+	while (stackSize > 0)
+	{
+		const SelectStackEntry entry = stack[--stackSize];
+		const uint32_t nodeIndex = GetNodeIndex(entry.lodLevel, entry.x, entry.z);
+
+		if (entry.lodLevel == blockLevel)
+		{
+			for (uint32_t mask = entry.viewMask; mask != 0; mask &= mask - 1)
+			{
+				QuadTreeSelection& selection = *selections[std::countr_zero(mask)];
+				SelectionBlock& block = selection.m_Blocks.emplace_back();
+				block.m_X = entry.x;
+				block.m_Z = entry.z;
+				block.m_LodLevel = entry.lodLevel;
+				block.m_FirstNode = static_cast<uint32_t>(selection.m_Nodes.size());
+				block.m_FirstCulled = static_cast<uint32_t>(selection.m_CulledNodes.size());
+				block.m_RangeMargin = std::numeric_limits<float>::max();
+				block.m_PlaneMargins.fill(std::numeric_limits<float>::max());
+			}
+		}
+
+		if (entry.lodLevel == 0)
+		{
+			for (uint32_t mask = entry.viewMask; mask != 0; mask &= mask - 1)
+			{
+				QuadTreeSelection& selection = *selections[std::countr_zero(mask)];
+				selection.m_Nodes.push_back({ nodeIndex, 0, SelectedNode::WHOLE_NODE });
+				selection.m_NumInstances++;
+			}
+			endRecords(entry);
+			continue;
+		}
+
+		const box3 bounds = GetNodeBounds(entry.lodLevel, entry.x, entry.z);
+
+		// The children sample a finer mip, the node is drawn whole until its pages are resident
+		if (m_Streamer && !m_Streamer->IsResident(m_Streamer->GetMipForLod(entry.lodLevel - 1), float2(bounds.m_mins.x, bounds.m_mins.z), float2(bounds.m_maxs.x, bounds.m_maxs.z)))
+		{
+			for (uint32_t mask = entry.viewMask; mask != 0; mask &= mask - 1)
+			{
+				QuadTreeSelection& selection = *selections[std::countr_zero(mask)];
+				selection.m_Nodes.push_back({ nodeIndex, entry.lodLevel, SelectedNode::WHOLE_NODE });
+				selection.m_NumInstances++;
+			}
+			endRecords(entry);
+			continue;
+		}
+
+		const float3 center = bounds.center();
+		const uint32_t firstChild = GetChildIndex(nodeIndex, Node::BL);
+		for (int i = 0; i < 4; i++)
+		{
+			children.minX[i] = i & 1 ? center.x : bounds.m_mins.x;
+			children.maxX[i] = i & 1 ? bounds.m_maxs.x : center.x;
+			children.minZ[i] = i & 2 ? center.z : bounds.m_mins.z;
+			children.maxZ[i] = i & 2 ? bounds.m_maxs.z : center.z;
+			children.minY[i] = heightLoaded ? static_cast<float>(m_Nodes[firstChild + i].m_MinHeight) / 255.0f * heightScale : 0.0f;
+			children.maxY[i] = heightLoaded ? static_cast<float>(m_Nodes[firstChild + i].m_MaxHeight) / 255.0f * heightScale : 0.0f;
+		}
+
+		std::array<uint8_t, 4> childViewMasks = {};
+		for (uint32_t mask = entry.viewMask; mask != 0; mask &= mask - 1)
+		{
+			const int v = std::countr_zero(mask);
+			const SelectionView& view = views[v];
+			QuadTreeSelection& selection = *selections[v];
+			const auto [rangeMargin, planeMargins] = getMargins(selection, entry);
+
+			if (!heightLoaded)
+			{
+				for (int i = 0; i < 4; i++)
+					children.maxY[i] = view.position.y;
+			}
+
+			// The node is in range of the finer LOD if any of its children is, otherwise it is drawn whole
+			const float rangeScaleSq = view.lodRangeScale * view.lodRangeScale;
+			const uint32_t rangeMask = NodeCull::RangeMask(children, view.position, m_LodRangesSq[entry.lodLevel - 1] * rangeScaleSq, *rangeMargin);
+			if (rangeMask == 0)
+			{
+				selection.m_Nodes.push_back({ nodeIndex, entry.lodLevel, SelectedNode::WHOLE_NODE });
+				selection.m_NumInstances++;
+				continue;
+			}
+
+			const uint32_t frustumMask = NodeCull::FrustumMask(children, view.frustum, planeMargins);
+			for (int i = 0; i < 4; i++)
+			{
+				if (!(frustumMask & (1u << i)))
+					selection.m_CulledNodes.push_back(firstChild + i);
+			}
+
+			// Children out of range of their LOD are drawn as part of this node, the others are refined further.
+			// The record goes in before any record of the children, as the children are only visited after this node
+			const uint8_t childMask = static_cast<uint8_t>(~rangeMask & frustumMask & 0xf);
+			if (childMask != 0)
+			{
+				selection.m_Nodes.push_back({ nodeIndex, entry.lodLevel, childMask });
+				selection.m_NumInstances += std::popcount(childMask);
+			}
+
+			const uint32_t refineMask = rangeMask & frustumMask;
+			for (int i = 0; i < 4; i++)
+			{
+				if (refineMask & (1u << i))
+					childViewMasks[i] |= static_cast<uint8_t>(1u << v);
+			}
+		}
+		endRecords(entry);
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (childViewMasks[i] != 0)
+			{
+				assert(stackSize < MAX_SELECT_STACK_SIZE);
+				stack[stackSize++] = { static_cast<uint16_t>(2 * entry.x + (i & 1)), static_cast<uint16_t>(2 * entry.z + (i >> 1)), static_cast<uint8_t>(entry.lodLevel - 1), childViewMasks[i] };
 			}
 		}
 	}
-	return true;
 }
 
-void QuadTree::DebugDraw(const Node* node) const
+void QuadTree::SetStitchFlags(QuadTreeSelection& selection) const
 {
-	//float height = m_DebugDrawData.view->GetViewOrigin().y * 0.5f;
-	//float3 size = float3(node->m_Extents.x * 2.0f, height, node->m_Extents.z * 2.0f);
-	//float3 position = float3(node->m_Position.x, height, node->m_Position.z);
+	// A drawn node covers the leaves of one range of Morton codes, keyed by its first leaf with the level in the low bits.
+	// Drawn nodes don't overlap, the node drawn over a leaf is the last one starting at or before it
+	std::vector<uint32_t>& drawnNodes = selection.m_DrawnNodes;
+	drawnNodes.clear();
+	for (const SelectedNode& selected : selection.m_Nodes)
+	{
+		ForEachSelectedInstance(selected, [&drawnNodes](const int lodLevel, const uint32_t x, const uint32_t z)
+			{
+				drawnNodes.push_back((EncodeMorton(x, z) << (2 * lodLevel + DRAWN_LEVEL_BITS)) | static_cast<uint32_t>(lodLevel));
+			});
+	}
+	std::sort(drawnNodes.begin(), drawnNodes.end());
+
+	// Edges in the order of TERRAIN_STITCH_MASK
+	static constexpr int edgeOffsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+	selection.m_StitchFlags.clear();
+	for (const SelectedNode& selected : selection.m_Nodes)
+	{
+		ForEachSelectedInstance(selected, [this, &selection, &drawnNodes](const int lodLevel, const uint32_t x, const uint32_t z)
+			{
+				const int64_t levelSize = int64_t(1) << (m_NumLods - lodLevel);
+				uint32_t flags = 0;
 
-	float3 size = node->m_Extents * 2.0f;
-	float3 position = node->m_Position;
+				// A sibling is never coarser, only the two edges on the boundary of the parent are looked up
+				const int edges[2] = { x & 1 ? 1 : 0, z & 1 ? 3 : 2 };
+				for (const int edge : edges)
+				{
+					const int64_t neighbourX = static_cast<int64_t>(x) + edgeOffsets[edge][0];
+					const int64_t neighbourZ = static_cast<int64_t>(z) + edgeOffsets[edge][1];
+					if (neighbourX < 0 || neighbourZ < 0 || neighbourX >= levelSize || neighbourZ >= levelSize)
+						continue;
+
+					// Only a node drawn over the first leaf of the neighbour from a coarser level covers all of it
+					const uint32_t firstLeaf = EncodeMorton(static_cast<uint32_t>(neighbourX), static_cast<uint32_t>(neighbourZ)) << (2 * lodLevel);
+					const uint32_t drawn = FindLastAtOrBelow(drawnNodes, (firstLeaf << DRAWN_LEVEL_BITS) | DRAWN_LEVEL_MASK);
+					const int drawnLevel = static_cast<int>(drawn & DRAWN_LEVEL_MASK);
+					const uint32_t drawnFirstLeaf = drawn >> DRAWN_LEVEL_BITS;
+					if (drawn != NOT_FOUND && drawnLevel > lodLevel && firstLeaf - drawnFirstLeaf < (1u << (2 * drawnLevel)))
+						flags |= PackEdgeStitch(edge, drawnLevel - lodLevel);
+				}
+				selection.m_StitchFlags.push_back(static_cast<uint16_t>(flags));
+			});
+	}
+}
 
-	const float4x4 transform = affineToHomogeneous(scaling(size) * math::translation(position));
-	const float4x4 view = affineToHomogeneous(m_DebugDrawData.view->GetViewMatrix());
-	const float4x4 proj = m_DebugDrawData.view->GetProjectionMatrix(true);
+box3 QuadTree::GetCoherenceBounds(const int lodLevel, const uint32_t x, const uint32_t z, const float maxHeight) const
+{
+	const box3 bounds = GetNodeBounds(lodLevel, x, z);
+	return box3(float3(bounds.m_mins.x, std::min(0.0f, maxHeight), bounds.m_mins.z), float3(bounds.m_maxs.x, std::max(0.0f, maxHeight), bounds.m_maxs.z));
+}
 
-	box3 cube = box3(float3(-0.5f), float3(0.5f)) * homogeneousToAffine(transform);
+bool QuadTree::IsCoherentAboveBlocks(const QuadTreeSelection& selection, const SelectionView& view, const float maxHeight) const
+{
+	const SelectionCoherence& coherence = selection.m_Coherence;
+	if (!coherence.valid || !IsHeightLoaded() || maxHeight != coherence.maxHeight || view.lodRangeScale != coherence.lodRangeScale)
+		return false;
 
-	ImU32 color = m_DebugDrawData.view->GetViewFrustum().intersectsWith(cube) ? IM_COL32(0, 255, 0, 255) : IM_COL32(255, 0, 0, 255);
+	if (m_Streamer && m_Streamer->GetGeneration() != coherence.residencyGeneration)
+		return false;
 
-	ImGuizmo::DrawCubes(view.m_data, proj.m_data, transform.m_data, 1, color);
+	const PlaneMargins planeChanges = GetPlaneChanges(GetCoherenceBounds(m_NumLods, 0, 0, maxHeight), view.frustum, coherence.frustum);
+	return IsWithinMargins(coherence.rangeMargin, coherence.planeMargins, GetDisplacement(view.position, coherence.position), planeChanges, m_WorldSize * COHERENCE_TOLERANCE);
 }
 
-float QuadTree::GetHeightValue(const float2 position) const
+bool QuadTree::IsBlockCoherent(const QuadTreeSelection& selection, const SelectionBlock& block, const SelectionView& view, PlaneMargins& planeChanges) const
 {
-	const uint8_t* byteData = static_cast<const uint8_t*>(m_HeightmapData.data);
+	const SelectionCoherence& coherence = selection.m_Coherence;
+	planeChanges = GetPlaneChanges(GetCoherenceBounds(block.m_LodLevel, block.m_X, block.m_Z, coherence.maxHeight), view.frustum, coherence.frustum);
+	return IsWithinMargins(block.m_RangeMargin, block.m_PlaneMargins, GetDisplacement(view.position, coherence.position), planeChanges, m_WorldSize * COHERENCE_TOLERANCE);
+}
 
-	const int index = static_cast<int>(position.x + position.y * static_cast<float>(m_HeightmapData.width));
+bool QuadTree::IsSelectionCoherent(const QuadTreeSelection& selection, const float3 position, const dm::frustum& frustum, const float maxHeight, const float lodRangeScale) const
+{
+	const SelectionView view = { position, frustum, lodRangeScale };
+	if (!IsCoherentAboveBlocks(selection, view, maxHeight))
+		return false;
 
-	const float heightValue = static_cast<float>(byteData[index]) / 255.0f;
+	PlaneMargins planeChanges;
+	for (const SelectionBlock& block : selection.m_Blocks)
+	{
+		if (!IsBlockCoherent(selection, block, view, planeChanges))
+			return false;
+	}
+	return true;
+}
+
+bool QuadTree::UpdateBlocks(QuadTreeSelection& selection, const SelectionView& view, const float maxHeight) const
+{
+	PlaneMargins planeChanges;
+	size_t numCoherent = 0;
+	while (numCoherent < selection.m_Blocks.size() && IsBlockCoherent(selection, selection.m_Blocks[numCoherent], view, planeChanges))
+		numCoherent++;
+	if (numCoherent == selection.m_Blocks.size())
+		return false;
+
+	SelectionCoherence& coherence = selection.m_Coherence;
+	const float tolerance = m_WorldSize * COHERENCE_TOLERANCE;
+	const float displacement = GetDisplacement(view.position, coherence.position);
+	const size_t numBlocks = selection.m_Blocks.size();
+	const size_t numNodes = selection.m_Nodes.size();
+	const size_t numCulledNodes = selection.m_CulledNodes.size();
+
+	std::vector<SelectedNode>& nodes = selection.m_SplicedNodes;
+	std::vector<uint32_t>& culledNodes = selection.m_SplicedCulledNodes;
+	std::vector<SelectionBlock>& blocks = selection.m_SplicedBlocks;
+	nodes.clear();
+	culledNodes.clear();
+	blocks.clear();
+
+	// The records of the walked blocks are appended past the old ones, then everything is spliced in traversal order
+	size_t nextNode = 0;
+	size_t nextCulled = 0;
+	for (size_t b = 0; b < numBlocks; b++)
+	{
+		SelectionBlock block = selection.m_Blocks[b]; // copied, walking a block appends to the selection
+
+		// Records above the blocks between the previous block and this one
+		nodes.insert(nodes.end(), selection.m_Nodes.begin() + nextNode, selection.m_Nodes.begin() + block.m_FirstNode);
+		culledNodes.insert(culledNodes.end(), selection.m_CulledNodes.begin() + nextCulled, selection.m_CulledNodes.begin() + block.m_FirstCulled);
+		nextNode = block.m_EndNode;
+		nextCulled = block.m_EndCulled;
+
+		if (IsBlockCoherent(selection, block, view, planeChanges))
+		{
+			// Kept margins are lowered by how far the view moved, they then hold from the new view like the walked ones
+			LowerMargins(block.m_RangeMargin, block.m_PlaneMargins, displacement, planeChanges, tolerance);
+		}
+		else
+		{
+			SelectStackEntry stack[MAX_SELECT_STACK_SIZE];
+			stack[0] = { block.m_X, block.m_Z, block.m_LodLevel, 1 };
+			QuadTreeSelection* selections[] = { &selection };
+			SelectSubtrees(selections, &view, maxHeight, stack, 1);
+			block = selection.m_Blocks.back();
+		}
+
+		const uint32_t firstNode = static_cast<uint32_t>(nodes.size());
+		const uint32_t firstCulled = static_cast<uint32_t>(culledNodes.size());
+		nodes.insert(nodes.end(), selection.m_Nodes.begin() + block.m_FirstNode, selection.m_Nodes.begin() + block.m_EndNode);
+		culledNodes.insert(culledNodes.end(), selection.m_CulledNodes.begin() + block.m_FirstCulled, selection.m_CulledNodes.begin() + block.m_EndCulled);
+		block.m_FirstNode = firstNode;
+		block.m_EndNode = static_cast<uint32_t>(nodes.size());
+		block.m_FirstCulled = firstCulled;
+		block.m_EndCulled = static_cast<uint32_t>(culledNodes.size());
+		blocks.push_back(block);
+	}
+	nodes.insert(nodes.end(), selection.m_Nodes.begin() + nextNode, selection.m_Nodes.begin() + numNodes);
+	culledNodes.insert(culledNodes.end(), selection.m_CulledNodes.begin() + nextCulled, selection.m_CulledNodes.begin() + numCulledNodes);
 
-	return heightValue;
+	std::swap(selection.m_Nodes, nodes);
+	std::swap(selection.m_CulledNodes, culledNodes);
+	std::swap(selection.m_Blocks, blocks);
+
+	selection.m_NumInstances = 0;
+	for (const SelectedNode& selected : selection.m_Nodes)
+		selection.m_NumInstances += selected.GetNumInstances();
+
+	const PlaneMargins topPlaneChanges = GetPlaneChanges(GetCoherenceBounds(m_NumLods, 0, 0, maxHeight), view.frustum, coherence.frustum);
+	LowerMargins(coherence.rangeMargin, coherence.planeMargins, displacement, topPlaneChanges, tolerance);
+	coherence.position = view.position;
+	coherence.frustum = view.frustum;
+
+	SetStitchFlags(selection);
+	return true;
 }
 
-float2 QuadTree::GetMinMaxHeightValue(const float2 position, const float width, const float height) const
+bool QuadTree::UpdateSelection(QuadTreeSelection& selection, const float3 position, const dm::frustum& frustum, const float maxHeight, const float lodRangeScale) const
 {
-	float2 minV = position - float2(width / 2, height / 2);
-	minV += float2(m_WorldSize / 2, m_WorldSize / 2);
-	minV *= m_TexelSize;
+	QuadTreeSelection* selections[] = { &selection };
+	const SelectionView view = { position, frustum, lodRangeScale };
+	return UpdateSelections(selections, &view, 1, maxHeight) != 0;
+}
 
-	const float2 maxV = minV + float2(width, height) * m_TexelSize;
+uint32_t QuadTree::UpdateSelections(QuadTreeSelection* const* selections, const SelectionView* views, const int numViews, const float maxHeight) const
+{
+	assert(numViews <= MAX_SELECT_VIEWS);
 
-	const int2 limitX = int2(floor(minV.x), ceil(maxV.x));
-	const int2 limitY = int2(floor(minV.y), ceil(maxV.y));
+	std::array<QuadTreeSelection*, MAX_SELECT_VIEWS> staleSelections;
+	std::array<SelectionView, MAX_SELECT_VIEWS> staleViews;
+	int numStale = 0;
+	uint32_t rebuiltMask = 0;
 
-	float2 minMax = float2(infinity, -infinity);
-	for (int i = limitX.x; i < limitX.y; i++)
+	for (int v = 0; v < numViews; v++)
 	{
-		for (int j = limitY.x; j < limitY.y; j++)
+		const SelectionView& view = views[v];
+		if (IsCoherentAboveBlocks(*selections[v], view, maxHeight))
 		{
-			const float sampledHeight = GetHeightValue(float2(static_cast<float>(i), static_cast<float>(j)));
-			minMax.x = min(minMax.x, sampledHeight);
-			minMax.y = max(minMax.y, sampledHeight);
+			if (UpdateBlocks(*selections[v], view, maxHeight))
+				rebuiltMask |= 1u << v;
+			continue;
 		}
+
+		selections[v]->Clear();
+		staleSelections[numStale] = selections[v];
+		staleViews[numStale] = view;
+		numStale++;
+		rebuiltMask |= 1u << v;
 	}
 
-	minMax.x = (minMax.y - minMax.x) == 0.f ? 0.f : minMax.x;
+	if (numStale > 0)
+		NodeSelect(staleSelections.data(), staleViews.data(), numStale, maxHeight);
 
-	return minMax;
+	return rebuiltMask;
 }
 
-void QuadTree::SetHeight(Node* node, int numSplits)
+int QuadTree::PackInstances(const QuadTreeSelection& selection, TerrainInstanceData* instanceData, const int maxInstances) const
 {
-	const float2 minMax = GetMinMaxHeightValue(float2(node->m_Position.x, node->m_Position.z), node->m_Extents.x * 2.0f, node->m_Extents.z * 2.0f);
+	assert(selection.m_StitchFlags.size() == static_cast<size_t>(selection.m_NumInstances));
 
-	const float extent = (minMax.y - minMax.x) / 2.0f;
+	const int numInstances = min(selection.m_NumInstances, maxInstances);
+	int instanceIndex = 0;
+	for (size_t i = 0; i < selection.m_Nodes.size() && instanceIndex < numInstances; i++)
+	{
+		ForEachSelectedInstance(selection.m_Nodes[i], [this, &selection, instanceData, numInstances, &instanceIndex](const int lodLevel, const uint32_t x, const uint32_t z)
+			{
+				if (instanceIndex >= numInstances)
+					return;
+				instanceData[instanceIndex] = PackTerrainInstance(GetNodeBounds(lodLevel, x, z), lodLevel, selection.m_StitchFlags[instanceIndex]);
+				instanceIndex++;
+			});
+	}
+	return instanceIndex;
+}
 
-	node->m_Position.y = minMax.x + extent;
-	node->m_Extents.y = extent;
+void QuadTree::GetTexelFootprint(const float2 worldMin, const float2 worldMax, int2& minTexel, int2& maxTexel) const
+{
+	// terrain_vs samples mip 0.1, a blend of bilinear fetches of mip 0 and mip 1. Texel centers sit at half texel
+	// offsets, a bilinear fetch at t reads texels floor(t) and floor(t) + 1, and mip 1 texel i averages mip 0 texels 2i and 2i + 1
+	const float2 halfWorld = float2(m_WorldSize / 2, m_WorldSize / 2);
+	const float2 minT = (worldMin + halfWorld) * m_TexelSize - float2(0.5f, 0.5f);
+	const float2 maxT = (worldMax + halfWorld) * m_TexelSize - float2(0.5f, 0.5f);
+	const float2 minMip1T = (worldMin + halfWorld) * m_TexelSize * 0.5f - float2(0.5f, 0.5f);
+	const float2 maxMip1T = (worldMax + halfWorld) * m_TexelSize * 0.5f - float2(0.5f, 0.5f);
+
+	const int width = static_cast<int>(m_Heightmap->GetWidth());
+	const int height = static_cast<int>(m_Heightmap->GetHeight());
+
+	const int2 first = int2(min(static_cast<int>(floor(minT.x)), 2 * static_cast<int>(floor(minMip1T.x))),
+		min(static_cast<int>(floor(minT.y)), 2 * static_cast<int>(floor(minMip1T.y))));
+	const int2 last = int2(max(static_cast<int>(floor(maxT.x)) + 1, 2 * static_cast<int>(floor(maxMip1T.x)) + 3),
+		max(static_cast<int>(floor(maxT.y)) + 1, 2 * static_cast<int>(floor(maxMip1T.y)) + 3));
+
+	minTexel = int2(clamp(first.x, 0, width - 1), clamp(first.y, 0, height - 1));
+	maxTexel = int2(clamp(last.x, 0, width - 1), clamp(last.y, 0, height - 1));
+}
 
-	numSplits++;
-	if (numSplits <= m_NumLods)
+namespace
+{
+	// Height texel formats. Texels are reduced as keys ordered like the heights they hold, the reduced keys then go back
+	// to the 8 bit node heights: minimums round down and maximums round up, so the node bounds contain every height
+	// SampleLevel can return whatever the texel precision
+	uint8_t QuantizeMinHeight(const float height)
 	{
-		for (int i = 0; i < 4; i++)
+		return static_cast<uint8_t>(std::floor(static_cast<double>(saturate(height)) * 255.0));
+	}
+
+	uint8_t QuantizeMaxHeight(const float height)
+	{
+		return static_cast<uint8_t>(std::ceil(static_cast<double>(saturate(height)) * 255.0));
+	}
+
+	struct HeightTexelR8
+	{
+		using Texel = uint8_t;
+		using Key = uint8_t;
+		static constexpr bool c_KeyIsTexel = true;
+		static Key ToKey(const Texel texel) { return texel; }
+		static uint8_t ToMinHeight(const Key key) { return key; }
+		static uint8_t ToMaxHeight(const Key key) { return key; }
+	};
+
+	struct HeightTexelR16
+	{
+		using Texel = uint16_t;
+		using Key = uint16_t;
+		static constexpr bool c_KeyIsTexel = true;
+		static Key ToKey(const Texel texel) { return texel; }
+		// 65535 = 255 * 257, exact in integers
+		static uint8_t ToMinHeight(const Key key) { return static_cast<uint8_t>(key / 257u); }
+		static uint8_t ToMaxHeight(const Key key) { return static_cast<uint8_t>((key + 256u) / 257u); }
+	};
+
+	struct HeightTexelR16F
+	{
+		using Texel = uint16_t;
+		using Key = uint16_t;
+		static constexpr bool c_KeyIsTexel = false;
+		// Positive halves order like their bits once the sign bit is set, negative ones are flipped below them
+		static Key ToKey(const Texel texel) { return static_cast<Key>((texel & 0x8000u) ? ~texel : (texel | 0x8000u)); }
+		static Texel FromKey(const Key key) { return static_cast<Texel>((key & 0x8000u) ? (key & 0x7fffu) : ~key); }
+		static uint8_t ToMinHeight(const Key key) { return QuantizeMinHeight(HalfToFloat(FromKey(key))); }
+		static uint8_t ToMaxHeight(const Key key) { return QuantizeMaxHeight(HalfToFloat(FromKey(key))); }
+	};
+
+	struct HeightTexelR32F
+	{
+		using Texel = float;
+		using Key = float;
+		static constexpr bool c_KeyIsTexel = true;
+		static Key ToKey(const Texel texel) { return texel; }
+		static uint8_t ToMinHeight(const Key key) { return QuantizeMinHeight(key); }
+		static uint8_t ToMaxHeight(const Key key) { return QuantizeMaxHeight(key); }
+	};
+}
+
+void QuadTree::SetLeafHeights(const uint32_t beginRow, const uint32_t endRow, const uint32_t beginColumn, const uint32_t endColumn)
+{
+	switch (m_Heightmap->GetFormat())
+	{
+	case HeightmapFormat::R8_UNORM: SetLeafHeights<HeightTexelR8>(beginRow, endRow, beginColumn, endColumn); break;
+	case HeightmapFormat::R16_UNORM: SetLeafHeights<HeightTexelR16>(beginRow, endRow, beginColumn, endColumn); break;
+	case HeightmapFormat::R16_FLOAT: SetLeafHeights<HeightTexelR16F>(beginRow, endRow, beginColumn, endColumn); break;
+	case HeightmapFormat::R32_FLOAT: SetLeafHeights<HeightTexelR32F>(beginRow, endRow, beginColumn, endColumn); break;
+	}
+}
+
+template<typename THeightTexel>
+void QuadTree::SetLeafHeights(const uint32_t beginRow, const uint32_t endRow, const uint32_t beginColumn, const uint32_t endColumn)
+{
+	using Texel = typename THeightTexel::Texel;
+	using Key = typename THeightTexel::Key;
+
+	const uint32_t firstLeaf = static_cast<uint32_t>(GetNumNodes(m_NumLods));
+	const float2 leafSize = m_LodExtents[0] * 2.0f;
+	const float2 origin = float2(m_Location.x - m_Width * 0.5f, m_Location.z - m_Height * 0.5f);
+
+	// Column footprints are the same for every row of leaves
+	std::vector<int2> columns(endColumn - beginColumn);
+	for (uint32_t x = beginColumn; x < endColumn; x++)
+	{
+		int2 minTexel;
+		int2 maxTexel;
+		const float2 leafMin = origin + leafSize * float2(static_cast<float>(x), 0.0f);
+		GetTexelFootprint(leafMin, leafMin + leafSize, minTexel, maxTexel);
+		columns[x - beginColumn] = int2(minTexel.x, maxTexel.x);
+	}
+
+	const int firstColumn = columns.front().x;
+	const size_t numColumns = static_cast<size_t>(columns.back().y - firstColumn + 1);
+	std::vector<Key> colMin(numColumns);
+	std::vector<Key> colMax(numColumns);
+	std::vector<Key> rowKeys(THeightTexel::c_KeyIsTexel ? 0 : numColumns);
+
+	for (uint32_t z = beginRow; z < endRow; z++)
+	{
+		int2 minTexel;
+		int2 maxTexel;
+		const float2 leafMin = origin + leafSize * float2(0.0f, static_cast<float>(z));
+		GetTexelFootprint(leafMin, leafMin + leafSize, minTexel, maxTexel);
+
+		// Vertical pass over the rows under this row of leaves, then a horizontal pass per leaf
+		std::fill(colMin.begin(), colMin.end(), std::numeric_limits<Key>::max());
+		std::fill(colMax.begin(), colMax.end(), std::numeric_limits<Key>::lowest());
+		for (int j = minTexel.y; j <= maxTexel.y; j++)
 		{
-			SetHeight(node->m_Children[i], numSplits);
+			const Texel* row = m_Heightmap->GetRow<Texel>(static_cast<uint32_t>(j)) + firstColumn;
+			if constexpr (THeightTexel::c_KeyIsTexel)
+			{
+				HeightReduce::AccumulateRow(row, numColumns, colMin.data(), colMax.data());
+			}
+			else
+			{
+				for (size_t i = 0; i < numColumns; i++)
+					rowKeys[i] = THeightTexel::ToKey(row[i]);
+				HeightReduce::AccumulateRow(rowKeys.data(), numColumns, colMin.data(), colMax.data());
+			}
+		}
+
+		for (uint32_t x = beginColumn; x < endColumn; x++)
+		{
+			const int2 column = columns[x - beginColumn];
+			const size_t offset = static_cast<size_t>(column.x - firstColumn);
+			const size_t count = static_cast<size_t>(column.y - column.x + 1);
+
+			Key minKey;
+			Key maxKey;
+			HeightReduce::MinMax(colMin.data() + offset, colMax.data() + offset, count, minKey, maxKey);
+
+			Node& node = m_BuiltNodes[firstLeaf + EncodeMorton(x, z)];
+			node.m_MinHeight = THeightTexel::ToMinHeight(minKey);
+			node.m_MaxHeight = THeightTexel::ToMaxHeight(maxKey);
+		}
+	}
+}
+
+void QuadTree::ReduceNode(const uint32_t nodeIndex)
+{
+	const Node* children = &m_BuiltNodes[GetChildIndex(nodeIndex, 0)];
+
+	Node& node = m_BuiltNodes[nodeIndex];
+	node.m_MinHeight = min(min(children[0].m_MinHeight, children[1].m_MinHeight), min(children[2].m_MinHeight, children[3].m_MinHeight));
+	node.m_MaxHeight = max(max(children[0].m_MaxHeight, children[1].m_MaxHeight), max(children[2].m_MaxHeight, children[3].m_MaxHeight));
+}
+
+void QuadTree::ReduceHeights(const int quadrant)
+{
+	// In Morton order the nodes of a top level quadrant are contiguous within every level
+	for (int depth = m_NumLods - 1; depth >= 1; depth--)
+	{
+		const uint32_t numQuadrantNodes = 1u << (2 * (depth - 1));
+		const uint32_t firstNode = static_cast<uint32_t>(GetNumNodes(depth)) + quadrant * numQuadrantNodes;
+
+		for (uint32_t nodeIndex = firstNode; nodeIndex < firstNode + numQuadrantNodes; nodeIndex++)
+		{
+			ReduceNode(nodeIndex);
 		}
 	}
 }
 
-void QuadTree::Split(Node* node, int numSplits)
+void QuadTree::SetHeight(tf::Executor& executor)
 {
-	const float3 extents = node->m_Extents / 2.0f;
-	const float3 position0 = node->m_Position + float3(-extents.x, 0.0f, extents.z);
-	const float3 position1 = node->m_Position + extents;
-	const float3 position2 = node->m_Position - extents;
-	const float3 position3 = node->m_Position - float3(-extents.x, 0.0f, extents.z);
+	constexpr uint32_t leafRowsPerTask = 64;
+
+	m_BuildTaskflow = std::make_unique<tf::Taskflow>("QuadTree Height");
 
-	node->m_Children[Node::TL] = new Node(position0, extents);
-	node->m_Children[Node::TR] = new Node(position1, extents);
-	node->m_Children[Node::BL] = new Node(position2, extents);
-	node->m_Children[Node::BR] = new Node(position3, extents);
+	tf::Task rootTask = m_BuildTaskflow->emplace([this]()
+		{
+			if (m_NumLods == 0)
+				SetLeafHeights(0, 1, 0, 1);
+			else
+				ReduceNode(ROOT_NODE);
 
-	numSplits++;
+			m_HeightLoaded.store(true, std::memory_order_release);
+			log::info("QuadTree nodes height set");
+		}).name("Root");
 
-	if (numSplits <= m_NumLods)
+	if (m_NumLods > 0)
 	{
-		for (int i = 0; i < 4; i++)
+		const uint32_t quadrantSize = 1u << (m_NumLods - 1);
+		for (int quadrant = 0; quadrant < 4; quadrant++)
 		{
-			Split(node->m_Children[i], numSplits);
+			const uint32_t beginColumn = (quadrant & 1) * quadrantSize;
+			const uint32_t beginRow = (quadrant >> 1) * quadrantSize;
+
+			tf::Task reduceTask = m_BuildTaskflow->emplace([this, quadrant]() { ReduceHeights(quadrant); }).name("Reduce");
+			reduceTask.precede(rootTask);
+
+			for (uint32_t row = beginRow; row < beginRow + quadrantSize; row += leafRowsPerTask)
+			{
+				const uint32_t endRow = min(row + leafRowsPerTask, beginRow + quadrantSize);
+				tf::Task leafTask = m_BuildTaskflow->emplace([this, row, endRow, beginColumn, quadrantSize]()
+					{
+						SetLeafHeights(row, endRow, beginColumn, beginColumn + quadrantSize);
+					}).name("Leaves");
+				leafTask.precede(reduceTask);
+			}
 		}
 	}
+
+	m_BuildFuture = executor.run(*m_BuildTaskflow);
+}
+
+void QuadTree::InitLodExtents()
+{
+	for (int i = 0; i <= m_NumLods; i++)
+	{
+		const float scale = 1.0f / static_cast<float>(1 << (m_NumLods - i));
+		m_LodExtents[i] = float2(m_Width / 2.0f, m_Height / 2.0f) * scale;
+	}
+}
+
+void QuadTree::Build()
+{
+	InitLodExtents();
+
+	m_BuiltNodes.clear();
+	m_BuiltNodes.resize(GetNumNodes(m_NumLods + 1));
+	m_Nodes = m_BuiltNodes;
 }
 
 void QuadTree::InitLodRanges()
@@ -237,6 +944,7 @@ void QuadTree::InitLodRanges()
 	for (int i = 0; i < MAX_LODS; i++)
 	{
 		m_LodRanges[i] = minLodDistance * pow(2.0f, static_cast<float>(i));
+		m_LodRangesSq[i] = m_LodRanges[i] * m_LodRanges[i];
 	}
 }
 
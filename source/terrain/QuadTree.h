@@ -1,9 +1,15 @@
 #pragma once
 
+#include "HeightmapStore.h"
+
 #include <donut/core/math/math.h>
-#include <donut/engine/TextureCache.h>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <future>
+#include <limits>
 #include <memory>
+#include <span>
 #include <vector>
 
 namespace donut::engine
@@ -14,65 +20,139 @@ namespace donut::engine
 using namespace donut;
 using namespace donut::math;
 
+struct TerrainInstanceData;
+class TileStreamer;
+
 namespace tf
 {
 	class Executor;
+	class Taskflow;
 }
 
+// Nodes only keep their normalized height range, xz bounds are implicit in the node position within the tree
 struct Node
 {
-	Node(const float3 position, const float3 extents) 
-		: m_Position(position)
-		, m_Extents(extents) 
-	{
-		m_Children.fill(nullptr);
-	};
+	uint8_t m_MinHeight = 0;
+	uint8_t m_MaxHeight = 0;
+
+	// Child slots, bit 0 is the x half and bit 1 the z half of the parent
+	static constexpr int BL = 0;
+	static constexpr int BR = 1;
+	static constexpr int TL = 2;
+	static constexpr int TR = 3;
+};
 
-	bool Intersects(const float3 position, const float radius) const
-	{
-		const float3 min = m_Position - m_Extents;
-		const float3 max = m_Position + m_Extents;
-		float3 distance = float3(0.0,0.0, 0.0);
-
-		if (position.x < min.x) distance.x = (position.x - min.x);
-		else if (position.x > max.x) distance.x = (position.x - max.x);
-		/*if (position.y < min.y) distance.y = (position.y - min.y);
-		else if (position.y > max.y) distance.y = (position.y - max.y);*/
-		if (position.z < min.z) distance.z = (position.z - min.z);
-		else if (position.z > max.z) distance.z = (position.z - max.z);
-
-		return dot(distance, distance) <= radius;
-	};
+// Compact selection record, covers either a whole node or some of its children drawn one LOD level below
+struct SelectedNode
+{
+	uint32_t m_NodeIndex;
+	uint8_t m_LodLevel;
+	uint8_t m_ChildMask; // WHOLE_NODE or bit i set for each child i drawn at m_LodLevel - 1
+
+	static constexpr uint8_t WHOLE_NODE = 0;
 
-	float3 m_Position;
-	float3 m_Extents;
-	std::array<Node*, 4> m_Children;
+	int GetNumInstances() const { return m_ChildMask == WHOLE_NODE ? 1 : std::popcount(m_ChildMask); }
+};
+
+using PlaneMargins = std::array<float, dm::frustum::PLANES_COUNT>;
 
-	static constexpr int TL = 0;
-	static constexpr int TR = 1;
-	static constexpr int BL = 2;
-	static constexpr int BR = 3;
+// Inputs of a traversal and how far they can change before any of its range or frustum tests flips.
+// The margins cover the tests above the selection blocks, each block keeps the margins of its own tests
+struct SelectionCoherence
+{
+	float3 position;
+	dm::frustum frustum;
+	float maxHeight = 0.0f;
+	float lodRangeScale = 1.0f;
+	float rangeMargin = 0.0f;
+	PlaneMargins planeMargins = {};
+	uint64_t residencyGeneration = 0; // pages of the streamer the selection was made with
+	bool valid = false;
 };
 
-struct HeightmapData
+// Subtree of a selection rooted SELECTION_BLOCK_DEPTH levels below the tree root. The traversal is depth first, its records
+// and culled nodes are contiguous ranges of the selection. It is walked again on its own once the camera moves past its margins
+struct SelectionBlock
 {
-	void* data;
-	uint32_t width;
-	uint32_t height;
+	uint16_t m_X;
+	uint16_t m_Z;
+	uint8_t m_LodLevel;
+	uint32_t m_FirstNode;
+	uint32_t m_EndNode;
+	uint32_t m_FirstCulled;
+	uint32_t m_EndCulled;
+	float m_RangeMargin;
+	PlaneMargins m_PlaneMargins;
+};
+
+// Selection of one view over a quadtree, kept by the caller so every view can be updated on its own
+struct QuadTreeSelection
+{
+	std::vector<SelectedNode> m_Nodes;
+	std::vector<uint32_t> m_CulledNodes;
+	std::vector<uint16_t> m_StitchFlags; // instance flags of every drawn node, in ForEachSelectedInstance order
+	std::vector<uint32_t> m_DrawnNodes; // leaf ranges of the drawn nodes for the stitch flags, kept to reuse its storage
+	int m_NumInstances = 0;
+	SelectionCoherence m_Coherence;
+	std::vector<SelectionBlock> m_Blocks; // in traversal order
+
+	// The kept and walked again blocks are spliced into these, then swapped with the selection, kept to reuse their storage
+	std::vector<SelectedNode> m_SplicedNodes;
+	std::vector<uint32_t> m_SplicedCulledNodes;
+	std::vector<SelectionBlock> m_SplicedBlocks;
+
+	void Clear() { m_Nodes.clear(); m_CulledNodes.clear(); m_Blocks.clear(); m_StitchFlags.clear(); m_DrawnNodes.clear(); m_NumInstances = 0; m_Coherence.valid = false; }
+};
+
+// Inputs of one view of a batched traversal
+struct SelectionView
+{
+	float3 position;
+	dm::frustum frustum;
+	float lodRangeScale = 1.0f;
 };
 
 class QuadTree
 {
 public:
 	static constexpr int MAX_LODS = 12;
-private:
-
-	bool m_HeightLoaded = false;
+	static constexpr uint32_t ROOT_NODE = 0;
+	static constexpr int MAX_SELECT_STACK_SIZE = 3 * MAX_LODS + 1; // depth first, each pop pushes at most 4 children
+	static constexpr int MAX_SELECT_VIEWS = 8; // views of a batched traversal, one bit each in the stack entries
+	static constexpr float COHERENCE_TOLERANCE = 1e-5f; // fraction of the world size kept off the selection margins for rounding
+	static constexpr int SELECTION_BLOCK_DEPTH = 2; // levels below the root of the subtrees an incremental update walks again
+
+	// Node of the selection traversal, viewMask has bit v set for the views that refine it
+	struct SelectStackEntry
+	{
+		uint16_t x;
+		uint16_t z;
+		uint8_t lodLevel;
+		uint8_t viewMask;
+	};
 
-	std::unique_ptr<Node> m_RootNode;
-	std::vector<const Node*> m_SelectedNodes;
+private:
+	// Level of a drawn node in the low bits of its leaf range key, the leaf Morton codes in the bits above
+	static constexpr int DRAWN_LEVEL_BITS = 4;
+	static constexpr uint32_t DRAWN_LEVEL_MASK = (1u << DRAWN_LEVEL_BITS) - 1;
+	static_assert(MAX_LODS - 1 <= DRAWN_LEVEL_MASK && 2 * (MAX_LODS - 1) + DRAWN_LEVEL_BITS <= 32, "Leaf range keys are 32 bit");
+
+	// Set once the height bounds task graph completed, node heights must not be read before
+	std::atomic<bool> m_HeightLoaded = false;
+	std::unique_ptr<tf::Taskflow> m_BuildTaskflow;
+	std::future<void> m_BuildFuture;
+
+	// Full tree stored level by level in a single allocation, the children of node i are at 4 * i + 1 + child.
+	// Within a level nodes are in Morton order, x in the even bits and z in the odd bits of the level local index.
+	// m_Nodes views either the nodes built from the heightmap or baked nodes read in place, kept alive by m_NodesOwner
+	std::span<const Node> m_Nodes;
+	std::vector<Node> m_BuiltNodes;
+	std::shared_ptr<const void> m_NodesOwner;
 	std::array<float, MAX_LODS> m_LodRanges;
-	HeightmapData m_HeightmapData;
+	std::array<float, MAX_LODS> m_LodRangesSq;
+	std::array<float2, MAX_LODS> m_LodExtents;
+	std::shared_ptr<const HeightmapStore> m_Heightmap;
+	std::shared_ptr<const TileStreamer> m_Streamer;
 
 	float3 m_Location;
 	int m_NumLods;
@@ -81,47 +161,137 @@ private:
 	float m_WorldSize;
 	float2 m_TexelSize;
 
-	float GetHeightValue(float2 position) const;
-	float2 GetMinMaxHeightValue(float2 position, float width, float height) const;
+	// Texels read by a bilinear fetch anywhere inside the world space rectangle, inclusive and clamped to the heightmap
+	void GetTexelFootprint(float2 worldMin, float2 worldMax, int2& minTexel, int2& maxTexel) const;
 
-	void Split(Node* node, int numSplits = 0);
+	// Fills the leaves in rows [beginRow, endRow) and columns [beginColumn, endColumn) from the heightmap
+	void SetLeafHeights(uint32_t beginRow, uint32_t endRow, uint32_t beginColumn, uint32_t endColumn);
+	// Inner loops for one texel format, THeightTexel is one of the texel formats of QuadTree.cpp
+	template<typename THeightTexel>
+	void SetLeafHeights(uint32_t beginRow, uint32_t endRow, uint32_t beginColumn, uint32_t endColumn);
 
-	void SetHeight(Node* node, int numSplits = 0);
+	// Reduces the inner nodes of a top level quadrant once its leaves are set, the root is reduced separately
+	void ReduceHeights(int quadrant);
+	void ReduceNode(uint32_t nodeIndex);
+
+	void InitLodExtents();
+	void Build();
+
+	// Builds the height bounds as a task graph, one subgraph per top level quadrant. O(N) in the number of nodes
+	void SetHeight(tf::Executor& executor);
 
 	void InitLodRanges();
 
+	// Walks the subtrees of the stack entries depth first, appending their records and blocks to the selections
+	void SelectSubtrees(QuadTreeSelection* const* selections, const SelectionView* views, float maxHeight, SelectStackEntry* stack, int stackSize) const;
+
+	// Bounds of every box the tests of a node's subtree are made with, for the plane changes
+	box3 GetCoherenceBounds(int lodLevel, uint32_t x, uint32_t z, float maxHeight) const;
+	// Inputs and the tests above the blocks are still coherent, the blocks are checked on their own
+	bool IsCoherentAboveBlocks(const QuadTreeSelection& selection, const SelectionView& view, float maxHeight) const;
+	bool IsBlockCoherent(const QuadTreeSelection& selection, const SelectionBlock& block, const SelectionView& view, PlaneMargins& planeChanges) const;
+
+	// Walks the blocks of a selection whose margins the view moved past again and keeps the others, the tests above
+	// the blocks must still be coherent. Returns false if every block was still coherent and nothing changed
+	bool UpdateBlocks(QuadTreeSelection& selection, const SelectionView& view, float maxHeight) const;
+
+	// Flags every drawn edge bordering a coarser drawn node of the same tree, once the selection is complete.
+	// Neighbours in other trees or culled are not known, those edges are left as they are. Culled neighbours aren't drawn,
+	// but each tree is selected on its own: where the next tree draws a coarser node across the tree border the edge
+	// keeps its T-junctions and may crack. Closing that gap needs the selections of the adjacent trees
+	void SetStitchFlags(QuadTreeSelection& selection) const;
+
 public:
 	QuadTree(const float width, const float height,  float worldSize, const float3 location = float3(0.0f, 0.0f, 0.0f));
 
-	~QuadTree()
-	{
-		if (m_HeightmapData.data)
-			free(m_HeightmapData.data);
-	}
+	~QuadTree();
+
+	// Builds the height bounds on the executor, the tree keeps a reference to the shared heightmap
+	void Init(std::shared_ptr<const HeightmapStore> heightmap, tf::Executor& executor);
+	// Uses height bounds baked in the same layout, read in place. Fails if their count doesn't match the tree
+	bool InitBaked(std::span<const Node> nodes, std::shared_ptr<const void> owner);
+	// Nodes are only refined once the pages their children sample are resident, coarser nodes are drawn meanwhile.
+	// Selections made before a page became resident or was evicted are no longer coherent
+	void SetStreamer(std::shared_ptr<const TileStreamer> streamer) { m_Streamer = std::move(streamer); }
+
+	static uint32_t GetChildIndex(const uint32_t nodeIndex, const int child) { return nodeIndex * 4 + 1 + child; }
+
+	// Number of nodes of a complete tree with the given number of levels
+	static size_t GetNumNodes(const int numLevels) { return ((size_t(1) << (2 * numLevels)) - 1) / 3; }
+
+	static uint32_t EncodeMorton(uint32_t x, uint32_t z);
+	static uint2 DecodeMorton(uint32_t code);
 
-	void Init(const std::shared_ptr<engine::LoadedTexture>& loadedTexture, tf::Executor& executor);
+	uint32_t GetNodeIndex(int lodLevel, uint32_t x, uint32_t z) const;
 
-	static void Print(const Node* node, int level);
+	// Bounds in world units for xz, y is the normalized height range of the node
+	box3 GetNodeBounds(int lodLevel, uint32_t x, uint32_t z) const;
+	box3 GetNodeBounds(uint32_t nodeIndex) const;
 
-	void PrintSelected() const;
+	void Print(uint32_t nodeIndex, int level) const;
 
-	bool NodeSelect(const float3 position, const Node* node, int lodLevel, const dm::frustum& frustum, const float maxHeight);
+	void PrintSelected(const QuadTreeSelection& selection) const;
 
-	const std::vector<const Node*> GetSelectedNodes() const { return m_SelectedNodes; }
+	// Non recursive traversal from the root, appends the selection records to the selection.
+	// LOD ranges are measured from position and scaled by lodRangeScale, lower scales select coarser nodes
+	void NodeSelect(QuadTreeSelection& selection, const float3 position, const dm::frustum& frustum, const float maxHeight, const float lodRangeScale = 1.0f) const;
 
-	const std::unique_ptr<Node>& GetRootNode() const { return m_RootNode; }
+	// Selects for several views in a single traversal, selections[v] gets the same records NodeSelect gives for views[v].
+	// A node is visited once for all the views still refining it, its bounds are only computed once.
+	// Both variants also give every drawn node the stitch flags of its edges
+	void NodeSelect(QuadTreeSelection* const* selections, const SelectionView* views, int numViews, const float maxHeight) const;
 
-	void ClearSelectedNodes() { m_SelectedNodes.clear(); }
+	// True if the selection is still the one NodeSelect would produce for these inputs
+	bool IsSelectionCoherent(const QuadTreeSelection& selection, const float3 position, const dm::frustum& frustum, const float maxHeight, const float lodRangeScale = 1.0f) const;
+
+	// Keeps the selection when it is still coherent. Otherwise only the blocks the camera moved past the margins of are
+	// walked again, unless a test above the blocks flipped and the whole tree is selected again. Gives the same records
+	// as NodeSelect. Returns true if any of it was selected again
+	bool UpdateSelection(QuadTreeSelection& selection, const float3 position, const dm::frustum& frustum, const float maxHeight, const float lodRangeScale = 1.0f) const;
+
+	// Batched UpdateSelection, the views whose tests above the blocks are no longer coherent are selected again together.
+	// Returns a mask with bit v set if any of selections[v] was selected again
+	uint32_t UpdateSelections(QuadTreeSelection* const* selections, const SelectionView* views, int numViews, const float maxHeight) const;
+
+	// Writes one instance per node drawn by the selection with its stitch flags, at most maxInstances of them.
+	// instanceData must hold min(selection.m_NumInstances, maxInstances), returns the number written
+	int PackInstances(const QuadTreeSelection& selection, TerrainInstanceData* instanceData, int maxInstances = std::numeric_limits<int>::max()) const;
+
+	// Calls func(lodLevel, x, z) for every node drawn by a selection record
+	template<typename TFunc>
+	void ForEachSelectedInstance(const SelectedNode& selected, TFunc&& func) const
+	{
+		const int depth = m_NumLods - selected.m_LodLevel;
+		const uint2 coords = DecodeMorton(selected.m_NodeIndex - static_cast<uint32_t>(GetNumNodes(depth)));
+
+		if (selected.m_ChildMask == SelectedNode::WHOLE_NODE)
+		{
+			func(static_cast<int>(selected.m_LodLevel), coords.x, coords.y);
+			return;
+		}
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (selected.m_ChildMask & (1 << i))
+				func(selected.m_LodLevel - 1, 2 * coords.x + (i & 1), 2 * coords.y + (i >> 1));
+		}
+	}
+
+	const Node& GetNode(const uint32_t nodeIndex) const { return m_Nodes[nodeIndex]; }
 
 	int GetNumLods() const { return m_NumLods; }
 
+	bool IsHeightLoaded() const { return m_HeightLoaded.load(std::memory_order_acquire); }
+
 	const std::array<float, MAX_LODS>& GetLodRanges() const { return m_LodRanges; }
 
-	void DebugDraw(const Node* node) const;
+	// Half size of the nodes of each level
+	const std::array<float2, MAX_LODS>& GetLodExtents() const { return m_LodExtents; }
 
-	struct DebugDrawData
-	{
-		const engine::IView* view;
-		std::vector<const Node*> culledNodes;
-	} m_DebugDrawData;
+	// xz of the tree min corner, node bounds are offset from it
+	float2 GetTreeMin() const { return float2(m_Location.x - m_Width * 0.5f, m_Location.z - m_Height * 0.5f); }
+
+	std::span<const Node> GetNodes() const { return m_Nodes; }
+
+	void DebugDraw(const engine::IView* debugView, uint32_t nodeIndex) const;
 };
\ No newline at end of file
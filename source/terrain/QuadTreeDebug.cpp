@@ -0,0 +1,27 @@
+#include "QuadTree.h"
+
+#include "../editor/ImGuizmo.h"
+#include "donut/engine/View.h"
+
+// Kept apart from QuadTree.cpp so the tree does not depend on the editor
+
+void QuadTree::DebugDraw(const engine::IView* debugView, const uint32_t nodeIndex) const
+{
+	//float height = debugView->GetViewOrigin().y * 0.5f;
+	//float3 size = float3(node->m_Extents.x * 2.0f, height, node->m_Extents.z * 2.0f);
+	//float3 position = float3(node->m_Position.x, height, node->m_Position.z);
+
+	const box3 bounds = GetNodeBounds(nodeIndex);
+	float3 size = bounds.diagonal();
+	float3 position = bounds.center();
+
+	const float4x4 transform = affineToHomogeneous(scaling(size) * math::translation(position));
+	const float4x4 view = affineToHomogeneous(debugView->GetViewMatrix());
+	const float4x4 proj = debugView->GetProjectionMatrix(true);
+
+	box3 cube = box3(float3(-0.5f), float3(0.5f)) * homogeneousToAffine(transform);
+
+	ImU32 color = debugView->GetViewFrustum().intersectsWith(cube) ? IM_COL32(0, 255, 0, 255) : IM_COL32(255, 0, 0, 255);
+
+	ImGuizmo::DrawCubes(view.m_data, proj.m_data, transform.m_data, 1, color);
+}
@@ -0,0 +1,478 @@
+#include "TerrainBake.h"
+#include "BlockCompress.h"
+#include "NormalMap.h"
+#include "QuadTree.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <donut/core/log.h>
+
+using namespace TerrainBake;
+
+static_assert(sizeof(Node) == 2, "Baked nodes are read in place");
+
+namespace
+{
+	// One mip with tightly packed rows
+	struct Image
+	{
+		std::vector<uint8_t> texels;
+		uint32_t width = 0;
+		uint32_t height = 0;
+	};
+
+	uint64_t AlignSection(const uint64_t offset)
+	{
+		return (offset + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1);
+	}
+
+	uint32_t GetNumMips(const uint32_t width, const uint32_t height)
+	{
+		return std::min(static_cast<uint32_t>(std::bit_width(std::max(width, height))), MAX_MIPS);
+	}
+
+	uint32_t GetNumTiles(const uint32_t size, const uint32_t tileSize)
+	{
+		return (size + tileSize - 1) / tileSize;
+	}
+
+	// 2x2 box filter, the last row and column are repeated on odd sizes
+	template<typename Texel, typename TAverage>
+	Image Downsample(const Image& source, TAverage average)
+	{
+		Image mip;
+		mip.width = std::max(source.width / 2, 1u);
+		mip.height = std::max(source.height / 2, 1u);
+		mip.texels.resize(static_cast<size_t>(mip.width) * mip.height * sizeof(Texel));
+
+		const Texel* src = reinterpret_cast<const Texel*>(source.texels.data());
+		Texel* dst = reinterpret_cast<Texel*>(mip.texels.data());
+		for (uint32_t y = 0; y < mip.height; y++)
+		{
+			const size_t row0 = static_cast<size_t>(std::min(2 * y, source.height - 1)) * source.width;
+			const size_t row1 = static_cast<size_t>(std::min(2 * y + 1, source.height - 1)) * source.width;
+			for (uint32_t x = 0; x < mip.width; x++)
+			{
+				const uint32_t x0 = std::min(2 * x, source.width - 1);
+				const uint32_t x1 = std::min(2 * x + 1, source.width - 1);
+				dst[static_cast<size_t>(y) * mip.width + x] = average(src[row0 + x0], src[row0 + x1], src[row1 + x0], src[row1 + x1]);
+			}
+		}
+		return mip;
+	}
+
+	Image DownsampleHeights(const Image& source, const HeightmapFormat format)
+	{
+		switch (format)
+		{
+		case HeightmapFormat::R8_UNORM:
+			return Downsample<uint8_t>(source, [](const uint32_t a, const uint32_t b, const uint32_t c, const uint32_t d)
+				{
+					return static_cast<uint8_t>((a + b + c + d + 2) / 4);
+				});
+		case HeightmapFormat::R16_UNORM:
+			return Downsample<uint16_t>(source, [](const uint32_t a, const uint32_t b, const uint32_t c, const uint32_t d)
+				{
+					return static_cast<uint16_t>((a + b + c + d + 2) / 4);
+				});
+		case HeightmapFormat::R16_FLOAT:
+			return Downsample<uint16_t>(source, [](const uint16_t a, const uint16_t b, const uint16_t c, const uint16_t d)
+				{
+					return FloatToHalf((HalfToFloat(a) + HalfToFloat(b) + HalfToFloat(c) + HalfToFloat(d)) * 0.25f);
+				});
+		case HeightmapFormat::R32_FLOAT:
+			return Downsample<float>(source, [](const float a, const float b, const float c, const float d)
+				{
+					return (a + b + c + d) * 0.25f;
+				});
+		}
+		return {};
+	}
+
+	float SrgbToLinear(const uint8_t value)
+	{
+		const float c = static_cast<float>(value) / 255.0f;
+		return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	uint8_t LinearToSrgb(const float value)
+	{
+		const float c = std::clamp(value, 0.0f, 1.0f);
+		const float srgb = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+		return static_cast<uint8_t>(srgb * 255.0f + 0.5f);
+	}
+
+	// Color channels are averaged in linear space, alpha as is
+	Image DownsampleAlbedo(const Image& source)
+	{
+		static const std::array<float, 256> srgbToLinear = []()
+			{
+				std::array<float, 256> table;
+				for (int i = 0; i < 256; i++)
+					table[i] = SrgbToLinear(static_cast<uint8_t>(i));
+				return table;
+			}();
+
+		return Downsample<uint32_t>(source, [](const uint32_t a, const uint32_t b, const uint32_t c, const uint32_t d)
+			{
+				uint32_t result = 0;
+				for (uint32_t shift = 0; shift < 24; shift += 8)
+				{
+					const float sum = srgbToLinear[(a >> shift) & 0xff] + srgbToLinear[(b >> shift) & 0xff] + srgbToLinear[(c >> shift) & 0xff] + srgbToLinear[(d >> shift) & 0xff];
+					result |= static_cast<uint32_t>(LinearToSrgb(sum * 0.25f)) << shift;
+				}
+				const uint32_t alpha = ((a >> 24) + (b >> 24) + (c >> 24) + (d >> 24) + 2) / 4;
+				return result | (alpha << 24);
+			});
+	}
+
+	std::vector<Image> BuildMipChain(Image mip0, const uint32_t numMips, Image (*downsample)(const Image&, HeightmapFormat), const HeightmapFormat format)
+	{
+		std::vector<Image> mips;
+		mips.reserve(numMips);
+		mips.push_back(std::move(mip0));
+		while (mips.size() < numMips)
+			mips.push_back(downsample(mips.back(), format));
+		return mips;
+	}
+
+	// Tiles of tileSize squared texels in row major tile order, texels past the edge repeat the edge
+	std::vector<uint8_t> TileImage(const Image& image, const uint32_t tileSize, const uint32_t bytesPerTexel)
+	{
+		const uint32_t numTilesX = GetNumTiles(image.width, tileSize);
+		const uint32_t numTilesY = GetNumTiles(image.height, tileSize);
+		const size_t tileRowSize = static_cast<size_t>(tileSize) * bytesPerTexel;
+		std::vector<uint8_t> tiles(tileRowSize * tileSize * numTilesX * numTilesY);
+
+		uint8_t* dst = tiles.data();
+		for (uint32_t tileY = 0; tileY < numTilesY; tileY++)
+		{
+			for (uint32_t tileX = 0; tileX < numTilesX; tileX++)
+			{
+				for (uint32_t row = 0; row < tileSize; row++)
+				{
+					const uint32_t y = std::min(tileY * tileSize + row, image.height - 1);
+					const uint8_t* src = image.texels.data() + static_cast<size_t>(y) * image.width * bytesPerTexel;
+					for (uint32_t column = 0; column < tileSize; column++)
+					{
+						const uint32_t x = std::min(tileX * tileSize + column, image.width - 1);
+						memcpy(dst, src + static_cast<size_t>(x) * bytesPerTexel, bytesPerTexel);
+						dst += bytesPerTexel;
+					}
+				}
+			}
+		}
+		return tiles;
+	}
+
+	bool WriteSection(std::ofstream& file, uint64_t& position, const uint64_t offset, const void* data, const size_t size)
+	{
+		static const std::array<char, 4096> padding = {};
+		while (position < offset)
+		{
+			const size_t count = static_cast<size_t>(std::min<uint64_t>(offset - position, padding.size()));
+			file.write(padding.data(), static_cast<std::streamsize>(count));
+			position += count;
+		}
+		file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+		position += size;
+		return file.good();
+	}
+}
+
+namespace TerrainBake
+{
+	uint64_t GetSourceStamp(const std::span<const std::filesystem::path> sources)
+	{
+		// FNV-1a over the size and write time of every source
+		uint64_t stamp = 14695981039346656037ull;
+		for (const std::filesystem::path& source : sources)
+		{
+			std::error_code error;
+			const uint64_t size = static_cast<uint64_t>(std::filesystem::file_size(source, error));
+			if (error)
+				return 0;
+			const uint64_t time = static_cast<uint64_t>(std::filesystem::last_write_time(source, error).time_since_epoch().count());
+			if (error)
+				return 0;
+
+			for (const uint64_t value : { size, time })
+				stamp = (stamp ^ value) * 1099511628211ull;
+		}
+		return stamp != 0 ? stamp : 1;
+	}
+
+	uint32_t GetAlbedoBlockSize(const AlbedoFormat format)
+	{
+		return format == AlbedoFormat::BC1_SRGB || format == AlbedoFormat::BC7_SRGB ? BlockCompress::BLOCK_SIZE : 1;
+	}
+
+	size_t GetAlbedoBlockBytes(const AlbedoFormat format)
+	{
+		switch (format)
+		{
+		case AlbedoFormat::RGBA8_SRGB:
+			return 4;
+		case AlbedoFormat::BC1_SRGB:
+			return BlockCompress::GetBlockBytes(BlockCompress::Format::BC1);
+		case AlbedoFormat::BC7_SRGB:
+			return BlockCompress::GetBlockBytes(BlockCompress::Format::BC7);
+		default:
+			return 0;
+		}
+	}
+
+	size_t GetAlbedoDataSize(const AlbedoFormat format, const uint32_t width, const uint32_t height)
+	{
+		const uint32_t blockSize = GetAlbedoBlockSize(format);
+		return static_cast<size_t>((width + blockSize - 1) / blockSize) * ((height + blockSize - 1) / blockSize) * GetAlbedoBlockBytes(format);
+	}
+
+	bool Write(const std::filesystem::path& path, const BakeParameters& params, const HeightmapStore& heightmap,
+		const std::span<const QuadTree* const> quadTrees, const AlbedoView* albedo)
+	{
+		const uint32_t bytesPerTexel = GetBytesPerTexel(heightmap.GetFormat());
+		if (heightmap.GetDataSize() == 0 || bytesPerTexel == 0 || params.tileSize == 0 || quadTrees.empty())
+			return false;
+
+		const size_t numNodesPerTree = quadTrees[0]->GetNodes().size();
+		for (const QuadTree* quadTree : quadTrees)
+		{
+			if (!quadTree->IsHeightLoaded() || quadTree->GetNodes().size() != numNodesPerTree)
+				return false;
+		}
+
+		Image heightMip0;
+		heightMip0.width = heightmap.GetWidth();
+		heightMip0.height = heightmap.GetHeight();
+		heightMip0.texels.assign(heightmap.GetRow<uint8_t>(0), heightmap.GetRow<uint8_t>(0) + heightmap.GetDataSize());
+		const std::vector<Image> heightMips = BuildMipChain(std::move(heightMip0), GetNumMips(heightmap.GetWidth(), heightmap.GetHeight()), DownsampleHeights, heightmap.GetFormat());
+
+		std::vector<Image> normalMips;
+		for (NormalMap::Mip& mip : NormalMap::Build(heightmap, static_cast<uint32_t>(heightMips.size())))
+			normalMips.push_back({ std::move(mip.texels), mip.width, mip.height });
+
+		std::vector<Image> albedoMips;
+		if (albedo && albedo->data && albedo->width > 0 && albedo->height > 0)
+		{
+			Image albedoMip0;
+			albedoMip0.width = albedo->width;
+			albedoMip0.height = albedo->height;
+			const uint8_t* albedoData = static_cast<const uint8_t*>(albedo->data);
+			albedoMip0.texels.assign(albedoData, albedoData + static_cast<size_t>(albedo->width) * albedo->height * 4);
+			albedoMips = BuildMipChain(std::move(albedoMip0), GetNumMips(albedo->width, albedo->height),
+				[](const Image& source, HeightmapFormat) { return DownsampleAlbedo(source); }, HeightmapFormat::R8_UNORM);
+		}
+
+		// The mips are filtered uncompressed, then each is encoded. Block compressed textures need whole blocks at mip 0
+		AlbedoFormat albedoFormat = albedoMips.empty() ? AlbedoFormat::NONE : params.albedoFormat;
+		if (albedoFormat == AlbedoFormat::NONE)
+			albedoMips.clear();
+		const uint32_t albedoBlockSize = GetAlbedoBlockSize(albedoFormat);
+		if (albedoBlockSize > 1 && (albedo->width % albedoBlockSize != 0 || albedo->height % albedoBlockSize != 0))
+		{
+			donut::log::warning("The terrain albedo size isn't a multiple of %u, it is baked uncompressed", albedoBlockSize);
+			albedoFormat = AlbedoFormat::RGBA8_SRGB;
+		}
+		if (albedoFormat == AlbedoFormat::BC1_SRGB || albedoFormat == AlbedoFormat::BC7_SRGB)
+		{
+			const BlockCompress::Format blockFormat = albedoFormat == AlbedoFormat::BC1_SRGB ? BlockCompress::Format::BC1 : BlockCompress::Format::BC7;
+			for (Image& mip : albedoMips)
+				mip.texels = BlockCompress::Encode(blockFormat, mip.texels.data(), mip.width, mip.height);
+		}
+
+		Header header = {};
+		header.magic = MAGIC;
+		header.version = VERSION;
+		header.sourceStamp = params.sourceStamp;
+		header.heightWidth = heightmap.GetWidth();
+		header.heightHeight = heightmap.GetHeight();
+		header.heightFormat = static_cast<uint32_t>(heightmap.GetFormat());
+		header.tileSize = params.tileSize;
+		header.numHeightMips = static_cast<uint32_t>(heightMips.size());
+		header.numNormalMips = static_cast<uint32_t>(normalMips.size());
+		header.worldSize = params.worldSize;
+		header.surfaceSize = params.surfaceSize;
+		header.numTrees = static_cast<uint32_t>(quadTrees.size());
+		header.numNodesPerTree = numNodesPerTree;
+		header.albedoFormat = static_cast<uint32_t>(albedoFormat);
+		header.numAlbedoMips = static_cast<uint32_t>(albedoMips.size());
+
+		// Offsets first, the sections are then written in order
+		const size_t tileDataSize = static_cast<size_t>(params.tileSize) * params.tileSize * bytesPerTexel;
+		uint64_t offset = sizeof(Header);
+		for (uint32_t mip = 0; mip < header.numHeightMips; mip++)
+		{
+			MipDesc& desc = header.heightMips[mip];
+			desc.width = heightMips[mip].width;
+			desc.height = heightMips[mip].height;
+			desc.numTilesX = GetNumTiles(desc.width, params.tileSize);
+			desc.numTilesY = GetNumTiles(desc.height, params.tileSize);
+			desc.size = static_cast<uint64_t>(desc.numTilesX) * desc.numTilesY * tileDataSize;
+			desc.offset = AlignSection(offset);
+			offset = desc.offset + desc.size;
+		}
+
+		const size_t normalTileDataSize = static_cast<size_t>(params.tileSize) * params.tileSize * NormalMap::BYTES_PER_TEXEL;
+		for (uint32_t mip = 0; mip < header.numNormalMips; mip++)
+		{
+			MipDesc& desc = header.normalMips[mip];
+			desc = header.heightMips[mip];
+			desc.size = static_cast<uint64_t>(desc.numTilesX) * desc.numTilesY * normalTileDataSize;
+			desc.offset = AlignSection(offset);
+			offset = desc.offset + desc.size;
+		}
+
+		header.nodesOffset = AlignSection(offset);
+		offset = header.nodesOffset + header.numTrees * header.numNodesPerTree * sizeof(Node);
+
+		for (uint32_t mip = 0; mip < header.numAlbedoMips; mip++)
+		{
+			MipDesc& desc = header.albedoMips[mip];
+			desc.width = albedoMips[mip].width;
+			desc.height = albedoMips[mip].height;
+			desc.size = albedoMips[mip].texels.size();
+			desc.offset = AlignSection(offset);
+			offset = desc.offset + desc.size;
+		}
+
+		std::filesystem::path tempPath = path;
+		tempPath += ".tmp";
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+		{
+			donut::log::warning("Couldn't create %s", tempPath.generic_string().c_str());
+			return false;
+		}
+
+		uint64_t position = 0;
+		bool written = WriteSection(file, position, 0, &header, sizeof(header));
+		for (uint32_t mip = 0; written && mip < header.numHeightMips; mip++)
+		{
+			const std::vector<uint8_t> tiles = TileImage(heightMips[mip], params.tileSize, bytesPerTexel);
+			written = WriteSection(file, position, header.heightMips[mip].offset, tiles.data(), tiles.size());
+		}
+		for (uint32_t mip = 0; written && mip < header.numNormalMips; mip++)
+		{
+			const std::vector<uint8_t> tiles = TileImage(normalMips[mip], params.tileSize, NormalMap::BYTES_PER_TEXEL);
+			written = WriteSection(file, position, header.normalMips[mip].offset, tiles.data(), tiles.size());
+		}
+		for (size_t i = 0; written && i < quadTrees.size(); i++)
+		{
+			const std::span<const Node> nodes = quadTrees[i]->GetNodes();
+			written = WriteSection(file, position, header.nodesOffset + i * numNodesPerTree * sizeof(Node), nodes.data(), nodes.size_bytes());
+		}
+		for (uint32_t mip = 0; written && mip < header.numAlbedoMips; mip++)
+			written = WriteSection(file, position, header.albedoMips[mip].offset, albedoMips[mip].texels.data(), albedoMips[mip].texels.size());
+		file.close();
+
+		std::error_code error;
+		if (!written || file.fail())
+		{
+			std::filesystem::remove(tempPath, error);
+			donut::log::warning("Couldn't write %s", tempPath.generic_string().c_str());
+			return false;
+		}
+
+		std::filesystem::rename(tempPath, path, error);
+		if (error)
+		{
+			std::filesystem::remove(tempPath, error);
+			donut::log::warning("Couldn't replace %s", path.generic_string().c_str());
+			return false;
+		}
+		return true;
+	}
+}
+
+std::shared_ptr<BakedTerrain> BakedTerrain::Open(const std::filesystem::path& path)
+{
+	auto bake = std::make_shared<BakedTerrain>();
+	if (!bake->m_File.Open(path))
+		return nullptr;
+
+	const uint64_t fileSize = bake->m_File.GetSize();
+	const Header* header = static_cast<const Header*>(bake->m_File.GetData());
+	const auto fits = [fileSize](const uint64_t offset, const uint64_t size) { return offset <= fileSize && size <= fileSize - offset; };
+
+	const uint32_t bytesPerTexel = fileSize >= sizeof(Header) ? GetBytesPerTexel(static_cast<HeightmapFormat>(header->heightFormat)) : 0;
+	bool valid = bytesPerTexel != 0 && header->magic == MAGIC && header->version == VERSION
+		&& header->tileSize > 0 && header->tileSize <= 4096
+		&& header->numHeightMips > 0 && header->numHeightMips <= MAX_MIPS && header->numAlbedoMips <= MAX_MIPS
+		&& (header->numNormalMips == 0 || header->numNormalMips == header->numHeightMips)
+		&& header->numTrees > 0 && header->numNodesPerTree <= fileSize
+		&& fits(header->nodesOffset, header->numTrees * header->numNodesPerTree * sizeof(Node));
+
+	const uint64_t tileDataSize = valid ? static_cast<uint64_t>(header->tileSize) * header->tileSize * bytesPerTexel : 0;
+	for (uint32_t mip = 0; valid && mip < header->numHeightMips; mip++)
+	{
+		const MipDesc& desc = header->heightMips[mip];
+		valid = desc.numTilesX == GetNumTiles(desc.width, header->tileSize) && desc.numTilesY == GetNumTiles(desc.height, header->tileSize)
+			&& desc.size == static_cast<uint64_t>(desc.numTilesX) * desc.numTilesY * tileDataSize && fits(desc.offset, desc.size);
+	}
+	const uint64_t normalTileDataSize = valid ? static_cast<uint64_t>(header->tileSize) * header->tileSize * NormalMap::BYTES_PER_TEXEL : 0;
+	for (uint32_t mip = 0; valid && mip < header->numNormalMips; mip++)
+	{
+		const MipDesc& desc = header->normalMips[mip];
+		const MipDesc& heightDesc = header->heightMips[mip];
+		valid = desc.width == heightDesc.width && desc.height == heightDesc.height && desc.numTilesX == heightDesc.numTilesX && desc.numTilesY == heightDesc.numTilesY
+			&& desc.size == static_cast<uint64_t>(desc.numTilesX) * desc.numTilesY * normalTileDataSize && fits(desc.offset, desc.size);
+	}
+
+	const AlbedoFormat albedoFormat = static_cast<AlbedoFormat>(header->albedoFormat);
+	valid = valid && (header->numAlbedoMips == 0 || GetAlbedoBlockBytes(albedoFormat) != 0);
+	for (uint32_t mip = 0; valid && mip < header->numAlbedoMips; mip++)
+	{
+		const MipDesc& desc = header->albedoMips[mip];
+		valid = desc.size == GetAlbedoDataSize(albedoFormat, desc.width, desc.height) && fits(desc.offset, desc.size);
+	}
+
+	if (!valid)
+	{
+		donut::log::warning("Ignoring invalid or outdated terrain bake %s", path.generic_string().c_str());
+		return nullptr;
+	}
+
+	bake->m_Header = header;
+	return bake;
+}
+
+bool BakedTerrain::Matches(const uint64_t sourceStamp, const float worldSize, const float surfaceSize) const
+{
+	return (sourceStamp == 0 || sourceStamp == m_Header->sourceStamp) && worldSize == m_Header->worldSize && surfaceSize == m_Header->surfaceSize;
+}
+
+size_t BakedTerrain::GetTileDataSize() const
+{
+	return static_cast<size_t>(m_Header->tileSize) * m_Header->tileSize * GetBytesPerTexel(GetHeightFormat());
+}
+
+const void* BakedTerrain::GetHeightTile(const uint32_t mip, const uint32_t tileX, const uint32_t tileY) const
+{
+	const MipDesc& desc = m_Header->heightMips[mip];
+	return GetData(desc.offset + (static_cast<uint64_t>(tileY) * desc.numTilesX + tileX) * GetTileDataSize());
+}
+
+const void* BakedTerrain::GetNormalTile(const uint32_t mip, const uint32_t tileX, const uint32_t tileY) const
+{
+	const MipDesc& desc = m_Header->normalMips[mip];
+	const size_t tileDataSize = static_cast<size_t>(m_Header->tileSize) * m_Header->tileSize * NormalMap::BYTES_PER_TEXEL;
+	return GetData(desc.offset + (static_cast<uint64_t>(tileY) * desc.numTilesX + tileX) * tileDataSize);
+}
+
+std::span<const Node> BakedTerrain::GetNodes(const uint32_t treeIndex) const
+{
+	const Node* nodes = reinterpret_cast<const Node*>(GetData(m_Header->nodesOffset));
+	return std::span<const Node>(nodes + treeIndex * m_Header->numNodesPerTree, m_Header->numNodesPerTree);
+}
+
+const void* BakedTerrain::GetAlbedoMip(const uint32_t mip) const
+{
+	return GetData(m_Header->albedoMips[mip].offset);
+}
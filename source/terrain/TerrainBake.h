@@ -0,0 +1,128 @@
+#pragma once
+
+#include "HeightmapStore.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+struct Node;
+class QuadTree;
+
+// Offline baked terrain, memory-mapped and read in place: the heightmap and normal map mip chains split in tiles, the
+// height bounds of every quadtree and the albedo mip chain, block compressed by default. Nothing is decoded or rebuilt at startup
+namespace TerrainBake
+{
+	constexpr uint32_t MAGIC = 0x42525456; // "VTRB"
+	constexpr uint32_t VERSION = 3;
+	constexpr uint32_t MAX_MIPS = 16;
+	constexpr uint64_t SECTION_ALIGNMENT = 4096; // sections start on a page
+
+	enum class AlbedoFormat : uint32_t
+	{
+		NONE,
+		RGBA8_SRGB,
+		BC1_SRGB,
+		BC7_SRGB,
+	};
+
+	struct MipDesc
+	{
+		uint64_t offset; // from the start of the file
+		uint64_t size;
+		uint32_t width;
+		uint32_t height;
+		uint32_t numTilesX; // height mips only
+		uint32_t numTilesY;
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceStamp; // identifies the source files the terrain was baked from
+
+		// Height mips are stored as tiles of tileSize squared texels in row major tile order,
+		// texels past the mip edge repeat the edge texels
+		uint32_t heightWidth;
+		uint32_t heightHeight;
+		uint32_t heightFormat; // HeightmapFormat
+		uint32_t tileSize;
+		uint32_t numHeightMips;
+		uint32_t numNormalMips; // NormalMap texels, tiled as the height mips
+
+		// Quadtrees of surfaceSize laid out row by row over worldSize, as in TerrainPass::Init
+		float worldSize;
+		float surfaceSize;
+		uint32_t numTrees;
+		uint64_t numNodesPerTree;
+		uint64_t nodesOffset;
+
+		uint32_t albedoFormat; // AlbedoFormat
+		uint32_t numAlbedoMips;
+
+		MipDesc heightMips[MAX_MIPS];
+		MipDesc albedoMips[MAX_MIPS]; // rows of texels or blocks are tightly packed
+		MipDesc normalMips[MAX_MIPS];
+	};
+
+	// RGBA8 sRGB texels, rows are tightly packed
+	struct AlbedoView
+	{
+		const void* data = nullptr;
+		uint32_t width = 0;
+		uint32_t height = 0;
+	};
+
+	struct BakeParameters
+	{
+		uint64_t sourceStamp = 0;
+		uint32_t tileSize = 256;
+		float worldSize = 0.0f;
+		float surfaceSize = 0.0f;
+		AlbedoFormat albedoFormat = AlbedoFormat::BC7_SRGB; // block compressed albedos fall back to RGBA8 unless their size is a multiple of 4
+	};
+
+	// Texels on a side of a block, 1 for uncompressed formats
+	uint32_t GetAlbedoBlockSize(AlbedoFormat format);
+	size_t GetAlbedoBlockBytes(AlbedoFormat format);
+	size_t GetAlbedoDataSize(AlbedoFormat format, uint32_t width, uint32_t height);
+
+	// Identifies source files by size and last write time, 0 if one of them is missing
+	uint64_t GetSourceStamp(std::span<const std::filesystem::path> sources);
+
+	// Bakes loaded quadtrees, their heights must be loaded. albedo may be null.
+	// Writes a temporary file renamed once complete, so a partial bake is never opened
+	bool Write(const std::filesystem::path& path, const BakeParameters& params, const HeightmapStore& heightmap,
+		std::span<const QuadTree* const> quadTrees, const AlbedoView* albedo);
+}
+
+// Opened bake, every accessor points into the mapping
+class BakedTerrain
+{
+public:
+	// nullptr if the file is missing, from another version, or its sections don't fit in it
+	static std::shared_ptr<BakedTerrain> Open(const std::filesystem::path& path);
+
+	// The bake is for this quadtree layout and these sources. A zero stamp means the sources are not shipped, any bake is taken
+	bool Matches(uint64_t sourceStamp, float worldSize, float surfaceSize) const;
+
+	const TerrainBake::Header& GetHeader() const { return *m_Header; }
+	HeightmapFormat GetHeightFormat() const { return static_cast<HeightmapFormat>(m_Header->heightFormat); }
+	size_t GetTileDataSize() const;
+
+	const void* GetHeightTile(uint32_t mip, uint32_t tileX, uint32_t tileY) const;
+	bool HasNormals() const { return m_Header->numNormalMips > 0; }
+	const void* GetNormalTile(uint32_t mip, uint32_t tileX, uint32_t tileY) const;
+	std::span<const Node> GetNodes(uint32_t treeIndex) const;
+	TerrainBake::AlbedoFormat GetAlbedoFormat() const { return static_cast<TerrainBake::AlbedoFormat>(m_Header->albedoFormat); }
+	const void* GetAlbedoMip(uint32_t mip) const;
+
+private:
+	MappedFile m_File;
+	const TerrainBake::Header* m_Header = nullptr;
+
+	const uint8_t* GetData(uint64_t offset) const { return static_cast<const uint8_t*>(m_File.GetData()) + offset; }
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+// Grid meshes the terrain nodes are drawn with, one per quality tier from 16 to 128 quads per side. Every size is
+// generated by the same constexpr template, small grids can be built entirely at compile time. Indices are 16 bit
+// whenever the vertices fit. The quads are emitted in column strips narrow enough for the vertices shared with the
+// row above to still be in the post-transform cache, and the vertices are numbered in the order the indices first use
+// them so the vertex fetch walks the buffer forward. Each size also has 15 stitched variants, the edges of the stitch
+// mask merge every other vertex into the one before so they match the vertices of a node one level coarser
+namespace TerrainGrid
+{
+	enum class Tier : uint32_t
+	{
+		Low, // 16 quads per side
+		Medium, // 32
+		High, // 64
+		Ultra, // 128
+		Count
+	};
+
+	constexpr uint32_t NUM_TIERS = static_cast<uint32_t>(Tier::Count);
+
+	constexpr uint32_t GetGridSize(const Tier tier)
+	{
+		return 16u << static_cast<uint32_t>(tier);
+	}
+
+	// Post-transform cache entries the strips are sized for by default
+	constexpr uint32_t CACHE_SIZE = 32;
+
+	// Quads per strip row. A strip row and the row above it fit with two entries to spare, without them a FIFO cache
+	// evicts the shared row of the first strip row and misses on every row after
+	constexpr uint32_t GetStripWidth(const uint32_t gridSize, const uint32_t cacheSize)
+	{
+		return std::clamp(cacheSize / 2, 3u, gridSize + 2) - 2;
+	}
+
+	// Stitch mask bits, the edge order of TERRAIN_STITCH_MASK
+	constexpr uint32_t EDGE_NEG_X = 1; // x == 0
+	constexpr uint32_t EDGE_POS_X = 2; // x == GridSize
+	constexpr uint32_t EDGE_NEG_Z = 4;
+	constexpr uint32_t EDGE_POS_Z = 8;
+	constexpr uint32_t NUM_STITCH_VARIANTS = 16;
+
+	// Same layout as float3, x and z in [-1, 1]
+	struct Vertex
+	{
+		float x;
+		float y;
+		float z;
+	};
+
+	template <uint32_t GridSize>
+	struct Mesh
+	{
+		static_assert(GridSize >= 2 && GridSize % 2 == 0, "The grid is centered on a vertex");
+
+		static constexpr uint32_t SIDE_VERTICES = GridSize + 1;
+		static constexpr uint32_t NUM_VERTICES = SIDE_VERTICES * SIDE_VERTICES;
+		static constexpr uint32_t NUM_INDICES = GridSize * GridSize * 6;
+		using Index = std::conditional_t<(NUM_VERTICES <= 0x10000), uint16_t, uint32_t>;
+
+		std::array<Vertex, NUM_VERTICES> vertices = {};
+		std::array<Index, NUM_INDICES> indices = {};
+		uint32_t numIndices = 0; // stitched variants drop the triangles their merged vertices collapse
+	};
+
+	// Two triangles per quad with the winding of the row major grid it replaces. The vertices are numbered by the
+	// unstitched order whatever the mask, every variant of a size indexes the same vertices
+	template <uint32_t GridSize>
+	constexpr void Build(Mesh<GridSize>& mesh, const uint32_t cacheSize = CACHE_SIZE, const uint32_t stitchMask = 0)
+	{
+		using GridMesh = Mesh<GridSize>;
+		using Index = typename GridMesh::Index;
+		constexpr uint32_t side = GridMesh::SIDE_VERTICES;
+		constexpr uint32_t unused = ~0u;
+		const uint32_t stripWidth = GetStripWidth(GridSize, cacheSize);
+
+		auto forEachQuad = [stripWidth](auto&& func)
+			{
+				for (uint32_t stripX = 0; stripX < GridSize; stripX += stripWidth)
+				{
+					const uint32_t stripEnd = std::min(stripX + stripWidth, GridSize);
+					for (uint32_t z = 0; z < GridSize; z++)
+					{
+						for (uint32_t x = stripX; x < stripEnd; x++)
+							func(x, z);
+					}
+				}
+			};
+
+		// grid vertex to mesh vertex, numbered on first use
+		std::array<uint32_t, GridMesh::NUM_VERTICES> remap = {};
+		for (uint32_t& vertex : remap)
+			vertex = unused;
+
+		uint32_t numVertices = 0;
+		auto number = [&](const uint32_t x, const uint32_t z)
+			{
+				uint32_t& vertex = remap[z * side + x];
+				if (vertex == unused)
+				{
+					vertex = numVertices++;
+					mesh.vertices[vertex] = Vertex{ 2.0f * static_cast<float>(x) / GridSize - 1.0f, 0.0f, 2.0f * static_cast<float>(z) / GridSize - 1.0f };
+				}
+			};
+
+		forEachQuad([&](const uint32_t x, const uint32_t z)
+			{
+				number(x, z);
+				number(x, z + 1);
+				number(x + 1, z + 1);
+				number(x + 1, z);
+			});
+
+		// Odd vertices of the stitched edges merge into the even one before them. The triangles left keep their winding,
+		// the ones with two merged corners have no area and are dropped
+		auto stitched = [&](uint32_t x, uint32_t z)
+			{
+				if (((stitchMask & EDGE_NEG_X) && x == 0) || ((stitchMask & EDGE_POS_X) && x == GridSize))
+					z &= ~1u;
+				if (((stitchMask & EDGE_NEG_Z) && z == 0) || ((stitchMask & EDGE_POS_Z) && z == GridSize))
+					x &= ~1u;
+				return remap[z * side + x];
+			};
+
+		mesh.numIndices = 0;
+		auto emitTriangle = [&](const uint32_t a, const uint32_t b, const uint32_t c)
+			{
+				if (a == b || b == c || c == a)
+					return;
+				mesh.indices[mesh.numIndices++] = static_cast<Index>(a);
+				mesh.indices[mesh.numIndices++] = static_cast<Index>(b);
+				mesh.indices[mesh.numIndices++] = static_cast<Index>(c);
+			};
+
+		forEachQuad([&](const uint32_t x, const uint32_t z)
+			{
+				const uint32_t bottomLeft = stitched(x, z);
+				const uint32_t topLeft = stitched(x, z + 1);
+				const uint32_t topRight = stitched(x + 1, z + 1);
+				const uint32_t bottomRight = stitched(x + 1, z);
+				emitTriangle(bottomLeft, topLeft, topRight);
+				emitTriangle(bottomLeft, topRight, bottomRight);
+			});
+	}
+
+	// The plain row major grid, the reference the strips are measured against
+	template <uint32_t GridSize>
+	constexpr void BuildRowMajor(Mesh<GridSize>& mesh)
+	{
+		using Index = typename Mesh<GridSize>::Index;
+		constexpr uint32_t side = Mesh<GridSize>::SIDE_VERTICES;
+
+		for (uint32_t z = 0; z < side; z++)
+		{
+			for (uint32_t x = 0; x < side; x++)
+				mesh.vertices[z * side + x] = Vertex{ 2.0f * static_cast<float>(x) / GridSize - 1.0f, 0.0f, 2.0f * static_cast<float>(z) / GridSize - 1.0f };
+		}
+
+		mesh.numIndices = 0;
+		for (uint32_t z = 0; z < GridSize; z++)
+		{
+			for (uint32_t x = 0; x < GridSize; x++)
+			{
+				const Index bottomLeft = static_cast<Index>(z * side + x);
+				const Index topLeft = static_cast<Index>((z + 1) * side + x);
+				const Index indices[6] = { bottomLeft, topLeft, static_cast<Index>(topLeft + 1), bottomLeft, static_cast<Index>(topLeft + 1), static_cast<Index>(bottomLeft + 1) };
+				for (const Index index : indices)
+					mesh.indices[mesh.numIndices++] = index;
+			}
+		}
+	}
+
+	template <uint32_t GridSize>
+	constexpr Mesh<GridSize> MakeMesh(const uint32_t stitchMask = 0)
+	{
+		Mesh<GridSize> mesh;
+		Build(mesh, CACHE_SIZE, stitchMask);
+		return mesh;
+	}
+
+	// Every vertex is used and numbered by its first use
+	template <uint32_t GridSize>
+	constexpr bool IsFetchOrdered(const Mesh<GridSize>& mesh)
+	{
+		uint32_t next = 0;
+		for (uint32_t i = 0; i < mesh.numIndices; i++)
+		{
+			if (mesh.indices[i] > next)
+				return false;
+			if (mesh.indices[i] == next)
+				next++;
+		}
+		return next == Mesh<GridSize>::NUM_VERTICES;
+	}
+
+	// Twice the area of the triangles, a grid covers [-1, 1] on x and z whatever its stitching. A triangle wound the
+	// other way or overlapping another would leave a hole somewhere else
+	template <uint32_t GridSize>
+	constexpr float GetDoubleArea(const Mesh<GridSize>& mesh)
+	{
+		float area = 0.0f;
+		for (uint32_t i = 0; i + 2 < mesh.numIndices; i += 3)
+		{
+			const Vertex& a = mesh.vertices[mesh.indices[i]];
+			const Vertex& b = mesh.vertices[mesh.indices[i + 1]];
+			const Vertex& c = mesh.vertices[mesh.indices[i + 2]];
+			const float cross = (b.z - a.z) * (c.x - a.x) - (b.x - a.x) * (c.z - a.z);
+			if (cross <= 0.0f)
+				return -1.0f;
+			area += cross;
+		}
+		return area;
+	}
+
+	// Vertex shader runs of an index buffer through a simulated post-transform cache
+	struct CacheStats
+	{
+		double acmr = 0.0; // per triangle, a large grid tends to 0.5
+		double atvr = 0.0; // per vertex, 1 when no vertex is shaded twice
+	};
+
+	// FIFO as the fixed function caches replaced entries, or LRU
+	template <typename Index>
+	CacheStats SimulateCache(const std::span<const Index> indices, const uint32_t numVertices, const uint32_t cacheSize, const bool lru)
+	{
+		std::vector<uint32_t> cache; // oldest first
+		cache.reserve(cacheSize + 1);
+		uint64_t numShaded = 0;
+		for (const Index index : indices)
+		{
+			const auto entry = std::find(cache.begin(), cache.end(), static_cast<uint32_t>(index));
+			if (entry != cache.end())
+			{
+				if (lru)
+				{
+					cache.erase(entry);
+					cache.push_back(index);
+				}
+				continue;
+			}
+
+			numShaded++;
+			cache.push_back(index);
+			if (cache.size() > cacheSize)
+				cache.erase(cache.begin());
+		}
+
+		CacheStats stats;
+		stats.acmr = static_cast<double>(numShaded) / static_cast<double>(indices.size() / 3);
+		stats.atvr = static_cast<double>(numShaded) / static_cast<double>(numVertices);
+		return stats;
+	}
+
+	static_assert(IsFetchOrdered(MakeMesh<8>()));
+	static_assert(GetDoubleArea(MakeMesh<8>()) == 8.0f && GetDoubleArea(MakeMesh<8>(NUM_STITCH_VARIANTS - 1)) == 8.0f);
+	static_assert(MakeMesh<8>(NUM_STITCH_VARIANTS - 1).numIndices == (8 * 8 * 2 - 4 * 8 / 2) * 3, "A stitched edge drops a triangle per merged vertex");
+	static_assert(std::is_same_v<Mesh<GetGridSize(Tier::Ultra)>::Index, uint16_t>, "Every tier is drawn with 16 bit indices");
+}
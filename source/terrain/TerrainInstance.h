@@ -0,0 +1,61 @@
+#pragma once
+
+#include <donut/core/math/math.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+using namespace donut::math;
+#include "../../shaders/terrain/terrain_instance.h"
+
+static_assert(sizeof(TerrainInstanceData) == 16, "TerrainInstanceData must match the instance input layout");
+
+inline uint32_t PackLodAndFlags(const int lodLevel, const uint32_t flags)
+{
+	assert(lodLevel >= 0 && lodLevel <= TERRAIN_INSTANCE_LOD_MASK && flags <= TERRAIN_INSTANCE_FLAGS_MASK);
+	return static_cast<uint32_t>(lodLevel) | (flags << TERRAIN_INSTANCE_FLAGS_SHIFT);
+}
+
+inline int UnpackLodLevel(const uint32_t lodAndFlags)
+{
+	return static_cast<int>(lodAndFlags & TERRAIN_INSTANCE_LOD_MASK);
+}
+
+inline uint32_t UnpackFlags(const uint32_t lodAndFlags)
+{
+	return (lodAndFlags >> TERRAIN_INSTANCE_FLAGS_SHIFT) & TERRAIN_INSTANCE_FLAGS_MASK;
+}
+
+// Flags of an instance whose edge borders a node levels coarser, edge in the order of TERRAIN_STITCH_MASK
+inline uint32_t PackEdgeStitch(const int edge, const int levels)
+{
+	assert(edge >= 0 && edge < 4 && levels > 0);
+	const uint32_t extraLevels = static_cast<uint32_t>(std::min(levels - 1, TERRAIN_STITCH_MAX_EXTRA_LEVELS));
+	return (1u << edge) | (extraLevels << (TERRAIN_STITCH_LEVELS_SHIFT + 2 * edge));
+}
+
+inline uint32_t UnpackStitchMask(const uint32_t lodAndFlags)
+{
+	return UnpackFlags(lodAndFlags) & TERRAIN_STITCH_MASK;
+}
+
+// The instance without its stitch flags, drawn with the plain grid
+inline uint32_t ClearStitchFlags(const uint32_t lodAndFlags)
+{
+	constexpr uint32_t stitchFlags = TERRAIN_STITCH_MASK | (0xffu << TERRAIN_STITCH_LEVELS_SHIFT);
+	return lodAndFlags & ~(stitchFlags << TERRAIN_INSTANCE_FLAGS_SHIFT);
+}
+
+// Instance drawing the grid mesh over the xz extents of the bounds, the height comes from the heightmap
+inline TerrainInstanceData PackTerrainInstance(const box3& bounds, const int lodLevel, const uint32_t flags = 0)
+{
+	const float3 center = bounds.center();
+
+	TerrainInstanceData instance;
+	instance.offset = float2(center.x, center.z);
+	instance.scale = (bounds.m_maxs.x - bounds.m_mins.x) * 0.5f;
+	instance.lodAndFlags = PackLodAndFlags(lodLevel, flags);
+
+	assert(UnpackLodLevel(instance.lodAndFlags) == lodLevel && UnpackFlags(instance.lodAndFlags) == flags);
+	return instance;
+}
\ No newline at end of file
@@ -1,4 +1,8 @@
 #include "../terrain/TerrainPass.h"
+#include "../terrain/TerrainSelect.h"
+#include "../terrain/TerrainBake.h"
+#include "../terrain/TileStreamer.h"
+#include "../terrain/NormalMap.h"
 #include <donut/engine/ShaderFactory.h>
 #include <donut/engine/SceneTypes.h>
 #include <donut/engine/SceneGraph.h>
@@ -7,6 +11,7 @@
 #include <donut/engine/CommonRenderPasses.h>
 #include <nvrhi/utils.h>
 #include <donut/shaders/bindless.h>
+#include <taskflow/taskflow.hpp>
 
 #include "../profiler/Profiler.h"
 #include "../Renderer.h"
@@ -14,16 +19,345 @@
 using namespace donut::math;
 #include "../../shaders/terrain/terrain_cb.h"
 
+static_assert(TERRAIN_MAX_LODS == QuadTree::MAX_LODS, "terrain_cb.h must match QuadTree::MAX_LODS");
+
 using namespace vRenderer;
 using namespace donut;
 
+static_assert(TerrainGrid::NUM_STITCH_VARIANTS == TERRAIN_STITCH_MASK + 1 && TerrainGrid::EDGE_NEG_X == 1 && TerrainGrid::EDGE_POS_Z == 8,
+	"The grid variants are indexed by the instance stitch mask");
+
+namespace
+{
+	// Views over the instance budget halve their LOD ranges until they fit, at worst every quadtree root is drawn whole
+	constexpr float LOD_BUDGET_STEP = 0.5f;
+	constexpr float MIN_LOD_BUDGET_SCALE = 1.0f / 256.0f;
+}
+
 struct TerrainPass::Resources
 {
-	std::array<InstanceData, MAX_INSTANCES> instanceData;
 	std::shared_ptr<engine::LoadedTexture> heightmapTexture;
 	std::shared_ptr<engine::LoadedTexture> colorTexture;
+
+	// Uploaded from a bake instead of the texture cache
+	nvrhi::TextureHandle bakedHeightmapTexture;
+	nvrhi::TextureHandle bakedColorTexture;
+
+	// Built from the heightmap or uploaded from a bake
+	nvrhi::TextureHandle normalTexture;
+
+	// Sources of the bake written once the quadtrees are built
+	std::shared_ptr<const HeightmapStore> heightmap;
+	std::shared_ptr<vfs::IBlob> colorData;
+	TerrainBake::AlbedoView albedo;
+
+	// Slots of the streamed pages
+	nvrhi::TextureHandle heightAtlas;
+	nvrhi::TextureHandle normalAtlas;
+	nvrhi::TextureHandle colorAtlas;
+	TerrainStreamConstants streamConstants = {};
 };
 
+namespace
+{
+	nvrhi::Format GetTextureFormat(const HeightmapFormat format)
+	{
+		switch (format)
+		{
+		case HeightmapFormat::R8_UNORM: return nvrhi::Format::R8_UNORM;
+		case HeightmapFormat::R16_UNORM: return nvrhi::Format::R16_UNORM;
+		case HeightmapFormat::R16_FLOAT: return nvrhi::Format::R16_FLOAT;
+		case HeightmapFormat::R32_FLOAT: return nvrhi::Format::R32_FLOAT;
+		default: return nvrhi::Format::UNKNOWN;
+		}
+	}
+
+	nvrhi::Format GetTextureFormat(const TerrainBake::AlbedoFormat format)
+	{
+		switch (format)
+		{
+		case TerrainBake::AlbedoFormat::RGBA8_SRGB: return nvrhi::Format::SRGBA8_UNORM;
+		case TerrainBake::AlbedoFormat::BC1_SRGB: return nvrhi::Format::BC1_UNORM_SRGB;
+		case TerrainBake::AlbedoFormat::BC7_SRGB: return nvrhi::Format::BC7_UNORM_SRGB;
+		default: return nvrhi::Format::UNKNOWN;
+		}
+	}
+
+	bool GetHeightmapFormat(const nvrhi::Format format, HeightmapFormat& outFormat)
+	{
+		switch (format)
+		{
+		case nvrhi::Format::R8_UNORM: outFormat = HeightmapFormat::R8_UNORM; return true;
+		case nvrhi::Format::R16_UNORM: outFormat = HeightmapFormat::R16_UNORM; return true;
+		case nvrhi::Format::R16_FLOAT: outFormat = HeightmapFormat::R16_FLOAT; return true;
+		case nvrhi::Format::R32_FLOAT: outFormat = HeightmapFormat::R32_FLOAT; return true;
+		default: return false;
+		}
+	}
+
+	// The quadtrees share the mip 0 texels in place, the store keeps the loaded blob alive once the texture cache drops it
+	std::shared_ptr<HeightmapStore> CreateHeightmapStore(const engine::LoadedTexture& texture)
+	{
+		const engine::TextureData* textureData = static_cast<const engine::TextureData*>(&texture);
+		if (!textureData->data || textureData->dataLayout.empty() || textureData->dataLayout[0].empty())
+			return nullptr;
+
+		HeightmapFormat format;
+		if (!GetHeightmapFormat(textureData->format, format))
+		{
+			log::error("Unsupported heightmap format %s", nvrhi::utils::FormatToString(textureData->format));
+			return nullptr;
+		}
+
+		const engine::TextureSubresourceData& mip0 = textureData->dataLayout[0][0];
+		if (mip0.rowPitch != static_cast<size_t>(textureData->width) * GetBytesPerTexel(format))
+		{
+			log::error("Heightmap rows must be tightly packed");
+			return nullptr;
+		}
+
+		HeightmapView view;
+		view.data = static_cast<const uint8_t*>(textureData->data->data()) + mip0.dataOffset;
+		view.width = textureData->width;
+		view.height = textureData->height;
+		view.format = format;
+		return std::make_shared<HeightmapStore>(view, textureData->data);
+	}
+
+	// The bake keeps the albedo mip 0 when it is RGBA8 with tightly packed rows, the mips are rebuilt from it
+	bool GetAlbedoView(const engine::LoadedTexture& texture, TerrainBake::AlbedoView& outAlbedo)
+	{
+		const engine::TextureData* textureData = static_cast<const engine::TextureData*>(&texture);
+		if (!textureData->data || textureData->dataLayout.empty() || textureData->dataLayout[0].empty())
+			return false;
+		if (textureData->format != nvrhi::Format::SRGBA8_UNORM && textureData->format != nvrhi::Format::RGBA8_UNORM)
+			return false;
+
+		const engine::TextureSubresourceData& mip0 = textureData->dataLayout[0][0];
+		if (mip0.rowPitch != static_cast<size_t>(textureData->width) * 4)
+			return false;
+
+		outAlbedo.data = static_cast<const uint8_t*>(textureData->data->data()) + mip0.dataOffset;
+		outAlbedo.width = textureData->width;
+		outAlbedo.height = textureData->height;
+		return true;
+	}
+
+	using GetTileFunction = const void* (BakedTerrain::*)(uint32_t mip, uint32_t tileX, uint32_t tileY) const;
+
+	// The tiles are copied row by row into a staging texture, nothing but the staging memory is allocated
+	nvrhi::TextureHandle CreateBakedTiledTexture(nvrhi::IDevice* device, nvrhi::ICommandList* commandList, const BakedTerrain& bake,
+		const TerrainBake::MipDesc* mipDescs, const uint32_t numMips, const GetTileFunction getTile, const nvrhi::Format format, const size_t bytesPerTexel, const char* debugName)
+	{
+		const TerrainBake::Header& header = bake.GetHeader();
+		const size_t tileRowSize = header.tileSize * bytesPerTexel;
+
+		nvrhi::TextureDesc textureDesc;
+		textureDesc.width = mipDescs[0].width;
+		textureDesc.height = mipDescs[0].height;
+		textureDesc.mipLevels = numMips;
+		textureDesc.format = format;
+		textureDesc.debugName = debugName;
+		textureDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+		textureDesc.keepInitialState = true;
+		nvrhi::TextureHandle texture = device->createTexture(textureDesc);
+		nvrhi::StagingTextureHandle stagingTexture = device->createStagingTexture(textureDesc, nvrhi::CpuAccessMode::Write);
+		if (!texture || !stagingTexture)
+			return nullptr;
+
+		for (uint32_t mip = 0; mip < numMips; mip++)
+		{
+			const TerrainBake::MipDesc& mipDesc = mipDescs[mip];
+			const nvrhi::TextureSlice slice = nvrhi::TextureSlice().setMipLevel(mip);
+
+			size_t rowPitch = 0;
+			uint8_t* mapped = static_cast<uint8_t*>(device->mapStagingTexture(stagingTexture, slice, nvrhi::CpuAccessMode::Write, &rowPitch));
+			if (!mapped)
+				return nullptr;
+
+			for (uint32_t y = 0; y < mipDesc.height; y++)
+			{
+				const uint32_t tileY = y / header.tileSize;
+				const size_t tileRowOffset = (y % header.tileSize) * tileRowSize;
+				uint8_t* row = mapped + y * rowPitch;
+				for (uint32_t tileX = 0; tileX < mipDesc.numTilesX; tileX++)
+				{
+					// the last tile in the row overhangs the mip edge
+					const uint32_t x = tileX * header.tileSize;
+					const size_t size = std::min(header.tileSize, mipDesc.width - x) * bytesPerTexel;
+					memcpy(row + x * bytesPerTexel, static_cast<const uint8_t*>((bake.*getTile)(mip, tileX, tileY)) + tileRowOffset, size);
+				}
+			}
+			device->unmapStagingTexture(stagingTexture);
+
+			commandList->copyTexture(texture, slice, stagingTexture, slice);
+		}
+
+		return texture;
+	}
+
+	// Mip 0 is built in bands of rows on the workers
+	nvrhi::TextureHandle CreateNormalTexture(nvrhi::IDevice* device, nvrhi::ICommandList* commandList, const HeightmapStore& heightmap, tf::Executor& executor)
+	{
+		constexpr uint32_t rowsPerTask = 64;
+
+		std::vector<NormalMap::Mip> mips(1);
+		NormalMap::Mip& mip0 = mips[0];
+		mip0.width = heightmap.GetWidth();
+		mip0.height = heightmap.GetHeight();
+		mip0.texels.resize(static_cast<size_t>(mip0.width) * mip0.height * NormalMap::BYTES_PER_TEXEL);
+
+		const int numTasks = static_cast<int>((mip0.height + rowsPerTask - 1) / rowsPerTask);
+		tf::Taskflow taskflow("Terrain Normals");
+		taskflow.for_each_index(0, numTasks, 1, [&heightmap, &mip0](const int task)
+			{
+				const uint32_t firstRow = static_cast<uint32_t>(task) * rowsPerTask;
+				NormalMap::BuildRows(heightmap, firstRow, std::min(rowsPerTask, mip0.height - firstRow),
+					mip0.texels.data() + static_cast<size_t>(firstRow) * mip0.width * NormalMap::BYTES_PER_TEXEL);
+			}).name("BuildRows");
+		executor.run(taskflow).wait();
+
+		while (mips.back().width > 1 || mips.back().height > 1)
+			mips.push_back(NormalMap::Downsample(mips.back()));
+
+		nvrhi::TextureDesc textureDesc;
+		textureDesc.width = mip0.width;
+		textureDesc.height = mip0.height;
+		textureDesc.mipLevels = static_cast<uint32_t>(mips.size());
+		textureDesc.format = nvrhi::Format::RG8_SNORM;
+		textureDesc.debugName = "TerrainNormals";
+		textureDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+		textureDesc.keepInitialState = true;
+		nvrhi::TextureHandle texture = device->createTexture(textureDesc);
+		if (!texture)
+			return nullptr;
+
+		commandList->open();
+		for (uint32_t mip = 0; mip < mips.size(); mip++)
+			commandList->writeTexture(texture, 0, mip, mips[mip].texels.data(), static_cast<size_t>(mips[mip].width) * NormalMap::BYTES_PER_TEXEL);
+		commandList->close();
+		device->executeCommandList(commandList);
+
+		return texture;
+	}
+
+	nvrhi::TextureHandle CreateBakedColorTexture(nvrhi::IDevice* device, nvrhi::ICommandList* commandList, const BakedTerrain& bake)
+	{
+		const TerrainBake::Header& header = bake.GetHeader();
+		const nvrhi::Format format = GetTextureFormat(bake.GetAlbedoFormat());
+		if (format == nvrhi::Format::UNKNOWN || header.numAlbedoMips == 0)
+			return nullptr;
+
+		nvrhi::TextureDesc textureDesc;
+		textureDesc.width = header.albedoMips[0].width;
+		textureDesc.height = header.albedoMips[0].height;
+		textureDesc.mipLevels = header.numAlbedoMips;
+		textureDesc.format = format;
+		textureDesc.debugName = "BakedAlbedo";
+		textureDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+		textureDesc.keepInitialState = true;
+		nvrhi::TextureHandle texture = device->createTexture(textureDesc);
+		if (!texture)
+			return nullptr;
+
+		// Block compressed rows are rows of blocks
+		const uint32_t blockSize = TerrainBake::GetAlbedoBlockSize(bake.GetAlbedoFormat());
+		const size_t blockBytes = TerrainBake::GetAlbedoBlockBytes(bake.GetAlbedoFormat());
+		for (uint32_t mip = 0; mip < header.numAlbedoMips; mip++)
+			commandList->writeTexture(texture, 0, mip, bake.GetAlbedoMip(mip), (header.albedoMips[mip].width + blockSize - 1) / blockSize * blockBytes);
+
+		return texture;
+	}
+
+	nvrhi::TextureHandle CreateAtlas(nvrhi::IDevice* device, const TileStreamer& streamer, const uint32_t slotSize, const nvrhi::Format format, const char* debugName)
+	{
+		const uint32_t numRows = (streamer.GetNumSlots() + streamer.GetSlotsPerRow() - 1) / streamer.GetSlotsPerRow();
+
+		nvrhi::TextureDesc textureDesc;
+		textureDesc.width = streamer.GetSlotsPerRow() * slotSize;
+		textureDesc.height = numRows * slotSize;
+		textureDesc.format = format;
+		textureDesc.debugName = debugName;
+		textureDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+		textureDesc.keepInitialState = true;
+		return device->createTexture(textureDesc);
+	}
+
+	// Appends the grid of one size and its stitched variants to the shared buffers, in stitch mask order.
+	// The variants share the vertices, their indices are relative to the first one
+	template <uint32_t GridSize>
+	void AppendGridMesh(std::vector<TerrainGrid::Vertex>& vertices, std::vector<uint16_t>& indices,
+		std::vector<std::shared_ptr<engine::MeshGeometry>>& geometries, const uint32_t cacheSize)
+	{
+		const std::unique_ptr<TerrainGrid::Mesh<GridSize>> mesh = std::make_unique<TerrainGrid::Mesh<GridSize>>();
+		const uint32_t vertexOffset = static_cast<uint32_t>(vertices.size());
+
+		for (uint32_t stitchMask = 0; stitchMask < TerrainGrid::NUM_STITCH_VARIANTS; stitchMask++)
+		{
+			TerrainGrid::Build(*mesh, cacheSize, stitchMask);
+			if (stitchMask == 0)
+				vertices.insert(vertices.end(), mesh->vertices.begin(), mesh->vertices.end());
+
+			const std::shared_ptr<engine::MeshGeometry> geometry = std::make_shared<engine::MeshGeometry>();
+			geometry->material = nullptr;
+			geometry->indexOffsetInMesh = static_cast<uint32_t>(indices.size());
+			geometry->vertexOffsetInMesh = vertexOffset;
+			geometry->numIndices = mesh->numIndices;
+			geometry->numVertices = static_cast<uint32_t>(mesh->vertices.size());
+
+			indices.insert(indices.end(), mesh->indices.begin(), mesh->indices.begin() + mesh->numIndices);
+			geometries.push_back(geometry);
+		}
+	}
+
+	// NUM_STITCH_VARIANTS geometries per tier, in tier order
+	template <uint32_t... Tiers>
+	void AppendGridMeshes(std::integer_sequence<uint32_t, Tiers...>, std::vector<TerrainGrid::Vertex>& vertices, std::vector<uint16_t>& indices,
+		std::vector<std::shared_ptr<engine::MeshGeometry>>& geometries, const uint32_t cacheSize)
+	{
+		(AppendGridMesh<TerrainGrid::GetGridSize(static_cast<TerrainGrid::Tier>(Tiers))>(vertices, indices, geometries, cacheSize), ...);
+	}
+
+	// The pages are laid out side by side in one staging texture, then each is copied to its slot. Uncompressed formats
+	// are blocks of one texel
+	void UploadPages(nvrhi::IDevice* device, nvrhi::ICommandList* commandList, nvrhi::ITexture* atlas, const std::span<const TileStreamer::PageUpload> uploads,
+		const uint8_t* const TileStreamer::PageUpload::* pageTexels, const uint32_t slotSize, const uint32_t slotsPerRow, const uint32_t blockSize, const size_t blockBytes)
+	{
+		const uint32_t numUploads = static_cast<uint32_t>(uploads.size());
+		const uint32_t stagingColumns = std::min(numUploads, TileStreamer::MAX_ATLAS_SIZE / slotSize);
+
+		nvrhi::TextureDesc stagingDesc = atlas->getDesc();
+		stagingDesc.width = stagingColumns * slotSize;
+		stagingDesc.height = (numUploads + stagingColumns - 1) / stagingColumns * slotSize;
+		stagingDesc.debugName = "TerrainPageStaging";
+		nvrhi::StagingTextureHandle stagingTexture = device->createStagingTexture(stagingDesc, nvrhi::CpuAccessMode::Write);
+
+		size_t rowPitch = 0;
+		uint8_t* mapped = stagingTexture ? static_cast<uint8_t*>(device->mapStagingTexture(stagingTexture, nvrhi::TextureSlice(), nvrhi::CpuAccessMode::Write, &rowPitch)) : nullptr;
+		if (!mapped)
+			return;
+
+		const uint32_t slotRows = slotSize / blockSize;
+		const size_t slotRowSize = slotRows * blockBytes;
+		for (uint32_t i = 0; i < numUploads; i++)
+		{
+			const uint8_t* texels = uploads[i].*pageTexels;
+			uint8_t* dst = mapped + static_cast<size_t>(i / stagingColumns) * slotRows * rowPitch + (i % stagingColumns) * slotRowSize;
+			for (uint32_t row = 0; row < slotRows; row++)
+				memcpy(dst + row * rowPitch, texels + row * slotRowSize, slotRowSize);
+		}
+		device->unmapStagingTexture(stagingTexture);
+
+		for (uint32_t i = 0; i < numUploads; i++)
+		{
+			const uint32_t slot = uploads[i].slot;
+			const nvrhi::TextureSlice srcSlice = nvrhi::TextureSlice().setOrigin((i % stagingColumns) * slotSize, (i / stagingColumns) * slotSize).setWidth(slotSize).setHeight(slotSize);
+			const nvrhi::TextureSlice dstSlice = nvrhi::TextureSlice().setOrigin((slot % slotsPerRow) * slotSize, (slot / slotsPerRow) * slotSize).setWidth(slotSize).setHeight(slotSize);
+			commandList->copyTexture(atlas, dstSlice, stagingTexture, srcSlice);
+		}
+	}
+}
+
 TerrainPass::TerrainPass(nvrhi::IDevice* device, std::shared_ptr<engine::CommonRenderPasses> commonPasses)
 	: m_Device(device)
 	, m_CommonPasses(std::move(commonPasses))
@@ -31,9 +365,10 @@ TerrainPass::TerrainPass(nvrhi::IDevice* device, std::shared_ptr<engine::CommonR
 	m_Resources = std::make_shared<Resources>();
 }
 
-void TerrainPass::Init(engine::ShaderFactory& shaderFactory, const CreateParameters& params, nvrhi::ICommandList* commandList, const std::shared_ptr<engine::LoadedTexture>& heightmapTexture, const std::shared_ptr<engine::LoadedTexture>& colorTexture, tf::Executor& executor)
+void TerrainPass::InitCommon(engine::ShaderFactory& shaderFactory, const CreateParameters& params, nvrhi::ICommandList* commandList, tf::Executor& executor)
 {
 	m_SupportedViewTypes = engine::ViewType::PLANAR;
+	m_Executor = &executor;
 
 	CreateShaders(shaderFactory, params);
 
@@ -45,99 +380,269 @@ void TerrainPass::Init(engine::ShaderFactory& shaderFactory, const CreateParamet
 	m_ViewBindingSet = CreateViewBindingSet();
 	m_LightBindingLayout = CreateLightBindingLayout();
 
-	std::vector<float3> vPositions;
-	std::vector<uint32_t> vIndices;
-	uint32_t vPositionsByteSize = 0;
+	// Streaming replaces it, the shaders don't read it otherwise
+	nvrhi::BufferDesc pageTableDesc;
+	pageTableDesc.byteSize = sizeof(uint32_t);
+	pageTableDesc.format = nvrhi::Format::R32_UINT;
+	pageTableDesc.canHaveTypedViews = true;
+	pageTableDesc.debugName = "TerrainPageTable";
+	pageTableDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+	pageTableDesc.keepInitialState = true;
+	m_PageTableBuffer = m_Device->createBuffer(pageTableDesc);
+
+	m_SelectConstantsCB = m_Device->createBuffer(nvrhi::utils::CreateVolatileConstantBufferDesc(sizeof(TerrainSelectConstants), "TerrainSelectConstants", params.numConstantBufferVersions));
+	m_SelectBindingLayout = CreateSelectBindingLayout();
+	CreateSelectBuffers();
+
+	// Every tier in the same buffers, the draws pick their geometry
+	std::vector<TerrainGrid::Vertex> vPositions;
+	std::vector<uint16_t> vIndices;
+	std::vector<std::shared_ptr<engine::MeshGeometry>> geometries;
+	AppendGridMeshes(std::make_integer_sequence<uint32_t, TerrainGrid::NUM_TIERS>(), vPositions, vIndices, geometries, params.vertexCacheSize);
+	const uint32_t vPositionsByteSize = static_cast<uint32_t>(vPositions.size() * sizeof(TerrainGrid::Vertex));
 
-	constexpr int sideSize = GRID_SIZE + 1;
-	constexpr int halfSize = GRID_SIZE / 2;
-	vPositions.resize(sideSize * sideSize);
-	vPositionsByteSize = sideSize * sideSize * sizeof(float3);
+	m_HeightmapBindingLayout = CreateHeightmapBindingLayout();
 
-	size_t index = 0;
-	for (int h = -halfSize; h <= halfSize; h++)
-	{
-		for (int w = -halfSize; w <= halfSize; w++)
-		{
-			assert(index < vPositions.size());
-			vPositions[index] = float3(static_cast<float>(w) / halfSize, 0.0f, static_cast<float>(h) / halfSize);
-			index++;
-		}
-	}
+	commandList->open();
+
+	m_Buffers = std::make_shared<engine::BufferGroup>();
+
+	m_Buffers->indexBuffer = CreateGeometryBuffer(m_Device, commandList, "IndexBuffer", vIndices.data(), vIndices.size() * sizeof(uint16_t), false);
+
+	uint64_t vertexBufferSize = 0;
+	m_Buffers->getVertexBufferRange(engine::VertexAttribute::Position).setByteOffset(vertexBufferSize).setByteSize(vPositionsByteSize); vertexBufferSize += vPositionsByteSize;
+	m_Buffers->vertexBuffer = CreateGeometryBuffer(m_Device, commandList, "VertexBuffer", nullptr, vertexBufferSize, true);
+
+	commandList->beginTrackingBufferState(m_Buffers->vertexBuffer, nvrhi::ResourceStates::CopyDest);
+	commandList->writeBuffer(m_Buffers->vertexBuffer, vPositions.data(), vPositionsByteSize, m_Buffers->getVertexBufferRange(engine::VertexAttribute::Position).byteOffset);
+	commandList->setPermanentBufferState(m_Buffers->vertexBuffer, nvrhi::ResourceStates::VertexBuffer);
+	commandList->close();
+	m_Device->executeCommandList(commandList);
 
-	index = 0;
-	vIndices.resize((sideSize - 1) * (sideSize - 1) * 6);
-	for (int i = 0; i < sideSize - 1; i++)
+	m_MeshInfo = std::make_shared<engine::MeshInfo>();
+	m_MeshInfo->name = "TerrainMesh";
+	m_MeshInfo->buffers = m_Buffers;
+	m_MeshInfo->objectSpaceBounds = math::box3(math::float3(-0.5f), math::float3(0.5f));
+	m_MeshInfo->totalIndices = static_cast<uint32_t>(vIndices.size());
+	m_MeshInfo->totalVertices = static_cast<uint32_t>(vPositions.size());
+	m_MeshInfo->geometries = std::move(geometries);
+}
+
+void TerrainPass::CreateQuadTrees()
+{
+	constexpr int numSurfacesPerSide = WORLD_SIZE / SURFACE_SIZE;
+	constexpr int numSurfaces = numSurfacesPerSide * numSurfacesPerSide;
+	m_QuadTrees.resize(numSurfaces);
+	for (int i = 0; i < numSurfaces; i++)
 	{
-		for (int j = 0; j < sideSize - 1; j++)
-		{
-			uint32_t indexBottomLeft = i * sideSize + j;
-			uint32_t indexTopLeft = (i + 1) * sideSize + j;
-			uint32_t indexTopRight = (i + 1) * sideSize + j + 1;
-			uint32_t indexBottomRight = i * sideSize + j + 1;
-
-			vIndices[index++] = indexBottomLeft;
-			vIndices[index++] = indexTopLeft;
-			vIndices[index++] = indexTopRight;
-
-			vIndices[index++] = indexBottomLeft;
-			vIndices[index++] = indexTopRight;
-			vIndices[index++] = indexBottomRight;
-		}
+		int column = i % numSurfacesPerSide;
+		int row = i / numSurfacesPerSide;
+
+		float x = -0.5f * (numSurfacesPerSide - 1) + column;
+		float y = -0.5f * (numSurfacesPerSide - 1) + row;
+
+		m_QuadTrees[i] = std::make_shared<QuadTree>((float)SURFACE_SIZE, (float)SURFACE_SIZE, (float)WORLD_SIZE, float3(x * (float)SURFACE_SIZE, 0.0f, y * (float)SURFACE_SIZE));
 	}
+}
 
-	m_HeightmapBindingLayout = CreateHeightmapBindingLayout();
+void TerrainPass::Init(engine::ShaderFactory& shaderFactory, const CreateParameters& params, nvrhi::ICommandList* commandList, const std::shared_ptr<engine::LoadedTexture>& heightmapTexture, const std::shared_ptr<engine::LoadedTexture>& colorTexture, tf::Executor& executor, const BakeTarget& bakeTarget)
+{
+	InitCommon(shaderFactory, params, commandList, executor);
 
 	if (heightmapTexture)
 	{
-		
 		m_Resources->heightmapTexture = heightmapTexture;
 		m_Resources->colorTexture = colorTexture;
+		m_Resources->heightmap = CreateHeightmapStore(*heightmapTexture);
 
-		constexpr int numSurfacesPerSide = WORLD_SIZE / SURFACE_SIZE;
-		constexpr int numSurfaces = numSurfacesPerSide * numSurfacesPerSide;
-		m_QuadTrees.resize(numSurfaces);
-		for (int i = 0; i < numSurfaces; i++)
-		{
-			int column = i % numSurfacesPerSide;
-			int row = i / numSurfacesPerSide;
+		CreateQuadTrees();
+		for (const std::shared_ptr<QuadTree>& quadTree : m_QuadTrees)
+			quadTree->Init(m_Resources->heightmap, executor);
 
-			float x = -0.5f * (numSurfacesPerSide - 1) + column;
-			float y = -0.5f * (numSurfacesPerSide - 1) + row;
+		if (m_Resources->heightmap)
+			m_Resources->normalTexture = CreateNormalTexture(m_Device, commandList, *m_Resources->heightmap, executor);
 
-			m_QuadTrees[i] = std::make_shared<QuadTree>((float)SURFACE_SIZE, (float)SURFACE_SIZE, (float)WORLD_SIZE, float3(x * (float)SURFACE_SIZE, 0.0f, y * (float)SURFACE_SIZE));
-			m_QuadTrees[i]->Init(m_Resources->heightmapTexture, executor);
+		if (!bakeTarget.path.empty() && m_Resources->heightmap)
+		{
+			m_BakeTarget = bakeTarget;
+			if (colorTexture && GetAlbedoView(*colorTexture, m_Resources->albedo))
+				m_Resources->colorData = static_cast<const engine::TextureData*>(colorTexture.get())->data;
 		}
 	}
-	commandList->open();
+}
 
-	m_Buffers = std::make_shared<engine::BufferGroup>();
-	m_Buffers->instanceBuffer = CreateInstanceBuffer(m_Device);
+void TerrainPass::InitBaked(engine::ShaderFactory& shaderFactory, const CreateParameters& params, nvrhi::ICommandList* commandList, const std::shared_ptr<BakedTerrain>& bake, tf::Executor& executor)
+{
+	InitCommon(shaderFactory, params, commandList, executor);
 
-	m_Buffers->indexBuffer = CreateGeometryBuffer(m_Device, commandList, "IndexBuffer", vIndices.data(), vIndices.size() * sizeof(uint32_t), false);
+	CreateQuadTrees();
+	if (bake->GetHeader().numTrees != m_QuadTrees.size())
+	{
+		log::error("The baked terrain has %u quadtrees, %u expected", bake->GetHeader().numTrees, static_cast<uint32_t>(m_QuadTrees.size()));
+		m_QuadTrees.clear();
+		return;
+	}
 
-	uint64_t vertexBufferSize = 0;
-	m_Buffers->getVertexBufferRange(engine::VertexAttribute::Position).setByteOffset(vertexBufferSize).setByteSize(vPositionsByteSize); vertexBufferSize += vPositionsByteSize;
-	m_Buffers->vertexBuffer = CreateGeometryBuffer(m_Device, commandList, "VertexBuffer", nullptr, vertexBufferSize, true);
+	// the trees keep the mapping alive, the textures don't need it once uploaded
+	for (uint32_t i = 0; i < m_QuadTrees.size(); i++)
+	{
+		if (!m_QuadTrees[i]->InitBaked(bake->GetNodes(i), bake))
+			log::error("The baked terrain doesn't match quadtree %u", i);
+	}
 
-	commandList->beginTrackingBufferState(m_Buffers->vertexBuffer, nvrhi::ResourceStates::CopyDest);
-	commandList->writeBuffer(m_Buffers->vertexBuffer, vPositions.data(), vPositionsByteSize, m_Buffers->getVertexBufferRange(engine::VertexAttribute::Position).byteOffset);
-	commandList->setPermanentBufferState(m_Buffers->vertexBuffer, nvrhi::ResourceStates::VertexBuffer);
+	if (params.streamingBudget > 0)
+	{
+		InitStreaming(bake, params.streamingBudget, params.gridTier);
+		return;
+	}
+
+	commandList->open();
+	const TerrainBake::Header& header = bake->GetHeader();
+	m_Resources->bakedHeightmapTexture = CreateBakedTiledTexture(m_Device, commandList, *bake, header.heightMips, header.numHeightMips, &BakedTerrain::GetHeightTile,
+		GetTextureFormat(bake->GetHeightFormat()), GetBytesPerTexel(bake->GetHeightFormat()), "BakedHeightmap");
+	if (bake->HasNormals())
+	{
+		m_Resources->normalTexture = CreateBakedTiledTexture(m_Device, commandList, *bake, header.normalMips, header.numNormalMips, &BakedTerrain::GetNormalTile,
+			nvrhi::Format::RG8_SNORM, NormalMap::BYTES_PER_TEXEL, "BakedNormals");
+	}
+	m_Resources->bakedColorTexture = CreateBakedColorTexture(m_Device, commandList, *bake);
 	commandList->close();
 	m_Device->executeCommandList(commandList);
+}
+
+void TerrainPass::InitStreaming(const std::shared_ptr<BakedTerrain>& bake, const uint64_t budget, const TerrainGrid::Tier gridTier)
+{
+	const TerrainBake::Header& header = bake->GetHeader();
+	const QuadTree& quadTree = *m_QuadTrees[0];
+
+	// Nodes sample the finest mip whose texels are no smaller than their grid cells
+	const float leafTexels = 2.0f * quadTree.GetLodExtents()[0].x * static_cast<float>(header.heightWidth) / header.worldSize;
+	TileStreamer::Parameters streamParams;
+	streamParams.budget = budget;
+	streamParams.lodMipOffset = static_cast<int>(std::floor(std::log2(leafTexels / static_cast<float>(TerrainGrid::GetGridSize(gridTier)))));
+	streamParams.maxLod = quadTree.GetNumLods();
+	m_Streamer = std::make_shared<TileStreamer>(bake, streamParams, *m_Executor);
+
+	for (const std::shared_ptr<QuadTree>& tree : m_QuadTrees)
+		tree->SetStreamer(m_Streamer);
+
+	m_Resources->heightAtlas = CreateAtlas(m_Device, *m_Streamer, m_Streamer->GetPageSize() + 1, GetTextureFormat(m_Streamer->GetHeightFormat()), "TerrainHeightAtlas");
+	if (m_Streamer->HasNormals())
+		m_Resources->normalAtlas = CreateAtlas(m_Device, *m_Streamer, m_Streamer->GetPageSize() + 1, nvrhi::Format::RG8_SNORM, "TerrainNormalAtlas");
+	if (m_Streamer->HasAlbedo())
+		m_Resources->colorAtlas = CreateAtlas(m_Device, *m_Streamer, m_Streamer->GetAlbedoSlotSize(), GetTextureFormat(m_Streamer->GetAlbedoFormat()), "TerrainColorAtlas");
+
+	nvrhi::BufferDesc pageTableDesc = m_PageTableBuffer->getDesc();
+	pageTableDesc.byteSize = m_Streamer->GetPageTable().size_bytes();
+	m_PageTableBuffer = m_Device->createBuffer(pageTableDesc);
+	m_PageTableGeneration = ~0ull;
+
+	TerrainStreamConstants& stream = m_Resources->streamConstants;
+	stream.enabled = 1;
+	stream.lodMipOffset = streamParams.lodMipOffset;
+	stream.numMips = m_Streamer->GetNumMips();
+	stream.slotsPerRow = m_Streamer->GetSlotsPerRow();
+	stream.pageSize = m_Streamer->GetPageSize();
+	stream.albedoPageSize = m_Streamer->GetAlbedoPageSize();
+	stream.albedoSlotSize = m_Streamer->GetAlbedoSlotSize();
+
+	const nvrhi::TextureDesc& heightAtlasDesc = m_Resources->heightAtlas->getDesc();
+	stream.atlasInvSize.x = 1.0f / static_cast<float>(heightAtlasDesc.width);
+	stream.atlasInvSize.y = 1.0f / static_cast<float>(heightAtlasDesc.height);
+	if (m_Resources->colorAtlas)
+	{
+		const nvrhi::TextureDesc& colorAtlasDesc = m_Resources->colorAtlas->getDesc();
+		stream.atlasInvSize.z = 1.0f / static_cast<float>(colorAtlasDesc.width);
+		stream.atlasInvSize.w = 1.0f / static_cast<float>(colorAtlasDesc.height);
+	}
 
-	const std::shared_ptr<engine::MeshGeometry> geometry = std::make_shared<engine::MeshGeometry>();
-	geometry->material = nullptr;
-	geometry->numIndices = static_cast<uint32_t>(vIndices.size());
-	geometry->numVertices = static_cast<uint32_t>(vPositions.size());
+	for (uint32_t mip = 0; mip < m_Streamer->GetNumMips(); mip++)
+	{
+		const uint2 size = m_Streamer->GetMipSize(mip);
+		const uint2 albedoSize = m_Streamer->GetAlbedoMipSize(mip);
+		stream.mips[mip] = uint4(m_Streamer->GetMipFirstPage(mip), m_Streamer->GetMipNumPagesX(mip), size.x, size.y);
+		stream.albedoMipSizes[mip] = uint4(albedoSize.x, albedoSize.y, 0, 0);
+	}
 
-	m_MeshInfo = std::make_shared<engine::MeshInfo>();
-	m_MeshInfo->name = "TerrainMesh";
-	m_MeshInfo->buffers = m_Buffers;
-	m_MeshInfo->objectSpaceBounds = math::box3(math::float3(-0.5f), math::float3(0.5f));
-	m_MeshInfo->totalIndices = geometry->numIndices;
-	m_MeshInfo->totalVertices = geometry->numVertices;
-	m_MeshInfo->geometries.push_back(geometry);
+	log::info("Terrain streaming %u pages of %zu bytes in %u slots", static_cast<uint32_t>(m_Streamer->GetPageTable().size()),
+		m_Streamer->GetPageDataSize(), m_Streamer->GetNumSlots());
+}
+
+void TerrainPass::UpdateStreaming(nvrhi::ICommandList* commandList, const float3& cameraPosition)
+{
+	if (!m_Streamer)
+		return;
+
+	PROFILE_CPU_SCOPE();
+
+	// A node is refined once one of its children is in range, so the nodes of a level reach the range plus the parent
+	// diagonal. They sample the mip of their level and blend to the mip of the next one while morphing
+	std::array<float, TerrainBake::MAX_MIPS> mipRanges = {};
+	const QuadTree& quadTree = *m_QuadTrees[0];
+	for (int lodLevel = 0; lodLevel <= quadTree.GetNumLods(); lodLevel++)
+	{
+		const float reach = quadTree.GetLodRanges()[lodLevel] + 4.0f * length(quadTree.GetLodExtents()[lodLevel]);
+		const int mip = m_Streamer->GetMipForLod(lodLevel);
+		const int parentMip = m_Streamer->GetMipForLod(lodLevel + 1);
+		mipRanges[mip] = std::max(mipRanges[mip], reach);
+		mipRanges[parentMip] = std::max(mipRanges[parentMip], reach);
+	}
+
+	m_Streamer->Update(cameraPosition, std::span<const float>(mipRanges.data(), m_Streamer->GetNumMips()));
+
+	const std::span<const TileStreamer::PageUpload> uploads = m_Streamer->GetUploads();
+	if (!uploads.empty())
+	{
+		UploadPages(m_Device, commandList, m_Resources->heightAtlas, uploads, &TileStreamer::PageUpload::heightTexels, m_Streamer->GetPageSize() + 1,
+			m_Streamer->GetSlotsPerRow(), 1, GetBytesPerTexel(m_Streamer->GetHeightFormat()));
+		if (m_Resources->normalAtlas)
+		{
+			UploadPages(m_Device, commandList, m_Resources->normalAtlas, uploads, &TileStreamer::PageUpload::normalTexels, m_Streamer->GetPageSize() + 1,
+				m_Streamer->GetSlotsPerRow(), 1, NormalMap::BYTES_PER_TEXEL);
+		}
+		if (m_Resources->colorAtlas)
+		{
+			const TerrainBake::AlbedoFormat albedoFormat = m_Streamer->GetAlbedoFormat();
+			UploadPages(m_Device, commandList, m_Resources->colorAtlas, uploads, &TileStreamer::PageUpload::albedoTexels, m_Streamer->GetAlbedoSlotSize(),
+				m_Streamer->GetSlotsPerRow(), TerrainBake::GetAlbedoBlockSize(albedoFormat), TerrainBake::GetAlbedoBlockBytes(albedoFormat));
+		}
+	}
+
+	if (m_PageTableGeneration != m_Streamer->GetGeneration())
+	{
+		const std::span<const uint32_t> pageTable = m_Streamer->GetPageTable();
+		commandList->writeBuffer(m_PageTableBuffer, pageTable.data(), pageTable.size_bytes());
+		m_PageTableGeneration = m_Streamer->GetGeneration();
+	}
+}
+
+void TerrainPass::WriteBakeWhenBuilt()
+{
+	if (m_BakeTarget.path.empty())
+		return;
+
+	for (const std::shared_ptr<QuadTree>& quadTree : m_QuadTrees)
+	{
+		if (!quadTree->IsHeightLoaded())
+			return;
+	}
+
+	// the task holds its own references, the pass may be destroyed or reloaded before the bake is written
+	TerrainBake::BakeParameters bakeParams;
+	bakeParams.sourceStamp = m_BakeTarget.sourceStamp;
+	bakeParams.worldSize = (float)WORLD_SIZE;
+	bakeParams.surfaceSize = (float)SURFACE_SIZE;
+	m_Executor->silent_async([path = m_BakeTarget.path, bakeParams, quadTrees = m_QuadTrees, heightmap = m_Resources->heightmap,
+		colorData = m_Resources->colorData, albedo = m_Resources->albedo]()
+	{
+		std::vector<const QuadTree*> trees;
+		for (const std::shared_ptr<QuadTree>& quadTree : quadTrees)
+			trees.push_back(quadTree.get());
+
+		if (TerrainBake::Write(path, bakeParams, *heightmap, trees, colorData ? &albedo : nullptr))
+			log::info("Baked terrain to %s", path.generic_string().c_str());
+	});
+	m_BakeTarget = BakeTarget();
 }
 
 void TerrainPass::Render(
@@ -154,6 +659,8 @@ void TerrainPass::Render(
 	m_RenderParams = renderParams;
 	m_MaxHeight = editorParams.m_MaxHeight;
 
+	WriteBakeWhenBuilt();
+
 	const engine::ViewType::Enum supportedViewTypes = GetSupportedViewTypes();
 
 	if (compositeViewPrev)
@@ -162,43 +669,74 @@ void TerrainPass::Render(
 		assert(compositeView->GetNumChildViews(supportedViewTypes) == compositeViewPrev->GetNumChildViews(supportedViewTypes));
 	}
 
-	for (uint viewIndex = 0; viewIndex < compositeView->GetNumChildViews(supportedViewTypes); viewIndex++)
+	const uint numViews = compositeView->GetNumChildViews(supportedViewTypes);
+	assert(numViews <= QuadTree::MAX_SELECT_VIEWS);
+
+	BatchSelection& batch = m_Selections[compositeView];
+	batch.lastFrame = m_FrameIndex;
+	if (batch.views.size() != numViews)
 	{
-		const engine::IView* view = compositeView->GetChildView(supportedViewTypes, viewIndex);
-		const engine::IView* viewPrev = compositeViewPrev ? compositeViewPrev->GetChildView(supportedViewTypes, viewIndex) : nullptr;
+		batch.views.assign(numViews, ViewSelection());
+		batch.instanceData.resize(static_cast<size_t>(MAX_INSTANCES) * numViews);
+		batch.groupedInstanceData.resize(batch.instanceData.size());
+		batch.instanceBuffer = CreateInstanceBuffer(m_Device, MAX_INSTANCES * numViews);
+		batch.numInstances = 0;
+		batch.uploaded = false;
+		batch.drawArgsBuffer = CreateDrawArgsBuffer(commandList, numViews);
+		batch.drawArgsTier = m_RenderParams.gridTier;
+		batch.selectBindingSets = {};
+		batch.gpuSelected = false;
+	}
 
-		assert(view != nullptr);
+	// The tier may change every frame
+	if (batch.drawArgsTier != m_RenderParams.gridTier)
+		WriteDrawArgsGrid(commandList, batch);
 
-		int numNodes = 0;
-		if (!m_RenderParams.lockView)
+	if (!m_RenderParams.lockView && numViews > 0)
+	{
+		// The compute passes don't know which pages are resident nor write the stitch flags, streamed and stitched
+		// terrains are selected on the CPU
+		if (m_RenderParams.gpuSelection && !m_RenderParams.stitchEdges && !m_Streamer && UploadNodeHeights(commandList))
 		{
-			int instanceDataOffset = 0;
-			for (const auto& quadTree : m_QuadTrees)
-			{
-				quadTree->ClearSelectedNodes();
-				quadTree->m_DebugDrawData.view = view;
-				quadTree->m_DebugDrawData.culledNodes.clear();
-				quadTree->NodeSelect(float3(view->GetViewOrigin()), quadTree->GetRootNode().get(), quadTree->GetNumLods(), view->GetViewFrustum(), m_MaxHeight);
-
-				UpdateTransforms(quadTree, instanceDataOffset);
-
-				instanceDataOffset += static_cast<int>(quadTree->GetSelectedNodes().size());
-			}
-			numNodes = instanceDataOffset;
-			commandList->writeBuffer(m_Buffers->instanceBuffer, m_Resources->instanceData.data(), m_Resources->instanceData.size() * sizeof(InstanceData));
-			commandList->setBufferState(m_Buffers->instanceBuffer, nvrhi::ResourceStates::VertexBuffer);
+			SelectNodesGpu(commandList, compositeView, batch);
+			batch.gpuSelected = true;
+			batch.uploaded = false; // the compute passes overwrote the CPU instances
 		}
 		else
 		{
-			for (const auto& quadTree : m_QuadTrees)
-			{
-				numNodes += static_cast<int>(quadTree->GetSelectedNodes().size());
-			}
+			SelectNodes(compositeView, batch);
+			batch.gpuSelected = false;
+			// Only the selected instances are uploaded, writeBuffer stages them through the command list upload ring
+			if (batch.numInstances > 0 && !batch.uploaded)
+				commandList->writeBuffer(batch.instanceBuffer, batch.instanceData.data(), batch.numInstances * sizeof(TerrainInstanceData));
+			batch.uploaded = true;
 		}
-		editorParams.m_NumChunks = numNodes;
+	}
+	editorParams.m_NumChunks = batch.gpuSelected ? 0 : batch.numInstances; // the GPU count is never read back
+
+	const bool hasInstances = batch.gpuSelected || batch.numInstances > 0;
+	if (hasInstances)
+		commandList->setBufferState(batch.instanceBuffer, nvrhi::ResourceStates::VertexBuffer);
+
+	// One draw per child view, each from its own range of the shared instance buffer
+	for (uint viewIndex = 0; viewIndex < numViews && hasInstances; viewIndex++)
+	{
+		const engine::IView* view = compositeView->GetChildView(supportedViewTypes, viewIndex);
+		const engine::IView* viewPrev = compositeViewPrev ? compositeViewPrev->GetChildView(supportedViewTypes, viewIndex) : nullptr;
+
+		assert(view != nullptr);
+
+		const ViewSelection& viewSelection = batch.views[viewIndex];
+		if (!batch.gpuSelected && viewSelection.numInstances == 0)
+			continue;
+
+		const SelectionView selectionView = GetSelectionView(view, viewIndex, viewSelection.lodBudgetScale);
+		m_LodOrigin = selectionView.position;
+		m_LodRangeScale = selectionView.lodRangeScale;
 
 		nvrhi::IFramebuffer* framebuffer = framebufferFactory.GetFramebuffer(*view);
 		Context passContext;
+		passContext.instanceBuffer = batch.instanceBuffer;
 		SetupView(passContext, commandList, view, viewPrev);
 
 		nvrhi::GraphicsState graphicsState;
@@ -210,16 +748,34 @@ void TerrainPass::Render(
 
 		if (SetupMaterial(passContext, nullptr, nvrhi::RasterCullMode::Back, graphicsState))
 		{
-			commandList->setGraphicsState(graphicsState);
+			if (batch.gpuSelected)
+			{
+				// Everything but the instance count was written with the buffer
+				graphicsState.indirectParams = batch.drawArgsBuffer;
+				commandList->setGraphicsState(graphicsState);
+				commandList->drawIndexedIndirect(viewIndex * sizeof(nvrhi::DrawIndexedIndirectArguments));
+				continue;
+			}
 
-			nvrhi::DrawArguments args;
-			args.vertexCount = m_MeshInfo->geometries[0]->numIndices;
-			args.startVertexLocation = m_MeshInfo->vertexOffset + m_MeshInfo->geometries[0]->vertexOffsetInMesh;
-			args.startIndexLocation = m_MeshInfo->indexOffset + m_MeshInfo->geometries[0]->indexOffsetInMesh;
-			args.startInstanceLocation = 0;
-			args.instanceCount += numNodes;
+			commandList->setGraphicsState(graphicsState);
 
-			commandList->drawIndexed(args);
+			// One draw per stitch mask in use, each with the grid variant stitching those edges
+			for (uint32_t stitchMask = 0; stitchMask < TerrainGrid::NUM_STITCH_VARIANTS; stitchMask++)
+			{
+				const int numStitched = viewSelection.stitchOffsets[stitchMask + 1] - viewSelection.stitchOffsets[stitchMask];
+				if (numStitched == 0)
+					continue;
+
+				const engine::MeshGeometry& geometry = GetGridGeometry(m_RenderParams.gridTier, stitchMask);
+				nvrhi::DrawArguments args;
+				args.vertexCount = geometry.numIndices;
+				args.startVertexLocation = m_MeshInfo->vertexOffset + geometry.vertexOffsetInMesh;
+				args.startIndexLocation = m_MeshInfo->indexOffset + geometry.indexOffsetInMesh;
+				args.startInstanceLocation = viewSelection.firstInstance + viewSelection.stitchOffsets[stitchMask];
+				args.instanceCount = numStitched;
+
+				commandList->drawIndexed(args);
+			}
 		}
 		else
 		{
@@ -231,28 +787,332 @@ void TerrainPass::Render(
 	PROFILE_CPU_END();
 }
 
-void vRenderer::TerrainPass::UpdateTransforms(const std::shared_ptr<QuadTree>& quadTree, const int instanceDataOffset) const
+void TerrainPass::BeginFrame()
+{
+	std::erase_if(m_Selections, [this](const auto& entry) { return entry.second.lastFrame != m_FrameIndex; });
+	m_FrameIndex++;
+}
+
+SelectionView TerrainPass::GetSelectionView(const engine::IView* view, const uint viewIndex, const float lodBudgetScale) const
+{
+	// LOD distances are measured from the lod view when there is one, shadow cascades get coarser further out
+	const engine::IView* lodView = m_RenderParams.lodView ? m_RenderParams.lodView : view;
+
+	SelectionView selectionView;
+	selectionView.position = float3(lodView->GetViewOrigin());
+	selectionView.frustum = view->GetViewFrustum();
+	selectionView.lodRangeScale = m_RenderParams.lodRangeScale * powf(m_RenderParams.cascadeLodRangeScale, static_cast<float>(viewIndex)) * lodBudgetScale;
+	return selectionView;
+}
+
+int TerrainPass::SelectNodes(const engine::ICompositeView* compositeView, BatchSelection& batch) const
 {
 	PROFILE_CPU_SCOPE();
-	auto& nodes = quadTree->GetSelectedNodes();
-	assert(static_cast<int>(nodes.size()) < MAX_INSTANCES);
 
-	for (int i = 0; i < nodes.size(); i++)
+	const engine::ViewType::Enum supportedViewTypes = GetSupportedViewTypes();
+	const int numViews = static_cast<int>(batch.views.size());
+	const int numQuadTrees = static_cast<int>(m_QuadTrees.size());
+
+	std::array<SelectionView, QuadTree::MAX_SELECT_VIEWS> selectionViews;
+	for (int v = 0; v < numViews; v++)
 	{
-		const Node* node = nodes[i];
-		InstanceData& idata = m_Resources->instanceData[instanceDataOffset + i];
+		ViewSelection& viewSelection = batch.views[v];
+		viewSelection.quadTrees.resize(numQuadTrees);
+		viewSelection.instanceOffsets.resize(numQuadTrees + 1);
+		viewSelection.instanceOffsets[0] = 0;
 
-		math::affine3 scale = math::scaling(node->m_Extents);
-		math::affine3 translation = math::translation(node->m_Position);
-		math::affine3 transform = scale * translation;
+		// A view back well within the budget gets its LOD ranges back a step at a time
+		if (viewSelection.lodBudgetScale < 1.0f && viewSelection.numInstances < MAX_INSTANCES / 2)
+			viewSelection.lodBudgetScale = std::min(viewSelection.lodBudgetScale / LOD_BUDGET_STEP, 1.0f);
 
-		affineToColumnMajor(transform, idata.transform);
-		idata.firstGeometryInstanceIndex = 0;
-		idata.firstGeometryIndex = 0;
-		idata.numGeometries = 1;
-		idata.padding = 0u;
+		selectionViews[v] = GetSelectionView(compositeView->GetChildView(supportedViewTypes, v), v, viewSelection.lodBudgetScale);
 	}
 
+	// Each task walks one quadtree once for all the views
+	std::atomic<bool> selectionChanged = false;
+	auto selectNodes = [this, &batch, &selectionViews, numViews, &selectionChanged](const int i)
+		{
+			std::array<QuadTreeSelection*, QuadTree::MAX_SELECT_VIEWS> selections;
+			for (int v = 0; v < numViews; v++)
+				selections[v] = &batch.views[v].quadTrees[i];
+
+			const auto& quadTree = m_QuadTrees[i];
+			if (m_RenderParams.incrementalSelection)
+			{
+				if (quadTree->UpdateSelections(selections.data(), selectionViews.data(), numViews, m_MaxHeight) != 0)
+					selectionChanged = true;
+			}
+			else
+			{
+				for (int v = 0; v < numViews; v++)
+					selections[v]->Clear();
+				quadTree->NodeSelect(selections.data(), selectionViews.data(), numViews, m_MaxHeight);
+				selectionChanged = true;
+			}
+		};
+
+	// Views past the instance budget are selected again with shorter LOD ranges until they fit, coarser nodes cover
+	// the same area with fewer instances where dropping instances would leave holes
+	auto fitBudget = [this, &batch, &selectionViews, numQuadTrees, &selectionChanged](const int v)
+		{
+			ViewSelection& viewSelection = batch.views[v];
+			auto countInstances = [&viewSelection]()
+				{
+					int numInstances = 0;
+					for (const QuadTreeSelection& selection : viewSelection.quadTrees)
+						numInstances += selection.m_NumInstances;
+					return numInstances;
+				};
+
+			while (countInstances() > MAX_INSTANCES && viewSelection.lodBudgetScale > MIN_LOD_BUDGET_SCALE)
+			{
+				viewSelection.lodBudgetScale *= LOD_BUDGET_STEP;
+				SelectionView& selectionView = selectionViews[v];
+				selectionView.lodRangeScale *= LOD_BUDGET_STEP;
+				for (int i = 0; i < numQuadTrees; i++)
+				{
+					viewSelection.quadTrees[i].Clear();
+					m_QuadTrees[i]->NodeSelect(viewSelection.quadTrees[i], selectionView.position, selectionView.frustum, m_MaxHeight, selectionView.lodRangeScale);
+				}
+				selectionChanged = true;
+				log::warning("Terrain view %d is over the instance budget, LOD ranges scaled by %f", v, viewSelection.lodBudgetScale);
+			}
+		};
+
+	// The views are laid out one after the other, each quadtree writes its own range within them once the offsets are known.
+	// The ranges are clamped to the view's part of the buffers in case even the coarsest ranges don't fit
+	auto computeOffsets = [&batch, numViews, numQuadTrees]()
+		{
+			int firstInstance = 0;
+			for (int v = 0; v < numViews; v++)
+			{
+				ViewSelection& viewSelection = batch.views[v];
+				int numDropped = 0;
+				for (int i = 0; i < numQuadTrees; i++)
+				{
+					const int numInstances = viewSelection.quadTrees[i].m_NumInstances;
+					const int numKept = std::min(numInstances, MAX_INSTANCES - viewSelection.instanceOffsets[i]);
+					viewSelection.instanceOffsets[i + 1] = viewSelection.instanceOffsets[i] + numKept;
+					numDropped += numInstances - numKept;
+				}
+				if (numDropped > 0)
+					log::warning("Terrain view %d is %d instances over budget at LOD range scale %f", v, numDropped, viewSelection.lodBudgetScale);
+
+				viewSelection.firstInstance = firstInstance;
+				viewSelection.numInstances = viewSelection.instanceOffsets[numQuadTrees];
+				firstInstance += viewSelection.numInstances;
+			}
+			batch.numInstances = firstInstance;
+		};
+
+	auto updateTransforms = [this, &batch, numQuadTrees](const int task)
+		{
+			const ViewSelection& viewSelection = batch.views[task / numQuadTrees];
+			const int i = task % numQuadTrees;
+			UpdateTransforms(*m_QuadTrees[i], viewSelection.quadTrees[i], &batch.instanceData[viewSelection.firstInstance + viewSelection.instanceOffsets[i]],
+				viewSelection.instanceOffsets[i + 1] - viewSelection.instanceOffsets[i]);
+		};
+
+	// Counting sort of the instances of a view by stitch mask into the same range of the grouped copy. Without
+	// stitching the flags are cleared and every instance is drawn with the plain grid
+	const bool stitchEdges = m_RenderParams.stitchEdges;
+	auto groupInstances = [&batch, stitchEdges](const int v)
+		{
+			ViewSelection& viewSelection = batch.views[v];
+			const TerrainInstanceData* instances = &batch.instanceData[viewSelection.firstInstance];
+			TerrainInstanceData* grouped = &batch.groupedInstanceData[viewSelection.firstInstance];
+
+			std::array<int, TerrainGrid::NUM_STITCH_VARIANTS + 1>& offsets = viewSelection.stitchOffsets;
+			offsets.fill(0);
+			if (!stitchEdges)
+			{
+				for (int i = 0; i < viewSelection.numInstances; i++)
+				{
+					grouped[i] = instances[i];
+					grouped[i].lodAndFlags = ClearStitchFlags(instances[i].lodAndFlags);
+				}
+				std::fill(offsets.begin() + 1, offsets.end(), viewSelection.numInstances);
+				return;
+			}
+
+			for (int i = 0; i < viewSelection.numInstances; i++)
+				offsets[UnpackStitchMask(instances[i].lodAndFlags) + 1]++;
+			for (uint32_t stitchMask = 0; stitchMask < TerrainGrid::NUM_STITCH_VARIANTS; stitchMask++)
+				offsets[stitchMask + 1] += offsets[stitchMask];
+
+			std::array<int, TerrainGrid::NUM_STITCH_VARIANTS> next;
+			std::copy_n(offsets.begin(), next.size(), next.begin());
+			for (int i = 0; i < viewSelection.numInstances; i++)
+				grouped[next[UnpackStitchMask(instances[i].lodAndFlags)]++] = instances[i];
+		};
+
+	if (numQuadTrees > 1 && m_Executor)
+	{
+		tf::Taskflow taskflow("Terrain Select");
+		taskflow.for_each_index(0, numQuadTrees, 1, selectNodes).name("NodeSelect");
+		m_Executor->run(taskflow).wait();
+	}
+	else
+	{
+		for (int i = 0; i < numQuadTrees; i++)
+			selectNodes(i);
+	}
+
+	for (int v = 0; v < numViews; v++)
+		fitBudget(v);
+
+	// The instance data still holds this selection if no quadtree selected again and it was grouped the same way
+	if (!selectionChanged && batch.stitched == stitchEdges)
+		return batch.numInstances;
+	batch.stitched = stitchEdges;
+
+	computeOffsets();
+
+	const int numTasks = numViews * numQuadTrees;
+	if (numTasks > 1 && m_Executor)
+	{
+		tf::Taskflow taskflow("Terrain Transforms");
+		tf::Task transforms = taskflow.for_each_index(0, numTasks, 1, updateTransforms).name("UpdateTransforms");
+		tf::Task group = taskflow.for_each_index(0, numViews, 1, groupInstances).name("GroupInstances");
+		transforms.precede(group);
+		m_Executor->run(taskflow).wait();
+	}
+	else
+	{
+		for (int task = 0; task < numTasks; task++)
+			updateTransforms(task);
+		for (int v = 0; v < numViews; v++)
+			groupInstances(v);
+	}
+
+	// The grouped copy is the one uploaded and drawn, the other one is written again on the next selection
+	std::swap(batch.instanceData, batch.groupedInstanceData);
+	batch.uploaded = false;
+	return batch.numInstances;
+}
+
+void TerrainPass::SelectNodesGpu(nvrhi::ICommandList* commandList, const engine::ICompositeView* compositeView, BatchSelection& batch)
+{
+	PROFILE_CPU_SCOPE();
+	commandList->beginMarker("TerrainSelect");
+
+	if (!m_SelectRootPipeline)
+	{
+		m_SelectRootPipeline = CreateComputePipeline(m_SelectRootShader);
+		m_SelectLevelPipeline = CreateComputePipeline(m_SelectLevelShader);
+		m_SelectArgsPipeline = CreateComputePipeline(m_SelectArgsShader);
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (!batch.selectBindingSets[i])
+			batch.selectBindingSets[i] = CreateSelectBindingSet(batch, i);
+	}
+
+	const engine::ViewType::Enum supportedViewTypes = GetSupportedViewTypes();
+	for (uint viewIndex = 0; viewIndex < batch.views.size(); viewIndex++)
+	{
+		const SelectionView selectionView = GetSelectionView(compositeView->GetChildView(supportedViewTypes, viewIndex), viewIndex, batch.views[viewIndex].lodBudgetScale);
+
+		for (size_t i = 0; i < m_QuadTrees.size(); i++)
+		{
+			const QuadTree& quadTree = *m_QuadTrees[i];
+			const TerrainSelectConstants constants = TerrainSelect::MakeConstants(quadTree, selectionView, m_MaxHeight, m_NodeBases[i],
+				viewIndex * MAX_INSTANCES, MAX_INSTANCES, viewIndex * sizeof(nvrhi::DrawIndexedIndirectArguments));
+			commandList->writeBuffer(m_SelectConstantsCB, &constants, sizeof(constants));
+
+			// The root pass writes the arguments of the first level pass, which reads list 0
+			TerrainSelectPushConstants pushConstants = {};
+			pushConstants.resetInstances = i == 0 ? 1 : 0;
+
+			nvrhi::ComputeState state;
+			state.pipeline = m_SelectRootPipeline;
+			state.bindings = { batch.selectBindingSets[0] };
+			commandList->setComputeState(state);
+			commandList->setPushConstants(&pushConstants, sizeof(pushConstants));
+			commandList->dispatch(1);
+
+			pushConstants.resetInstances = 0;
+			int inputList = 0;
+			for (int lodLevel = quadTree.GetNumLods(); lodLevel >= 0; lodLevel--)
+			{
+				pushConstants.lodLevel = static_cast<uint>(lodLevel);
+				pushConstants.inputList = static_cast<uint>(inputList);
+
+				// Both passes bind the arguments buffer the level pass does not read
+				state.pipeline = m_SelectLevelPipeline;
+				state.bindings = { batch.selectBindingSets[1 - inputList] };
+				state.indirectParams = m_DispatchArgsBuffers[inputList];
+				commandList->setComputeState(state);
+				commandList->setPushConstants(&pushConstants, sizeof(pushConstants));
+				commandList->dispatchIndirect(0);
+
+				state.pipeline = m_SelectArgsPipeline;
+				state.indirectParams = nullptr;
+				commandList->setComputeState(state);
+				commandList->setPushConstants(&pushConstants, sizeof(pushConstants));
+				commandList->dispatch(1);
+
+				inputList = 1 - inputList;
+			}
+		}
+	}
+
+	commandList->endMarker();
+}
+
+bool TerrainPass::UploadNodeHeights(nvrhi::ICommandList* commandList)
+{
+	if (m_NodeHeightsBuffer)
+		return true;
+
+	if (m_QuadTrees.empty())
+		return false;
+
+	size_t numNodes = 0;
+	for (const auto& quadTree : m_QuadTrees)
+	{
+		if (!quadTree->IsHeightLoaded())
+			return false;
+		numNodes += quadTree->GetNodes().size();
+	}
+
+	// Raw buffers are read by 4 byte words, the last node may sit in the lower half of one
+	std::vector<Node> nodes;
+	nodes.reserve(numNodes + 1);
+	m_NodeBases.resize(m_QuadTrees.size());
+	for (size_t i = 0; i < m_QuadTrees.size(); i++)
+	{
+		m_NodeBases[i] = static_cast<uint32_t>(nodes.size());
+		const std::span<const Node> treeNodes = m_QuadTrees[i]->GetNodes();
+		nodes.insert(nodes.end(), treeNodes.begin(), treeNodes.end());
+	}
+	if (nodes.size() % 2 != 0)
+		nodes.emplace_back();
+
+	nvrhi::BufferDesc bufferDesc;
+	bufferDesc.byteSize = nodes.size() * sizeof(Node);
+	bufferDesc.debugName = "Terrain Node Heights";
+	bufferDesc.canHaveRawViews = true;
+	bufferDesc.initialState = nvrhi::ResourceStates::ShaderResource;
+	bufferDesc.keepInitialState = true;
+	m_NodeHeightsBuffer = m_Device->createBuffer(bufferDesc);
+
+	commandList->writeBuffer(m_NodeHeightsBuffer, nodes.data(), bufferDesc.byteSize);
+	return true;
+}
+
+void TerrainPass::UpdateTransforms(const QuadTree& quadTree, const QuadTreeSelection& selection, TerrainInstanceData* instanceData, const int maxInstances)
+{
+	PROFILE_CPU_SCOPE();
+
+	quadTree.PackInstances(selection, instanceData, maxInstances);
+}
+
+const TerrainPass::ViewSelection* TerrainPass::GetViewSelection(const engine::ICompositeView* compositeView, const uint viewIndex) const
+{
+	const auto it = m_Selections.find(compositeView);
+	return it != m_Selections.end() && viewIndex < it->second.views.size() ? &it->second.views[viewIndex] : nullptr;
 }
 
 void TerrainPass::CreateShaders(engine::ShaderFactory& shaderFactory, const CreateParameters& params)
@@ -261,10 +1121,17 @@ void TerrainPass::CreateShaders(engine::ShaderFactory& shaderFactory, const Crea
 	m_PixelShader = CreatePixelShader(shaderFactory, params);
 	m_InputLayout = CreateInputLayout(m_VertexShader, params);
 
+	m_SelectRootShader = shaderFactory.CreateShader("/shaders/vrenderer/terrain/terrain_select_cs.hlsl", "main_root", nullptr, nvrhi::ShaderType::Compute);
+	m_SelectLevelShader = shaderFactory.CreateShader("/shaders/vrenderer/terrain/terrain_select_cs.hlsl", "main_level", nullptr, nvrhi::ShaderType::Compute);
+	m_SelectArgsShader = shaderFactory.CreateShader("/shaders/vrenderer/terrain/terrain_select_cs.hlsl", "main_args", nullptr, nvrhi::ShaderType::Compute);
+
 	for (int i = 0; i < PipelineKey::Count; ++i)
 	{
 		m_Pipelines[i].Reset();
 	}
+	m_SelectRootPipeline.Reset();
+	m_SelectLevelPipeline.Reset();
+	m_SelectArgsPipeline.Reset();
 }
 
 engine::ViewType::Enum TerrainPass::GetSupportedViewTypes() const
@@ -285,14 +1152,17 @@ void TerrainPass::SetupView(GeometryPassContext& context, nvrhi::ICommandList* c
 	paramsConstants.worldSize = WORLD_SIZE;
 	paramsConstants.surfaceSize = (float)SURFACE_SIZE;
 	paramsConstants.maxHeight = m_MaxHeight;
-	paramsConstants.gridSize = GRID_SIZE;
+	paramsConstants.gridSize = static_cast<float>(TerrainGrid::GetGridSize(m_RenderParams.gridTier));
+	paramsConstants.lodOrigin = float4(m_LodOrigin, 0.0f);
+	paramsConstants.normalMap = m_Resources->normalTexture || m_Resources->normalAtlas ? 1 : 0;
+	paramsConstants.stream = m_Resources->streamConstants;
 
 	if (!m_QuadTrees.empty())
 	{
 		const auto& lodRanges = m_QuadTrees[0]->GetLodRanges();
 		for (int i = 0; i < lodRanges.size(); i++)
 		{
-			paramsConstants.lodRanges[i].x = lodRanges[i];
+			paramsConstants.lodRanges[i].x = lodRanges[i] * m_LodRangeScale;
 		}
 	}
 	commandList->writeBuffer(m_TerrainViewPassCB, &viewConstants, sizeof(viewConstants));
@@ -336,12 +1206,14 @@ bool TerrainPass::SetupMaterial(GeometryPassContext& context, const engine::Mate
 
 void TerrainPass::SetupInputBuffers(GeometryPassContext& context, const engine::BufferGroup* buffers, nvrhi::GraphicsState& state)
 {
+	const Context& terrainContext = (Context&)context;
+
 	state.vertexBuffers = {
 		{buffers->vertexBuffer, 0, buffers->getVertexBufferRange(engine::VertexAttribute::Position).byteOffset },
-		{buffers->instanceBuffer, 1, 0 },
+		{terrainContext.instanceBuffer, 1, 0 },
 	};
 
-	state.indexBuffer = { buffers->indexBuffer, nvrhi::Format::R32_UINT, 0 };
+	state.indexBuffer = { buffers->indexBuffer, nvrhi::Format::R16_UINT, 0 };
 }
 
 nvrhi::InputLayoutHandle TerrainPass::CreateInputLayout(nvrhi::IShader* vertexShader, const CreateParameters& params) const
@@ -349,7 +1221,27 @@ nvrhi::InputLayoutHandle TerrainPass::CreateInputLayout(nvrhi::IShader* vertexSh
 	const nvrhi::VertexAttributeDesc inputDescs[] =
 	{
 		engine::GetVertexAttributeDesc(engine::VertexAttribute::Position, "POS", 0),
-		engine::GetVertexAttributeDesc(engine::VertexAttribute::Transform, "TRANSFORM", 1)
+		nvrhi::VertexAttributeDesc()
+			.setName("INSTANCE_OFFSET")
+			.setFormat(nvrhi::Format::RG32_FLOAT)
+			.setBufferIndex(1)
+			.setOffset(offsetof(TerrainInstanceData, offset))
+			.setElementStride(sizeof(TerrainInstanceData))
+			.setIsInstanced(true),
+		nvrhi::VertexAttributeDesc()
+			.setName("INSTANCE_SCALE")
+			.setFormat(nvrhi::Format::R32_FLOAT)
+			.setBufferIndex(1)
+			.setOffset(offsetof(TerrainInstanceData, scale))
+			.setElementStride(sizeof(TerrainInstanceData))
+			.setIsInstanced(true),
+		nvrhi::VertexAttributeDesc()
+			.setName("INSTANCE_LOD")
+			.setFormat(nvrhi::Format::R32_UINT)
+			.setBufferIndex(1)
+			.setOffset(offsetof(TerrainInstanceData, lodAndFlags))
+			.setElementStride(sizeof(TerrainInstanceData))
+			.setIsInstanced(true)
 	};
 
 	return m_Device->createInputLayout(inputDescs, dim(inputDescs), vertexShader);
@@ -400,6 +1292,11 @@ nvrhi::BindingLayoutHandle vRenderer::TerrainPass::CreateHeightmapBindingLayout(
 	heightmapLayoutDescs.bindings = {
 		nvrhi::BindingLayoutItem::Texture_SRV(0),
 		nvrhi::BindingLayoutItem::Texture_SRV(1),
+		nvrhi::BindingLayoutItem::TypedBuffer_SRV(2),
+		nvrhi::BindingLayoutItem::Texture_SRV(3),
+		nvrhi::BindingLayoutItem::Texture_SRV(4),
+		nvrhi::BindingLayoutItem::Texture_SRV(5),
+		nvrhi::BindingLayoutItem::Texture_SRV(6),
 		nvrhi::BindingLayoutItem::Sampler(0)
 	};
 
@@ -408,12 +1305,29 @@ nvrhi::BindingLayoutHandle vRenderer::TerrainPass::CreateHeightmapBindingLayout(
 
 nvrhi::BindingSetHandle vRenderer::TerrainPass::GetOrCreateHeightmapBindingSet()
 {
-	const bool textureLoaded = m_Resources->heightmapTexture && m_Resources->heightmapTexture->texture;
+	nvrhi::ITexture* heightmapTexture = m_CommonPasses->m_BlackTexture;
+	nvrhi::ITexture* colorTexture = m_CommonPasses->m_BlackTexture;
+	if (m_Resources->bakedHeightmapTexture)
+	{
+		heightmapTexture = m_Resources->bakedHeightmapTexture;
+		if (m_Resources->bakedColorTexture)
+			colorTexture = m_Resources->bakedColorTexture;
+	}
+	else if (m_Resources->heightmapTexture && m_Resources->heightmapTexture->texture)
+	{
+		heightmapTexture = m_Resources->heightmapTexture->texture;
+		colorTexture = m_Resources->colorTexture->texture;
+	}
 
 	nvrhi::BindingSetDesc bindingSetDescs;
 	bindingSetDescs.bindings = {
-		nvrhi::BindingSetItem::Texture_SRV(0, textureLoaded ? m_Resources->heightmapTexture->texture : m_CommonPasses->m_BlackTexture, nvrhi::Format::UNKNOWN),
-		nvrhi::BindingSetItem::Texture_SRV(1, textureLoaded ? m_Resources->colorTexture->texture : m_CommonPasses->m_BlackTexture, nvrhi::Format::UNKNOWN),
+		nvrhi::BindingSetItem::Texture_SRV(0, heightmapTexture, nvrhi::Format::UNKNOWN),
+		nvrhi::BindingSetItem::Texture_SRV(1, colorTexture, nvrhi::Format::UNKNOWN),
+		nvrhi::BindingSetItem::TypedBuffer_SRV(2, m_PageTableBuffer),
+		nvrhi::BindingSetItem::Texture_SRV(3, m_Resources->heightAtlas ? m_Resources->heightAtlas.Get() : m_CommonPasses->m_BlackTexture.Get(), nvrhi::Format::UNKNOWN),
+		nvrhi::BindingSetItem::Texture_SRV(4, m_Resources->colorAtlas ? m_Resources->colorAtlas.Get() : m_CommonPasses->m_BlackTexture.Get(), nvrhi::Format::UNKNOWN),
+		nvrhi::BindingSetItem::Texture_SRV(5, m_Resources->normalTexture ? m_Resources->normalTexture.Get() : m_CommonPasses->m_BlackTexture.Get(), nvrhi::Format::UNKNOWN),
+		nvrhi::BindingSetItem::Texture_SRV(6, m_Resources->normalAtlas ? m_Resources->normalAtlas.Get() : m_CommonPasses->m_BlackTexture.Get(), nvrhi::Format::UNKNOWN),
 		nvrhi::BindingSetItem::Sampler(0, m_CommonPasses->m_LinearClampSampler)
 	};
 
@@ -503,12 +1417,12 @@ nvrhi::BufferHandle TerrainPass::CreateGeometryBuffer(nvrhi::IDevice* device, nv
 	return bufHandle;
 }
 
-nvrhi::BufferHandle TerrainPass::CreateInstanceBuffer(nvrhi::IDevice* device) const
+nvrhi::BufferHandle TerrainPass::CreateInstanceBuffer(nvrhi::IDevice* device, const uint32_t maxInstances) const
 {
 	nvrhi::BufferDesc bufferDesc;
-	bufferDesc.byteSize = sizeof(InstanceData) * m_Resources->instanceData.size();
+	bufferDesc.byteSize = sizeof(TerrainInstanceData) * maxInstances;
 	bufferDesc.debugName = "Terrain Instance Transform Data";
-	bufferDesc.structStride = /*m_EnableBindlessResources*/false ? sizeof(InstanceData) : 0;
+	bufferDesc.structStride = /*m_EnableBindlessResources*/false ? sizeof(TerrainInstanceData) : 0;
 	bufferDesc.canHaveRawViews = true;
 	bufferDesc.canHaveUAVs = true;
 	bufferDesc.isVertexBuffer = true;
@@ -517,3 +1431,123 @@ nvrhi::BufferHandle TerrainPass::CreateInstanceBuffer(nvrhi::IDevice* device) co
 
 	return device->createBuffer(bufferDesc);
 }
+
+nvrhi::BufferHandle TerrainPass::CreateDrawArgsBuffer(nvrhi::ICommandList* commandList, const uint32_t numViews) const
+{
+	nvrhi::BufferDesc bufferDesc;
+	bufferDesc.byteSize = sizeof(nvrhi::DrawIndexedIndirectArguments) * std::max(numViews, 1u);
+	bufferDesc.debugName = "Terrain Draw Arguments";
+	bufferDesc.canHaveRawViews = true;
+	bufferDesc.canHaveUAVs = true;
+	bufferDesc.isDrawIndirectArgs = true;
+	bufferDesc.initialState = nvrhi::ResourceStates::IndirectArgument;
+	bufferDesc.keepInitialState = true;
+	nvrhi::BufferHandle buffer = m_Device->createBuffer(bufferDesc);
+
+	// The selection passes only write the instance counts
+	const engine::MeshGeometry& geometry = GetGridGeometry(m_RenderParams.gridTier);
+	std::vector<nvrhi::DrawIndexedIndirectArguments> args(numViews);
+	for (uint32_t i = 0; i < numViews; i++)
+	{
+		args[i].indexCount = geometry.numIndices;
+		args[i].instanceCount = 0;
+		args[i].startIndexLocation = m_MeshInfo->indexOffset + geometry.indexOffsetInMesh;
+		args[i].baseVertexLocation = static_cast<int32_t>(m_MeshInfo->vertexOffset + geometry.vertexOffsetInMesh);
+		args[i].startInstanceLocation = i * MAX_INSTANCES;
+	}
+	if (numViews > 0)
+		commandList->writeBuffer(buffer, args.data(), args.size() * sizeof(nvrhi::DrawIndexedIndirectArguments));
+
+	return buffer;
+}
+
+void TerrainPass::WriteDrawArgsGrid(nvrhi::ICommandList* commandList, BatchSelection& batch) const
+{
+	const engine::MeshGeometry& geometry = GetGridGeometry(m_RenderParams.gridTier);
+	const uint32_t indexCount = geometry.numIndices;
+	const int32_t indexRange[2] = {
+		static_cast<int32_t>(m_MeshInfo->indexOffset + geometry.indexOffsetInMesh),
+		static_cast<int32_t>(m_MeshInfo->vertexOffset + geometry.vertexOffsetInMesh) };
+
+	for (size_t i = 0; i < batch.views.size(); i++)
+	{
+		const uint64_t offset = i * sizeof(nvrhi::DrawIndexedIndirectArguments);
+		commandList->writeBuffer(batch.drawArgsBuffer, &indexCount, sizeof(indexCount), offset + offsetof(nvrhi::DrawIndexedIndirectArguments, indexCount));
+		commandList->writeBuffer(batch.drawArgsBuffer, indexRange, sizeof(indexRange), offset + offsetof(nvrhi::DrawIndexedIndirectArguments, startIndexLocation));
+	}
+	batch.drawArgsTier = m_RenderParams.gridTier;
+}
+
+const engine::MeshGeometry& TerrainPass::GetGridGeometry(const TerrainGrid::Tier tier, const uint32_t stitchMask) const
+{
+	assert(stitchMask < TerrainGrid::NUM_STITCH_VARIANTS);
+	return *m_MeshInfo->geometries[static_cast<uint32_t>(tier) * TerrainGrid::NUM_STITCH_VARIANTS + stitchMask];
+}
+
+void TerrainPass::CreateSelectBuffers()
+{
+	nvrhi::BufferDesc bufferDesc;
+	bufferDesc.canHaveRawViews = true;
+	bufferDesc.canHaveUAVs = true;
+	bufferDesc.initialState = nvrhi::ResourceStates::UnorderedAccess;
+	bufferDesc.keepInitialState = true;
+
+	bufferDesc.byteSize = 2 * TERRAIN_SELECT_MAX_NODES * sizeof(uint32_t);
+	bufferDesc.debugName = "Terrain Select Node Lists";
+	m_NodeListsBuffer = m_Device->createBuffer(bufferDesc);
+
+	bufferDesc.byteSize = 4 * sizeof(uint32_t);
+	bufferDesc.debugName = "Terrain Select Counters";
+	m_SelectCountersBuffer = m_Device->createBuffer(bufferDesc);
+
+	bufferDesc.byteSize = sizeof(nvrhi::DispatchIndirectArguments);
+	bufferDesc.debugName = "Terrain Select Dispatch Arguments";
+	bufferDesc.isDrawIndirectArgs = true;
+	for (nvrhi::BufferHandle& buffer : m_DispatchArgsBuffers)
+		buffer = m_Device->createBuffer(bufferDesc);
+}
+
+nvrhi::BindingLayoutHandle TerrainPass::CreateSelectBindingLayout() const
+{
+	nvrhi::BindingLayoutDesc selectLayoutDescs;
+	selectLayoutDescs.visibility = nvrhi::ShaderType::Compute;
+	selectLayoutDescs.bindings = {
+		nvrhi::BindingLayoutItem::VolatileConstantBuffer(0),
+		nvrhi::BindingLayoutItem::PushConstants(1, sizeof(TerrainSelectPushConstants)),
+		nvrhi::BindingLayoutItem::RawBuffer_SRV(0),
+		nvrhi::BindingLayoutItem::RawBuffer_UAV(0),
+		nvrhi::BindingLayoutItem::RawBuffer_UAV(1),
+		nvrhi::BindingLayoutItem::RawBuffer_UAV(2),
+		nvrhi::BindingLayoutItem::RawBuffer_UAV(3),
+		nvrhi::BindingLayoutItem::RawBuffer_UAV(4),
+	};
+
+	return m_Device->createBindingLayout(selectLayoutDescs);
+}
+
+nvrhi::BindingSetHandle TerrainPass::CreateSelectBindingSet(const BatchSelection& batch, const int dispatchArgsIndex) const
+{
+	nvrhi::BindingSetDesc bindingSetDescs;
+	bindingSetDescs.bindings = {
+		nvrhi::BindingSetItem::ConstantBuffer(0, m_SelectConstantsCB),
+		nvrhi::BindingSetItem::PushConstants(1, sizeof(TerrainSelectPushConstants)),
+		nvrhi::BindingSetItem::RawBuffer_SRV(0, m_NodeHeightsBuffer),
+		nvrhi::BindingSetItem::RawBuffer_UAV(0, batch.instanceBuffer),
+		nvrhi::BindingSetItem::RawBuffer_UAV(1, m_NodeListsBuffer),
+		nvrhi::BindingSetItem::RawBuffer_UAV(2, m_SelectCountersBuffer),
+		nvrhi::BindingSetItem::RawBuffer_UAV(3, m_DispatchArgsBuffers[dispatchArgsIndex]),
+		nvrhi::BindingSetItem::RawBuffer_UAV(4, batch.drawArgsBuffer),
+	};
+	bindingSetDescs.trackLiveness = m_TrackLiveness;
+
+	return m_Device->createBindingSet(bindingSetDescs, m_SelectBindingLayout);
+}
+
+nvrhi::ComputePipelineHandle TerrainPass::CreateComputePipeline(nvrhi::IShader* shader) const
+{
+	nvrhi::ComputePipelineDesc pipelineDescs;
+	pipelineDescs.CS = shader;
+	pipelineDescs.bindingLayouts = { m_SelectBindingLayout };
+
+	return m_Device->createComputePipeline(pipelineDescs);
+}
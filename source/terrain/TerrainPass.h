@@ -3,8 +3,12 @@
 #include <donut/engine/View.h>
 #include <donut/render/GeometryPasses.h>
 
+#include <filesystem>
 #include <mutex>
+#include <unordered_map>
 #include "QuadTree.h"
+#include "TerrainGrid.h"
+#include "TerrainInstance.h"
 
 namespace donut::engine
 {
@@ -13,6 +17,9 @@ namespace donut::engine
 	class CommonRenderPasses;
 }
 
+class BakedTerrain;
+class TileStreamer;
+
 using namespace donut;
 using namespace donut::render;
 
@@ -22,10 +29,9 @@ namespace vRenderer
 
 	enum TerrainSettings : int
 	{
-		MAX_INSTANCES = 4096,
+		MAX_INSTANCES = 4096, // per child view
 		SURFACE_SIZE = 2048,
-		WORLD_SIZE = 2048,
-		GRID_SIZE = 32
+		WORLD_SIZE = 2048
 	};
 	static_assert(WORLD_SIZE >= SURFACE_SIZE && (WORLD_SIZE % SURFACE_SIZE == 0));
 
@@ -51,6 +57,7 @@ namespace vRenderer
 		{
 		public:
 			nvrhi::BindingSetHandle lightBindingSet;
+			nvrhi::IBuffer* instanceBuffer = nullptr;
 			PipelineKey keyTemplate;
 
 			Context()
@@ -63,13 +70,64 @@ namespace vRenderer
 		{
 			bool trackLiveness = true;
 			uint32_t numConstantBufferVersions = 16;
+			uint64_t streamingBudget = 0; // bytes of baked terrain pages kept resident, 0 uploads the whole bake
+			TerrainGrid::Tier gridTier = TerrainGrid::Tier::Medium; // the streamed mips are matched to its density
+			uint32_t vertexCacheSize = TerrainGrid::CACHE_SIZE; // post-transform cache entries the grid index order is tuned for
+		};
+
+		// Where the terrain loaded from textures is baked once its quadtrees are built, no bake without a path
+		struct BakeTarget
+		{
+			std::filesystem::path path;
+			uint64_t sourceStamp = 0;
 		};
 
 		struct RenderParams
 		{
 			bool wireframe = false;
 			bool lockView = false;
+			bool incrementalSelection = true;
 			bool depthOnly = false;
+			bool gpuSelection = false; // select in compute passes and draw indirect, the CPU path is used until the node heights are uploaded
+			bool stitchEdges = true; // draw the edges bordering coarser nodes with the stitched grids, the compute passes don't stitch and are only used without
+			TerrainGrid::Tier gridTier = TerrainGrid::Tier::Medium; // every tier's mesh is resident, switching is free
+
+			// LOD distances are measured from lodView when set, otherwise from the rendered view. Shadow views pass the camera view
+			const engine::IView* lodView = nullptr;
+			float lodRangeScale = 1.0f; // below 1 selects coarser nodes
+			float cascadeLodRangeScale = 1.0f; // applied once more for every child view after the first
+		};
+
+		// Selection state of one child view, its instances are the range [firstInstance, firstInstance + numInstances) of the batch.
+		// Within it they are grouped by stitch mask, each group is drawn with its grid variant
+		struct ViewSelection
+		{
+			std::vector<QuadTreeSelection> quadTrees;
+			std::vector<int> instanceOffsets; // prefix sum of the selected instances per quadtree, where they are packed before grouping
+			std::array<int, TerrainGrid::NUM_STITCH_VARIANTS + 1> stitchOffsets = {}; // prefix sum of the instances per stitch mask, relative to firstInstance
+			int firstInstance = 0;
+			int numInstances = 0;
+			float lodBudgetScale = 1.0f; // below 1 while the view needs more than MAX_INSTANCES at its own LOD ranges
+		};
+
+		// Selection state of all the child views of a composite view, kept across frames. The views are selected
+		// in one traversal per quadtree and share one instance buffer, each view is drawn from its own range
+		struct BatchSelection
+		{
+			std::vector<ViewSelection> views;
+			std::vector<TerrainInstanceData> instanceData;
+			std::vector<TerrainInstanceData> groupedInstanceData; // scratch the instances are grouped into, swapped with instanceData
+			nvrhi::BufferHandle instanceBuffer;
+			int numInstances = 0;
+			bool uploaded = false; // instanceBuffer holds the current instance data
+			bool stitched = true; // instanceData was grouped with stitchEdges set
+
+			// GPU selection, view v writes the range [v * MAX_INSTANCES, (v + 1) * MAX_INSTANCES) and the draw arguments v
+			nvrhi::BufferHandle drawArgsBuffer;
+			std::array<nvrhi::BindingSetHandle, 2> selectBindingSets; // one per dispatch arguments buffer written
+			bool gpuSelected = false; // the last selection was made on the GPU, views are drawn indirect
+			TerrainGrid::Tier drawArgsTier = TerrainGrid::Tier::Medium; // grid whose index range the draw arguments hold
+			uint64_t lastFrame = 0; // frame the composite view was last rendered in
 		};
 
 	protected:
@@ -95,12 +153,39 @@ namespace vRenderer
 		nvrhi::BufferHandle m_TerrainParamsPassCB;
 
 		nvrhi::GraphicsPipelineHandle m_Pipelines[PipelineKey::Count];
+
+		// GPU selection
+		nvrhi::ShaderHandle m_SelectRootShader;
+		nvrhi::ShaderHandle m_SelectLevelShader;
+		nvrhi::ShaderHandle m_SelectArgsShader;
+		nvrhi::ComputePipelineHandle m_SelectRootPipeline;
+		nvrhi::ComputePipelineHandle m_SelectLevelPipeline;
+		nvrhi::ComputePipelineHandle m_SelectArgsPipeline;
+		nvrhi::BindingLayoutHandle m_SelectBindingLayout;
+		nvrhi::BufferHandle m_SelectConstantsCB;
+		nvrhi::BufferHandle m_NodeHeightsBuffer;
+		nvrhi::BufferHandle m_NodeListsBuffer;
+		nvrhi::BufferHandle m_SelectCountersBuffer;
+		std::array<nvrhi::BufferHandle, 2> m_DispatchArgsBuffers; // ping-pong, a level pass reads one while the next args pass writes the other
+		std::vector<uint32_t> m_NodeBases; // first node of each quadtree in m_NodeHeightsBuffer
+
+		// Streaming, the pages of a baked terrain are copied to atlas slots and found through the page table
+		std::shared_ptr<TileStreamer> m_Streamer;
+		nvrhi::BufferHandle m_PageTableBuffer;
+		uint64_t m_PageTableGeneration = ~0ull;
+
 		bool m_TrackLiveness = true;
 		std::mutex m_Mutex;
 		RenderParams m_RenderParams;
 		float m_MaxHeight = 1.0f;
+		float3 m_LodOrigin = float3(0.0f);
+		float m_LodRangeScale = 1.0f;
 
 		std::vector<std::shared_ptr<QuadTree>> m_QuadTrees;
+		std::unordered_map<const engine::ICompositeView*, BatchSelection> m_Selections;
+		uint64_t m_FrameIndex = 0;
+		tf::Executor* m_Executor = nullptr;
+		BakeTarget m_BakeTarget;
 
 		// Terrain Geometry
 		std::shared_ptr<engine::BufferGroup> m_Buffers;
@@ -110,6 +195,15 @@ namespace vRenderer
 		std::shared_ptr<Resources> m_Resources;
 		std::shared_ptr<engine::CommonRenderPasses> m_CommonPasses;
 
+		// Shaders, constant buffers, binding layouts and the grid meshes, everything but the terrain data
+		void InitCommon(engine::ShaderFactory& shaderFactory, const CreateParameters& params, nvrhi::ICommandList* commandList, tf::Executor& executor);
+		// Quadtrees of SURFACE_SIZE covering WORLD_SIZE, not initialized
+		void CreateQuadTrees();
+		// Writes the bake on a worker once all the quadtrees are built
+		void WriteBakeWhenBuilt();
+		// Streamer, atlases and page table of a baked terrain, the quadtrees must be initialized
+		void InitStreaming(const std::shared_ptr<BakedTerrain>& bake, uint64_t budget, TerrainGrid::Tier gridTier);
+
 		nvrhi::InputLayoutHandle CreateInputLayout(nvrhi::IShader* vertexShader, const CreateParameters& params) const;
 		static nvrhi::ShaderHandle CreateVertexShader(engine::ShaderFactory& shaderFactory, const CreateParameters& params);
 		static nvrhi::ShaderHandle CreatePixelShader(engine::ShaderFactory& shaderFactory, const CreateParameters& params);
@@ -127,7 +221,23 @@ namespace vRenderer
 
 		static nvrhi::BufferHandle CreateGeometryBuffer(nvrhi::IDevice* device, nvrhi::ICommandList* commandList, const char* debugName, const void* data, uint64_t dataSize, bool isVertexBuffer);
 
-		nvrhi::BufferHandle CreateInstanceBuffer(nvrhi::IDevice* device) const;
+		nvrhi::BufferHandle CreateInstanceBuffer(nvrhi::IDevice* device, uint32_t maxInstances) const;
+		nvrhi::BufferHandle CreateDrawArgsBuffer(nvrhi::ICommandList* commandList, uint32_t numViews) const;
+		// Points the draw arguments of every view at the grid of the render tier, the instance counts are kept
+		void WriteDrawArgsGrid(nvrhi::ICommandList* commandList, BatchSelection& batch) const;
+		// The grid of the tier stitched on the edges of stitchMask, the draw arguments written for GPU selection use the plain grid
+		const engine::MeshGeometry& GetGridGeometry(TerrainGrid::Tier tier, uint32_t stitchMask = 0) const;
+
+		nvrhi::BindingLayoutHandle CreateSelectBindingLayout() const;
+		nvrhi::BindingSetHandle CreateSelectBindingSet(const BatchSelection& batch, int dispatchArgsIndex) const;
+		nvrhi::ComputePipelineHandle CreateComputePipeline(nvrhi::IShader* shader) const;
+		void CreateSelectBuffers();
+
+		// Uploads the node heights of every quadtree once they are all loaded, returns true once they are on the GPU
+		bool UploadNodeHeights(nvrhi::ICommandList* commandList);
+
+		// LOD origin, frustum and LOD range scale the child view is selected with
+		SelectionView GetSelectionView(const engine::IView* view, uint viewIndex, float lodBudgetScale) const;
 
 	public:
 		TerrainPass(nvrhi::IDevice* device, std::shared_ptr<engine::CommonRenderPasses> commonPasses);
@@ -136,6 +246,13 @@ namespace vRenderer
 			nvrhi::ICommandList* commandList, 
 			const std::shared_ptr<engine::LoadedTexture>& heightmapTexture,
 			const std::shared_ptr<engine::LoadedTexture>& colorTexture,
+			tf::Executor& executor,
+			const BakeTarget& bakeTarget = BakeTarget());
+		// Same as Init from a baked terrain, its textures are uploaded from the mapping and the quadtrees read their bounds in place
+		void InitBaked(engine::ShaderFactory& shaderFactory,
+			const CreateParameters& params,
+			nvrhi::ICommandList* commandList,
+			const std::shared_ptr<BakedTerrain>& bake,
 			tf::Executor& executor);
 		void Render(
 			nvrhi::ICommandList* commandList, 
@@ -146,7 +263,22 @@ namespace vRenderer
 			EditorParams& editorParams
 		);
 
-		void UpdateTransforms(const std::shared_ptr<QuadTree>& quadTree, const int instanceDataOffset) const;
+		// Once per frame before any Render, drops the selections of the composite views not rendered last frame.
+		// The selections are keyed by view address, a view destroyed for more than a frame can't leave its state to a new one
+		void BeginFrame();
+
+		// Once per frame before any Render, streams the pages around the camera and uploads the ones made resident.
+		// Does nothing unless the terrain was baked and initialized with a streaming budget
+		void UpdateStreaming(nvrhi::ICommandList* commandList, const float3& cameraPosition);
+
+		// Selects the nodes of every quadtree for all the child views as parallel tasks and fills the batch instance data, returns the number of instances.
+		// The instance data is only rewritten, and marked for upload, when a view of a quadtree selected again. LOD ranges are scaled
+		// by each view's lodBudgetScale, lowered until the view fits in MAX_INSTANCES
+		int SelectNodes(const engine::ICompositeView* compositeView, BatchSelection& batch) const;
+		// Records the selection compute passes of every child view and quadtree, the CPU does no per node work
+		void SelectNodesGpu(nvrhi::ICommandList* commandList, const engine::ICompositeView* compositeView, BatchSelection& batch);
+		// Writes the instances of the selection, at most maxInstances of them
+		static void UpdateTransforms(const QuadTree& quadTree, const QuadTreeSelection& selection, TerrainInstanceData* instanceData, int maxInstances);
 		void CreateShaders(engine::ShaderFactory& shaderFactory, const CreateParameters& params);
 
 		// IGeometryPass implementation
@@ -157,5 +289,9 @@ namespace vRenderer
 		void SetPushConstants(GeometryPassContext& context, nvrhi::ICommandList* commandList, nvrhi::GraphicsState& state, nvrhi::DrawArguments& args) override { }
 
 		const std::vector<std::shared_ptr<QuadTree>>& GetQuadTrees() const { return m_QuadTrees; }
+		const TileStreamer* GetStreamer() const { return m_Streamer.get(); }
+
+		// Last selection made for a child view, nullptr if the composite view was never rendered
+		const ViewSelection* GetViewSelection(const engine::ICompositeView* compositeView, uint viewIndex) const;
 	};
 }
\ No newline at end of file
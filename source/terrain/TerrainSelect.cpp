@@ -0,0 +1,128 @@
+#include "TerrainSelect.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+	uint32_t PackNodeHeights(const Node& node)
+	{
+		return static_cast<uint32_t>(node.m_MinHeight) | (static_cast<uint32_t>(node.m_MaxHeight) << 8);
+	}
+
+	bool InstanceLess(const TerrainInstanceData& a, const TerrainInstanceData& b)
+	{
+		return memcmp(&a, &b, sizeof(TerrainInstanceData)) < 0;
+	}
+}
+
+namespace TerrainSelect
+{
+	TerrainSelectConstants MakeConstants(const QuadTree& quadTree, const SelectionView& view, const float maxHeight,
+		const uint32_t nodeBase, const uint32_t firstInstance, const uint32_t maxInstances, const uint32_t drawArgsOffset)
+	{
+		TerrainSelectConstants constants = {};
+		for (int i = 0; i < dm::frustum::PLANES_COUNT; i++)
+		{
+			const dm::plane& plane = view.frustum.planes[i];
+			constants.frustumPlanes[i] = float4(plane.normal, plane.distance);
+		}
+
+		// Same ranges as NodeSelect, squared then scaled
+		const float rangeScaleSq = view.lodRangeScale * view.lodRangeScale;
+		const auto& lodRanges = quadTree.GetLodRanges();
+		const auto& lodExtents = quadTree.GetLodExtents();
+		for (int i = 0; i < QuadTree::MAX_LODS; i++)
+		{
+			constants.lodExtents[i] = float4(lodExtents[i].x, lodExtents[i].y, 0.0f, 0.0f);
+			constants.lodRangesSq[i] = float4(lodRanges[i] * lodRanges[i] * rangeScaleSq, 0.0f, 0.0f, 0.0f);
+		}
+
+		constants.lodOrigin = view.position;
+		constants.heightScale = maxHeight / 255.0f;
+		constants.treeMin = quadTree.GetTreeMin();
+		constants.numLods = static_cast<uint>(quadTree.GetNumLods());
+		constants.nodeBase = nodeBase;
+		constants.firstInstance = firstInstance;
+		constants.maxInstances = maxInstances;
+		constants.drawArgsOffset = drawArgsOffset;
+		return constants;
+	}
+
+	void SelectReference(const QuadTree& quadTree, const TerrainSelectConstants& constants, std::vector<TerrainInstanceData>& instances)
+	{
+		assert(quadTree.IsHeightLoaded());
+
+		auto emitInstance = [&instances, &constants](const TerrainSelectBox& box, const uint lodLevel)
+			{
+				if (instances.size() < constants.maxInstances)
+					instances.push_back(TerrainSelect_PackInstance(box, lodLevel));
+			};
+
+		if (!TerrainSelect_Root(constants, PackNodeHeights(quadTree.GetNode(QuadTree::ROOT_NODE))))
+			return;
+
+		// Level lists of packed x | z << 16 coordinates, processed in the order of the level dispatches
+		std::vector<uint32_t> lists[2];
+		lists[0].push_back(0);
+		int inputList = 0;
+
+		for (int lodLevel = static_cast<int>(constants.numLods); lodLevel >= 0; lodLevel--)
+		{
+			// The list count as the GPU counter holds it, growing past the list size on failed reservations
+			std::vector<uint32_t>& outputList = lists[1 - inputList];
+			outputList.clear();
+			uint32_t outputCount = 0;
+
+			for (const uint32_t packed : lists[inputList])
+			{
+				const uint x = packed & 0xffff;
+				const uint z = packed >> 16;
+				const uint level = static_cast<uint>(lodLevel);
+				const uint nodeIndex = TerrainSelect_NodeIndex(constants.numLods, level, x, z);
+
+				uint childHeights[4] = { 0, 0, 0, 0 };
+				if (level > 0)
+				{
+					for (uint i = 0; i < 4; i++)
+						childHeights[i] = PackNodeHeights(quadTree.GetNode(QuadTree::GetChildIndex(nodeIndex, static_cast<int>(i))));
+				}
+
+				// Drawn whole if its refined children don't all fit in the list, as reserveNodes
+				const TerrainSelectResult result = TerrainSelect_ProcessNode(constants, level, x, z, childHeights);
+				const uint32_t numRefined = static_cast<uint32_t>(std::popcount(result.refineMask));
+				const bool reserved = numRefined == 0 || outputCount + numRefined <= TERRAIN_SELECT_MAX_NODES;
+				outputCount += numRefined;
+				if (result.drawWhole || !reserved)
+				{
+					emitInstance(TerrainSelect_NodeBounds(constants, level, x, z, PackNodeHeights(quadTree.GetNode(nodeIndex))), level);
+					continue;
+				}
+
+				for (uint i = 0; i < 4; i++)
+				{
+					const uint childX = 2 * x + (i & 1);
+					const uint childZ = 2 * z + (i >> 1);
+					if (result.drawMask & (1u << i))
+						emitInstance(TerrainSelect_NodeBounds(constants, level - 1, childX, childZ, childHeights[i]), level - 1);
+					if (result.refineMask & (1u << i))
+						outputList.push_back(childX | (childZ << 16));
+				}
+			}
+
+			inputList = 1 - inputList;
+		}
+	}
+
+	bool SameInstances(std::vector<TerrainInstanceData> a, std::vector<TerrainInstanceData> b)
+	{
+		if (a.size() != b.size())
+			return false;
+
+		std::sort(a.begin(), a.end(), InstanceLess);
+		std::sort(b.begin(), b.end(), InstanceLess);
+		return a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(TerrainInstanceData)) == 0;
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "QuadTree.h"
+#include "TerrainInstance.h"
+
+#include <vector>
+
+#include "../../shaders/terrain/terrain_select.h"
+
+static_assert(sizeof(Node) == 2, "Node must match the node heights layout of terrain_select_cs.hlsl");
+static_assert(TERRAIN_SELECT_MAX_LODS == QuadTree::MAX_LODS, "terrain_select.h must match QuadTree::MAX_LODS");
+
+// CPU side of the GPU terrain selection. The selection itself is in terrain_select.h, compiled both here and in
+// terrain_select_cs.hlsl, the reference runs it on the CPU in the same level order as the dispatches
+namespace TerrainSelect
+{
+	// Constants of a quadtree seen from a view, as uploaded for the compute passes
+	TerrainSelectConstants MakeConstants(const QuadTree& quadTree, const SelectionView& view, float maxHeight,
+		uint32_t nodeBase, uint32_t firstInstance, uint32_t maxInstances, uint32_t drawArgsOffset);
+
+	// Appends the instances the GPU selection writes for these constants, the tree heights must be loaded.
+	// Instances past constants.maxInstances are dropped and nodes whose children overflow a level list drawn whole, as on the GPU
+	void SelectReference(const QuadTree& quadTree, const TerrainSelectConstants& constants, std::vector<TerrainInstanceData>& instances);
+
+	// True if both hold the same instances bit for bit in any order, the GPU appends them in no particular order.
+	// Only meaningful when neither selection dropped instances or filled a level list
+	bool SameInstances(std::vector<TerrainInstanceData> a, std::vector<TerrainInstanceData> b);
+}
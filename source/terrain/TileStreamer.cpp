@@ -0,0 +1,368 @@
+#include "TileStreamer.h"
+#include "TerrainBake.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "NormalMap.h"
+
+#include <donut/core/log.h>
+#include <taskflow/taskflow.hpp>
+
+namespace
+{
+	using GetTileFunction = const void* (BakedTerrain::*)(uint32_t mip, uint32_t tileX, uint32_t tileY) const;
+
+	// A tile and the border taken from the next tiles, the last tiles repeat their edge as the bake does past the mip edge
+	void CopyTiledPage(const BakedTerrain& bake, const GetTileFunction getTile, const size_t bytesPerTexel, const uint32_t mip,
+		const uint32_t pageX, const uint32_t pageY, uint8_t* texels)
+	{
+		const TerrainBake::MipDesc& desc = bake.GetHeader().heightMips[mip];
+		const uint32_t pageSize = bake.GetHeader().tileSize;
+		const size_t rowSize = (pageSize + 1) * bytesPerTexel;
+
+		const uint32_t nextX = pageX + 1 < desc.numTilesX ? pageX + 1 : pageX;
+		const uint32_t nextColumn = nextX != pageX ? 0 : pageSize - 1;
+		for (uint32_t row = 0; row <= pageSize; row++)
+		{
+			uint32_t tileY = pageY;
+			uint32_t tileRow = row;
+			if (row == pageSize)
+			{
+				tileY = pageY + 1 < desc.numTilesY ? pageY + 1 : pageY;
+				tileRow = tileY != pageY ? 0 : pageSize - 1;
+			}
+
+			const size_t rowOffset = static_cast<size_t>(tileRow) * pageSize * bytesPerTexel;
+			const uint8_t* tile = static_cast<const uint8_t*>((bake.*getTile)(mip, pageX, tileY)) + rowOffset;
+			const uint8_t* nextTile = static_cast<const uint8_t*>((bake.*getTile)(mip, nextX, tileY)) + rowOffset;
+
+			uint8_t* dst = texels + row * rowSize;
+			memcpy(dst, tile, pageSize * bytesPerTexel);
+			memcpy(dst + pageSize * bytesPerTexel, nextTile + nextColumn * bytesPerTexel, bytesPerTexel);
+		}
+	}
+}
+
+TileStreamer::TileStreamer(std::shared_ptr<const BakedTerrain> bake, const Parameters& params, tf::Executor& executor)
+	: m_Bake(std::move(bake))
+	, m_Executor(executor)
+	, m_Params(params)
+	, m_LoadQueue(std::make_shared<LoadQueue>())
+{
+	const TerrainBake::Header& header = m_Bake->GetHeader();
+	m_HeightFormat = m_Bake->GetHeightFormat();
+	m_PageSize = header.tileSize;
+	m_WorldSize = header.worldSize;
+	m_HeightPageDataSize = static_cast<size_t>(m_PageSize + 1) * (m_PageSize + 1) * GetBytesPerTexel(m_HeightFormat);
+	m_NormalPageDataSize = m_Bake->HasNormals() ? static_cast<size_t>(m_PageSize + 1) * (m_PageSize + 1) * NormalMap::BYTES_PER_TEXEL : 0;
+
+	// Albedo pages cover the same area as the height pages, the albedo has to be the heightmap size times a power of two
+	const TerrainBake::AlbedoFormat albedoFormat = m_Bake->GetAlbedoFormat();
+	if (TerrainBake::GetAlbedoBlockBytes(albedoFormat) != 0 && header.numAlbedoMips >= header.numHeightMips)
+	{
+		for (uint32_t shift = 0; shift < 4 && m_AlbedoPageSize == 0; shift++)
+		{
+			if (header.albedoMips[0].width == header.heightWidth << shift && header.albedoMips[0].height == header.heightHeight << shift)
+				m_AlbedoPageSize = m_PageSize << shift;
+		}
+		if (m_AlbedoPageSize == 0)
+			donut::log::warning("The terrain albedo isn't the heightmap size times a power of two, it isn't streamed");
+	}
+	if (m_AlbedoPageSize > 0)
+	{
+		// The height texel picks the page, the albedo texel k = albedoPageSize / pageSize times finer under it reaches
+		// ceil((k - 1) / 2) past the page, and the bilinear footprint one more. Block compressed slots hold whole blocks
+		const uint32_t albedoScale = m_AlbedoPageSize / m_PageSize;
+		const uint32_t blockSize = TerrainBake::GetAlbedoBlockSize(albedoFormat);
+		m_AlbedoFormat = albedoFormat;
+		m_AlbedoSlotSize = m_AlbedoPageSize + (albedoScale / 2 + blockSize) / blockSize * blockSize;
+		m_AlbedoPageDataSize = TerrainBake::GetAlbedoDataSize(albedoFormat, m_AlbedoSlotSize, m_AlbedoSlotSize);
+	}
+
+	uint32_t numPages = 0;
+	m_Mips.resize(header.numHeightMips);
+	for (uint32_t mip = 0; mip < header.numHeightMips; mip++)
+	{
+		const TerrainBake::MipDesc& desc = header.heightMips[mip];
+		Mip& m = m_Mips[mip];
+		m.firstPage = numPages;
+		m.numPagesX = desc.numTilesX;
+		m.numPagesY = desc.numTilesY;
+		m.size = uint2(desc.width, desc.height);
+		m.albedoSize = m_AlbedoPageSize > 0 ? uint2(header.albedoMips[mip].width, header.albedoMips[mip].height) : uint2(0u, 0u);
+		numPages += desc.numTilesX * desc.numTilesY;
+	}
+	m_Pages.resize(numPages);
+	m_PageTable.assign(numPages, 0);
+
+	const uint32_t firstPinnedMip = static_cast<uint32_t>(GetMipForLod(params.maxLod));
+	const uint32_t numPinnedPages = numPages - m_Mips[firstPinnedMip].firstPage;
+
+	// As many slots as the budget holds, and at least the pinned pages and the loads in flight
+	const uint64_t maxSlotsPerRow = MAX_ATLAS_SIZE / std::max(m_PageSize + 1, m_AlbedoSlotSize);
+	const uint64_t minSlots = std::min<uint64_t>(numPinnedPages + params.maxLoadsInFlight, numPages);
+	uint64_t numSlots = params.budget / GetPageDataSize();
+	if (numSlots < minSlots)
+	{
+		donut::log::warning("Terrain streaming budget raised to %llu bytes to hold the coarsest mips",
+			static_cast<unsigned long long>(minSlots * GetPageDataSize()));
+		numSlots = minSlots;
+	}
+	numSlots = std::min({ numSlots, static_cast<uint64_t>(numPages), maxSlotsPerRow * maxSlotsPerRow });
+	if (numSlots < numPinnedPages)
+		donut::log::error("The terrain atlases can't hold the %u pages of the coarsest mips", numPinnedPages);
+
+	m_NumSlots = static_cast<uint32_t>(numSlots);
+	m_SlotsPerRow = std::min(static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(numSlots)))), static_cast<uint32_t>(maxSlotsPerRow));
+	m_FreeSlots.resize(m_NumSlots);
+	for (uint32_t i = 0; i < m_NumSlots; i++)
+		m_FreeSlots[i] = m_NumSlots - 1 - i; // lowest slots are taken first
+
+	// Pinned pages are read now and made resident by the first Update
+	for (uint32_t mip = firstPinnedMip; mip < m_Mips.size(); mip++)
+	{
+		const Mip& m = m_Mips[mip];
+		for (uint32_t y = 0; y < m.numPagesY; y++)
+		{
+			for (uint32_t x = 0; x < m.numPagesX; x++)
+			{
+				const uint32_t page = m.firstPage + y * m.numPagesX + x;
+				m_Pages[page].pinned = true;
+				m_Pages[page].loading = true;
+				m_Pending.push_back({ page, LoadPage(*m_Bake, mip, x, y, m_AlbedoPageSize, m_AlbedoSlotSize) });
+			}
+		}
+	}
+}
+
+int TileStreamer::GetMipForLod(const int lodLevel) const
+{
+	return std::clamp(lodLevel + m_Params.lodMipOffset, 0, static_cast<int>(m_Mips.size()) - 1);
+}
+
+void TileStreamer::GetPageRange(const uint32_t mip, const float2 worldMin, const float2 worldMax, uint2& minPage, uint2& maxPage) const
+{
+	// Texels under the rectangle, as the shaders address them
+	const Mip& m = m_Mips[mip];
+	const float2 mipSize = float2(static_cast<float>(m.size.x), static_cast<float>(m.size.y));
+	const float2 minTexel = clamp((worldMin / m_WorldSize + 0.5f) * mipSize - 0.5f, float2(0.0f), mipSize - 1.0f);
+	const float2 maxTexel = clamp((worldMax / m_WorldSize + 0.5f) * mipSize - 0.5f, float2(0.0f), mipSize - 1.0f);
+
+	minPage = uint2(std::min(static_cast<uint32_t>(minTexel.x) / m_PageSize, m.numPagesX - 1), std::min(static_cast<uint32_t>(minTexel.y) / m_PageSize, m.numPagesY - 1));
+	maxPage = uint2(std::min(static_cast<uint32_t>(maxTexel.x) / m_PageSize, m.numPagesX - 1), std::min(static_cast<uint32_t>(maxTexel.y) / m_PageSize, m.numPagesY - 1));
+}
+
+bool TileStreamer::IsResident(const int mip, const float2 worldMin, const float2 worldMax) const
+{
+	uint2 minPage;
+	uint2 maxPage;
+	GetPageRange(static_cast<uint32_t>(mip), worldMin, worldMax, minPage, maxPage);
+
+	const Mip& m = m_Mips[mip];
+	for (uint32_t y = minPage.y; y <= maxPage.y; y++)
+	{
+		for (uint32_t x = minPage.x; x <= maxPage.x; x++)
+		{
+			if (m_PageTable[m.firstPage + y * m.numPagesX + x] == 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+void TileStreamer::Update(const float3 position, const std::span<const float> mipRanges)
+{
+	m_NumUpdates++;
+	m_Installed.clear();
+	m_Uploads.clear();
+
+	// Wanted pages move to the front of the LRU list, the missing ones are requested
+	m_Requests.clear();
+	const float2 center = float2(position.x, position.z);
+	for (int mip = static_cast<int>(m_Mips.size()) - 1; mip >= 0; mip--)
+	{
+		const float range = mip < static_cast<int>(mipRanges.size()) ? mipRanges[mip] : 0.0f;
+		if (range <= 0.0f)
+			continue;
+
+		uint2 minPage;
+		uint2 maxPage;
+		GetPageRange(static_cast<uint32_t>(mip), center - range, center + range, minPage, maxPage);
+
+		const Mip& m = m_Mips[mip];
+		const float pageWorldSize = m_WorldSize * static_cast<float>(m_PageSize) / static_cast<float>(m.size.x);
+		for (uint32_t y = minPage.y; y <= maxPage.y; y++)
+		{
+			for (uint32_t x = minPage.x; x <= maxPage.x; x++)
+			{
+				const uint32_t pageIndex = m.firstPage + y * m.numPagesX + x;
+				Page& page = m_Pages[pageIndex];
+				page.lastWanted = m_NumUpdates;
+
+				if (page.slot != INVALID_SLOT)
+				{
+					if (!page.pinned)
+						m_Lru.splice(m_Lru.begin(), m_Lru, page.lru);
+				}
+				else if (!page.loading)
+				{
+					const float2 pageCenter = (float2(static_cast<float>(x), static_cast<float>(y)) + 0.5f) * pageWorldSize - m_WorldSize * 0.5f;
+					m_Requests.push_back({ pageIndex, static_cast<uint32_t>(mip), x, y, lengthSquared(pageCenter - center) });
+				}
+			}
+		}
+	}
+
+	// Loads finished since the last Update
+	{
+		std::lock_guard<std::mutex> lock(m_LoadQueue->mutex);
+		m_NumLoadsInFlight -= static_cast<uint32_t>(m_LoadQueue->loaded.size());
+		for (LoadedPage& loaded : m_LoadQueue->loaded)
+			m_Pending.push_back(std::move(loaded));
+		m_LoadQueue->loaded.clear();
+	}
+
+	size_t numProcessed = 0;
+	for (; numProcessed < m_Pending.size(); numProcessed++)
+	{
+		LoadedPage& loaded = m_Pending[numProcessed];
+		Page& page = m_Pages[loaded.page];
+		if (m_Installed.size() >= m_Params.maxUploadsPerUpdate && !page.pinned)
+			break;
+
+		page.loading = false;
+		const uint32_t slot = AllocateSlot();
+		if (slot == INVALID_SLOT)
+			continue; // every slot holds a wanted page, the page is requested again once one is free
+
+		Install(std::move(loaded), slot);
+	}
+	m_Pending.erase(m_Pending.begin(), m_Pending.begin() + numProcessed);
+
+	for (const LoadedPage& installed : m_Installed)
+	{
+		const uint8_t* texels = installed.texels.data();
+		m_Uploads.push_back({ m_Pages[installed.page].slot, texels, HasNormals() ? texels + m_HeightPageDataSize : nullptr,
+			m_AlbedoPageSize > 0 ? texels + m_HeightPageDataSize + m_NormalPageDataSize : nullptr });
+	}
+
+	// Coarse mips first so there is always a fallback, then nearest first
+	std::sort(m_Requests.begin(), m_Requests.end(), [](const Request& a, const Request& b)
+		{
+			return a.mip != b.mip ? a.mip > b.mip : a.distanceSq < b.distanceSq;
+		});
+
+	for (const Request& request : m_Requests)
+	{
+		const uint32_t numOutstanding = m_NumLoadsInFlight + static_cast<uint32_t>(m_Pending.size());
+		if (numOutstanding >= m_Params.maxLoadsInFlight)
+			break;
+
+		// Every slot is free for an outstanding load or holds a wanted page, the budget is full
+		const bool canEvict = !m_Lru.empty() && m_Pages[m_Lru.back()].lastWanted != m_NumUpdates;
+		if (m_FreeSlots.size() <= numOutstanding && !canEvict)
+			break;
+
+		RequestLoad(request.page, request.mip, request.pageX, request.pageY);
+	}
+}
+
+void TileStreamer::RequestLoad(const uint32_t page, const uint32_t mip, const uint32_t pageX, const uint32_t pageY)
+{
+	m_Pages[page].loading = true;
+	m_NumLoadsInFlight++;
+
+	m_Executor.silent_async([bake = m_Bake, queue = m_LoadQueue, page, mip, pageX, pageY, albedoPageSize = m_AlbedoPageSize, albedoSlotSize = m_AlbedoSlotSize]()
+		{
+			LoadedPage loaded = { page, LoadPage(*bake, mip, pageX, pageY, albedoPageSize, albedoSlotSize) };
+
+			std::lock_guard<std::mutex> lock(queue->mutex);
+			queue->loaded.push_back(std::move(loaded));
+		});
+}
+
+uint32_t TileStreamer::AllocateSlot()
+{
+	if (!m_FreeSlots.empty())
+	{
+		const uint32_t slot = m_FreeSlots.back();
+		m_FreeSlots.pop_back();
+		return slot;
+	}
+
+	// Pages wanted by this Update may be drawn, they are never evicted
+	if (m_Lru.empty() || m_Pages[m_Lru.back()].lastWanted == m_NumUpdates)
+		return INVALID_SLOT;
+
+	const uint32_t evicted = m_Lru.back();
+	m_Lru.pop_back();
+
+	Page& page = m_Pages[evicted];
+	const uint32_t slot = page.slot;
+	page.slot = INVALID_SLOT;
+	m_PageTable[evicted] = 0;
+	m_Generation++;
+	return slot;
+}
+
+void TileStreamer::Install(LoadedPage&& loaded, const uint32_t slot)
+{
+	Page& page = m_Pages[loaded.page];
+	page.slot = slot;
+
+	// A page no longer wanted by the time it is loaded is the first to go
+	if (!page.pinned)
+		page.lru = m_Lru.insert(page.lastWanted == m_NumUpdates ? m_Lru.begin() : m_Lru.end(), loaded.page);
+
+	m_PageTable[loaded.page] = slot + 1;
+	m_Generation++;
+	m_Installed.push_back(std::move(loaded));
+}
+
+std::vector<uint8_t> TileStreamer::LoadPage(const BakedTerrain& bake, const uint32_t mip, const uint32_t pageX, const uint32_t pageY, const uint32_t albedoPageSize, const uint32_t albedoSlotSize)
+{
+	const TerrainBake::Header& header = bake.GetHeader();
+	const uint32_t pageSize = header.tileSize;
+	const size_t bytesPerTexel = GetBytesPerTexel(bake.GetHeightFormat());
+	const size_t heightDataSize = static_cast<size_t>(pageSize + 1) * (pageSize + 1) * bytesPerTexel;
+	const size_t normalDataSize = bake.HasNormals() ? static_cast<size_t>(pageSize + 1) * (pageSize + 1) * NormalMap::BYTES_PER_TEXEL : 0;
+
+	std::vector<uint8_t> texels(heightDataSize + normalDataSize + TerrainBake::GetAlbedoDataSize(bake.GetAlbedoFormat(), albedoSlotSize, albedoSlotSize));
+
+	CopyTiledPage(bake, &BakedTerrain::GetHeightTile, bytesPerTexel, mip, pageX, pageY, texels.data());
+	if (normalDataSize > 0)
+		CopyTiledPage(bake, &BakedTerrain::GetNormalTile, NormalMap::BYTES_PER_TEXEL, mip, pageX, pageY, texels.data() + heightDataSize);
+
+	if (albedoPageSize > 0)
+	{
+		// Albedo mips are stored whole, blocks past the mip edge repeat the edge
+		const TerrainBake::AlbedoFormat albedoFormat = bake.GetAlbedoFormat();
+		const TerrainBake::MipDesc& albedoDesc = header.albedoMips[mip];
+		const uint32_t blockSize = TerrainBake::GetAlbedoBlockSize(albedoFormat);
+		const size_t blockBytes = TerrainBake::GetAlbedoBlockBytes(albedoFormat);
+		const uint32_t mipBlocksX = (albedoDesc.width + blockSize - 1) / blockSize;
+		const uint32_t mipBlocksY = (albedoDesc.height + blockSize - 1) / blockSize;
+		const uint32_t pageBlocks = albedoPageSize / blockSize;
+		const uint32_t slotBlocks = albedoSlotSize / blockSize;
+		const size_t albedoRowSize = slotBlocks * blockBytes;
+
+		const uint8_t* albedo = static_cast<const uint8_t*>(bake.GetAlbedoMip(mip));
+		const uint32_t firstColumn = std::min(pageX * pageBlocks, mipBlocksX - 1);
+		const uint32_t numColumns = std::min(slotBlocks, mipBlocksX - firstColumn);
+
+		for (uint32_t row = 0; row < slotBlocks; row++)
+		{
+			const uint32_t y = std::min(pageY * pageBlocks + row, mipBlocksY - 1);
+			const uint8_t* src = albedo + (static_cast<size_t>(y) * mipBlocksX + firstColumn) * blockBytes;
+
+			uint8_t* dst = texels.data() + heightDataSize + normalDataSize + row * albedoRowSize;
+			memcpy(dst, src, numColumns * blockBytes);
+			for (uint32_t x = numColumns; x < slotBlocks; x++)
+				memcpy(dst + x * blockBytes, src + (numColumns - 1) * blockBytes, blockBytes);
+		}
+	}
+
+	return texels;
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "HeightmapStore.h"
+#include "TerrainBake.h"
+
+#include <donut/core/math/math.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace tf
+{
+	class Executor;
+}
+
+using namespace donut::math;
+
+// Pages of a baked terrain kept resident around the camera under a memory budget. A page is one height tile of a mip, its
+// normal tile and the albedo texels over the same area, all with a border taken from the next page so that bilinear
+// fetches anywhere in the page stay inside it, block compressed albedo borders are whole blocks. Pages are read from the
+// bake on executor workers, each resident page owns a slot of the atlases and the least recently wanted page gives its
+// slot away. The pages sampled by the quadtree roots are pinned, so there is always a coarser mip to fall back to
+class TileStreamer
+{
+public:
+	static constexpr uint32_t INVALID_SLOT = ~0u;
+	static constexpr uint32_t MAX_ATLAS_SIZE = 16384; // texels on a side of an atlas
+
+	struct Parameters
+	{
+		uint64_t budget = 64ull << 20; // bytes of resident height and albedo texels
+		int lodMipOffset = 0; // mip sampled by the nodes of a LOD level minus the level, clamped to the mip chain
+		int maxLod = 0; // LOD of the quadtree roots, the pages of their mip and coarser ones are never evicted
+		uint32_t maxLoadsInFlight = 8;
+		uint32_t maxUploadsPerUpdate = 16; // pages made resident by one Update, pinned pages are never held back
+	};
+
+	// Page made resident by the last Update, the texels stay valid until the next one
+	struct PageUpload
+	{
+		uint32_t slot;
+		const uint8_t* heightTexels; // (pageSize + 1) squared, tightly packed
+		const uint8_t* normalTexels; // same layout, NormalMap texels, null without normals
+		const uint8_t* albedoTexels; // albedoSlotSize squared texels in the bake albedo format, null without albedo
+	};
+
+	// The pinned pages are read before it returns
+	TileStreamer(std::shared_ptr<const BakedTerrain> bake, const Parameters& params, tf::Executor& executor);
+
+	// Once per frame, before any selection. Marks the pages within mipRanges[mip] of position as wanted, makes the loaded
+	// pages resident, evicting pages that are not wanted, and requests the missing ones, coarse mips first then nearest first
+	void Update(float3 position, std::span<const float> mipRanges);
+
+	int GetMipForLod(int lodLevel) const;
+	// True when all the pages of the mip under the world space rectangle are resident
+	bool IsResident(int mip, float2 worldMin, float2 worldMax) const;
+	// Changes whenever a page becomes resident or is evicted
+	uint64_t GetGeneration() const { return m_Generation; }
+
+	std::span<const PageUpload> GetUploads() const { return m_Uploads; }
+	// Slot + 1 of every page, 0 if it isn't resident. The pages of a mip are in row major order from its first page
+	std::span<const uint32_t> GetPageTable() const { return m_PageTable; }
+
+	HeightmapFormat GetHeightFormat() const { return m_HeightFormat; }
+	bool HasNormals() const { return m_NormalPageDataSize > 0; }
+	bool HasAlbedo() const { return m_AlbedoPageSize > 0; }
+	uint32_t GetPageSize() const { return m_PageSize; }
+	uint32_t GetAlbedoPageSize() const { return m_AlbedoPageSize; }
+	uint32_t GetAlbedoSlotSize() const { return m_AlbedoSlotSize; }
+	TerrainBake::AlbedoFormat GetAlbedoFormat() const { return m_AlbedoFormat; }
+	uint32_t GetNumSlots() const { return m_NumSlots; }
+	uint32_t GetSlotsPerRow() const { return m_SlotsPerRow; }
+	uint32_t GetNumMips() const { return static_cast<uint32_t>(m_Mips.size()); }
+	uint32_t GetMipFirstPage(uint32_t mip) const { return m_Mips[mip].firstPage; }
+	uint32_t GetMipNumPagesX(uint32_t mip) const { return m_Mips[mip].numPagesX; }
+	uint2 GetMipSize(uint32_t mip) const { return m_Mips[mip].size; }
+	uint2 GetAlbedoMipSize(uint32_t mip) const { return m_Mips[mip].albedoSize; }
+	uint64_t GetResidentBytes() const { return static_cast<uint64_t>(m_NumSlots - m_FreeSlots.size()) * GetPageDataSize(); }
+	size_t GetPageDataSize() const { return m_HeightPageDataSize + m_NormalPageDataSize + m_AlbedoPageDataSize; }
+
+private:
+	struct Mip
+	{
+		uint32_t firstPage;
+		uint32_t numPagesX;
+		uint32_t numPagesY;
+		uint2 size;
+		uint2 albedoSize;
+	};
+
+	struct Page
+	{
+		uint32_t slot = INVALID_SLOT;
+		uint64_t lastWanted = 0; // Update the page was last within its mip range
+		bool loading = false;
+		bool pinned = false;
+		std::list<uint32_t>::iterator lru; // in m_Lru while resident and not pinned
+	};
+
+	struct LoadedPage
+	{
+		uint32_t page;
+		std::vector<uint8_t> texels; // height, normals then albedo
+	};
+
+	struct Request
+	{
+		uint32_t page;
+		uint32_t mip;
+		uint32_t pageX;
+		uint32_t pageY;
+		float distanceSq;
+	};
+
+	// Loads finish on the workers, the queue outlives the streamer if it is destroyed with loads in flight
+	struct LoadQueue
+	{
+		std::mutex mutex;
+		std::vector<LoadedPage> loaded;
+	};
+
+	std::shared_ptr<const BakedTerrain> m_Bake;
+	tf::Executor& m_Executor;
+	Parameters m_Params;
+
+	HeightmapFormat m_HeightFormat;
+	uint32_t m_PageSize = 0;
+	uint32_t m_AlbedoPageSize = 0;
+	uint32_t m_AlbedoSlotSize = 0; // albedo page and border
+	TerrainBake::AlbedoFormat m_AlbedoFormat = TerrainBake::AlbedoFormat::NONE;
+	size_t m_HeightPageDataSize = 0;
+	size_t m_NormalPageDataSize = 0;
+	size_t m_AlbedoPageDataSize = 0;
+	float m_WorldSize = 0.0f;
+
+	std::vector<Mip> m_Mips;
+	std::vector<Page> m_Pages;
+	std::vector<uint32_t> m_PageTable;
+	std::list<uint32_t> m_Lru; // resident pages that may be evicted, most recently wanted first
+	std::vector<uint32_t> m_FreeSlots;
+	uint32_t m_NumSlots = 0;
+	uint32_t m_SlotsPerRow = 0;
+	uint32_t m_NumLoadsInFlight = 0;
+	uint64_t m_NumUpdates = 0;
+	uint64_t m_Generation = 0;
+
+	std::shared_ptr<LoadQueue> m_LoadQueue;
+	std::vector<LoadedPage> m_Pending; // loaded, waiting for a slot or held back by maxUploadsPerUpdate
+	std::vector<LoadedPage> m_Installed; // texels of m_Uploads
+	std::vector<Request> m_Requests;
+	std::vector<PageUpload> m_Uploads;
+
+	// Pages of a mip under a world space rectangle, inclusive
+	void GetPageRange(uint32_t mip, float2 worldMin, float2 worldMax, uint2& minPage, uint2& maxPage) const;
+	void RequestLoad(uint32_t page, uint32_t mip, uint32_t pageX, uint32_t pageY);
+	// Takes a free slot, or the slot of the least recently wanted page not wanted by this Update
+	uint32_t AllocateSlot();
+	void Install(LoadedPage&& loaded, uint32_t slot);
+
+	static std::vector<uint8_t> LoadPage(const BakedTerrain& bake, uint32_t mip, uint32_t pageX, uint32_t pageY, uint32_t albedoPageSize, uint32_t albedoSlotSize);
+};
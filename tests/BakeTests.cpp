@@ -0,0 +1,120 @@
+#include <taskflow/taskflow.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "../bench/TerrainScene.h"
+#include "../source/terrain/QuadTree.h"
+#include "../source/terrain/TerrainBake.h"
+#include "TerrainTest.h"
+
+namespace
+{
+	constexpr uint32_t HEIGHTMAP_SIZE = 256;
+	constexpr float WORLD_SIZE = 256.0f;
+	constexpr float SURFACE_SIZE = 128.0f;
+	constexpr uint32_t TILE_SIZE = 96; // the last tile of a row is past the heightmap edge
+
+	std::filesystem::path GetBakePath()
+	{
+		return std::filesystem::temp_directory_path() / "vrenderer_terrain_test.vtb";
+	}
+
+	bool WriteBake(const std::filesystem::path& path, const HeightmapStore& heightmap, const std::vector<std::unique_ptr<QuadTree>>& quadTrees)
+	{
+		std::vector<const QuadTree*> trees;
+		for (const auto& quadTree : quadTrees)
+			trees.push_back(quadTree.get());
+
+		TerrainBake::BakeParameters params;
+		params.sourceStamp = 42;
+		params.tileSize = TILE_SIZE;
+		params.worldSize = WORLD_SIZE;
+		params.surfaceSize = SURFACE_SIZE;
+		params.albedoFormat = TerrainBake::AlbedoFormat::NONE;
+		return TerrainBake::Write(path, params, heightmap, trees, nullptr);
+	}
+}
+
+// The trees pointed at a bake have the nodes of the trees it was baked from, and its tiles the heightmap texels
+TERRAIN_TEST(Bake, RoundTrip)
+{
+	tf::Executor executor;
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(HEIGHTMAP_SIZE, HeightmapFormat::R16_UNORM, 3);
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(WORLD_SIZE, SURFACE_SIZE, heightmap, executor);
+
+	const std::filesystem::path path = GetBakePath();
+	TEST_CHECK(WriteBake(path, *heightmap, quadTrees));
+
+	const std::shared_ptr<BakedTerrain> bake = BakedTerrain::Open(path);
+	TEST_CHECK(bake != nullptr);
+	if (!bake)
+		return;
+
+	const TerrainBake::Header& header = bake->GetHeader();
+	TEST_CHECK(bake->Matches(42, WORLD_SIZE, SURFACE_SIZE));
+	TEST_CHECK(bake->Matches(0, WORLD_SIZE, SURFACE_SIZE));
+	TEST_CHECK(!bake->Matches(43, WORLD_SIZE, SURFACE_SIZE));
+	TEST_CHECK(!bake->Matches(42, WORLD_SIZE, SURFACE_SIZE * 0.5f));
+	TEST_CHECK(header.numTrees == quadTrees.size());
+	TEST_CHECK(bake->GetHeightFormat() == HeightmapFormat::R16_UNORM);
+	TEST_CHECK(header.heightMips[0].numTilesX == 3 && header.heightMips[0].numTilesY == 3);
+
+	for (size_t i = 0; i < quadTrees.size(); i++)
+	{
+		const float2 treeMin = quadTrees[i]->GetTreeMin();
+		QuadTree bakedTree(SURFACE_SIZE, SURFACE_SIZE, WORLD_SIZE, float3(treeMin.x + SURFACE_SIZE * 0.5f, 0.0f, treeMin.y + SURFACE_SIZE * 0.5f));
+		TEST_CHECK(bakedTree.InitBaked(bake->GetNodes(static_cast<uint32_t>(i)), bake));
+		TEST_CHECK(bakedTree.IsHeightLoaded());
+
+		const std::span<const Node> built = quadTrees[i]->GetNodes();
+		const std::span<const Node> baked = bakedTree.GetNodes();
+		TEST_CHECK(built.size() == baked.size() && std::memcmp(built.data(), baked.data(), built.size_bytes()) == 0);
+	}
+
+	// Mip 0 tiles hold the texels, repeating the edge ones past the heightmap
+	bool tilesMatch = true;
+	for (uint32_t tileY = 0; tileY < header.heightMips[0].numTilesY; tileY++)
+	{
+		for (uint32_t tileX = 0; tileX < header.heightMips[0].numTilesX; tileX++)
+		{
+			const uint16_t* tile = static_cast<const uint16_t*>(bake->GetHeightTile(0, tileX, tileY));
+			for (uint32_t y = 0; y < TILE_SIZE; y++)
+			{
+				const uint16_t* row = heightmap->GetRow<uint16_t>(std::min(tileY * TILE_SIZE + y, HEIGHTMAP_SIZE - 1));
+				for (uint32_t x = 0; x < TILE_SIZE; x++)
+					tilesMatch = tilesMatch && tile[y * TILE_SIZE + x] == row[std::min(tileX * TILE_SIZE + x, HEIGHTMAP_SIZE - 1)];
+			}
+		}
+	}
+	TEST_CHECK(tilesMatch);
+
+	std::filesystem::remove(path);
+}
+
+// A bake cut short, or of a tree layout it wasn't made for, is not used
+TERRAIN_TEST(Bake, RejectsMismatch)
+{
+	tf::Executor executor;
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(HEIGHTMAP_SIZE, HeightmapFormat::R8_UNORM, 3);
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(WORLD_SIZE, SURFACE_SIZE, heightmap, executor);
+
+	const std::filesystem::path path = GetBakePath();
+	TEST_CHECK(WriteBake(path, *heightmap, quadTrees));
+	{
+		const std::shared_ptr<BakedTerrain> bake = BakedTerrain::Open(path);
+		TEST_CHECK(bake != nullptr);
+
+		// Trees of another size have another node count
+		QuadTree smallerTree(SURFACE_SIZE * 0.5f, SURFACE_SIZE * 0.5f, WORLD_SIZE);
+		TEST_CHECK(!bake || !smallerTree.InitBaked(bake->GetNodes(0), bake));
+	}
+
+	std::filesystem::resize_file(path, std::filesystem::file_size(path) / 2);
+	TEST_CHECK(BakedTerrain::Open(path) == nullptr);
+	std::filesystem::remove(path);
+	TEST_CHECK(BakedTerrain::Open(path) == nullptr);
+}
@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../bench/TerrainScene.h"
+#include "../source/terrain/BlockCompress.h"
+#include "TerrainTest.h"
+
+using namespace BlockCompress;
+
+namespace
+{
+	constexpr uint32_t NUM_TEXELS = BLOCK_SIZE * BLOCK_SIZE;
+
+	using Block = std::array<uint8_t, NUM_TEXELS * 4>;
+
+	Block MakeSolid(const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a)
+	{
+		Block texels;
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			texels[i * 4 + 0] = r;
+			texels[i * 4 + 1] = g;
+			texels[i * 4 + 2] = b;
+			texels[i * 4 + 3] = a;
+		}
+		return texels;
+	}
+
+	// Largest difference over the channels below numChannels
+	int EncodeDecode(const Format format, const Block& texels, const int numChannels, Block& decoded, std::array<uint8_t, 16>& block)
+	{
+		block = {};
+		EncodeBlock(format, texels.data(), block.data());
+		DecodeBlock(format, block.data(), decoded.data());
+
+		int maxError = 0;
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			for (int c = 0; c < numChannels; c++)
+				maxError = std::max(maxError, std::abs(texels[i * 4 + c] - decoded[i * 4 + c]));
+		}
+		return maxError;
+	}
+
+	uint32_t ReadBits(const uint8_t* data, const uint32_t first, const uint32_t numBits)
+	{
+		uint32_t value = 0;
+		for (uint32_t bit = 0; bit < numBits; bit++)
+			value |= ((data[(first + bit) >> 3] >> ((first + bit) & 7)) & 1u) << bit;
+		return value;
+	}
+
+	// Four color mode BC1 decoded from the format description, independently of BlockCompress
+	bool MatchesBC1Layout(const std::array<uint8_t, 16>& block, const Block& decoded)
+	{
+		const uint32_t color0 = block[0] | (block[1] << 8);
+		const uint32_t color1 = block[2] | (block[3] << 8);
+		if (color0 <= color1)
+			return false;
+
+		auto expand = [](const uint32_t color, const int c)
+			{
+				const uint32_t value = c == 0 ? (color >> 11) & 31 : c == 1 ? (color >> 5) & 63 : color & 31;
+				return c == 1 ? (value << 2) | (value >> 4) : (value << 3) | (value >> 2);
+			};
+
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			const uint32_t index = ReadBits(block.data() + 4, 2 * i, 2);
+			for (int c = 0; c < 3; c++)
+			{
+				const uint32_t c0 = expand(color0, c);
+				const uint32_t c1 = expand(color1, c);
+				const uint32_t palette[4] = { c0, c1, (2 * c0 + c1) / 3, (c0 + 2 * c1) / 3 };
+				if (decoded[i * 4 + c] != palette[index])
+					return false;
+			}
+			if (decoded[i * 4 + 3] != 255)
+				return false;
+		}
+		return true;
+	}
+
+	// Mode 6 BC7 decoded from the format description: mode bits, 7 bit endpoints channel by channel, the two p bits,
+	// then the indices with the anchor one 3 bits long
+	bool MatchesBC7Layout(const std::array<uint8_t, 16>& block, const Block& decoded)
+	{
+		static constexpr uint32_t WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		if (ReadBits(block.data(), 0, 7) != 0x40)
+			return false;
+
+		const uint32_t p0 = ReadBits(block.data(), 63, 1);
+		const uint32_t p1 = ReadBits(block.data(), 64, 1);
+		uint32_t position = 65;
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			const uint32_t numIndexBits = i == 0 ? 3 : 4;
+			const uint32_t index = ReadBits(block.data(), position, numIndexBits);
+			position += numIndexBits;
+			for (int c = 0; c < 4; c++)
+			{
+				const uint32_t e0 = ReadBits(block.data(), 7 + 14 * c, 7) * 2 + p0;
+				const uint32_t e1 = ReadBits(block.data(), 14 + 14 * c, 7) * 2 + p1;
+				if (decoded[i * 4 + c] != ((64 - WEIGHTS[index]) * e0 + WEIGHTS[index] * e1 + 32) >> 6)
+					return false;
+			}
+		}
+		return position == 128;
+	}
+
+	double GetPsnr(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b)
+	{
+		double errorSq = 0.0;
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			if (i % 4 == 3)
+				continue;
+			const double d = static_cast<double>(a[i]) - static_cast<double>(b[i]);
+			errorSq += d * d;
+		}
+		const double mse = errorSq / static_cast<double>(a.size() / 4 * 3);
+		return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : INFINITY;
+	}
+}
+
+TERRAIN_TEST(BlockCompress, SolidBlocks)
+{
+	Block decoded;
+	std::array<uint8_t, 16> block;
+	for (uint32_t seed = 0; seed < 64; seed++)
+	{
+		const uint32_t h = TerrainScene::Hash(seed, 0, 1);
+		const Block texels = MakeSolid(static_cast<uint8_t>(h), static_cast<uint8_t>(h >> 8), static_cast<uint8_t>(h >> 16), 255);
+
+		// 565 endpoints and their thirds get within a few levels, BC7 endpoints within one
+		TEST_CHECK(EncodeDecode(Format::BC1, texels, 3, decoded, block) <= 4);
+		TEST_CHECK(MatchesBC1Layout(block, decoded) || (block[0] == block[2] && block[1] == block[3]));
+		TEST_CHECK(EncodeDecode(Format::BC7, texels, 4, decoded, block) <= 1);
+		TEST_CHECK(MatchesBC7Layout(block, decoded));
+	}
+
+	// Black and white are exact in BC1, opaque black is one level off in BC7 as its channels want different p bits
+	TEST_CHECK(EncodeDecode(Format::BC1, MakeSolid(0, 0, 0, 255), 4, decoded, block) == 0);
+	TEST_CHECK(EncodeDecode(Format::BC1, MakeSolid(255, 255, 255, 255), 4, decoded, block) == 0);
+	TEST_CHECK(EncodeDecode(Format::BC7, MakeSolid(0, 0, 0, 255), 4, decoded, block) == 1);
+	TEST_CHECK(EncodeDecode(Format::BC7, MakeSolid(255, 255, 255, 255), 4, decoded, block) == 0);
+}
+
+TERRAIN_TEST(BlockCompress, TwoColorBlocks)
+{
+	Block decoded;
+	std::array<uint8_t, 16> block;
+	for (uint32_t seed = 0; seed < 64; seed++)
+	{
+		const uint32_t h = TerrainScene::Hash(seed, 1, 2);
+		const uint32_t pattern = TerrainScene::Hash(seed, 2, 2);
+		Block texels = MakeSolid(static_cast<uint8_t>(h), static_cast<uint8_t>(h >> 8), static_cast<uint8_t>(h >> 16), 255);
+		for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		{
+			if ((pattern >> i) & 1)
+				texels[i * 4 + 0] = texels[i * 4 + 1] = texels[i * 4 + 2] = static_cast<uint8_t>(h >> 24);
+		}
+
+		// Both colors are endpoints
+		TEST_CHECK(EncodeDecode(Format::BC1, texels, 3, decoded, block) <= 4);
+		TEST_CHECK(MatchesBC1Layout(block, decoded) || (block[0] == block[2] && block[1] == block[3]));
+		TEST_CHECK(EncodeDecode(Format::BC7, texels, 4, decoded, block) <= 1);
+		TEST_CHECK(MatchesBC7Layout(block, decoded));
+	}
+}
+
+TERRAIN_TEST(BlockCompress, GradientBlocks)
+{
+	// A ramp along the diagonal of the color cube, 16 steps of 8 levels
+	Block texels;
+	for (uint32_t i = 0; i < NUM_TEXELS; i++)
+	{
+		const uint8_t value = static_cast<uint8_t>(40 + 8 * i);
+		texels[i * 4 + 0] = value;
+		texels[i * 4 + 1] = value;
+		texels[i * 4 + 2] = static_cast<uint8_t>(value / 2);
+		texels[i * 4 + 3] = 255;
+	}
+
+	// BC1 has four colors for the 16 steps, two steps away at most. BC7 has an index per step
+	Block decoded;
+	std::array<uint8_t, 16> block;
+	TEST_CHECK(EncodeDecode(Format::BC1, texels, 3, decoded, block) <= 16);
+	TEST_CHECK(MatchesBC1Layout(block, decoded));
+	TEST_CHECK(EncodeDecode(Format::BC7, texels, 4, decoded, block) <= 2);
+	TEST_CHECK(MatchesBC7Layout(block, decoded));
+}
+
+TERRAIN_TEST(BlockCompress, AlphaBlocks)
+{
+	// Alpha ramps under a constant color
+	Block texels = MakeSolid(120, 90, 60, 0);
+	for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		texels[i * 4 + 3] = static_cast<uint8_t>(17 * i);
+
+	// The 4 bit weights are not evenly spaced, the steps of 17 land a few levels off
+	Block decoded;
+	std::array<uint8_t, 16> block;
+	TEST_CHECK(EncodeDecode(Format::BC7, texels, 4, decoded, block) <= 4);
+	TEST_CHECK(MatchesBC7Layout(block, decoded));
+
+	// BC1 drops alpha, every texel is opaque
+	TEST_CHECK(EncodeDecode(Format::BC1, texels, 3, decoded, block) <= 4);
+	bool opaque = true;
+	for (uint32_t i = 0; i < NUM_TEXELS; i++)
+		opaque = opaque && decoded[i * 4 + 3] == 255;
+	TEST_CHECK(opaque);
+}
+
+// The fit orders the endpoints dark to bright, BC1 stores the brighter first to stay in four color mode and
+// BC7 the one the first texel is closer to, its index is a bit shorter
+TERRAIN_TEST(BlockCompress, EndpointSwap)
+{
+	Block texels = MakeSolid(230, 220, 200, 255);
+	texels[0] = 20;
+	texels[1] = 30;
+	texels[2] = 40;
+
+	Block decoded;
+	std::array<uint8_t, 16> block;
+	TEST_CHECK(EncodeDecode(Format::BC1, texels, 3, decoded, block) <= 4);
+	TEST_CHECK(MatchesBC1Layout(block, decoded));
+
+	// color1 is the dark one, only the first texel uses it
+	uint32_t indices;
+	std::memcpy(&indices, block.data() + 4, sizeof(indices));
+	TEST_CHECK(indices == 1);
+
+	// Bright first texel: the encoder swaps the endpoints so that its index fits in 3 bits
+	Block bright = MakeSolid(20, 30, 40, 255);
+	bright[0] = 230;
+	bright[1] = 220;
+	bright[2] = 200;
+	TEST_CHECK(EncodeDecode(Format::BC7, bright, 4, decoded, block) <= 1);
+	TEST_CHECK(MatchesBC7Layout(block, decoded));
+	TEST_CHECK(ReadBits(block.data(), 65, 3) == 0);
+	TEST_CHECK(EncodeDecode(Format::BC7, texels, 4, decoded, block) <= 1);
+	TEST_CHECK(MatchesBC7Layout(block, decoded));
+	TEST_CHECK(ReadBits(block.data(), 65, 3) == 0);
+}
+
+// Blocks of other BC7 modes are not decoded
+TERRAIN_TEST(BlockCompress, OtherBC7Modes)
+{
+	std::array<uint8_t, 16> block = {};
+	block[0] = 0x20; // mode 5
+	Block decoded;
+	TEST_CHECK(!DecodeBlock(Format::BC7, block.data(), decoded.data()));
+	TEST_CHECK(decoded[0] == 255 && decoded[1] == 0 && decoded[2] == 255);
+}
+
+// The generated albedo through both encoders, partial blocks at the image edges included
+TERRAIN_TEST(BlockCompress, AlbedoQuality)
+{
+	constexpr uint32_t SIZE = 126;
+	const std::vector<uint8_t> albedo = TerrainScene::GenerateAlbedo(SIZE, 1);
+
+	const std::vector<uint8_t> bc1 = Encode(Format::BC1, albedo.data(), SIZE, SIZE);
+	const std::vector<uint8_t> bc7 = Encode(Format::BC7, albedo.data(), SIZE, SIZE);
+	TEST_CHECK(bc1.size() == 32 * 32 * 8);
+	TEST_CHECK(bc7.size() == 32 * 32 * 16);
+
+	const std::vector<uint8_t> bc1Decoded = Decode(Format::BC1, bc1.data(), SIZE, SIZE);
+	const std::vector<uint8_t> bc7Decoded = Decode(Format::BC7, bc7.data(), SIZE, SIZE);
+	TEST_CHECK(bc1Decoded.size() == albedo.size());
+	TEST_CHECK(GetPsnr(albedo, bc1Decoded) >= 38.0);
+	TEST_CHECK(GetPsnr(albedo, bc7Decoded) >= 44.0);
+}
@@ -0,0 +1,102 @@
+#include <taskflow/taskflow.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "../bench/TerrainScene.h"
+#include "../source/terrain/HeightmapStore.h"
+#include "../source/terrain/QuadTree.h"
+#include "TerrainTest.h"
+
+namespace
+{
+	constexpr uint32_t TREE_SIZE = 128;
+
+	// Normalized height of texel x of a row, as the vertex shader samples it
+	double DecodeTexel(const HeightmapStore& heightmap, const uint32_t row, const uint32_t x)
+	{
+		switch (heightmap.GetFormat())
+		{
+		case HeightmapFormat::R8_UNORM: return heightmap.GetRow<uint8_t>(row)[x] / 255.0;
+		case HeightmapFormat::R16_UNORM: return heightmap.GetRow<uint16_t>(row)[x] / 65535.0;
+		case HeightmapFormat::R16_FLOAT: return HalfToFloat(heightmap.GetRow<uint16_t>(row)[x]);
+		case HeightmapFormat::R32_FLOAT: return heightmap.GetRow<float>(row)[x];
+		}
+		return 0.0;
+	}
+}
+
+TERRAIN_TEST(Heightmap, HalfConversion)
+{
+	TEST_CHECK(FloatToHalf(0.0f) == 0x0000);
+	TEST_CHECK(FloatToHalf(-0.0f) == 0x8000);
+	TEST_CHECK(FloatToHalf(1.0f) == 0x3c00);
+	TEST_CHECK(FloatToHalf(0.5f) == 0x3800);
+	TEST_CHECK(FloatToHalf(-2.0f) == 0xc000);
+	TEST_CHECK(FloatToHalf(65504.0f) == 0x7bff);
+	TEST_CHECK(FloatToHalf(std::ldexp(1.0f, -14)) == 0x0400);
+	TEST_CHECK(FloatToHalf(std::ldexp(1.0f, -24)) == 0x0001);
+
+	// Ties round to even, past the largest half to infinity, NaNs stay NaNs
+	TEST_CHECK(FloatToHalf(1.0f + std::ldexp(1.0f, -11)) == 0x3c00);
+	TEST_CHECK(FloatToHalf(1.0f + 3.0f * std::ldexp(1.0f, -11)) == 0x3c02);
+	TEST_CHECK(FloatToHalf(std::ldexp(5.0f, -25)) == 0x0002);
+	TEST_CHECK(FloatToHalf(65520.0f) == 0x7c00);
+	TEST_CHECK(FloatToHalf(-std::numeric_limits<float>::infinity()) == 0xfc00);
+	TEST_CHECK(std::isnan(HalfToFloat(FloatToHalf(std::numeric_limits<float>::quiet_NaN()))));
+
+	// Every finite half survives the round trip through float
+	for (uint32_t half = 0; half <= 0xffff; half++)
+	{
+		if ((half & 0x7c00u) == 0x7c00u)
+			continue;
+		TEST_CHECK(FloatToHalf(HalfToFloat(static_cast<uint16_t>(half))) == half);
+	}
+}
+
+// The same heights in every format, each texel under a leaf is within the 8 bit height range of the leaf
+// and the finer formats quantize the leaves close to the R8 ones. R8 texels truncate the heights, the finer
+// ones round to nearest before their range is rounded outwards to 8 bits, two levels apart at most
+TERRAIN_TEST(Heightmap, LeafHeightsAllFormats)
+{
+	const HeightmapFormat formats[] = { HeightmapFormat::R8_UNORM, HeightmapFormat::R16_UNORM, HeightmapFormat::R16_FLOAT, HeightmapFormat::R32_FLOAT };
+	std::vector<Node> r8Leaves;
+	for (const HeightmapFormat format : formats)
+	{
+		const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(TREE_SIZE, format, 7);
+		TEST_CHECK(heightmap->GetDataSize() == static_cast<size_t>(TREE_SIZE) * TREE_SIZE * GetBytesPerTexel(format));
+
+		tf::Executor executor;
+		QuadTree quadTree(static_cast<float>(TREE_SIZE), static_cast<float>(TREE_SIZE), static_cast<float>(TREE_SIZE));
+		quadTree.Init(heightmap, executor);
+		executor.wait_for_all();
+		TEST_CHECK(quadTree.IsHeightLoaded());
+
+		const uint32_t leafSize = TREE_SIZE >> quadTree.GetNumLods();
+		bool contained = true;
+		for (uint32_t z = 0; z < TREE_SIZE; z++)
+		{
+			for (uint32_t x = 0; x < TREE_SIZE; x++)
+			{
+				const Node& leaf = quadTree.GetNode(quadTree.GetNodeIndex(0, x / leafSize, z / leafSize));
+				const double height = DecodeTexel(*heightmap, z, x) * 255.0;
+				contained = contained && leaf.m_MinHeight <= height && height <= leaf.m_MaxHeight;
+			}
+		}
+		TEST_CHECK(contained);
+
+		const std::span<const Node> nodes = quadTree.GetNodes();
+		const std::vector<Node> leaves(nodes.begin() + QuadTree::GetNumNodes(quadTree.GetNumLods()), nodes.end());
+		if (format == HeightmapFormat::R8_UNORM)
+			r8Leaves = leaves;
+
+		bool close = leaves.size() == r8Leaves.size();
+		for (size_t i = 0; close && i < leaves.size(); i++)
+			close = std::abs(leaves[i].m_MinHeight - r8Leaves[i].m_MinHeight) <= 2 && std::abs(leaves[i].m_MaxHeight - r8Leaves[i].m_MaxHeight) <= 2;
+		TEST_CHECK(close);
+	}
+}
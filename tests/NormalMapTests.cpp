@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "../bench/TerrainScene.h"
+#include "../source/terrain/NormalMap.h"
+#include "TerrainTest.h"
+
+namespace
+{
+	float3 DecodeTexel(const NormalMap::Mip& mip, const uint32_t x, const uint32_t y)
+	{
+		const int8_t* texel = reinterpret_cast<const int8_t*>(mip.texels.data() + (static_cast<size_t>(y) * mip.width + x) * NormalMap::BYTES_PER_TEXEL);
+		return NormalMap::Decode(float2(std::max(texel[0] / 127.0f, -1.0f), std::max(texel[1] / 127.0f, -1.0f)));
+	}
+
+	double GetAngle(const float3 a, const float3 b)
+	{
+		return std::acos(std::clamp(static_cast<double>(dot(a, b)), -1.0, 1.0)) * 180.0 / PI_d;
+	}
+
+	struct Error
+	{
+		double meanAngle = 0.0; // degrees
+		double maxAngle = 0.0;
+		double maxLambert = 0.0; // largest change of the diffuse term lit from sunDirection
+	};
+
+	// Every texel of a mip against the four taps of the terrain_ps.hlsl fallback at its center
+	Error GetShaderError(const HeightmapStore& heightmap, const NormalMap::Mip& mip)
+	{
+		const float3 sunDirection = normalize(float3(1.0f, 1.0f, 0.5f));
+		Error error;
+		for (uint32_t y = 0; y < mip.height; y++)
+		{
+			for (uint32_t x = 0; x < mip.width; x++)
+			{
+				const float2 uv = (float2(static_cast<float>(x), static_cast<float>(y)) + 0.5f) / float2(static_cast<float>(mip.width), static_cast<float>(mip.height));
+				const float3 stored = DecodeTexel(mip, x, y);
+				const float3 reference = NormalMap::GetReferenceNormal(heightmap, uv, NormalMap::UV_OFFSET);
+				const double angle = GetAngle(stored, reference);
+				const double lambert = std::abs(std::max(dot(stored, sunDirection), 0.0f) - std::max(dot(reference, sunDirection), 0.0f));
+				error.meanAngle += angle;
+				error.maxAngle = std::max(error.maxAngle, angle);
+				error.maxLambert = std::max(error.maxLambert, lambert);
+			}
+		}
+		error.meanAngle /= static_cast<double>(mip.width) * mip.height;
+		return error;
+	}
+}
+
+// The stored normals are the shader differences up to the RG8 quantization, the diffuse shading moves by less than 2%.
+// Heightmaps smaller than the SIMD width and of widths that aren't a multiple of it take the scalar tail
+TERRAIN_TEST(NormalMap, MatchesShaderDifferences)
+{
+	const HeightmapFormat formats[] = { HeightmapFormat::R8_UNORM, HeightmapFormat::R16_UNORM, HeightmapFormat::R32_FLOAT };
+	const uint32_t sizes[] = { 13, 256, 300 };
+	for (const HeightmapFormat format : formats)
+	{
+		for (const uint32_t size : sizes)
+		{
+			const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(size, format, 5);
+			const std::vector<NormalMap::Mip> mips = NormalMap::Build(*heightmap, 2);
+			TEST_CHECK(mips.size() == 2 && mips[1].width == size / 2);
+
+			const Error error = GetShaderError(*heightmap, mips[0]);
+			TEST_CHECK(error.meanAngle < 0.4);
+			TEST_CHECK(error.maxAngle < 1.0);
+			TEST_CHECK(error.maxLambert < 0.02);
+		}
+	}
+}
+
+// Mips average the normals, close to the shader differences while a texel is well under UV_OFFSET
+TERRAIN_TEST(NormalMap, Mips)
+{
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(256, HeightmapFormat::R16_UNORM, 5);
+	const std::vector<NormalMap::Mip> mips = NormalMap::Build(*heightmap, std::bit_width(256u));
+	TEST_CHECK(mips.size() == 9 && mips.back().width == 1 && mips.back().height == 1);
+	TEST_CHECK(GetShaderError(*heightmap, mips[1]).meanAngle < 1.0);
+	TEST_CHECK(GetShaderError(*heightmap, mips[2]).meanAngle < 2.5);
+
+	// A flat heightmap is up everywhere, in every mip
+	const std::vector<uint8_t> flat(64 * 64, 100);
+	const std::shared_ptr<HeightmapStore> flatHeightmap = HeightmapStore::CreateCopy({ flat.data(), 64, 64, HeightmapFormat::R8_UNORM });
+	bool up = true;
+	for (const NormalMap::Mip& mip : NormalMap::Build(*flatHeightmap, 7))
+	{
+		for (uint32_t y = 0; y < mip.height; y++)
+		{
+			for (uint32_t x = 0; x < mip.width; x++)
+				up = up && GetAngle(DecodeTexel(mip, x, y), float3(0.0f, 1.0f, 0.0f)) < 1e-3;
+		}
+	}
+	TEST_CHECK(up);
+}
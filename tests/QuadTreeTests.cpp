@@ -0,0 +1,148 @@
+#include <taskflow/taskflow.hpp>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "../bench/TerrainScene.h"
+#include "../source/terrain/QuadTree.h"
+#include "../source/terrain/TerrainInstance.h"
+#include "TerrainTest.h"
+
+namespace
+{
+	constexpr uint32_t TREE_SIZE = 64;
+
+	// Random R8 texels, a single tree over the whole heightmap with one texel per world unit
+	std::shared_ptr<HeightmapStore> CreateNoiseHeightmap(const uint32_t size)
+	{
+		std::vector<uint8_t> texels(static_cast<size_t>(size) * size);
+		uint32_t state = 0x9e3779b9u;
+		for (uint8_t& texel : texels)
+		{
+			state = state * 1664525u + 1013904223u;
+			texel = static_cast<uint8_t>(state >> 24);
+		}
+		return HeightmapStore::CreateCopy({ texels.data(), size, size, HeightmapFormat::R8_UNORM });
+	}
+
+	std::unique_ptr<QuadTree> CreateQuadTree(std::shared_ptr<const HeightmapStore> heightmap)
+	{
+		tf::Executor executor;
+		auto quadTree = std::make_unique<QuadTree>(static_cast<float>(TREE_SIZE), static_cast<float>(TREE_SIZE), static_cast<float>(TREE_SIZE));
+		quadTree->Init(std::move(heightmap), executor);
+		executor.wait_for_all();
+		return quadTree;
+	}
+}
+
+TERRAIN_TEST(QuadTree, MortonRoundTrip)
+{
+	for (uint32_t z = 0; z < 256; z += 3)
+	{
+		for (uint32_t x = 0; x < 256; x += 5)
+		{
+			const uint2 coords = QuadTree::DecodeMorton(QuadTree::EncodeMorton(x, z));
+			TEST_CHECK(coords.x == x && coords.y == z);
+		}
+	}
+	TEST_CHECK(QuadTree::EncodeMorton(1, 0) == 1);
+	TEST_CHECK(QuadTree::EncodeMorton(0, 1) == 2);
+	TEST_CHECK(QuadTree::EncodeMorton(0xffff, 0xffff) == ~0u);
+}
+
+TERRAIN_TEST(QuadTree, NodeLayout)
+{
+	const std::unique_ptr<QuadTree> quadTree = CreateQuadTree(CreateNoiseHeightmap(TREE_SIZE));
+	const int numLods = quadTree->GetNumLods();
+	TEST_CHECK(numLods == 6);
+	TEST_CHECK(quadTree->GetNodes().size() == QuadTree::GetNumNodes(numLods + 1));
+	TEST_CHECK(quadTree->GetNodeIndex(numLods, 0, 0) == QuadTree::ROOT_NODE);
+
+	// The children of every node are the four nodes one level below covering its quadrants
+	for (int lodLevel = numLods; lodLevel > 0; lodLevel--)
+	{
+		const uint32_t levelSize = 1u << (numLods - lodLevel);
+		for (uint32_t z = 0; z < levelSize; z++)
+		{
+			for (uint32_t x = 0; x < levelSize; x++)
+			{
+				const uint32_t nodeIndex = quadTree->GetNodeIndex(lodLevel, x, z);
+				for (int child = 0; child < 4; child++)
+				{
+					const uint32_t childIndex = quadTree->GetNodeIndex(lodLevel - 1, 2 * x + (child & 1), 2 * z + (child >> 1));
+					TEST_CHECK(QuadTree::GetChildIndex(nodeIndex, child) == childIndex);
+				}
+			}
+		}
+	}
+}
+
+TERRAIN_TEST(QuadTree, NodeBounds)
+{
+	const std::unique_ptr<QuadTree> quadTree = CreateQuadTree(CreateNoiseHeightmap(TREE_SIZE));
+	const int numLods = quadTree->GetNumLods();
+
+	const box3 rootBounds = quadTree->GetNodeBounds(QuadTree::ROOT_NODE);
+	TEST_CHECK_NEAR(rootBounds.m_mins.x, -0.5f * TREE_SIZE, 1e-4f);
+	TEST_CHECK_NEAR(rootBounds.m_maxs.z, 0.5f * TREE_SIZE, 1e-4f);
+
+	for (uint32_t nodeIndex = 0; nodeIndex < QuadTree::GetNumNodes(numLods); nodeIndex++)
+	{
+		const Node& node = quadTree->GetNode(nodeIndex);
+		const box3 bounds = quadTree->GetNodeBounds(nodeIndex);
+		for (int child = 0; child < 4; child++)
+		{
+			// Children split the xz bounds of their parent and their height range is within the parent's
+			const uint32_t childIndex = QuadTree::GetChildIndex(nodeIndex, child);
+			const Node& childNode = quadTree->GetNode(childIndex);
+			const box3 childBounds = quadTree->GetNodeBounds(childIndex);
+			TEST_CHECK(node.m_MinHeight <= childNode.m_MinHeight && childNode.m_MaxHeight <= node.m_MaxHeight);
+			TEST_CHECK_NEAR(childBounds.diagonal().x * 2.0f, bounds.diagonal().x, 1e-4f);
+			TEST_CHECK(childBounds.m_mins.x >= bounds.m_mins.x - 1e-4f && childBounds.m_maxs.z <= bounds.m_maxs.z + 1e-4f);
+		}
+	}
+}
+
+TERRAIN_TEST(QuadTree, LeafHeights)
+{
+	const std::shared_ptr<HeightmapStore> heightmap = CreateNoiseHeightmap(TREE_SIZE);
+	const std::unique_ptr<QuadTree> quadTree = CreateQuadTree(heightmap);
+
+	// Every texel within a leaf is inside its height range, the leaves also cover the bilinear neighbours
+	const uint32_t leafSize = TREE_SIZE >> quadTree->GetNumLods();
+	for (uint32_t z = 0; z < TREE_SIZE; z++)
+	{
+		const uint8_t* row = heightmap->GetRow<uint8_t>(z);
+		for (uint32_t x = 0; x < TREE_SIZE; x++)
+		{
+			const Node& leaf = quadTree->GetNode(quadTree->GetNodeIndex(0, x / leafSize, z / leafSize));
+			TEST_CHECK(leaf.m_MinHeight <= row[x] && row[x] <= leaf.m_MaxHeight);
+		}
+	}
+}
+
+TERRAIN_TEST(QuadTree, PackInstancesBudget)
+{
+	tf::Executor executor;
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(256, HeightmapFormat::R8_UNORM, 1);
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(256.0f, 256.0f, heightmap, executor);
+	const TerrainScene::Camera camera = TerrainScene::EvaluatePath("zoom", 1.0f, 256.0f, 50.0f);
+
+	QuadTreeSelection selection;
+	quadTrees[0]->NodeSelect(selection, camera.position, TerrainScene::MakeFrustum(camera, 256.0f), 50.0f);
+	TEST_CHECK(selection.m_NumInstances > 8);
+
+	// A smaller budget writes the first instances of the full packing and nothing past them
+	std::vector<TerrainInstanceData> full(selection.m_NumInstances);
+	TEST_CHECK(quadTrees[0]->PackInstances(selection, full.data()) == selection.m_NumInstances);
+
+	const int maxInstances = selection.m_NumInstances / 2;
+	TerrainInstanceData unwritten = {};
+	unwritten.lodAndFlags = ~0u;
+	std::vector<TerrainInstanceData> clamped(selection.m_NumInstances, unwritten);
+	TEST_CHECK(quadTrees[0]->PackInstances(selection, clamped.data(), maxInstances) == maxInstances);
+	TEST_CHECK(std::memcmp(clamped.data(), full.data(), maxInstances * sizeof(TerrainInstanceData)) == 0);
+	for (int i = maxInstances; i < selection.m_NumInstances; i++)
+		TEST_CHECK(clamped[i].lodAndFlags == ~0u);
+}
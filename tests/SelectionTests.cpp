@@ -0,0 +1,215 @@
+#include <taskflow/taskflow.hpp>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "../bench/TerrainScene.h"
+#include "../source/terrain/QuadTree.h"
+#include "../source/terrain/TerrainInstance.h"
+#include "TerrainTest.h"
+
+namespace
+{
+	constexpr float WORLD_SIZE = 1024.0f;
+	constexpr float SURFACE_SIZE = 512.0f;
+	constexpr float MAX_HEIGHT = 100.0f;
+	constexpr int NUM_FRAMES = 300;
+
+	bool SameSelection(const QuadTreeSelection& a, const QuadTreeSelection& b)
+	{
+		auto sameNode = [](const SelectedNode& x, const SelectedNode& y)
+			{
+				return x.m_NodeIndex == y.m_NodeIndex && x.m_LodLevel == y.m_LodLevel && x.m_ChildMask == y.m_ChildMask;
+			};
+		return a.m_NumInstances == b.m_NumInstances && a.m_CulledNodes == b.m_CulledNodes && a.m_StitchFlags == b.m_StitchFlags
+			&& std::equal(a.m_Nodes.begin(), a.m_Nodes.end(), b.m_Nodes.begin(), b.m_Nodes.end(), sameNode);
+	}
+}
+
+// Selections kept across the frames of the bench paths, with only the blocks the camera moved past walked again,
+// are the ones a full selection makes every frame
+TERRAIN_TEST(Selection, IncrementalMatchesFull)
+{
+	tf::Executor executor;
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(512, HeightmapFormat::R8_UNORM, 1);
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(WORLD_SIZE, SURFACE_SIZE, heightmap, executor);
+
+	for (const std::string_view path : TerrainScene::PATHS)
+	{
+		std::vector<QuadTreeSelection> kept(quadTrees.size());
+		int numKept = 0;
+		int numChanged = 0;
+		bool matches = true;
+		for (int frame = 0; frame < NUM_FRAMES; frame++)
+		{
+			const TerrainScene::Camera camera = TerrainScene::EvaluatePath(path, static_cast<float>(frame) / (NUM_FRAMES - 1), WORLD_SIZE, MAX_HEIGHT);
+			const dm::frustum frustum = TerrainScene::MakeFrustum(camera, WORLD_SIZE);
+			for (size_t i = 0; i < quadTrees.size(); i++)
+			{
+				const bool changed = quadTrees[i]->UpdateSelection(kept[i], camera.position, frustum, MAX_HEIGHT);
+				numChanged += changed ? 1 : 0;
+				numKept += changed ? 0 : 1;
+
+				QuadTreeSelection full;
+				quadTrees[i]->NodeSelect(full, camera.position, frustum, MAX_HEIGHT);
+				matches = matches && SameSelection(kept[i], full);
+				matches = matches && quadTrees[i]->IsSelectionCoherent(kept[i], camera.position, frustum, MAX_HEIGHT);
+			}
+		}
+		TEST_CHECK(matches);
+		TEST_CHECK(numChanged > 0);
+	}
+}
+
+// Views selected together keep their own blocks, as a cascade with coarser LOD ranges does next to the main view
+TERRAIN_TEST(Selection, BatchedViewsMatchFull)
+{
+	tf::Executor executor;
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(512, HeightmapFormat::R8_UNORM, 1);
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(WORLD_SIZE, SURFACE_SIZE, heightmap, executor);
+
+	for (const std::string_view path : TerrainScene::PATHS)
+	{
+		std::vector<std::array<QuadTreeSelection, 2>> kept(quadTrees.size());
+		bool matches = true;
+		for (int frame = 0; frame < NUM_FRAMES; frame++)
+		{
+			const TerrainScene::Camera camera = TerrainScene::EvaluatePath(path, static_cast<float>(frame) / (NUM_FRAMES - 1), WORLD_SIZE, MAX_HEIGHT);
+			const dm::frustum frustum = TerrainScene::MakeFrustum(camera, WORLD_SIZE);
+			const SelectionView views[] = { { camera.position, frustum, 1.0f }, { camera.position, frustum, 0.5f } };
+			for (size_t i = 0; i < quadTrees.size(); i++)
+			{
+				QuadTreeSelection* selections[] = { &kept[i][0], &kept[i][1] };
+				quadTrees[i]->UpdateSelections(selections, views, 2, MAX_HEIGHT);
+				for (int v = 0; v < 2; v++)
+				{
+					QuadTreeSelection full;
+					quadTrees[i]->NodeSelect(full, views[v].position, views[v].frustum, MAX_HEIGHT, views[v].lodRangeScale);
+					matches = matches && SameSelection(kept[i][v], full);
+				}
+			}
+		}
+		TEST_CHECK(matches);
+	}
+}
+
+// A camera moving a little past one LOD boundary only walks the blocks around it again, the others keep their records
+TERRAIN_TEST(Selection, KeepsCoherentBlocks)
+{
+	tf::Executor executor;
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(512, HeightmapFormat::R8_UNORM, 1);
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(SURFACE_SIZE, SURFACE_SIZE, heightmap, executor);
+	const QuadTree& quadTree = *quadTrees[0];
+
+	TerrainScene::Camera camera = { float3(10.0f, MAX_HEIGHT * 1.2f, -20.0f), normalize(float3(0.3f, -1.0f, 0.2f)) };
+	const dm::frustum frustum = TerrainScene::MakeFrustum(camera, SURFACE_SIZE);
+
+	QuadTreeSelection selection;
+	quadTree.NodeSelect(selection, camera.position, frustum, MAX_HEIGHT);
+	TEST_CHECK(selection.m_Blocks.size() > 4);
+
+	// Creep in steps below the smallest margin of the tests above the blocks until a block goes stale
+	int numUpdates = 0;
+	for (int step = 0; step < 2000 && numUpdates == 0; step++)
+	{
+		const std::vector<SelectionBlock> before = selection.m_Blocks;
+		camera.position.x += 0.05f;
+		if (!quadTree.IsSelectionCoherent(selection, camera.position, frustum, MAX_HEIGHT) && quadTree.UpdateSelection(selection, camera.position, frustum, MAX_HEIGHT))
+		{
+			numUpdates++;
+
+			// Same blocks in the same order, some of them kept with their margins lowered by the step
+			int numUnchanged = 0;
+			TEST_CHECK(before.size() == selection.m_Blocks.size());
+			for (size_t b = 0; b < before.size() && b < selection.m_Blocks.size(); b++)
+			{
+				TEST_CHECK(before[b].m_X == selection.m_Blocks[b].m_X && before[b].m_Z == selection.m_Blocks[b].m_Z);
+				numUnchanged += before[b].m_EndNode - before[b].m_FirstNode == selection.m_Blocks[b].m_EndNode - selection.m_Blocks[b].m_FirstNode
+					&& selection.m_Blocks[b].m_RangeMargin < before[b].m_RangeMargin ? 1 : 0;
+			}
+			TEST_CHECK(numUnchanged > 0);
+		}
+	}
+	TEST_CHECK(numUpdates == 1);
+
+	QuadTreeSelection full;
+	quadTree.NodeSelect(full, camera.position, frustum, MAX_HEIGHT);
+	TEST_CHECK(SameSelection(selection, full));
+}
+
+// The stitch flags of every drawn node over the bench paths are the ones a walk up the ancestors of each neighbour
+// finds: the first ancestor drawn, below the common ancestor with the node, gives how many levels coarser it is
+TERRAIN_TEST(Selection, StitchFlagsMatchAncestorWalk)
+{
+	tf::Executor executor;
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(512, HeightmapFormat::R8_UNORM, 1);
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(WORLD_SIZE, SURFACE_SIZE, heightmap, executor);
+
+	// Edges in the order of TERRAIN_STITCH_MASK
+	static constexpr int edgeOffsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+	for (const std::string_view path : TerrainScene::PATHS)
+	{
+		uint64_t numStitched = 0;
+		bool matches = true;
+		for (int frame = 0; frame < NUM_FRAMES; frame++)
+		{
+			const TerrainScene::Camera camera = TerrainScene::EvaluatePath(path, static_cast<float>(frame) / (NUM_FRAMES - 1), WORLD_SIZE, MAX_HEIGHT);
+			const dm::frustum frustum = TerrainScene::MakeFrustum(camera, WORLD_SIZE);
+			for (const std::unique_ptr<QuadTree>& quadTree : quadTrees)
+			{
+				QuadTreeSelection selection;
+				quadTree->NodeSelect(selection, camera.position, frustum, MAX_HEIGHT);
+				TEST_CHECK(selection.m_StitchFlags.size() == static_cast<size_t>(selection.m_NumInstances));
+
+				std::vector<uint32_t> drawn;
+				for (const SelectedNode& selected : selection.m_Nodes)
+				{
+					quadTree->ForEachSelectedInstance(selected, [&](const int lodLevel, const uint32_t x, const uint32_t z)
+						{
+							drawn.push_back(quadTree->GetNodeIndex(lodLevel, x, z));
+						});
+				}
+				std::sort(drawn.begin(), drawn.end());
+
+				const int numLods = quadTree->GetNumLods();
+				size_t instance = 0;
+				for (const SelectedNode& selected : selection.m_Nodes)
+				{
+					quadTree->ForEachSelectedInstance(selected, [&](const int lodLevel, const uint32_t x, const uint32_t z)
+						{
+							const int64_t levelSize = int64_t(1) << (numLods - lodLevel);
+							uint32_t flags = 0;
+							for (int edge = 0; edge < 4; edge++)
+							{
+								const int64_t neighbourX = static_cast<int64_t>(x) + edgeOffsets[edge][0];
+								const int64_t neighbourZ = static_cast<int64_t>(z) + edgeOffsets[edge][1];
+								if (neighbourX < 0 || neighbourZ < 0 || neighbourX >= levelSize || neighbourZ >= levelSize)
+									continue;
+
+								for (int levels = 1; lodLevel + levels <= numLods; levels++)
+								{
+									const uint32_t ancestorX = static_cast<uint32_t>(neighbourX >> levels);
+									const uint32_t ancestorZ = static_cast<uint32_t>(neighbourZ >> levels);
+									if (ancestorX == (x >> levels) && ancestorZ == (z >> levels))
+										break;
+									if (std::binary_search(drawn.begin(), drawn.end(), quadTree->GetNodeIndex(lodLevel + levels, ancestorX, ancestorZ)))
+									{
+										flags |= PackEdgeStitch(edge, levels);
+										numStitched++;
+										break;
+									}
+								}
+							}
+							matches = matches && instance < selection.m_StitchFlags.size() && selection.m_StitchFlags[instance] == flags;
+							instance++;
+						});
+				}
+			}
+		}
+		TEST_CHECK(matches);
+		TEST_CHECK(numStitched > 0);
+	}
+}
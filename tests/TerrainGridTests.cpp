@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "../source/terrain/QuadTree.h"
+#include "../source/terrain/TerrainGrid.h"
+#include "../source/terrain/TerrainInstance.h"
+#include "TerrainTest.h"
+
+namespace
+{
+	template <uint32_t GridSize>
+	TerrainGrid::CacheStats Simulate(const TerrainGrid::Mesh<GridSize>& mesh, const uint32_t cacheSize, const bool lru)
+	{
+		using Mesh = TerrainGrid::Mesh<GridSize>;
+		return TerrainGrid::SimulateCache<typename Mesh::Index>({ mesh.indices.data(), mesh.numIndices }, Mesh::NUM_VERTICES, cacheSize, lru);
+	}
+
+	// Strips sized for each cache shade every vertex close to once, fewer than the row major grid which shades the rows
+	// twice unless two of them fit. A FIFO cache hits as often as an LRU one, the strips never reuse an entry about to
+	// be evicted
+	template <uint32_t GridSize>
+	void CheckCacheOrder()
+	{
+		using Mesh = TerrainGrid::Mesh<GridSize>;
+		const std::unique_ptr<Mesh> rowMajor = std::make_unique<Mesh>();
+		const std::unique_ptr<Mesh> strips = std::make_unique<Mesh>();
+		TerrainGrid::BuildRowMajor(*rowMajor);
+		TEST_CHECK(rowMajor->numIndices == Mesh::NUM_INDICES);
+		TEST_CHECK(TerrainGrid::GetDoubleArea(*rowMajor) == 8.0f);
+
+		for (const uint32_t cacheSize : { 16u, TerrainGrid::CACHE_SIZE, 64u })
+		{
+			TerrainGrid::Build(*strips, cacheSize);
+			TEST_CHECK(strips->numIndices == Mesh::NUM_INDICES);
+			TEST_CHECK(TerrainGrid::IsFetchOrdered(*strips));
+			TEST_CHECK(TerrainGrid::GetDoubleArea(*strips) == 8.0f);
+
+			// The extra misses of a strip are its first row, the last vertex of each row and the strip edge shared with the next
+			const uint32_t stripWidth = TerrainGrid::GetStripWidth(GridSize, cacheSize);
+			const uint32_t numStrips = (GridSize + stripWidth - 1) / stripWidth;
+			const double maxAtvr = static_cast<double>(Mesh::NUM_VERTICES + (numStrips - 1) * Mesh::SIDE_VERTICES) / Mesh::NUM_VERTICES;
+
+			const TerrainGrid::CacheStats fifo = Simulate(*strips, cacheSize, false);
+			const TerrainGrid::CacheStats lru = Simulate(*strips, cacheSize, true);
+			TEST_CHECK(fifo.acmr == lru.acmr);
+			TEST_CHECK(fifo.atvr <= maxAtvr + 1e-9);
+			for (const bool useLru : { false, true })
+			{
+				const TerrainGrid::CacheStats before = Simulate(*rowMajor, cacheSize, useLru);
+				TEST_CHECK(fifo.acmr < before.acmr || (fifo.acmr == before.acmr && 2 * Mesh::SIDE_VERTICES <= cacheSize));
+			}
+		}
+	}
+}
+
+TERRAIN_TEST(TerrainGrid, CacheOrder)
+{
+	CheckCacheOrder<TerrainGrid::GetGridSize(TerrainGrid::Tier::Low)>();
+	CheckCacheOrder<TerrainGrid::GetGridSize(TerrainGrid::Tier::Medium)>();
+	CheckCacheOrder<TerrainGrid::GetGridSize(TerrainGrid::Tier::High)>();
+	CheckCacheOrder<TerrainGrid::GetGridSize(TerrainGrid::Tier::Ultra)>();
+}
+
+// The ratios the tuning was measured at, the 128 quad grid against the row major order
+TERRAIN_TEST(TerrainGrid, UltraRatios)
+{
+	using Mesh = TerrainGrid::Mesh<TerrainGrid::GetGridSize(TerrainGrid::Tier::Ultra)>;
+	const std::unique_ptr<Mesh> rowMajor = std::make_unique<Mesh>();
+	const std::unique_ptr<Mesh> strips = std::make_unique<Mesh>();
+	TerrainGrid::BuildRowMajor(*rowMajor);
+	TEST_CHECK_NEAR(Simulate(*rowMajor, TerrainGrid::CACHE_SIZE, false).acmr, 1.008, 0.001);
+
+	const uint32_t cacheSizes[] = { 16, 32, 64 };
+	const double acmrs[] = { 0.591, 0.543, 0.524 };
+	for (int i = 0; i < 3; i++)
+	{
+		TerrainGrid::Build(*strips, cacheSizes[i]);
+		TEST_CHECK_NEAR(Simulate(*strips, cacheSizes[i], false).acmr, acmrs[i], 0.001);
+	}
+}
+
+namespace
+{
+	// Every variant covers the grid without holes or overlaps: the triangles keep their winding and add up to the area of
+	// the grid, each inner edge is shared by two triangles wound opposite ways. The edges used by one triangle only lie
+	// on the sides of the grid, one cell long on the plain sides and two on the stitched ones, where the neighbour one
+	// level coarser has its vertices
+	template <uint32_t GridSize>
+	void CheckStitchVariants()
+	{
+		using Mesh = TerrainGrid::Mesh<GridSize>;
+		const std::unique_ptr<Mesh> mesh = std::make_unique<Mesh>();
+		for (uint32_t stitchMask = 0; stitchMask < TerrainGrid::NUM_STITCH_VARIANTS; stitchMask++)
+		{
+			TerrainGrid::Build(*mesh, TerrainGrid::CACHE_SIZE, stitchMask);
+			TEST_CHECK(TerrainGrid::GetDoubleArea(*mesh) == 8.0f);
+			TEST_CHECK(stitchMask != 0 || TerrainGrid::IsFetchOrdered(*mesh));
+
+			const uint32_t numStitched = static_cast<uint32_t>(std::popcount(stitchMask));
+			TEST_CHECK(mesh->numIndices == (2 * GridSize * GridSize - numStitched * GridSize / 2) * 3);
+
+			// Directed edges, the first vertex in the high bits, sorted to find their reverse
+			std::vector<uint64_t> edges;
+			edges.reserve(mesh->numIndices);
+			for (uint32_t i = 0; i < mesh->numIndices; i += 3)
+			{
+				for (uint32_t k = 0; k < 3; k++)
+					edges.push_back(static_cast<uint64_t>(mesh->indices[i + k]) << 32 | mesh->indices[i + (k + 1) % 3]);
+			}
+			std::sort(edges.begin(), edges.end());
+			TEST_CHECK(std::adjacent_find(edges.begin(), edges.end()) == edges.end());
+
+			uint32_t sideSegments[4] = {};
+			bool sidesMatch = true;
+			for (const uint64_t edge : edges)
+			{
+				const uint32_t a = static_cast<uint32_t>(edge >> 32);
+				const uint32_t b = static_cast<uint32_t>(edge);
+				if (std::binary_search(edges.begin(), edges.end(), static_cast<uint64_t>(b) << 32 | a))
+					continue;
+
+				// Cell coordinates of the ends, exact for the grid sizes
+				const TerrainGrid::Vertex& p = mesh->vertices[a];
+				const TerrainGrid::Vertex& q = mesh->vertices[b];
+				const int ax = static_cast<int>((p.x + 1.0f) * 0.5f * GridSize + 0.5f);
+				const int az = static_cast<int>((p.z + 1.0f) * 0.5f * GridSize + 0.5f);
+				const int bx = static_cast<int>((q.x + 1.0f) * 0.5f * GridSize + 0.5f);
+				const int bz = static_cast<int>((q.z + 1.0f) * 0.5f * GridSize + 0.5f);
+
+				int side = -1;
+				if (ax == bx && (ax == 0 || ax == static_cast<int>(GridSize)))
+					side = ax == 0 ? 0 : 1;
+				else if (az == bz && (az == 0 || az == static_cast<int>(GridSize)))
+					side = az == 0 ? 2 : 3;
+				if (side < 0)
+				{
+					sidesMatch = false;
+					continue;
+				}
+
+				const int length = std::abs(ax - bx) + std::abs(az - bz);
+				const bool stitched = (stitchMask >> side) & 1;
+				sidesMatch = sidesMatch && length == (stitched ? 2 : 1) && (!stitched || (side < 2 ? std::min(az, bz) : std::min(ax, bx)) % 2 == 0);
+				sideSegments[side]++;
+			}
+			TEST_CHECK(sidesMatch);
+			for (uint32_t side = 0; side < 4; side++)
+				TEST_CHECK(sideSegments[side] == ((stitchMask >> side) & 1 ? GridSize / 2 : GridSize));
+		}
+	}
+}
+
+TERRAIN_TEST(TerrainGrid, StitchVariants)
+{
+	CheckStitchVariants<TerrainGrid::GetGridSize(TerrainGrid::Tier::Low)>();
+	CheckStitchVariants<TerrainGrid::GetGridSize(TerrainGrid::Tier::Medium)>();
+	CheckStitchVariants<TerrainGrid::GetGridSize(TerrainGrid::Tier::High)>();
+	CheckStitchVariants<TerrainGrid::GetGridSize(TerrainGrid::Tier::Ultra)>();
+}
+
+namespace
+{
+	// snapStitchedEdges of terrain_vs.hlsl
+	float2 SnapStitchedEdges(const float2 gridVertex, const uint32_t flags, const float gridSize)
+	{
+		const uint32_t extraLevels = (flags >> TERRAIN_STITCH_LEVELS_SHIFT) & 0xff;
+		if (extraLevels == 0)
+			return gridVertex;
+
+		float2 cell = float2(std::round((gridVertex.x + 1.0f) * 0.5f * gridSize), std::round((gridVertex.y + 1.0f) * 0.5f * gridSize));
+		float steps[4];
+		for (uint32_t edge = 0; edge < 4; edge++)
+		{
+			const uint32_t levels = (extraLevels >> (2 * edge)) & 3;
+			steps[edge] = static_cast<float>(1u << (levels + std::min(levels, 1u)));
+		}
+		if (cell.x == 0.0f)
+			cell.y = std::floor(cell.y / steps[0]) * steps[0];
+		if (cell.x == gridSize)
+			cell.y = std::floor(cell.y / steps[1]) * steps[1];
+		if (cell.y == 0.0f)
+			cell.x = std::floor(cell.x / steps[2]) * steps[2];
+		if (cell.y == gridSize)
+			cell.x = std::floor(cell.x / steps[3]) * steps[3];
+		return cell * 2.0f / gridSize - 1.0f;
+	}
+
+	// stitchedEdgeLod of terrain_vs.hlsl
+	uint32_t StitchedEdgeLod(const float2 gridVertex, const uint32_t lod, const uint32_t flags, const float gridSize)
+	{
+		const uint32_t mask = flags & TERRAIN_STITCH_MASK;
+		if (mask == 0)
+			return lod;
+
+		const float2 cell = float2(std::round((gridVertex.x + 1.0f) * 0.5f * gridSize), std::round((gridVertex.y + 1.0f) * 0.5f * gridSize));
+		const bool onEdge[4] = { cell.x == 0.0f, cell.x == gridSize, cell.y == 0.0f, cell.y == gridSize };
+		uint32_t edgeLevels = 0;
+		for (uint32_t edge = 0; edge < 4; edge++)
+		{
+			if (onEdge[edge] && ((mask >> edge) & 1) != 0)
+				edgeLevels = std::max(edgeLevels, 1 + ((flags >> (TERRAIN_STITCH_LEVELS_SHIFT + 2 * edge)) & 3));
+		}
+		return std::min(lod + edgeLevels, static_cast<uint32_t>(QuadTree::MAX_LODS - 1));
+	}
+
+	// The vertices the stitched variant draws on an edge bordering a node levels coarser land on every vertex the
+	// neighbour has along it and nowhere else, and sample the heights at the neighbour's LOD. The other sides and the
+	// inner vertices are left as they are
+	template <uint32_t GridSize>
+	void CheckStitchedEdgeVertices()
+	{
+		using Mesh = TerrainGrid::Mesh<GridSize>;
+		const std::unique_ptr<Mesh> mesh = std::make_unique<Mesh>();
+		const float gridSize = static_cast<float>(GridSize);
+		const uint32_t lod = 2;
+		for (int edge = 0; edge < 4; edge++)
+		{
+			TerrainGrid::Build(*mesh, TerrainGrid::CACHE_SIZE, 1u << edge);
+			std::vector<bool> used(Mesh::NUM_VERTICES, false);
+			for (uint32_t i = 0; i < mesh->numIndices; i++)
+				used[mesh->indices[i]] = true;
+
+			for (int levels = 1; levels <= TERRAIN_STITCH_MAX_EXTRA_LEVELS + 1; levels++)
+			{
+				const uint32_t flags = PackEdgeStitch(edge, levels);
+				const int step = 1 << levels;
+				std::vector<bool> covered(GridSize / step + 1, false);
+				bool snapped = true;
+				bool othersKept = true;
+				bool lodsMatch = true;
+				for (uint32_t v = 0; v < Mesh::NUM_VERTICES; v++)
+				{
+					if (!used[v])
+						continue;
+
+					const float2 gridVertex = float2(mesh->vertices[v].x, mesh->vertices[v].z);
+					const float2 result = SnapStitchedEdges(gridVertex, flags, gridSize);
+					const int x = static_cast<int>(std::lround((gridVertex.x + 1.0f) * 0.5f * gridSize));
+					const int z = static_cast<int>(std::lround((gridVertex.y + 1.0f) * 0.5f * gridSize));
+					const int edgeCells[4] = { x, static_cast<int>(GridSize) - x, z, static_cast<int>(GridSize) - z };
+					if (edgeCells[edge] != 0)
+					{
+						othersKept = othersKept && result == gridVertex;
+						lodsMatch = lodsMatch && StitchedEdgeLod(result, lod, flags, gridSize) == lod;
+						continue;
+					}
+
+					const int along = static_cast<int>(std::lround(((edge < 2 ? result.y : result.x) + 1.0f) * 0.5f * gridSize));
+					const float across = edge < 2 ? result.x : result.y;
+					snapped = snapped && along % step == 0 && across == (edge < 2 ? gridVertex.x : gridVertex.y);
+					if (along % step == 0)
+						covered[along / step] = true;
+					lodsMatch = lodsMatch && StitchedEdgeLod(result, lod, flags, gridSize) == lod + levels;
+				}
+				TEST_CHECK(snapped);
+				TEST_CHECK(othersKept);
+				TEST_CHECK(lodsMatch);
+				TEST_CHECK(std::find(covered.begin(), covered.end(), false) == covered.end());
+			}
+		}
+
+		// A corner on two stitched edges takes the coarser neighbour, the LOD never runs past the last one
+		const uint32_t flags = PackEdgeStitch(0, 1) | PackEdgeStitch(2, 3);
+		TEST_CHECK(StitchedEdgeLod(float2(-1.0f, -1.0f), lod, flags, gridSize) == lod + 3);
+		TEST_CHECK(StitchedEdgeLod(float2(-1.0f, 1.0f), lod, flags, gridSize) == lod + 1);
+		TEST_CHECK(StitchedEdgeLod(float2(-1.0f, -1.0f), QuadTree::MAX_LODS - 2, flags, gridSize) == QuadTree::MAX_LODS - 1);
+	}
+}
+
+TERRAIN_TEST(TerrainGrid, StitchedEdgeVertices)
+{
+	CheckStitchedEdgeVertices<TerrainGrid::GetGridSize(TerrainGrid::Tier::Low)>();
+	CheckStitchedEdgeVertices<TerrainGrid::GetGridSize(TerrainGrid::Tier::Medium)>();
+	CheckStitchedEdgeVertices<TerrainGrid::GetGridSize(TerrainGrid::Tier::High)>();
+	CheckStitchedEdgeVertices<TerrainGrid::GetGridSize(TerrainGrid::Tier::Ultra)>();
+}
@@ -0,0 +1,100 @@
+#include <donut/core/math/math.h>
+
+#include <algorithm>
+#include <cstddef>
+
+#include "../source/terrain/TerrainInstance.h"
+#include "TerrainTest.h"
+
+namespace
+{
+	bool RoundTrips(const box3& bounds, const int lodLevel, const uint32_t flags)
+	{
+		const TerrainInstanceData instance = PackTerrainInstance(bounds, lodLevel, flags);
+		const float2 boundsMin = instance.offset - instance.scale;
+		const float2 boundsMax = instance.offset + instance.scale;
+		return boundsMin.x == bounds.m_mins.x && boundsMin.y == bounds.m_mins.z && boundsMax.x == bounds.m_maxs.x && boundsMax.y == bounds.m_maxs.z
+			&& UnpackLodLevel(instance.lodAndFlags) == lodLevel && UnpackFlags(instance.lodAndFlags) == flags
+			&& (instance.lodAndFlags >> (TERRAIN_INSTANCE_FLAGS_SHIFT + 16)) == 0;
+	}
+
+	// Square bounds of a node, the height range is not packed
+	box3 MakeBounds(const float minX, const float minZ, const float size)
+	{
+		return box3(float3(minX, 0.0f, minZ), float3(minX + size, 1.0f, minZ + size));
+	}
+}
+
+TERRAIN_TEST(TerrainInstance, Layout)
+{
+	TEST_CHECK(sizeof(TerrainInstanceData) == 16);
+	TEST_CHECK(offsetof(TerrainInstanceData, offset) == 0);
+	TEST_CHECK(offsetof(TerrainInstanceData, scale) == 8);
+	TEST_CHECK(offsetof(TerrainInstanceData, lodAndFlags) == 12);
+}
+
+TERRAIN_TEST(TerrainInstance, LodAndFlagsBoundaries)
+{
+	const int lodLevels[] = { 0, 1, 11, 254, TERRAIN_INSTANCE_LOD_MASK };
+	const uint32_t flags[] = { 0, 1, TERRAIN_STITCH_MASK, 1u << 15, 0x7fff, TERRAIN_INSTANCE_FLAGS_MASK };
+	for (const int lodLevel : lodLevels)
+	{
+		for (const uint32_t flag : flags)
+		{
+			// Neither field leaks into the other
+			const uint32_t lodAndFlags = PackLodAndFlags(lodLevel, flag);
+			TEST_CHECK(UnpackLodLevel(lodAndFlags) == lodLevel);
+			TEST_CHECK(UnpackFlags(lodAndFlags) == flag);
+			TEST_CHECK(UnpackStitchMask(lodAndFlags) == (flag & TERRAIN_STITCH_MASK));
+			TEST_CHECK(lodAndFlags < (1u << (TERRAIN_INSTANCE_FLAGS_SHIFT + 16)));
+		}
+	}
+}
+
+TERRAIN_TEST(TerrainInstance, OffsetAndScale)
+{
+	// Leaves to roots of the largest surfaces, at the corners and the center of the world
+	const float sizes[] = { 1.0f, 2.0f, 64.0f, 2048.0f, 4096.0f };
+	for (const float size : sizes)
+	{
+		TEST_CHECK(RoundTrips(MakeBounds(-2048.0f, -2048.0f, size), 0, 0));
+		TEST_CHECK(RoundTrips(MakeBounds(2048.0f - size, 2048.0f - size, size), 10, TERRAIN_INSTANCE_FLAGS_MASK));
+		TEST_CHECK(RoundTrips(MakeBounds(0.0f, -size, size), TERRAIN_INSTANCE_LOD_MASK, TERRAIN_STITCH_MASK));
+	}
+
+	// Bounds off the power of two grid keep their center and half size
+	const box3 bounds = MakeBounds(-1000.25f, 312.5f, 3.5f);
+	const TerrainInstanceData instance = PackTerrainInstance(bounds, 3, 5);
+	TEST_CHECK(instance.offset.x == -998.5f && instance.offset.y == 314.25f);
+	TEST_CHECK(instance.scale == 1.75f);
+}
+
+TERRAIN_TEST(TerrainInstance, EdgeStitch)
+{
+	for (int edge = 0; edge < 4; edge++)
+	{
+		for (int levels = 1; levels <= 6; levels++)
+		{
+			const uint32_t flags = PackEdgeStitch(edge, levels);
+			const uint32_t extraLevels = (flags >> (TERRAIN_STITCH_LEVELS_SHIFT + 2 * edge)) & 3;
+			TEST_CHECK((flags & TERRAIN_STITCH_MASK) == (1u << edge));
+			TEST_CHECK(extraLevels == static_cast<uint32_t>(std::min(levels - 1, TERRAIN_STITCH_MAX_EXTRA_LEVELS)));
+
+			// Nothing outside the edge's own bits
+			const uint32_t edgeBits = (1u << edge) | (3u << (TERRAIN_STITCH_LEVELS_SHIFT + 2 * edge));
+			TEST_CHECK((flags & ~edgeBits) == 0);
+		}
+	}
+
+	// All four edges the most levels coarser fill the stitch bits and survive the instance packing
+	uint32_t flags = 0;
+	for (int edge = 0; edge < 4; edge++)
+		flags |= PackEdgeStitch(edge, 4);
+	TEST_CHECK(flags == 0xfff);
+	TEST_CHECK(RoundTrips(MakeBounds(-2048.0f, 0.0f, 8.0f), 3, flags));
+
+	// Clearing them keeps the LOD and the flags above
+	const uint32_t lodAndFlags = PackLodAndFlags(7, flags | 0xf000);
+	TEST_CHECK(ClearStitchFlags(lodAndFlags) == PackLodAndFlags(7, 0xf000));
+	TEST_CHECK(UnpackStitchMask(ClearStitchFlags(lodAndFlags)) == 0);
+}
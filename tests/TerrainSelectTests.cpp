@@ -0,0 +1,97 @@
+#include <taskflow/taskflow.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "../bench/TerrainScene.h"
+#include "../source/terrain/QuadTree.h"
+#include "../source/terrain/TerrainSelect.h"
+#include "TerrainTest.h"
+
+namespace
+{
+	constexpr float WORLD_SIZE = 1024.0f;
+	constexpr float SURFACE_SIZE = 512.0f;
+	constexpr float MAX_HEIGHT = 100.0f;
+	constexpr int NUM_FRAMES = 300;
+	constexpr uint32_t MAX_INSTANCES = 1u << 20;
+
+	// Instances of the CPU selection without the stitch flags, which the GPU selection doesn't write
+	std::vector<TerrainInstanceData> PackLods(const QuadTree& quadTree, const QuadTreeSelection& selection)
+	{
+		std::vector<TerrainInstanceData> instances(selection.m_NumInstances);
+		quadTree.PackInstances(selection, instances.data());
+		for (TerrainInstanceData& instance : instances)
+			instance.lodAndFlags &= TERRAIN_INSTANCE_LOD_MASK;
+		return instances;
+	}
+}
+
+// The selection the compute passes run, replayed on the CPU over the bench paths, draws the instances of NodeSelect
+TERRAIN_TEST(TerrainSelect, ReferenceMatchesNodeSelect)
+{
+	tf::Executor executor;
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(512, HeightmapFormat::R8_UNORM, 1);
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(WORLD_SIZE, SURFACE_SIZE, heightmap, executor);
+
+	for (const std::string_view path : TerrainScene::PATHS)
+	{
+		int numInstances = 0;
+		bool matches = true;
+		for (int frame = 0; frame < NUM_FRAMES; frame++)
+		{
+			const TerrainScene::Camera camera = TerrainScene::EvaluatePath(path, static_cast<float>(frame) / (NUM_FRAMES - 1), WORLD_SIZE, MAX_HEIGHT);
+			SelectionView view;
+			view.position = camera.position;
+			view.frustum = TerrainScene::MakeFrustum(camera, WORLD_SIZE);
+
+			for (const std::unique_ptr<QuadTree>& quadTree : quadTrees)
+			{
+				QuadTreeSelection selection;
+				quadTree->NodeSelect(selection, view.position, view.frustum, MAX_HEIGHT);
+
+				std::vector<TerrainInstanceData> reference;
+				TerrainSelect::SelectReference(*quadTree, TerrainSelect::MakeConstants(*quadTree, view, MAX_HEIGHT, 0, 0, MAX_INSTANCES, 0), reference);
+				matches = matches && TerrainSelect::SameInstances(PackLods(*quadTree, selection), reference);
+				numInstances += selection.m_NumInstances;
+			}
+		}
+		TEST_CHECK(matches);
+		TEST_CHECK(numInstances > 0);
+	}
+}
+
+// Every node in range fills the level lists, the nodes whose children don't fit are drawn whole and the tree stays covered
+TERRAIN_TEST(TerrainSelect, FullListDrawsNodesWhole)
+{
+	tf::Executor executor;
+	const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(256, HeightmapFormat::R8_UNORM, 1);
+	const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(256.0f, 256.0f, heightmap, executor);
+	const QuadTree& quadTree = *quadTrees[0];
+	TEST_CHECK(quadTree.GetNumLods() == 8);
+
+	// High above the center looking down, the whole tree is in view and in range of the finest LOD
+	const TerrainScene::Camera camera = { float3(0.0f, 256.0f, 0.0f), float3(0.0f, -1.0f, 0.0f) };
+	SelectionView view;
+	view.position = camera.position;
+	view.frustum = TerrainScene::MakeFrustum(camera, 256.0f);
+	view.lodRangeScale = 1000.0f;
+
+	std::vector<TerrainInstanceData> instances;
+	TerrainSelect::SelectReference(quadTree, TerrainSelect::MakeConstants(quadTree, view, 50.0f, 0, 0, MAX_INSTANCES, 0), instances);
+
+	// Level 2 fills the level 1 list with the children of its first quarter, level 1 does the same for the leaves
+	int numInstances[3] = {};
+	float area = 0.0f;
+	for (const TerrainInstanceData& instance : instances)
+	{
+		const int lodLevel = UnpackLodLevel(instance.lodAndFlags);
+		TEST_CHECK(lodLevel <= 2);
+		numInstances[lodLevel]++;
+		area += 4.0f * instance.scale * instance.scale;
+	}
+	TEST_CHECK(numInstances[0] == TERRAIN_SELECT_MAX_NODES);
+	TEST_CHECK(numInstances[1] == TERRAIN_SELECT_MAX_NODES - TERRAIN_SELECT_MAX_NODES / 4);
+	TEST_CHECK(numInstances[2] == TERRAIN_SELECT_MAX_NODES - TERRAIN_SELECT_MAX_NODES / 4);
+	TEST_CHECK(area == 256.0f * 256.0f);
+}
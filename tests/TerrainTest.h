@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// Minimal test registry for the terrain core, no framework dependency. Each test file registers its cases with
+// TERRAIN_TEST, the runner executes every case or the suites named on the command line. A failed check reports
+// the expression and marks its case as failed, the case keeps running
+namespace TerrainTest
+{
+	using TestFunc = void (*)();
+
+	struct Registrar
+	{
+		Registrar(const char* suite, const char* name, TestFunc func);
+	};
+
+	void ReportFailure(const char* file, int line, const char* expression);
+
+	// Runs the registered cases whose suite is in suites, all of them if numSuites is 0. Returns the number of failed cases
+	int RunTests(const char* const* suites, int numSuites);
+}
+
+#define TERRAIN_TEST(suite, name) \
+	static void suite##_##name(); \
+	static const TerrainTest::Registrar suite##_##name##_registrar(#suite, #name, &suite##_##name); \
+	static void suite##_##name()
+
+#define TEST_CHECK(expression) \
+	((expression) ? static_cast<void>(0) : TerrainTest::ReportFailure(__FILE__, __LINE__, #expression))
+
+#define TEST_CHECK_NEAR(a, b, tolerance) \
+	TEST_CHECK(std::abs(static_cast<double>(a) - static_cast<double>(b)) <= static_cast<double>(tolerance))
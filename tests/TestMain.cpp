@@ -0,0 +1,72 @@
+// Runner of the terrain core tests.
+//
+// Usage: vRenderer_terrain_tests [suite...]
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "TerrainTest.h"
+
+namespace
+{
+	struct TestCase
+	{
+		const char* suite;
+		const char* name;
+		TerrainTest::TestFunc func;
+	};
+
+	// Function local so the registrars of every translation unit can use it during static initialization
+	std::vector<TestCase>& GetTestCases()
+	{
+		static std::vector<TestCase> testCases;
+		return testCases;
+	}
+
+	int g_NumCaseFailures = 0;
+}
+
+namespace TerrainTest
+{
+	Registrar::Registrar(const char* suite, const char* name, const TestFunc func)
+	{
+		GetTestCases().push_back({ suite, name, func });
+	}
+
+	void ReportFailure(const char* file, const int line, const char* expression)
+	{
+		std::fprintf(stderr, "  %s:%d: check failed: %s\n", file, line, expression);
+		g_NumCaseFailures++;
+	}
+
+	int RunTests(const char* const* suites, const int numSuites)
+	{
+		int numRun = 0;
+		int numFailed = 0;
+		for (const TestCase& testCase : GetTestCases())
+		{
+			bool selected = numSuites == 0;
+			for (int i = 0; i < numSuites && !selected; i++)
+				selected = std::strcmp(suites[i], testCase.suite) == 0;
+			if (!selected)
+				continue;
+
+			g_NumCaseFailures = 0;
+			testCase.func();
+			numRun++;
+
+			const bool passed = g_NumCaseFailures == 0;
+			numFailed += passed ? 0 : 1;
+			std::printf("%s %s.%s\n", passed ? "[  ok  ]" : "[ FAIL ]", testCase.suite, testCase.name);
+		}
+
+		std::printf("%d of %d tests passed\n", numRun - numFailed, numRun);
+		return numRun == 0 ? 1 : numFailed;
+	}
+}
+
+int main(const int argc, const char** argv)
+{
+	return TerrainTest::RunTests(argv + 1, argc - 1) == 0 ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+#include <taskflow/taskflow.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "../bench/TerrainScene.h"
+#include "../source/terrain/BlockCompress.h"
+#include "../source/terrain/QuadTree.h"
+#include "../source/terrain/TerrainBake.h"
+#include "../source/terrain/TileStreamer.h"
+#include "TerrainTest.h"
+
+namespace
+{
+	constexpr uint32_t HEIGHTMAP_SIZE = 128;
+	constexpr float WORLD_SIZE = 128.0f;
+	constexpr uint32_t TILE_SIZE = 32;
+	constexpr uint32_t ALBEDO_SCALE = 2; // albedo texels per height texel on a side
+
+	// Bilinear filtering of RGBA8 texels with clamped addressing, texel centers on integers
+	float4 SampleBilinear(const uint8_t* texels, const uint32_t rowTexels, const uint2 size, const float2 texel)
+	{
+		const float2 base = float2(std::floor(texel.x), std::floor(texel.y));
+		const float2 f = texel - base;
+
+		float4 result = float4(0.0f);
+		for (int dy = 0; dy < 2; dy++)
+		{
+			for (int dx = 0; dx < 2; dx++)
+			{
+				const uint32_t x = static_cast<uint32_t>(std::clamp(static_cast<int>(base.x) + dx, 0, static_cast<int>(size.x) - 1));
+				const uint32_t y = static_cast<uint32_t>(std::clamp(static_cast<int>(base.y) + dy, 0, static_cast<int>(size.y) - 1));
+				const uint8_t* rgba = texels + (static_cast<size_t>(y) * rowTexels + x) * 4;
+				const float weight = (dx ? f.x : 1.0f - f.x) * (dy ? f.y : 1.0f - f.y);
+				result += float4(rgba[0], rgba[1], rgba[2], rgba[3]) * weight;
+			}
+		}
+		return result;
+	}
+
+	// streamAtlasUv of terrain_common.hlsli for the albedo of a resident page, in atlas texels with the centers on integers
+	float2 GetAlbedoAtlasTexel(const TileStreamer& streamer, const float2 uv, const uint32_t mip, uint2& slotOrigin)
+	{
+		const uint2 mipSize = streamer.GetMipSize(mip);
+		const uint32_t pageSize = streamer.GetPageSize();
+		const uint32_t numPagesX = streamer.GetMipNumPagesX(mip);
+		const uint32_t numPagesY = (mipSize.y + pageSize - 1) / pageSize;
+		const float2 heightTexel = clamp(uv * float2(mipSize) - 0.5f, float2(0.0f), float2(mipSize) - 1.0f);
+		const uint2 page = min(uint2(heightTexel) / pageSize, uint2(numPagesX - 1, numPagesY - 1));
+		const uint32_t slot = streamer.GetPageTable()[streamer.GetMipFirstPage(mip) + page.y * numPagesX + page.x] - 1;
+
+		const float2 albedoSize = float2(streamer.GetAlbedoMipSize(mip));
+		const uint32_t slotSize = streamer.GetAlbedoSlotSize();
+		const float2 texel = clamp(uv * albedoSize - 0.5f, float2(0.0f), albedoSize - 1.0f);
+		const float2 pageTexel = clamp(texel - float2(page * streamer.GetAlbedoPageSize()), float2(0.0f), float2(static_cast<float>(slotSize - 1)));
+		slotOrigin = uint2(slot % streamer.GetSlotsPerRow(), slot / streamer.GetSlotsPerRow()) * slotSize;
+		return float2(slotOrigin) + pageTexel;
+	}
+
+	// RGBA8 texels of the albedo blocks, decoded when block compressed
+	std::vector<uint8_t> DecodeAlbedo(const TerrainBake::AlbedoFormat format, const uint8_t* data, const uint32_t width, const uint32_t height)
+	{
+		if (format == TerrainBake::AlbedoFormat::RGBA8_SRGB)
+			return std::vector<uint8_t>(data, data + static_cast<size_t>(width) * height * 4);
+		return BlockCompress::Decode(format == TerrainBake::AlbedoFormat::BC1_SRGB ? BlockCompress::Format::BC1 : BlockCompress::Format::BC7, data, width, height);
+	}
+
+	// An albedo twice as fine as the heights, sampled through the atlas slots, filters to the same colors as the whole
+	// albedo mips. The height texel picks the page, so the albedo footprint reaches past the page by more than one texel
+	void CheckAlbedoMatchesUnstreamed(const TerrainBake::AlbedoFormat format, const uint32_t slotSize)
+	{
+		tf::Executor executor;
+		const std::shared_ptr<const HeightmapStore> heightmap = TerrainScene::CreateHeightmap(HEIGHTMAP_SIZE, HeightmapFormat::R8_UNORM, 5);
+		const std::vector<std::unique_ptr<QuadTree>> quadTrees = TerrainScene::BuildQuadTrees(WORLD_SIZE, WORLD_SIZE, heightmap, executor);
+		const std::vector<uint8_t> albedoTexels = TerrainScene::GenerateAlbedo(HEIGHTMAP_SIZE * ALBEDO_SCALE, 5);
+
+		TerrainBake::AlbedoView albedo;
+		albedo.data = albedoTexels.data();
+		albedo.width = HEIGHTMAP_SIZE * ALBEDO_SCALE;
+		albedo.height = HEIGHTMAP_SIZE * ALBEDO_SCALE;
+
+		TerrainBake::BakeParameters params;
+		params.tileSize = TILE_SIZE;
+		params.worldSize = WORLD_SIZE;
+		params.surfaceSize = WORLD_SIZE;
+		params.albedoFormat = format;
+
+		const std::filesystem::path path = std::filesystem::temp_directory_path() / "vrenderer_streamer_test.vtb";
+		const QuadTree* trees[] = { quadTrees[0].get() };
+		TEST_CHECK(TerrainBake::Write(path, params, *heightmap, trees, &albedo));
+		const std::shared_ptr<BakedTerrain> bake = BakedTerrain::Open(path);
+		TEST_CHECK(bake != nullptr);
+		if (!bake)
+			return;
+
+		// Every mip pinned, all the pages are made resident by the first Update
+		TileStreamer::Parameters streamParams;
+		streamParams.budget = 1ull << 30;
+		streamParams.maxLod = 0;
+		TileStreamer streamer(bake, streamParams, executor);
+		streamer.Update(float3(0.0f), {});
+		TEST_CHECK(streamer.HasAlbedo());
+		TEST_CHECK(streamer.GetAlbedoFormat() == format);
+		TEST_CHECK(streamer.GetAlbedoPageSize() == TILE_SIZE * ALBEDO_SCALE);
+		TEST_CHECK(streamer.GetAlbedoSlotSize() == slotSize);
+		TEST_CHECK(streamer.GetUploads().size() == streamer.GetPageTable().size());
+
+		// The slots laid out as TerrainPass::UploadPages copies them, a row of blocks at a time
+		const uint32_t blockSize = TerrainBake::GetAlbedoBlockSize(format);
+		const size_t blockBytes = TerrainBake::GetAlbedoBlockBytes(format);
+		const uint32_t slotBlocks = slotSize / blockSize;
+		const uint32_t atlasWidth = streamer.GetSlotsPerRow() * slotSize;
+		const uint32_t atlasHeight = (streamer.GetNumSlots() + streamer.GetSlotsPerRow() - 1) / streamer.GetSlotsPerRow() * slotSize;
+		const size_t atlasRowSize = atlasWidth / blockSize * blockBytes;
+		std::vector<uint8_t> atlasBlocks(atlasRowSize * (atlasHeight / blockSize));
+		for (const TileStreamer::PageUpload& upload : streamer.GetUploads())
+		{
+			const uint2 origin = uint2(upload.slot % streamer.GetSlotsPerRow(), upload.slot / streamer.GetSlotsPerRow()) * slotBlocks;
+			for (uint32_t row = 0; row < slotBlocks; row++)
+				std::memcpy(atlasBlocks.data() + (static_cast<size_t>(origin.y) + row) * atlasRowSize + origin.x * blockBytes, upload.albedoTexels + row * slotBlocks * blockBytes, slotBlocks * blockBytes);
+		}
+		const std::vector<uint8_t> atlas = DecodeAlbedo(format, atlasBlocks.data(), atlasWidth, atlasHeight);
+
+		// Four samples per albedo texel on a side, including the ones just before the next height page
+		for (uint32_t mip = 0; mip < streamer.GetNumMips(); mip++)
+		{
+			const uint2 albedoSize = streamer.GetAlbedoMipSize(mip);
+			const std::vector<uint8_t> mipTexels = DecodeAlbedo(format, static_cast<const uint8_t*>(bake->GetAlbedoMip(mip)), albedoSize.x, albedoSize.y);
+			const uint32_t numSamples = albedoSize.x * 4;
+
+			bool inSlot = true;
+			float maxError = 0.0f;
+			for (uint32_t j = 0; j < numSamples; j++)
+			{
+				for (uint32_t i = 0; i < numSamples; i++)
+				{
+					const float2 uv = (float2(static_cast<float>(i), static_cast<float>(j)) + 0.5f) / static_cast<float>(numSamples);
+					uint2 slotOrigin;
+					const float2 atlasTexel = GetAlbedoAtlasTexel(streamer, uv, mip, slotOrigin);
+					const float2 footprint = float2(std::ceil(atlasTexel.x), std::ceil(atlasTexel.y));
+					inSlot = inSlot && footprint.x < static_cast<float>(slotOrigin.x + slotSize) && footprint.y < static_cast<float>(slotOrigin.y + slotSize);
+
+					const float4 streamed = SampleBilinear(atlas.data(), atlasWidth, uint2(atlasWidth, atlasHeight), atlasTexel);
+					const float4 unstreamed = SampleBilinear(mipTexels.data(), albedoSize.x, albedoSize, uv * float2(albedoSize) - 0.5f);
+					const float4 error = streamed - unstreamed;
+					maxError = std::max({ maxError, std::abs(error.x), std::abs(error.y), std::abs(error.z), std::abs(error.w) });
+				}
+			}
+			TEST_CHECK(inSlot);
+			TEST_CHECK_NEAR(maxError, 0.0f, 1e-3f);
+		}
+
+		std::filesystem::remove(path);
+	}
+}
+
+// The RGBA8 border is the two texels the footprint reaches, the block compressed one a whole block
+TERRAIN_TEST(TileStreamer, AlbedoMatchesUnstreamed)
+{
+	CheckAlbedoMatchesUnstreamed(TerrainBake::AlbedoFormat::RGBA8_SRGB, TILE_SIZE * ALBEDO_SCALE + 2);
+	CheckAlbedoMatchesUnstreamed(TerrainBake::AlbedoFormat::BC1_SRGB, TILE_SIZE * ALBEDO_SCALE + BlockCompress::BLOCK_SIZE);
+	CheckAlbedoMatchesUnstreamed(TerrainBake::AlbedoFormat::BC7_SRGB, TILE_SIZE * ALBEDO_SCALE + BlockCompress::BLOCK_SIZE);
+}